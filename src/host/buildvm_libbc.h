@@ -33,6 +33,32 @@ BC_MOV,7,2,0,BC_KSHORT,8,1,0,BC_FORI,6,4,128,BC_ADDVV,10,5,9,BC_TGETR,11,9,0,
 BC_TSETR,11,10,4,BC_FORL,6,252,127,BC_JMP,6,8,128,BC_MOV,6,2,0,BC_MOV,7,1,0,
 BC_KSHORT,8,255,255,BC_FORI,6,4,128,BC_ADDVV,10,5,9,BC_TGETR,11,9,0,BC_TSETR,
 11,10,4,BC_FORL,6,252,127,BC_RET1,4,2,0,
+/* table.sort.cmp */ 0,5,17,0,0,2,124,BC_ISTYPE,0,12,0,BC_ISTYPE,1,9,0,
+BC_ISGE,2,3,0,BC_JMP,5,118,128,BC_LOOP,5,117,128,BC_TGETR,5,2,0,BC_TGETR,6,3,
+0,BC_MOV,7,1,0,BC_MOV,9,6,0,BC_MOV,10,5,0,BC_CALL,7,3,2,BC_ISF,0,7,0,BC_JMP,8,
+2,128,BC_TSETR,6,2,0,BC_TSETR,5,3,0,BC_SUBVV,7,2,3,BC_ISNEN,7,0,0,BC_JMP,7,1,
+128,BC_JMP,5,103,128,BC_ADDVV,7,3,2,BC_MODVN,8,1,7,BC_SUBVV,8,8,7,BC_DIVVN,7,
+1,8,BC_TGETR,8,7,0,BC_TGETR,6,2,0,BC_MOV,5,8,0,BC_MOV,8,1,0,BC_MOV,10,5,0,
+BC_MOV,11,6,0,BC_CALL,8,3,2,BC_ISF,0,8,0,BC_JMP,9,3,128,BC_TSETR,6,7,0,
+BC_TSETR,5,2,0,BC_JMP,8,9,128,BC_TGETR,6,3,0,BC_MOV,8,1,0,BC_MOV,10,6,0,
+BC_MOV,11,5,0,BC_CALL,8,3,2,BC_ISF,0,8,0,BC_JMP,9,2,128,BC_TSETR,6,7,0,
+BC_TSETR,5,3,0,BC_SUBVV,8,2,3,BC_ISNEN,8,1,0,BC_JMP,8,1,128,BC_JMP,5,74,128,
+BC_TGETR,8,7,0,BC_SUBVN,9,0,3,BC_TGETR,9,9,0,BC_TSETR,9,7,0,BC_SUBVN,9,0,3,
+BC_TSETR,8,9,0,BC_SUBVN,9,0,3,BC_MOV,7,2,0,BC_LOOP,10,38,128,BC_ADDVN,7,0,7,
+BC_TGETR,5,7,0,BC_MOV,10,1,0,BC_MOV,12,5,0,BC_MOV,13,8,0,BC_CALL,10,3,2,
+BC_ISF,0,10,0,BC_JMP,11,8,128,BC_LOOP,10,7,128,BC_ISGT,3,7,0,BC_JMP,10,2,128,
+BC_KPRI,10,1,0,BC_RET1,10,2,0,BC_ADDVN,7,0,7,BC_TGETR,5,7,0,BC_JMP,10,242,127,
+BC_SUBVN,9,0,9,BC_TGETR,6,9,0,BC_MOV,10,1,0,BC_MOV,12,8,0,BC_MOV,13,6,0,
+BC_CALL,10,3,2,BC_ISF,0,10,0,BC_JMP,11,8,128,BC_LOOP,10,7,128,BC_ISGT,9,2,0,
+BC_JMP,10,2,128,BC_KPRI,10,1,0,BC_RET1,10,2,0,BC_SUBVN,9,0,9,BC_TGETR,6,9,0,
+BC_JMP,10,242,127,BC_ISGE,9,7,0,BC_JMP,10,1,128,BC_JMP,10,3,128,BC_TSETR,6,7,
+0,BC_TSETR,5,9,0,BC_JMP,10,217,127,BC_SUBVN,10,0,3,BC_TGETR,11,7,0,BC_TSETR,
+11,10,0,BC_TSETR,8,7,0,BC_SUBVV,10,2,7,BC_SUBVV,11,7,3,BC_ISGE,10,11,0,BC_JMP,
+10,4,128,BC_MOV,9,2,0,BC_SUBVN,7,0,7,BC_ADDVN,2,1,7,BC_JMP,10,3,128,BC_ADDVN,
+9,0,7,BC_MOV,7,3,0,BC_SUBVN,3,1,9,BC_MOV,10,4,0,BC_MOV,12,0,0,BC_MOV,13,1,0,
+BC_MOV,14,9,0,BC_MOV,15,7,0,BC_MOV,16,4,0,BC_CALL,10,6,2,BC_IST,0,10,0,BC_JMP,
+10,139,127,BC_KPRI,10,1,0,BC_RET1,10,2,0,BC_JMP,5,136,127,BC_KPRI,5,2,0,
+BC_RET1,5,2,0,2,4,
 #else
 /* math.deg */ 0,1,2,0,0,1,2,BC_MULVN,1,0,0,BC_RET1,1,2,0,241,135,158,166,3,
 220,203,178,130,4,
@@ -63,6 +89,31 @@ BC_MOV,7,2,0,BC_KSHORT,8,1,0,BC_FORI,6,4,128,BC_ADDVV,10,5,9,BC_TGETR,11,9,0,
 BC_TSETR,11,10,4,BC_FORL,6,252,127,BC_JMP,6,8,128,BC_MOV,6,2,0,BC_MOV,7,1,0,
 BC_KSHORT,8,255,255,BC_FORI,6,4,128,BC_ADDVV,10,5,9,BC_TGETR,11,9,0,BC_TSETR,
 11,10,4,BC_FORL,6,252,127,BC_RET1,4,2,0,
+/* table.sort.cmp */ 0,5,16,0,0,2,124,BC_ISTYPE,0,12,0,BC_ISTYPE,1,9,0,
+BC_ISGE,2,3,0,BC_JMP,5,118,128,BC_LOOP,5,117,128,BC_TGETR,5,2,0,BC_TGETR,6,3,
+0,BC_MOV,7,1,0,BC_MOV,8,6,0,BC_MOV,9,5,0,BC_CALL,7,3,2,BC_ISF,0,7,0,BC_JMP,8,
+2,128,BC_TSETR,6,2,0,BC_TSETR,5,3,0,BC_SUBVV,7,2,3,BC_ISNEN,7,0,0,BC_JMP,7,1,
+128,BC_JMP,5,103,128,BC_ADDVV,7,3,2,BC_MODVN,8,1,7,BC_SUBVV,8,8,7,BC_DIVVN,7,
+1,8,BC_TGETR,8,7,0,BC_TGETR,6,2,0,BC_MOV,5,8,0,BC_MOV,8,1,0,BC_MOV,9,5,0,
+BC_MOV,10,6,0,BC_CALL,8,3,2,BC_ISF,0,8,0,BC_JMP,9,3,128,BC_TSETR,6,7,0,
+BC_TSETR,5,2,0,BC_JMP,8,9,128,BC_TGETR,6,3,0,BC_MOV,8,1,0,BC_MOV,9,6,0,BC_MOV,
+10,5,0,BC_CALL,8,3,2,BC_ISF,0,8,0,BC_JMP,9,2,128,BC_TSETR,6,7,0,BC_TSETR,5,3,
+0,BC_SUBVV,8,2,3,BC_ISNEN,8,1,0,BC_JMP,8,1,128,BC_JMP,5,74,128,BC_TGETR,8,7,0,
+BC_SUBVN,9,0,3,BC_TGETR,9,9,0,BC_TSETR,9,7,0,BC_SUBVN,9,0,3,BC_TSETR,8,9,0,
+BC_SUBVN,9,0,3,BC_MOV,7,2,0,BC_LOOP,10,38,128,BC_ADDVN,7,0,7,BC_TGETR,5,7,0,
+BC_MOV,10,1,0,BC_MOV,11,5,0,BC_MOV,12,8,0,BC_CALL,10,3,2,BC_ISF,0,10,0,BC_JMP,
+11,8,128,BC_LOOP,10,7,128,BC_ISGT,3,7,0,BC_JMP,10,2,128,BC_KPRI,10,1,0,
+BC_RET1,10,2,0,BC_ADDVN,7,0,7,BC_TGETR,5,7,0,BC_JMP,10,242,127,BC_SUBVN,9,0,9,
+BC_TGETR,6,9,0,BC_MOV,10,1,0,BC_MOV,11,8,0,BC_MOV,12,6,0,BC_CALL,10,3,2,
+BC_ISF,0,10,0,BC_JMP,11,8,128,BC_LOOP,10,7,128,BC_ISGT,9,2,0,BC_JMP,10,2,128,
+BC_KPRI,10,1,0,BC_RET1,10,2,0,BC_SUBVN,9,0,9,BC_TGETR,6,9,0,BC_JMP,10,242,127,
+BC_ISGE,9,7,0,BC_JMP,10,1,128,BC_JMP,10,3,128,BC_TSETR,6,7,0,BC_TSETR,5,9,0,
+BC_JMP,10,217,127,BC_SUBVN,10,0,3,BC_TGETR,11,7,0,BC_TSETR,11,10,0,BC_TSETR,8,
+7,0,BC_SUBVV,10,2,7,BC_SUBVV,11,7,3,BC_ISGE,10,11,0,BC_JMP,10,4,128,BC_MOV,9,
+2,0,BC_SUBVN,7,0,7,BC_ADDVN,2,1,7,BC_JMP,10,3,128,BC_ADDVN,9,0,7,BC_MOV,7,3,0,
+BC_SUBVN,3,1,9,BC_MOV,10,4,0,BC_MOV,11,0,0,BC_MOV,12,1,0,BC_MOV,13,9,0,BC_MOV,
+14,7,0,BC_MOV,15,4,0,BC_CALL,10,6,2,BC_IST,0,10,0,BC_JMP,10,139,127,BC_KPRI,
+10,1,0,BC_RET1,10,2,0,BC_JMP,5,136,127,BC_KPRI,5,2,0,BC_RET1,5,2,0,2,4,
 #endif
 0
 };
@@ -76,6 +127,7 @@ static const struct { const char *name; int ofs; } libbc_map[] = {
 {"table_getn",213},
 {"table_remove",232},
 {"table_move",361},
-{NULL,508}
+{"table_sort_cmp",508},
+{NULL,1013}
 };
 
@@ -26,6 +26,7 @@ local tremove, tconcat = table.remove, table.concat
 local function usage()
   io.stderr:write[[
 Save LuaJIT bytecode: luajit -b[options] input output
+                      luajit -b[options] [name=]input... output.ljb
   -l        Only list bytecode.
   -L        Only list bytecode with lineinfo.
   -s        Strip debug info (default).
@@ -42,7 +43,8 @@ Save LuaJIT bytecode: luajit -b[options] input output
   --        Stop handling options.
   -         Use stdin as input and/or stdout as output.
 
-File types: c cc h obj o raw (default)
+File types: c cc h obj o ljb raw (default)
+A bytecode bundle (ljb) holds many modules for package.loadbundle().
 ]]
   os.exit(1)
 end
@@ -87,6 +89,7 @@ end
 
 local map_type = {
   raw = "raw", c = "c", cc = "c", h = "h", o = "obj", obj = "obj",
+  ljb = "bundle",
 }
 
 local map_arch = {
@@ -536,6 +539,49 @@ end
 
 ------------------------------------------------------------------------------
 
+------------------------------------------------------------------------------
+
+-- Bundle module name from input file name, e.g. "a/b/c.lua" -> "a.b.c".
+local function bundlemodname(str)
+  local name, file = str:match("^([^=]+)=(.+)$")
+  if name then return name, file end
+  name = str:gsub("^%.[/\\]", ""):gsub("%.[^./\\]*$", ""):gsub("[/\\]", ".")
+  check(name:match("^[%w_.%-]+$"), "cannot derive module name, use name=input")
+  return name, str
+end
+
+local function bcsave_bundle(ctx, inputs, output)
+  local mods, index = {}, {}
+  for i=1,#inputs do
+    local name, input = bundlemodname(inputs[i])
+    check(not mods[name], "duplicate module name ", name)
+    mods[name] = string.dump(readfile(ctx, input), ctx.mode)
+    index[#index+1] = name
+  end
+  table.sort(index)
+  local function u32(x)
+    return string.char(bit.band(x, 255), bit.band(bit.rshift(x, 8), 255),
+		       bit.band(bit.rshift(x, 16), 255), bit.rshift(x, 24))
+  end
+  local t = { "\027LJB\001\0\0\0", u32(#index) }
+  local ofs = 12 + 16*#index
+  for i=1,#index do
+    local name = index[i]
+    local s = mods[name]
+    t[#t+1] = u32(ofs)..u32(#name)..u32(ofs+#name)..u32(#s)
+    ofs = ofs + #name + #s
+  end
+  for i=1,#index do
+    local name = index[i]
+    t[#t+1] = name
+    t[#t+1] = mods[name]
+  end
+  local fp = savefile(output, "wb")
+  bcsave_tail(fp, output, tconcat(t))
+end
+
+------------------------------------------------------------------------------
+
 local function bclist(ctx, input, output, lineinfo)
   local f = readfile(ctx, input)
   require("jit.bc").dump(f, savefile(output, "w"), true, lineinfo)
@@ -621,8 +667,16 @@ local function docmd(...)
     if #arg == 0 or #arg > 2 then usage() end
     bclist(ctx, arg[1], arg[2] or "-", lineinfo)
   else
-    if #arg ~= 2 then usage() end
-    bcsave(ctx, arg[1], arg[2])
+    if #arg < 2 then usage() end
+    local output = arg[#arg]
+    if not ctx.type then ctx.type = detecttype(output) end
+    if ctx.type == "bundle" then
+      check(not ctx.string, "cannot bundle chunk strings")
+      bcsave_bundle(ctx, {unpack(arg, 1, #arg-1)}, output)
+    else
+      if #arg ~= 2 then usage() end
+      bcsave(ctx, arg[1], output)
+    end
   end
 end
 
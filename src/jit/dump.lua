@@ -590,6 +590,8 @@ local function dump_trace(what, tr, func, pc, otr, oex)
       end
     end
     if dumpmode.H then out:write("</pre>\n\n") else out:write("\n") end
+  elseif tr then
+    out:write("---- TRACE ", tr, " ", what, "\n\n")
   else
     if what == "flush" then symtab, nexitsym = {}, 0 end
     out:write("---- TRACE ", what, "\n\n")
@@ -133,6 +133,8 @@ local function dump_trace(what, tr, func, pc, otr, oex)
 	out:write(format("[TRACE %3s %s%s -> %d %s]\n",
 	  tr, startex, startloc, link, ltype))
       end
+    elseif tr then
+      out:write(format("[TRACE %3s %s]\n", tr, what))
     else
       out:write(format("[TRACE %s]\n", what))
     end
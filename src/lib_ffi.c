@@ -19,8 +19,12 @@
 #include "lj_gc.h"
 #include "lj_err.h"
 #include "lj_str.h"
+#include "lj_buf.h"
 #include "lj_tab.h"
+#include "lj_udata.h"
 #include "lj_meta.h"
+#include "lj_frame.h"
+#include "lj_vm.h"
 #include "lj_ctype.h"
 #include "lj_cparse.h"
 #include "lj_cdata.h"
@@ -469,6 +473,102 @@ LJLIB_PUSH(top-1) LJLIB_SET(__index)
 
 #include "lj_libdef.h"
 
+/* -- FFI pool methods ---------------------------------------------------- */
+
+#define LJLIB_MODULE_ffi_pool_method
+
+/* Check argument for an FFI pool and return it. */
+static CPool *ffi_checkpool(lua_State *L)
+{
+  TValue *o = L->base;
+  if (!(o < L->top && tvisudata(o) && udataV(o)->udtype == UDTYPE_FFI_POOL))
+    lj_err_argtype(L, 1, "ffi.pool");
+  return (CPool *)uddata(udataV(o));
+}
+
+typedef struct PoolInit {
+  CPool *cp;
+  void *p;
+  TValue *o;
+  MSize n;
+} PoolInit;
+
+static TValue *cppoolinit(lua_State *L, lua_CFunction dummy, void *ud)
+{
+  PoolInit *pi = (PoolInit *)ud;
+  CTState *cts = ctype_cts(L);
+  UNUSED(dummy);
+  cframe_errfunc(L->cframe) = -1;  /* Inherit error function. */
+  lj_cconv_ct_init(cts, ctype_raw(cts, pi->cp->id), pi->cp->size,
+		   (uint8_t *)pi->p, pi->o, pi->n);
+  return NULL;
+}
+
+LJLIB_CF(ffi_pool_method_alloc)	LJLIB_REC(.)
+{
+  CPool *cp = ffi_checkpool(L);
+  CTState *cts = ctype_cts(L);
+  TValue *o = L->base+1;
+  MSize n = (MSize)(L->top - o);
+  void *p = cp->free;
+  GCcdata *cd = lj_cdata_new(cts, cp->pid, CTSIZE_PTR);
+  *(void **)cdataptr(cd) = NULL;
+  setcdataV(L, L->top++, cd);  /* Anchor it before taking a slot. */
+  if (p)
+    cp->free = *(void **)p;
+  else
+    p = lj_cdata_pool_grow(L, cp);
+  if (n) {  /* Initialize slot, return it to the pool on error. */
+    PoolInit pi;
+    int errcode;
+    pi.cp = cp; pi.p = p; pi.o = o; pi.n = n;
+    errcode = lj_vm_cpcall(L, NULL, &pi, cppoolinit);
+    if (errcode) {
+      *(void **)p = cp->free;
+      cp->free = p;
+      lj_err_throw(L, errcode);
+    }
+  } else {
+    memset(p, 0, cp->size);
+  }
+  *(void **)cdataptr(cd) = p;
+  setcdataV(L, o, cd);
+  L->top = o+1;  /* Only return the pointer. */
+  lj_gc_check(L);
+  return 1;
+}
+
+LJLIB_CF(ffi_pool_method_free)	LJLIB_REC(.)
+{
+  CPool *cp = ffi_checkpool(L);
+  GCcdata *cd = ffi_checkcdata(L, 2);
+  CTState *cts = ctype_cts(L);
+  CType *ct = ctype_raw(cts, cd->ctypeid);
+  void *p;
+  if (!(ctype_isptr(ct->info) && ct->size == CTSIZE_PTR &&
+	ctype_rawchild(cts, ct) == ctype_raw(cts, cp->id)))
+    lj_err_arg(L, 2, LJ_ERR_FFI_INVTYPE);
+  p = *(void **)cdataptr(cd);
+  if (p) {  /* Like free(), ignore NULL. */
+    *(void **)p = cp->free;
+    cp->free = p;
+  }
+  return 0;
+}
+
+LJLIB_CF(ffi_pool_method___gc)
+{
+  TValue *o = L->base;
+  if (o < L->top && tvisudata(o) && udataV(o)->udtype == UDTYPE_FFI_POOL)
+    lj_cdata_pool_release(G(L), (CPool *)uddata(udataV(o)));
+  return 0;
+}
+
+LJLIB_PUSH("ffi.pool") LJLIB_SET(__metatable)
+LJLIB_PUSH(top-1) LJLIB_SET(__index)
+
+#include "lj_libdef.h"
+
 /* -- FFI library functions ----------------------------------------------- */
 
 #define LJLIB_MODULE_ffi
@@ -490,6 +590,58 @@ LJLIB_CF(ffi_cdef)
   return 0;
 }
 
+LJLIB_CF(ffi_cdef_dump)
+{
+  GCstr *s = lj_lib_checkstr(L, 1);
+  CTState *cts = ctype_cts(L);
+  CTypeID base = cts->top;
+  SBuf *sb;
+  CPState cp;
+  int errcode;
+  cp.L = L;
+  cp.cts = cts;
+  cp.srcname = strdata(s);
+  cp.p = strdata(s);
+  cp.param = L->base+1;
+  cp.mode = CPARSE_MODE_MULTI|CPARSE_MODE_DIRECT;
+  errcode = lj_cparse(&cp);
+  if (errcode) lj_err_throw(L, errcode);  /* Propagate errors. */
+  sb = lj_buf_tmp_(L);
+  errcode = lj_ctype_dump(cts, sb, base);
+  if (errcode) lj_err_throw(L, errcode);
+  setstrV(L, L->top++, lj_buf_str(L, sb));
+  lj_gc_check(L);
+  return 1;
+}
+
+LJLIB_CF(ffi_cdef_load)
+{
+  GCstr *path = lj_lib_checkstr(L, 1);
+  CTState *cts = ctype_cts(L);
+  SBuf *sb = lj_buf_tmp_(L);
+  FILE *fp = fopen(strdata(path), "rb");
+  size_t n;
+  int errcode;
+  if (fp == NULL)
+    lj_err_callermsg(L, lj_strfmt_pushf(L, "cannot open %s: %s",
+					strdata(path), strerror(errno)));
+  do {
+    char *p = lj_buf_more(sb, LUAL_BUFFERSIZE);
+    n = fread(p, 1, LUAL_BUFFERSIZE, fp);
+    sb->w = p + n;
+  } while (n == LUAL_BUFFERSIZE);
+  if (ferror(fp)) {
+    fclose(fp);
+    lj_err_callermsg(L, lj_strfmt_pushf(L, "cannot read %s: %s",
+					strdata(path), strerror(errno)));
+  }
+  fclose(fp);
+  errcode = lj_ctype_load(cts, sb->b, sbuflen(sb));
+  if (errcode) lj_err_throw(L, errcode);
+  lj_gc_check(L);
+  return 0;
+}
+
 LJLIB_CF(ffi_new)	LJLIB_REC(.)
 {
   CTState *cts = ctype_cts(L);
@@ -721,6 +873,68 @@ LJLIB_CF(ffi_fill)	LJLIB_REC(.)
   return 0;
 }
 
+LJLIB_CF(ffi_totable)	LJLIB_REC(.)
+{
+  CTState *cts = ctype_cts(L);
+  GCcdata *cd = ffi_checkcdata(L, 1);
+  CType *ct = ctype_raw(cts, cd->ctypeid), *e;
+  uint8_t *p = (uint8_t *)cdataptr(cd);
+  CTSize sz = CTSIZE_INVALID;
+  CTypeID eid;
+  int32_t n;
+  if (ctype_isref(ct->info)) {
+    p = *(uint8_t **)p;
+    ct = ctype_rawchild(cts, ct);
+  } else if (ctype_isrefarray(ct->info) && cdataisv(cd)) {
+    sz = cdatavlen(cd);
+  }
+  if (ctype_isptr(ct->info))
+    p = (uint8_t *)cdata_getptr(p, ct->size);
+  else if (ctype_isrefarray(ct->info))
+    sz = (ct->info & CTF_VLA) ? sz : ct->size;
+  else
+    lj_err_arg(L, 1, LJ_ERR_FFI_INVTYPE);
+  eid = ctype_cid(ct->info);
+  e = ctype_raw(cts, eid);
+  if (e->size == CTSIZE_INVALID || ctype_isfunc(e->info))
+    lj_err_arg(L, 1, LJ_ERR_FFI_INVTYPE);
+  if ((L->base+1 < L->top && !tvisnil(L->base+1)) || sz == CTSIZE_INVALID)
+    n = lj_lib_checkintrange(L, 2, 0, LJ_MAX_ASIZE-2);
+  else
+    n = e->size ? (int32_t)(sz / e->size) : 0;
+  settabV(L, L->top++, lj_cdata_totab(L, eid, p, (MSize)n));
+  lj_gc_check(L);
+  return 1;
+}
+
+LJLIB_CF(ffi_fromtable)	LJLIB_REC(.)
+{
+  CTState *cts = ctype_cts(L);
+  CTypeID id = ffi_checkctype(L, cts, NULL);
+  GCtab *t = lj_lib_checktab(L, 2);
+  CType *d = ctype_raw(cts, id);
+  CTSize sz, esize;
+  CTInfo info = lj_ctype_info(cts, id, &sz);
+  GCcdata *cd;
+  MSize n;
+  if (!ctype_isrefarray(d->info))
+    lj_err_arg(L, 1, LJ_ERR_FFI_INVTYPE);
+  esize = ctype_rawchild(cts, d)->size;
+  if ((info & CTF_VLA)) {
+    n = lj_tab_len(t);
+    sz = lj_ctype_vlsize(cts, d, n);
+  }
+  if (sz == CTSIZE_INVALID)
+    lj_err_arg(L, 1, LJ_ERR_FFI_INVSIZE);
+  if (!(info & CTF_VLA))
+    n = esize ? sz / esize : 0;
+  cd = lj_cdata_newx(cts, id, sz, info);
+  setcdataV(L, L->top++, cd);
+  lj_cdata_fromtab(L, ctype_cid(d->info), (uint8_t *)cdataptr(cd), t, n);
+  lj_gc_check(L);
+  return 1;
+}
+
 /* Test ABI string. */
 LJLIB_CF(ffi_abi)	LJLIB_REC(.)
 {
@@ -765,7 +979,7 @@ LJLIB_CF(ffi_abi)	LJLIB_REC(.)
   return 1;
 }
 
-LJLIB_PUSH(top-7) LJLIB_SET(!)  /* Store reference to miscmap table. */
+LJLIB_PUSH(top-8) LJLIB_SET(!)  /* Store reference to miscmap table. */
 
 LJLIB_CF(ffi_metatype)
 {
@@ -805,6 +1019,40 @@ LJLIB_CF(ffi_gc)	LJLIB_REC(.)
   return 1;
 }
 
+LJLIB_PUSH(top-6) LJLIB_SET(!)  /* Store pool metatable in func environment. */
+
+LJLIB_CF(ffi_pool)
+{
+  CTState *cts = ctype_cts(L);
+  CTypeID id = ffi_checkctype(L, cts, NULL);
+  CTSize sz;
+  CTInfo info = lj_ctype_info(cts, id, &sz);
+  GCtab *env = tabref(curr_func(L)->c.env);
+  GCudata *ud;
+  CPool cp;
+  int32_t n;
+  if (sz == CTSIZE_INVALID || sz == 0 || (info & CTF_VLA) ||
+      ctype_isfunc(info))
+    lj_err_arg(L, 1, LJ_ERR_FFI_INVSIZE);
+  lj_cdata_pool_init(cts, &cp, id, sz, info);
+  /* Default to chunks of roughly one page. */
+  n = 4096 / (int32_t)cp.esize;
+  n = lj_lib_optint(L, 2, n > 0 ? n : 1);
+  if (n <= 0 || (uint64_t)n * cp.esize > LJ_MAX_MEM32)
+    lj_err_arg(L, 2, LJ_ERR_FFI_INVSIZE);
+  cp.n = (MSize)n;
+  ud = lj_udata_new(L, sizeof(CPool), env);
+  ud->udtype = UDTYPE_FFI_POOL;
+  /* NOBARRIER: The GCudata is new (marked white). */
+  setgcref(ud->metatable, obj2gco(env));
+  setudataV(L, L->top++, ud);
+  *(CPool *)uddata(ud) = cp;
+  if (lj_meta_fastg(G(L), tabref(ud->metatable), MM_gc))
+    lj_mem_registergc_udata(L, ud);
+  lj_gc_check(L);
+  return 1;
+}
+
 LJLIB_PUSH(top-5) LJLIB_SET(!)  /* Store clib metatable in func environment. */
 
 LJLIB_CF(ffi_load)
@@ -841,6 +1089,7 @@ LUALIB_API int luaopen_ffi(lua_State *L)
   LJ_LIB_REG(L, NULL, ffi_meta);
   /* NOBARRIER: basemt is a GC root. */
   setgcref(basemt_it(G(L), LJ_TCDATA), obj2gco(tabV(L->top-1)));
+  LJ_LIB_REG(L, NULL, ffi_pool_method);
   LJ_LIB_REG(L, NULL, ffi_clib);
   LJ_LIB_REG(L, NULL, ffi_callback);
   /* NOBARRIER: the key is new and lj_tab_newkey() handles the barrier. */
@@ -18,6 +18,7 @@
 #include "lj_tab.h"
 #include "lj_state.h"
 #include "lj_bc.h"
+#include "lj_bcdump.h"
 #if LJ_HASFFI
 #include "lj_ctype.h"
 #endif
@@ -304,6 +305,8 @@ LJLIB_CF(jit_util_funck)
   } else {
     if (~idx < (ptrdiff_t)pt->sizekgc) {
       GCobj *gc = proto_kgc(pt, idx);
+      if (gc->gch.gct == ~LJ_TPROTO && proto_islazy(gco2pt(gc)))
+	gc = obj2gco(lj_bcread_lazy(L, pt, gco2pt(gc)));
       setgcV(L, L->top-1, gc, ~gc->gch.gct);
       return 1;
     }
@@ -355,6 +358,9 @@ LJLIB_CF(jit_util_traceinfo)
     setintfield(L, t, "nk", REF_BIAS - (int32_t)T->nk);
     setintfield(L, t, "link", T->link);
     setintfield(L, t, "nexit", T->nsnap);
+    setintfield(L, t, "exitcount", (int32_t)T->exitcount);
+    setintfield(L, t, "nspill", T->nspill);
+    setintfield(L, t, "nreload", T->nreload);
     setstrV(L, L->top++, lj_str_newz(L, jit_trlinkname[T->linktype]));
     lua_setfield(L, -2, "linktype");
     /* There are many more fields. Add them only when needed. */
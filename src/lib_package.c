@@ -15,6 +15,7 @@
 
 #include "lj_obj.h"
 #include "lj_err.h"
+#include "lj_bcdump.h"
 #include "lj_lib.h"
 
 #if LJ_TARGET_LINUX
@@ -26,6 +27,15 @@
 #include <mach-o/dyld.h>
 #endif
 
+#include <errno.h>
+
+#if LJ_TARGET_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 /* ------------------------------------------------------------------------ */
 
 /* Error codes for ll_loadfunc. */
@@ -495,6 +505,249 @@ static int lj_cf_package_loader_preload(lua_State *L)
   return 1;
 }
 
+/* -- Bytecode bundles ---------------------------------------------------- */
+
+/*
+** A bundle holds the bytecode of many modules in a single file, which is
+** memory-mapped (or read) once. Layout, all numbers are 32 bit little-endian
+** and all offsets are relative to the start of the file:
+**
+**   "\033LJB" version 0 0 0  n
+**   n * { nameofs namelen dataofs datalen }   sorted by name
+**   module names and bytecode dumps
+**
+** Prototypes loaded from a mapped bundle reference their debug info in
+** place. The mapping is shared with other processes mapping the same file
+** and is never unmapped once a module has been loaded from it.
+*/
+#define BUNDLE_MAGIC		"\033LJB"
+#define BUNDLE_VERSION		1
+#define BUNDLE_HDRSIZE		12
+#define BUNDLE_ENTSIZE		16
+#define BUNDLE_MT		"_BUNDLE"
+
+typedef struct Bundle {
+  const uint8_t *base;	/* Contents of the bundle file. */
+  size_t size;		/* Size of the bundle file. */
+  uint32_t n;		/* Number of modules. */
+  int mapped;		/* Contents are mapped with mmap(). */
+  int pinned;		/* Mapping is referenced by prototypes. */
+  char path[1];		/* Bundle file name. Contents may follow if read. */
+} Bundle;
+
+static uint32_t bundle_u32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	 ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Validate bundle header and index. Returns an error message or NULL. */
+static const char *bundle_check(Bundle *b)
+{
+  const uint8_t *p = b->base, *pn = NULL;
+  uint32_t i, pnlen = 0;
+  if (b->size < BUNDLE_HDRSIZE || memcmp(p, BUNDLE_MAGIC, 4) != 0)
+    return "not a bytecode bundle";
+  if (p[4] != BUNDLE_VERSION)
+    return "bytecode bundle version mismatch";
+  b->n = bundle_u32(p + 8);
+  if ((b->size - BUNDLE_HDRSIZE) / BUNDLE_ENTSIZE < b->n)
+    return "truncated bytecode bundle";
+  for (i = 0, p += BUNDLE_HDRSIZE; i < b->n; i++, p += BUNDLE_ENTSIZE) {
+    uint32_t nofs = bundle_u32(p), nlen = bundle_u32(p + 4);
+    uint32_t dofs = bundle_u32(p + 8), dlen = bundle_u32(p + 12);
+    const uint8_t *name = b->base + nofs;
+    int cmp;
+    if (nofs > b->size || nlen > b->size - nofs ||
+	dofs > b->size || dlen > b->size - dofs)
+      return "truncated bytecode bundle";
+    cmp = pn ? memcmp(pn, name, pnlen < nlen ? pnlen : nlen) : -1;
+    if (cmp > 0 || (cmp == 0 && pnlen >= nlen))
+      return "unsorted bytecode bundle";
+    pn = name; pnlen = nlen;
+  }
+  return NULL;
+}
+
+/* Map or read a bundle file. Returns an error message or NULL. */
+static const char *bundle_open(lua_State *L, const char *path)
+{
+  size_t plen = strlen(path);
+  Bundle *b;
+#if LJ_TARGET_POSIX
+  struct stat st;
+  void *p;
+  int fd;
+  /* Create the userdata first, so the mapping can't leak if this throws. */
+  b = (Bundle *)lua_newuserdata(L, sizeof(Bundle) + plen);
+  b->base = NULL;
+  b->size = 0;
+  b->mapped = 1;
+  b->pinned = 0;
+  b->n = 0;
+  luaL_getmetatable(L, BUNDLE_MT);
+  lua_setmetatable(L, -2);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return strerror(errno);
+  if (fstat(fd, &st) != 0 || (uint64_t)st.st_size > LJ_MAX_MEM32) {
+    close(fd);
+    return "cannot map bytecode bundle";
+  }
+  p = st.st_size ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+			fd, 0) : MAP_FAILED;
+  close(fd);
+  if (p == MAP_FAILED) return "cannot map bytecode bundle";
+  b->base = (const uint8_t *)p;
+  b->size = (size_t)st.st_size;
+#else
+  FILE *fp = fopen(path, "rb");
+  long sz;
+  int ok;
+  /* Get the size first, the file must not be open while allocating. */
+  if (fp == NULL) return strerror(errno);
+  ok = fseek(fp, 0, SEEK_END) == 0 && (sz = ftell(fp)) >= 0 &&
+       (uint64_t)sz <= LJ_MAX_MEM32;
+  fclose(fp);
+  if (!ok) return "cannot read bytecode bundle";
+  b = (Bundle *)lua_newuserdata(L, sizeof(Bundle) + plen + (size_t)sz);
+  b->base = (const uint8_t *)b->path + plen + 1;
+  b->size = (size_t)sz;
+  b->mapped = 0;
+  b->pinned = 0;
+  b->n = 0;
+  luaL_getmetatable(L, BUNDLE_MT);
+  lua_setmetatable(L, -2);
+  fp = fopen(path, "rb");
+  if (fp == NULL) return strerror(errno);
+  ok = fread((void *)b->base, 1, (size_t)sz, fp) == (size_t)sz &&
+       getc(fp) == EOF;  /* Changed in between? */
+  fclose(fp);
+  if (!ok) return "cannot read bytecode bundle";
+#endif
+  memcpy(b->path, path, plen + 1);
+  return bundle_check(b);
+}
+
+static int lj_cf_package_bundle_gc(lua_State *L)
+{
+  Bundle *b = (Bundle *)luaL_checkudata(L, 1, BUNDLE_MT);
+#if LJ_TARGET_POSIX
+  if (b->mapped && !b->pinned && b->base)
+    munmap((void *)b->base, b->size);
+#endif
+  b->base = NULL;
+  b->size = 0;
+  b->n = 0;
+  return 0;
+}
+
+/* Binary search for a module. Returns its index entry or NULL. */
+static const uint8_t *bundle_find(Bundle *b, const char *name, size_t len)
+{
+  uint32_t lo = 0, hi = b->n;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const uint8_t *e = b->base + BUNDLE_HDRSIZE + mid * BUNDLE_ENTSIZE;
+    uint32_t nlen = bundle_u32(e + 4);
+    int cmp = memcmp(b->base + bundle_u32(e), name, nlen < len ? nlen : len);
+    if (cmp == 0) {
+      if (nlen == len) return e;
+      cmp = nlen < len ? -1 : 1;
+    }
+    if (cmp < 0) lo = mid + 1; else hi = mid;
+  }
+  return NULL;
+}
+
+/* Load a bundle and add it to package.bundles. Returns # of modules. */
+static int bundle_load(lua_State *L, const char *path)
+{
+  int top = lua_gettop(L);
+  const char *err = bundle_open(L, path);
+  if (err) {
+    lua_settop(L, top);
+    lua_pushnil(L);
+    lua_pushfstring(L, "cannot load bundle " LUA_QS ": %s", path, err);
+    return 0;
+  }
+  lua_getfield(L, LUA_ENVIRONINDEX, "bundles");
+  if (!lua_istable(L, -1))
+    luaL_error(L, LUA_QL("package.bundles") " must be a table");
+  lua_pushvalue(L, -2);
+  lua_rawseti(L, -2, (int)lua_objlen(L, -2) + 1);
+  lua_pop(L, 1);
+  lua_pushinteger(L, (lua_Integer)((Bundle *)lua_touserdata(L, -1))->n);
+  return 1;
+}
+
+static int lj_cf_package_loadbundle(lua_State *L)
+{
+  return bundle_load(L, luaL_checkstring(L, 1)) ? 1 : 2;
+}
+
+static int lj_cf_package_loader_bundle(lua_State *L)
+{
+  size_t len;
+  const char *name = luaL_checklstring(L, 1, &len);
+  int i;
+  lua_settop(L, 1);
+  lua_getfield(L, LUA_ENVIRONINDEX, "bundles");
+  if (!lua_istable(L, 2))
+    luaL_error(L, LUA_QL("package.bundles") " must be a table");
+  lua_pushliteral(L, "");  /* Error message accumulator. */
+  for (i = 1; ; i++) {
+    Bundle *b;
+    const uint8_t *e;
+    lua_rawgeti(L, 2, i);
+    if (lua_isnil(L, -1)) break;
+    b = (Bundle *)luaL_checkudata(L, -1, BUNDLE_MT);
+    if (b->base && (e = bundle_find(b, name, len)) != NULL) {
+      const char *chunkname = lua_pushfstring(L, "@%s", name);
+      const char *data = (const char *)b->base + bundle_u32(e + 8);
+      int status;
+      if (b->mapped) {  /* Keep the mapping for the debug info. */
+	b->pinned = 1;
+	status = lj_load_persistent(L, data, bundle_u32(e + 12), chunkname);
+      } else {
+	status = luaL_loadbuffer(L, data, bundle_u32(e + 12), chunkname);
+      }
+      if (status != 0)
+	luaL_error(L, "error loading module " LUA_QS " from bundle " LUA_QS
+		   ":\n\t%s", name, b->path, lua_tostring(L, -1));
+      return 1;
+    }
+    lua_pushfstring(L, "\n\tno module " LUA_QS " in bundle " LUA_QS,
+		    name, b->path);
+    lua_remove(L, -2);
+    lua_concat(L, 2);
+  }
+  lua_pop(L, 1);
+  return 1;
+}
+
+/* Load bundles from a path list in an environment variable. */
+static void setbundles(lua_State *L, const char *envname, int noenv)
+{
+#if LJ_TARGET_CONSOLE || LJ_TARGET_PSP2
+  const char *path = NULL;
+  UNUSED(envname);
+#else
+  const char *path = noenv ? NULL : getenv(envname);
+#endif
+  lua_newtable(L);
+  lua_setfield(L, -2, "bundles");
+  if (path == NULL) return;
+  while ((path = pushnexttemplate(L, path)) != NULL) {
+    int ok = bundle_load(L, lua_tostring(L, -1));
+    if (!ok) {  /* Don't abort the startup, just warn. */
+      fputs(lua_tostring(L, -1), stderr);
+      fputc('\n', stderr);
+      fflush(stderr);
+    }
+    lua_pop(L, 3);
+  }
+}
+
 /* ------------------------------------------------------------------------ */
 
 #define KEY_SENTINEL	(U64x(80000000,00000000)|'s')
@@ -656,6 +909,7 @@ static const luaL_Reg package_global[] = {
 static const lua_CFunction package_loaders[] =
 {
   lj_cf_package_loader_preload,
+  lj_cf_package_loader_bundle,
   lj_cf_package_loader_lua,
   lj_cf_package_loader_c,
   lj_cf_package_loader_croot,
@@ -669,8 +923,14 @@ LUALIB_API int luaopen_package(lua_State *L)
   luaL_newmetatable(L, "_LOADLIB");
   lj_lib_pushcf(L, lj_cf_package_unloadlib, 1);
   lua_setfield(L, -2, "__gc");
+  luaL_newmetatable(L, BUNDLE_MT);
+  lj_lib_pushcf(L, lj_cf_package_bundle_gc, 1);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
   luaL_register(L, LUA_LOADLIBNAME, package_lib);
   lua_copy(L, -1, LUA_ENVIRONINDEX);
+  lj_lib_pushcf(L, lj_cf_package_loadbundle, 1);
+  lua_setfield(L, -2, "loadbundle");
   lua_createtable(L, sizeof(package_loaders)/sizeof(package_loaders[0])-1, 0);
   for (i = 0; package_loaders[i] != NULL; i++) {
     lj_lib_pushcf(L, package_loaders[i], 1);
@@ -686,6 +946,7 @@ LUALIB_API int luaopen_package(lua_State *L)
   lua_pop(L, 1);
   setpath(L, "path", LUA_PATH, LUA_PATH_DEFAULT, noenv);
   setpath(L, "cpath", LUA_CPATH, LUA_CPATH_DEFAULT, noenv);
+  setbundles(L, LUA_BUNDLE, noenv);
   lua_pushliteral(L, LUA_PATH_CONFIG);
   lua_setfield(L, -2, "config");
   luaL_findtable(L, LUA_REGISTRYINDEX, "_LOADED", 16);
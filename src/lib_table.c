@@ -17,7 +17,9 @@
 #include "lj_gc.h"
 #include "lj_err.h"
 #include "lj_buf.h"
+#include "lj_str.h"
 #include "lj_tab.h"
+#include "lj_state.h"
 #include "lj_ff.h"
 #include "lj_lib.h"
 
@@ -303,14 +305,201 @@ static void auxsort(lua_State *L, int l, int u)
   }  /* repeat the routine for the larger one */
 }
 
+/* -- Fast sort for arrays of numbers or strings --------------------------- */
+
+/* With the default comparator, arrays consisting only of numbers or only of
+** strings are sorted in place with an introsort. This is semantically
+** identical to the generic sort, since neither type consults metamethods
+** for '<'. NaNs would violate the strict weak ordering, so they're excluded.
+*/
+
+#define SORT_INSERTION	16	/* Use insertion sort for ranges up to this. */
+
+static LJ_AINLINE int sort_lt(cTValue *a, cTValue *b, int isstr)
+{
+  if (isstr)
+    return lj_str_cmp(strV(a), strV(b)) < 0;
+  else
+    return numberVnum(a) < numberVnum(b);
+}
+
+static LJ_AINLINE void sort_swap(TValue *a, TValue *b)
+{
+  TValue tmp = *a; *a = *b; *b = tmp;
+}
+
+static void sort_insertion(TValue *a, ptrdiff_t lo, ptrdiff_t hi, int isstr)
+{
+  ptrdiff_t i, j;
+  for (i = lo+1; i <= hi; i++) {
+    TValue x = a[i];
+    for (j = i; j > lo && sort_lt(&x, &a[j-1], isstr); j--)
+      a[j] = a[j-1];
+    a[j] = x;
+  }
+}
+
+static void sort_siftdown(TValue *a, ptrdiff_t i, ptrdiff_t n, int isstr)
+{
+  TValue x = a[i];
+  for (;;) {
+    ptrdiff_t c = 2*i+1;
+    if (c >= n) break;
+    if (c+1 < n && sort_lt(&a[c], &a[c+1], isstr)) c++;
+    if (!sort_lt(&x, &a[c], isstr)) break;
+    a[i] = a[c];
+    i = c;
+  }
+  a[i] = x;
+}
+
+/* Heapsort fallback for adversarial inputs. */
+static void sort_heap(TValue *a, ptrdiff_t n, int isstr)
+{
+  ptrdiff_t i;
+  for (i = n/2-1; i >= 0; i--)
+    sort_siftdown(a, i, n, isstr);
+  for (i = n-1; i > 0; i--) {
+    sort_swap(&a[0], &a[i]);
+    sort_siftdown(a, 0, i, isstr);
+  }
+}
+
+static void sort_intro(TValue *a, ptrdiff_t lo, ptrdiff_t hi, int depth,
+		       int isstr)
+{
+  while (hi - lo >= SORT_INSERTION) {
+    ptrdiff_t i = lo, j = hi, mid = lo + ((hi - lo) >> 1);
+    TValue p;
+    if (depth-- == 0) {
+      sort_heap(a+lo, hi-lo+1, isstr);
+      return;
+    }
+    /* Median of three. Leaves sentinels at both ends. */
+    if (sort_lt(&a[mid], &a[lo], isstr)) sort_swap(&a[mid], &a[lo]);
+    if (sort_lt(&a[hi], &a[mid], isstr)) {
+      sort_swap(&a[hi], &a[mid]);
+      if (sort_lt(&a[mid], &a[lo], isstr)) sort_swap(&a[mid], &a[lo]);
+    }
+    p = a[mid];
+    for (;;) {
+      do i++; while (sort_lt(&a[i], &p, isstr));
+      do j--; while (sort_lt(&p, &a[j], isstr));
+      if (i >= j) break;
+      sort_swap(&a[i], &a[j]);
+    }
+    /* Recurse into the smaller half, loop on the larger one. */
+    if (j - lo < hi - j) {
+      sort_intro(a, lo, j, depth, isstr);
+      lo = j+1;
+    } else {
+      sort_intro(a, j+1, hi, depth, isstr);
+      hi = j;
+    }
+  }
+  sort_insertion(a, lo, hi, isstr);
+}
+
+/* Try the fast path. Returns 0 if the array is not eligible. */
+static int sort_fast(GCtab *t, int32_t n)
+{
+  TValue *array = tvref(t->array);
+  int32_t i;
+  int isstr, depth = 0;
+  if (n < 2 || (uint32_t)n >= t->asize)
+    return n < 2;
+  isstr = tvisstr(&array[1]);
+  for (i = 1; i <= n; i++) {
+    cTValue *o = &array[i];
+    if (isstr ? !tvisstr(o) : !(tvisint(o) || (tvisnum(o) && !tvisnan(o))))
+      return 0;
+  }
+  for (i = n; i > 1; i >>= 1) depth += 2;
+  /* NOBARRIER: This just moves existing elements around. */
+  sort_intro(array, 1, n, depth, isstr);
+  return 1;
+}
+
+/* -- Generic sort -------------------------------------------------------- */
+
+/* Sort with a custom comparator. This is a Lua function, so the comparator
+** calls can be inlined by the trace compiler. Same algorithm as auxsort().
+** Returns false for an invalid order function. Indexing t is raw like the
+** lua_rawgeti()/lua_rawseti() of auxsort(): genlibbc turns TGETV/TSETV on an
+** argument passed through CHECK_tab into TGETR/TSETR.
+*/
+LJLIB_LUA(table_sort_cmp) /*
+  function(t, comp, l, u, sort)
+    CHECK_tab(t)
+    CHECK_func(comp)
+    while l < u do
+      local a, b = t[l], t[u]
+      if comp(b, a) then t[l] = b; t[u] = a end
+      if u-l == 1 then break end
+      local i = l + u
+      i = (i - i % 2) / 2
+      a, b = t[i], t[l]
+      if comp(a, b) then
+	t[i] = b; t[l] = a
+      else
+	b = t[u]
+	if comp(b, a) then t[i] = b; t[u] = a end
+      end
+      if u-l == 2 then break end
+      local p = t[i]
+      t[i] = t[u-1]; t[u-1] = p
+      local j = u-1
+      i = l
+      while true do
+	i = i + 1; a = t[i]
+	while comp(a, p) do
+	  if i >= u then return false end
+	  i = i + 1; a = t[i]
+	end
+	j = j - 1; b = t[j]
+	while comp(p, b) do
+	  if j <= l then return false end
+	  j = j - 1; b = t[j]
+	end
+	if j < i then break end
+	t[i] = b; t[j] = a
+      end
+      t[u-1] = t[i]; t[i] = p
+      if i-l < u-i then
+	j = l; i = i-1; l = i+2
+      else
+	j = i+1; i = u; u = j-2
+      end
+      if not sort(t, comp, j, i, sort) then return false end
+    end
+    return true
+  end
+*/
+
+LJLIB_PUSH("sort_cmp")  /* Replaced with the Lua function in luaopen_table. */
 LJLIB_CF(table_sort)
 {
   GCtab *t = lj_lib_checktab(L, 1);
   int32_t n = (int32_t)lj_tab_len(t);
   lua_settop(L, 2);
-  if (!tvisnil(L->base+1))
+  if (!tvisnil(L->base+1)) {
     lj_lib_checkfunc(L, 2);
-  auxsort(L, 1, n);
+    if (n > 1) {
+      lj_state_checkstack(L, 6);
+      copyTV(L, L->top, lj_lib_upvalue(L, 1));
+      copyTV(L, L->top+1, L->base);
+      copyTV(L, L->top+2, L->base+1);
+      setintV(L->top+3, 1);
+      setintV(L->top+4, n);
+      copyTV(L, L->top+5, L->top);
+      L->top += 6;
+      lua_call(L, 5, 1);
+      if (!tvistruecond(L->top-1))
+	lj_err_caller(L, LJ_ERR_TABSORT);
+    }
+  } else if (!sort_fast(t, n)) {
+    auxsort(L, 1, n);
+  }
   return 0;
 }
 
@@ -380,9 +569,21 @@ static int luaopen_table_clear(lua_State *L)
 
 #include "lj_libdef.h"
 
+/* Move the Lua sort function from the library table to its upvalue slot. */
+static void table_sort_init(lua_State *L, GCtab *t)
+{
+  GCfunc *fn = funcV(lj_tab_getstr(t, lj_str_newlit(L, "sort")));
+  TValue *uv = &fn->c.data->upvalue[0];
+  TValue *o = lj_tab_setstr(L, t, strV(uv));
+  /* NOBARRIER: Both functions are new (marked white). */
+  copyTV(L, uv, o);
+  setnilV(o);
+}
+
 LUALIB_API int luaopen_table(lua_State *L)
 {
   LJ_LIB_REG(L, LUA_TABLIBNAME, table);
+  table_sort_init(L, tabV(L->top-1));
 #if LJ_52
   lua_getglobal(L, "unpack");
   lua_setfield(L, -2, "unpack");
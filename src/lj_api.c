@@ -14,6 +14,7 @@
 #include "lj_err.h"
 #include "lj_debug.h"
 #include "lj_str.h"
+#include "lj_buf.h"
 #include "lj_tab.h"
 #include "lj_func.h"
 #include "lj_udata.h"
@@ -25,6 +26,11 @@
 #include "lj_vm.h"
 #include "lj_strscan.h"
 #include "lj_strfmt.h"
+#include "lj_serialize.h"
+#if LJ_HASFFI
+#include "lj_ctype.h"
+#include "lj_cdata.h"
+#endif
 
 /* -- Common helper functions --------------------------------------------- */
 
@@ -1420,3 +1426,215 @@ LUA_API void *lua_getexdata2(lua_State *L)
 {
   return L->exdata2;
 }
+
+LUA_API int lua_isbuffer(lua_State *L, int idx)
+{
+  cTValue *o = index2adr(L, idx);
+  return tvisbuf(o);
+}
+
+LUA_API const char *lua_tobuffer(lua_State *L, int idx, size_t *len)
+{
+  cTValue *o = index2adr(L, idx);
+  SBufExt *sbx;
+  if (!tvisbuf(o)) {
+    if (len) *len = 0;
+    return NULL;
+  }
+  sbx = bufV(o);
+  if (len) *len = sbufxlen(sbx);
+  return sbx->r;
+}
+
+LUA_API char *lua_reservebuffer(lua_State *L, int idx, size_t sz, size_t *len)
+{
+  cTValue *o = index2adr(L, idx);
+  SBufExt *sbx;
+  if (!tvisbuf(o) || sz > LJ_MAX_BUF) return NULL;
+  sbx = bufV(o);
+  setsbufXL_(sbx, L);
+  lj_buf_more((SBuf *)sbx, (MSize)sz);
+  if (len) *len = sbufleft(sbx);
+  return sbx->w;
+}
+
+LUA_API void lua_commitbuffer(lua_State *L, int idx, size_t len)
+{
+  cTValue *o = index2adr(L, idx);
+  SBufExt *sbx;
+  lj_checkapi(tvisbuf(o), "stack slot %d is not a buffer", idx);
+  sbx = bufV(o);
+  lj_checkapi(len <= sbufleft(sbx), "commit past reserved space");
+  sbx->w += len;
+}
+
+/* Create an empty buffer object like the one given. */
+static GCudata *api_newbufx(lua_State *L, GCudata *ud)
+{
+  GCtab *mt = tabref(ud->metatable);
+  GCudata *nud = lj_udata_new(L, sizeof(SBufExt), tabref(ud->env));
+  nud->udtype = UDTYPE_BUFFER;
+  /* NOBARRIER: The GCudata is new (marked white). */
+  setgcref(nud->metatable, obj2gco(mt));
+  if (mt && lj_meta_fastg(G(L), mt, MM_gc))
+    lj_mem_registergc_udata(L, nud);
+  lj_bufx_init(L, (SBufExt *)uddata(nud));
+  return nud;
+}
+
+LUA_API const char *lua_pinbuffer(lua_State *L, int idx, size_t *len)
+{
+  cTValue *o = index2adr(L, idx);
+  GCudata *ud;
+  SBufExt *sbx;
+  GCobj *ref;
+  lj_checkapi(tvisbuf(o), "stack slot %d is not a buffer", idx);
+  ud = udataV(o);
+  sbx = (SBufExt *)uddata(ud);
+  if (sbufiscow(sbx) && gcref(sbx->cowref)) {
+    ref = gcref(sbx->cowref);  /* Contents are immutable already. */
+  } else {
+    /* Move the contents to a new buffer and make this one copy-on-write. */
+    GCudata *pud = api_newbufx(L, ud);
+    SBufExt *psbx = (SBufExt *)uddata(pud);
+    psbx->b = sbx->b; psbx->e = sbx->e;
+    psbx->r = sbx->r; psbx->w = sbx->w;
+    lj_bufx_set_cow(L, sbx, psbx->r, sbufxlen(psbx));
+    ref = obj2gco(pud);
+    setgcref(sbx->cowref, ref);
+    lj_gc_objbarrier(L, ud, ref);
+  }
+  setgcV(L, L->top, ref, ~ref->gch.gct);
+  incr_top(L);
+  if (len) *len = sbufxlen(sbx);
+  return sbx->r;
+}
+
+LUA_API void lua_detachbuffer(lua_State *L, int idx)
+{
+  cTValue *o = index2adr(L, idx);
+  GCudata *ud, *nud;
+  SBufExt *sbx, *nsbx;
+  lj_checkapi(tvisbuf(o), "stack slot %d is not a buffer", idx);
+  ud = udataV(o);
+  sbx = (SBufExt *)uddata(ud);
+  nud = api_newbufx(L, ud);
+  nsbx = (SBufExt *)uddata(nud);
+  /* NOBARRIER: The GCudata is new (marked white). */
+  setsbufXL(nsbx, L, sbufflag(sbx) & SBUF_MASK_FLAG);
+  setgcref(nsbx->cowref, gcref(sbx->cowref));
+  nsbx->b = sbx->b; nsbx->e = sbx->e;
+  nsbx->r = sbx->r; nsbx->w = sbx->w;
+  setsbufXL(sbx, L, SBUF_FLAG_EXT);
+  setgcrefnull(sbx->cowref);
+  sbx->r = sbx->w = sbx->b = sbx->e = NULL;
+  setudataV(L, L->top, nud);
+  incr_top(L);
+}
+
+LUA_API void lua_attachbuffer(lua_State *L, int idx, int from)
+{
+  cTValue *o = index2adr(L, idx), *fo = index2adr(L, from);
+  SBufExt *sbx, *fsbx;
+  lj_checkapi(tvisbuf(o), "stack slot %d is not a buffer", idx);
+  lj_checkapi(tvisbuf(fo), "stack slot %d is not a buffer", from);
+  sbx = bufV(o);
+  fsbx = bufV(fo);
+  if (sbx == fsbx) return;
+  if (sbufxlen(sbx) == 0 && !sbufiscow(sbx)) {
+    /* Take over the memory. */
+    GCobj *ref = gcref(fsbx->cowref);
+    lj_bufx_free(L, sbx);
+    setsbufXL(sbx, L, sbufflag(fsbx) & SBUF_MASK_FLAG);
+    if (ref) {
+      setgcref(sbx->cowref, ref);
+      lj_gc_objbarrier(L, udataV(o), ref);
+    }
+    sbx->b = fsbx->b; sbx->e = fsbx->e;
+    sbx->r = fsbx->r; sbx->w = fsbx->w;
+    setsbufXL(fsbx, L, SBUF_FLAG_EXT);
+    setgcrefnull(fsbx->cowref);
+    fsbx->r = fsbx->w = fsbx->b = fsbx->e = NULL;
+  } else {
+    MSize len = sbufxlen(fsbx);
+    if (len) lj_buf_putmem((SBuf *)sbx, fsbx->r, len);
+    lj_bufx_free(L, fsbx);
+  }
+}
+
+LUA_API void *lua_tocpointer(lua_State *L, int idx)
+{
+  cTValue *o = index2adr(L, idx);
+#if LJ_HASFFI
+  if (tviscdata(o)) {
+    CTState *cts = ctype_ctsG(G(L));
+    GCcdata *cd = cdataV(o);
+    CType *ct = ctype_raw(cts, cd->ctypeid);
+    void *p = cdataptr(cd);
+    if (ctype_isref(ct->info)) {
+      p = cdata_getptr(p, ct->size);
+      ct = ctype_rawchild(cts, ct);
+    }
+    if (ctype_isptr(ct->info))
+      return cdata_getptr(p, ct->size);
+    else if (ctype_isarray(ct->info) || ctype_isstruct(ct->info))
+      return p;
+    return NULL;
+  }
+#endif
+  if (tvislightud(o))
+    return lightudV(G(L), o);
+  return NULL;
+}
+
+#if LJ_HASBUFFER
+typedef struct SerializeCtx {
+  SBufExt sbx;
+  TValue o;
+} SerializeCtx;
+
+static int cpserialize(lua_State *L)
+{
+  SerializeCtx *sc = (SerializeCtx *)lua_touserdata(L, 1);
+  lj_serialize_put(&sc->sbx, &sc->o);
+  return 0;
+}
+#endif
+
+LUA_API int lua_serialize(lua_State *L, int idx, const char **p, size_t *len)
+{
+#if LJ_HASBUFFER
+  SerializeCtx sc;
+  int status;
+  memset(&sc.sbx, 0, sizeof(SBufExt));
+  lj_bufx_set_borrow(L, &sc.sbx, &G(L)->tmpbuf);
+  copyTV(L, &sc.o, index2adr(L, idx));
+  status = lua_cpcall(L, cpserialize, &sc);
+  if (status == 0) {
+    *p = sc.sbx.r;
+    *len = sbufxlen(&sc.sbx);
+  }
+  return status;
+#else
+  UNUSED(idx); UNUSED(p); UNUSED(len);
+  lua_pushliteral(L, "serialization not supported");
+  return LUA_ERRRUN;
+#endif
+}
+
+LUA_API void lua_deserialize(lua_State *L, const char *p, size_t len)
+{
+#if LJ_HASBUFFER
+  SBufExt sbx;
+  memset(&sbx, 0, sizeof(SBufExt));
+  lj_bufx_set_cow(L, &sbx, p, (MSize)len);
+  setnilV(L->top);
+  incr_top(L);
+  if (lj_serialize_get(&sbx, L->top-1) != sbx.w)
+    lj_err_caller(L, LJ_ERR_BUFFER_LEFTOV);
+  lj_gc_check(L);
+#else
+  UNUSED(p); UNUSED(len);
+  lj_err_caller(L, LJ_ERR_BADVAL);
+#endif
+}
@@ -64,6 +64,9 @@ typedef struct ASMState {
 
   int32_t evenspill;	/* Next even spill slot. */
   int32_t oddspill;	/* Next odd spill slot (or 0). */
+  uint32_t nspill;	/* Number of spilled IR instructions. */
+  uint32_t nreload;	/* Number of reloads from spill slots. */
+  uint32_t *usechain;	/* Use chains for eviction by next use (or NULL). */
 
   IRRef curins;		/* Reference of current instruction. */
   IRRef stopins;	/* Stop assembly before hitting this instruction. */
@@ -442,6 +445,7 @@ static int32_t ra_spill(ASMState *as, IRIns *ir)
     if (as->evenspill > 256)
       lj_trace_err(as->J, LJ_TRERR_SPILLOV);
     ir->s = (uint8_t)slot;
+    as->nspill++;
   }
   return sps_scale(slot);
 }
@@ -476,6 +480,7 @@ static Reg ra_restore(ASMState *as, IRRef ref)
       ra_modified(as, r);
       RA_DBGX((as, "restore   $i $r", ir, r));
       emit_spload(as, ir, r, ofs);
+      as->nreload++;
     }
     return r;
   }
@@ -488,6 +493,38 @@ static void ra_save(ASMState *as, IRIns *ir, Reg r)
   emit_spstore(as, ir, r, sps_scale(ir->s));
 }
 
+/* Get the closest use of a ref at or below the current instruction.
+** The assembler goes backwards, so this is the next use it encounters.
+*/
+static IRRef ra_nextuse(ASMState *as, IRRef ref)
+{
+  uint32_t *head = as->usechain, *link = head + (as->orignins - REF_BIAS);
+  uint32_t u = head[ref - REF_BIAS];
+  while (u && REF_BIAS + (u >> 1) > as->curins)
+    u = link[u];
+  head[ref - REF_BIAS] = u;  /* Uses above are never needed again. */
+  return u ? REF_BIAS + (u >> 1) : 0;
+}
+
+/* Set the costs of the allocated registers to their next use distance.
+** Values used in the loop body are needed by the next iteration, too.
+*/
+static void ra_usecost(ASMState *as, RegSet allow)
+{
+  RegSet work = allow & RSET_ALL & ~as->freeset;
+  while (work) {
+    Reg r = rset_pickbot(work);
+    IRRef ref = regcost_ref(as->cost[r]);
+    rset_clear(work, r);
+    if (!irref_isk(ref)) {
+      IRRef use = ref < as->loopref && as->curins > as->loopref ?
+		  as->curins : ra_nextuse(as, ref);
+      if (use < ref) use = ref;  /* No other use before the definition. */
+      as->cost[r] = REGCOST(use, ref) + REGCOST_T(irt_t(IR(ref)->t));
+    }
+  }
+}
+
 #define MINCOST(name) \
   if (rset_test(RSET_ALL, RID_##name) && \
       LJ_LIKELY(allow&RID2RSET(RID_##name)) && as->cost[RID_##name] < cost) \
@@ -499,6 +536,8 @@ static Reg ra_evict(ASMState *as, RegSet allow)
   IRRef ref;
   RegCost cost = ~(RegCost)0;
   lj_assertA(allow != RSET_EMPTY, "evict from empty set");
+  if (as->usechain)
+    ra_usecost(as, allow);
   if (RID_NUM_FPR == 0 || allow < RID2RSET(RID_MAX_GPR)) {
     GPRDEF(MINCOST)
   } else {
@@ -916,6 +955,58 @@ static void ra_destpair(ASMState *as, IRIns *ir)
   if (ra_hasspill(ir->s)) ra_save(as, ir, RID_RETLO);
 }
 
+#if LJ_HASFFI && (LJ_TARGET_X64 || LJ_TARGET_ARM64)
+/* Force the destination registers for a pair of FP or mixed call results. */
+static void ra_destpair_fp(ASMState *as, IRIns *ir)
+{
+  IRIns *irh = ir+1;
+  Reg rlo = RID_FPRET, rhi = RID_FPRET+1, destlo, desthi;
+  if (!irt_isfp(ir->t) || !irt_isfp(irh->t)) {  /* One GPR plus one FPR. */
+    ra_destreg(as, ir, irt_isfp(ir->t) ? RID_FPRET : RID_RET);
+    ra_destreg(as, irh, irt_isfp(irh->t) ? RID_FPRET : RID_RET);
+    return;
+  }
+  /* Scratch regs are already evicted, so only the dests may conflict. */
+  destlo = ir->r; desthi = irh->r;
+  if (ra_hasreg(destlo)) {
+    ra_free(as, destlo);
+    ra_modified(as, destlo);
+  } else {
+    destlo = rlo;
+  }
+  if (ra_hasreg(desthi)) {
+    ra_free(as, desthi);
+    ra_modified(as, desthi);
+  } else {
+    desthi = rhi;
+  }
+  if (destlo == rhi) {
+    if (desthi == rlo) {  /* Swap with a free scratch register. */
+      RegSet tmpset = as->freeset & RSET_SCRATCH & RSET_FPR &
+		      ~(RID2RSET(rlo)|RID2RSET(rhi));
+      Reg tmp;
+      lj_assertA(tmpset, "no free FPR for result swap");
+      tmp = rset_pickbot(tmpset);
+      emit_movrr(as, ir, rhi, tmp);
+      emit_movrr(as, irh, rlo, rhi);
+      emit_movrr(as, ir, tmp, rlo);
+    } else {
+      emit_movrr(as, ir, rhi, rlo);
+      if (desthi != rhi) emit_movrr(as, irh, desthi, rhi);
+    }
+  } else if (desthi == rlo) {
+    emit_movrr(as, irh, rlo, rhi);
+    if (destlo != rlo) emit_movrr(as, ir, destlo, rlo);
+  } else {
+    if (desthi != rhi) emit_movrr(as, irh, desthi, rhi);
+    if (destlo != rlo) emit_movrr(as, ir, destlo, rlo);
+  }
+  /* Restore spill slots (if any). */
+  if (ra_hasspill(irh->s)) ra_save(as, irh, rhi);
+  if (ra_hasspill(ir->s)) ra_save(as, ir, rlo);
+}
+#endif
+
 /* -- Snapshot handling --------- ----------------------------------------- */
 
 /* Can we rematerialize a KNUM instead of forcing a spill? */
@@ -2458,6 +2549,36 @@ static void asm_setup_regsp(ASMState *as)
     as->oddspill = 0;
 }
 
+/* Setup use chains for eviction by next use. Each chain links the uses
+** of a ref in descending order, starting with its last use.
+*/
+static void asm_setup_usechain(ASMState *as)
+{
+  uint32_t n = as->orignins - REF_BIAS, *head, *link;
+  IRRef ref;
+  as->usechain = NULL;
+  if (!(as->flags & JIT_F_OPT_RALIVE))
+    return;
+  head = (uint32_t *)lj_buf_tmp(as->J->L, 3*n*sizeof(uint32_t));
+  link = head + n;
+  memset(head, 0, n*sizeof(uint32_t));
+  for (ref = REF_FIRST; ref < as->orignins; ref++) {
+    IRIns *ir = IR(ref);
+    uint32_t m = lj_ir_mode[ir->o], u = 2*(ref - REF_BIAS);
+    if (ir->r == RID_SINK)
+      continue;
+    if (irm_op1(m) == IRMref && ir->op1 >= REF_FIRST) {
+      link[u] = head[ir->op1 - REF_BIAS];
+      head[ir->op1 - REF_BIAS] = u;
+    }
+    if (irm_op2(m) == IRMref && ir->op2 >= REF_FIRST) {
+      link[u+1] = head[ir->op2 - REF_BIAS];
+      head[ir->op2 - REF_BIAS] = u+1;
+    }
+  }
+  as->usechain = head;
+}
+
 /* -- Assembler core ------------------------------------------------------ */
 
 /* Assemble a trace. */
@@ -2550,7 +2671,9 @@ void lj_asm_trace(jit_State *J, GCtrace *T)
     as->gcsteps = 0;
     as->sectref = as->loopref;
     as->fuseref = (as->flags & JIT_F_OPT_FUSE) ? as->loopref : FUSE_DISABLED;
+    as->nspill = as->nreload = 0;
     asm_setup_regsp(as);
+    asm_setup_usechain(as);
     if (!as->loopref)
       asm_tail_link(as);
 
@@ -2612,6 +2735,8 @@ void lj_asm_trace(jit_State *J, GCtrace *T)
   RA_DBG_FLUSH();
   if (as->freeset != RSET_ALL)
     lj_trace_err(as->J, LJ_TRERR_BADRA);  /* Ouch! Should never happen. */
+  T->nspill = (uint16_t)as->nspill;
+  T->nreload = (uint16_t)(as->nreload < 0xffff ? as->nreload : 0xffff);
 
   /* Set trace entry point before fixing up tail to allow link to self. */
   T->mcode = as->mcp;
@@ -538,6 +538,11 @@ static void asm_setupresult(ASMState *as, IRIns *ir, const CCallInfo *ci)
   ra_evictset(as, drop); /* Evictions must be performed first. */
   if (ra_used(ir)) {
     lj_assertA(!irt_ispri(ir->t), "PRI dest");
+#if LJ_HASFFI
+    if (hiop && irt_isfp(ir->t)) {
+      ra_destpair_fp(as, ir);  /* Struct returned in d0/d1 or s0/s1. */
+    } else
+#endif
     if (irt_isfp(ir->t)) {
       if (ci->flags & CCI_CASTU64) {
 	Reg dest = ra_dest(as, ir, RSET_FPR) & 31;
@@ -1788,8 +1793,9 @@ static void asm_hiop(ASMState *as, IRIns *ir)
   case IR_CALLL:
   case IR_CALLS:
   case IR_CALLXS:
-    if (!uselo)
-      ra_allocref(as, ir->op1, RID2RSET(RID_RETLO));  /* Mark lo op as used. */
+    if (!uselo)  /* Mark lo op as used. */
+      ra_allocref(as, ir->op1, RID2RSET(irt_isfp((ir-1)->t) ? RID_FPRET :
+								 RID_RETLO));
     break;
   default: lj_assertA(0, "bad HIOP for op %d", (ir-1)->o); break;
   }
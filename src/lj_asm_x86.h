@@ -672,6 +672,11 @@ static void asm_setupresult(ASMState *as, IRIns *ir, const CCallInfo *ci)
     rset_clear(drop, (ir+1)->r);  /* Dest reg handled below. */
   ra_evictset(as, drop);  /* Evictions must be performed first. */
   if (ra_used(ir)) {
+#if LJ_64 && LJ_HASFFI
+    if (hiop && (irt_isfp(ir->t) || irt_isfp((ir+1)->t))) {
+      ra_destpair_fp(as, ir);  /* Struct returned in xmm0/xmm1 or mixed. */
+    } else
+#endif
     if (irt_isfp(ir->t)) {
       int32_t ofs = sps_scale(ir->s);  /* Use spill slot or temp slots. */
 #if LJ_64
@@ -2680,8 +2685,9 @@ static void asm_hiop(ASMState *as, IRIns *ir)
     break;
 #endif
   case IR_CALLN: case IR_CALLL: case IR_CALLS: case IR_CALLXS:
-    if (!uselo)
-      ra_allocref(as, ir->op1, RID2RSET(RID_RETLO));  /* Mark lo op as used. */
+    if (!uselo)  /* Mark lo op as used. */
+      ra_allocref(as, ir->op1, RID2RSET(irt_isfp((ir-1)->t) ? RID_FPRET :
+								 RID_RETLO));
     break;
   default: lj_assertA(0, "bad HIOP for op %d", (ir-1)->o); break;
   }
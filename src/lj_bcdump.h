@@ -66,5 +66,8 @@ LJ_FUNC int lj_bcwrite(lua_State *L, GCproto *pt, lua_Writer writer,
 		       void *data, uint32_t flags);
 LJ_FUNC GCproto *lj_bcread_proto(LexState *ls);
 LJ_FUNC GCproto *lj_bcread(LexState *ls);
+LJ_FUNC GCproto *lj_bcread_lazy(lua_State *L, GCproto *parent, GCproto *pt);
+LJ_FUNC int lj_load_persistent(lua_State *L, const char *buf, size_t size,
+			       const char *chunkname);
 
 #endif
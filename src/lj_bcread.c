@@ -22,6 +22,8 @@
 #include "lj_bcdump.h"
 #include "lj_state.h"
 #include "lj_strfmt.h"
+#include "lj_frame.h"
+#include "lj_vm.h"
 
 /* Reuse some lexer fields for our own purposes. */
 #define bcread_flags(ls)	ls->level
@@ -317,6 +319,7 @@ GCproto *lj_bcread_proto(LexState *ls)
   MSize ofsk, ofsuv, ofsdbg;
   MSize sizedbg = 0;
   BCLine firstline = 0, numline = 0;
+  int dbgref;
 
   /* Read prototype header. */
   flags = bcread_byte(ls);
@@ -333,6 +336,9 @@ GCproto *lj_bcread_proto(LexState *ls)
       numline = bcread_uleb128(ls);
     }
   }
+  /* Persistent input: reference debug info in place, if it's usable as is. */
+  dbgref = sizedbg && ls->persist &&
+	   (numline < 256 || (LJ_TARGET_UNALIGNED && !bcread_swap(ls)));
 
   /* Calculate total size of prototype including all colocated arrays. */
   sizept = (MSize)sizeof(GCproto) +
@@ -341,7 +347,7 @@ GCproto *lj_bcread_proto(LexState *ls)
   sizept = (sizept + (MSize)sizeof(TValue)-1) & ~((MSize)sizeof(TValue)-1);
   ofsk = sizept; sizept += sizekn*(MSize)sizeof(TValue);
   ofsuv = sizept; sizept += ((sizeuv+1)&~1)*2;
-  ofsdbg = sizept; sizept += sizedbg;
+  ofsdbg = sizept; if (!dbgref) sizept += sizedbg;
 
   /* Allocate prototype object and initialize its fields. */
   pt = (GCproto *)lj_mem_newgco(ls->L, (MSize)sizept);
@@ -376,9 +382,16 @@ GCproto *lj_bcread_proto(LexState *ls)
   pt->numline = numline;
   if (sizedbg) {
     MSize sizeli = (sizebc-1) << (numline < 256 ? 0 : numline < 65536 ? 1 : 2);
-    setmref(pt->lineinfo, (char *)pt + ofsdbg);
-    setmref(pt->uvinfo, (char *)pt + ofsdbg + sizeli);
-    bcread_dbg(ls, pt, sizedbg);
+    if (dbgref) {
+      const char *p = (const char *)bcread_mem(ls, sizedbg);
+      lj_assertLS(sbuflen(&ls->sb) == 0, "persistent input copied to buffer");
+      setmref(pt->lineinfo, p);
+      setmref(pt->uvinfo, p + sizeli);
+    } else {
+      setmref(pt->lineinfo, (char *)pt + ofsdbg);
+      setmref(pt->uvinfo, (char *)pt + ofsdbg + sizeli);
+      bcread_dbg(ls, pt, sizedbg);
+    }
     setmref(pt->varinfo, bcread_varinfo(pt));
   } else {
     setmref(pt->lineinfo, NULL);
@@ -388,7 +401,227 @@ GCproto *lj_bcread_proto(LexState *ls)
   return pt;
 }
 
-/* Read and check header of bytecode dump. */
+/* -- Lazy prototypes ----------------------------------------------------- */
+
+/*
+** Prototypes loaded from persistent input are decoded lazily. Only the
+** outermost prototype of a dump is decoded. Its children are stubs, which
+** reference the dumps of the child and all of its descendants. A stub is
+** decoded (the same way) by the first FNEW or any other use, which then
+** replaces the stub in the constants of the parent.
+**
+** A stub is a GCproto with sizebc = 0, followed by a BCLazy and a copy of
+** the upvalue refs. Its header fields are valid, except for the constants.
+*/
+typedef struct BCLazy {
+  const char *p;	/* Start of the dumps of all descendants. */
+  const char *pe;	/* End of the dump of the prototype itself. */
+  uint32_t flags;	/* Bytecode dump flags. */
+  MSize slot;		/* Constant slot in the parent. */
+} BCLazy;
+
+#define proto_lazy(pt)	((BCLazy *)((char *)(pt) + sizeof(GCproto)))
+
+/* Skip a constant table key or value. */
+static void bcread_skipktabk(LexState *ls)
+{
+  MSize tp = bcread_uleb128(ls);
+  if (tp >= BCDUMP_KTAB_STR) {
+    ls->p += tp - BCDUMP_KTAB_STR;
+  } else if (tp == BCDUMP_KTAB_INT) {
+    bcread_uleb128(ls);
+  } else if (tp == BCDUMP_KTAB_NUM) {
+    bcread_uleb128(ls);
+    bcread_uleb128(ls);
+  }
+}
+
+/* Count the children of a prototype dump. */
+static MSize bcread_nchild(LexState *ls)
+{
+  MSize flags = bcread_byte(ls), sizeuv, sizekgc, sizebc, n = 0;
+  if (!(flags & PROTO_CHILD)) return 0;
+  ls->p += 2;  /* Skip numparams and framesize. */
+  sizeuv = bcread_byte(ls);
+  sizekgc = bcread_uleb128(ls);
+  bcread_uleb128(ls);  /* Skip sizekn. */
+  sizebc = bcread_uleb128(ls);
+  if (!(bcread_flags(ls) & BCDUMP_F_STRIP) && bcread_uleb128(ls)) {
+    bcread_uleb128(ls);  /* Skip firstline and numline. */
+    bcread_uleb128(ls);
+  }
+  ls->p += sizebc*(MSize)sizeof(BCIns) + sizeuv*2;
+  for (; sizekgc; sizekgc--) {
+    MSize tp = bcread_uleb128(ls);
+    if (tp >= BCDUMP_KGC_STR) {
+      ls->p += tp - BCDUMP_KGC_STR;
+    } else if (tp == BCDUMP_KGC_TAB) {
+      MSize narray = bcread_uleb128(ls);
+      MSize nhash = bcread_uleb128(ls);
+      for (narray += 2*nhash; narray; narray--)
+	bcread_skipktabk(ls);
+    } else if (tp == BCDUMP_KGC_CHILD) {
+      n++;
+    } else {  /* 64 bit integer or complex number. */
+      MSize k = tp == BCDUMP_KGC_COMPLEX ? 4 : 2;
+      while (k--) bcread_uleb128(ls);
+    }
+  }
+  return n;
+}
+
+/* Create a stub for the dump at q..pe, preceded by its descendants at p. */
+static GCproto *bcread_stub(LexState *ls, const char *p, const char *q,
+			    const char *pe)
+{
+  GCproto *pt;
+  MSize flags, numparams, framesize, sizeuv, sizebc, sizept;
+  BCLine firstline = 0, numline = 0;
+  ls->p = q;
+  flags = bcread_byte(ls);
+  numparams = bcread_byte(ls);
+  framesize = bcread_byte(ls);
+  sizeuv = bcread_byte(ls);
+  bcread_uleb128(ls);  /* Skip sizekgc and sizekn. */
+  bcread_uleb128(ls);
+  sizebc = bcread_uleb128(ls);
+  if (!(bcread_flags(ls) & BCDUMP_F_STRIP) && bcread_uleb128(ls)) {
+    firstline = bcread_uleb128(ls);
+    numline = bcread_uleb128(ls);
+  }
+  ls->p += sizebc*(MSize)sizeof(BCIns);
+  sizept = (MSize)(sizeof(GCproto) + sizeof(BCLazy)) + ((sizeuv+1)&~1)*2;
+  pt = (GCproto *)lj_mem_newgco(ls->L, sizept);
+  pt->gct = ~LJ_TPROTO;
+  pt->numparams = (uint8_t)numparams;
+  pt->framesize = (uint8_t)framesize;
+  pt->sizebc = 0;
+  setmref(pt->k, proto_lazy(pt) + 1);
+  setmref(pt->uv, proto_lazy(pt) + 1);
+  pt->sizekgc = 0;
+  pt->sizekn = 0;
+  pt->sizept = sizept;
+  pt->sizeuv = (uint8_t)sizeuv;
+  pt->flags = (uint8_t)flags;
+  pt->trace = 0;
+  setgcref(pt->chunkname, obj2gco(ls->chunkname));
+  pt->firstline = firstline;
+  pt->numline = numline;
+  setmref(pt->lineinfo, NULL);
+  setmref(pt->uvinfo, NULL);
+  setmref(pt->varinfo, NULL);
+  proto_lazy(pt)->p = p;
+  proto_lazy(pt)->pe = pe;
+  proto_lazy(pt)->flags = bcread_flags(ls);
+  bcread_uv(ls, pt, sizeuv);
+  return pt;
+}
+
+/* Scan the dumps up to pe, but only decode the last one. Its children are
+** decoded the same way for depth > 0, otherwise they get stubs. The buffer
+** holds a stack of descendants/dump/end triples, starting at base.
+*/
+static GCproto *bcread_lazy(LexState *ls, const char *pe, MSize base,
+			    int depth)
+{
+  lua_State *L = ls->L;
+  const char **stk;
+  const char *q, *qe;
+  MSize top = base, n, i;
+  GCproto *pt;
+  for (;;) {
+    const char *p = ls->p;
+    MSize len;
+    if (p >= pe || *p == 0)
+      bcread_error(ls, LJ_ERR_BCBAD);
+    len = bcread_uleb128(ls);
+    q = ls->p;
+    if (len > (MSize)(pe - q))
+      bcread_error(ls, LJ_ERR_BCBAD);
+    qe = q + len;
+    n = bcread_nchild(ls);
+    if (ls->p > qe || n > top - base)
+      bcread_error(ls, LJ_ERR_BCBAD);
+    top -= n;
+    if (qe == pe || *qe == 0) break;  /* Last dump. */
+    stk = (const char **)lj_buf_need(&ls->sb, (top+1)*3*sizeof(const char *));
+    if (!n) stk[top*3] = p;  /* Else keep the start of the first child. */
+    stk[top*3+1] = q;
+    stk[top*3+2] = qe;
+    top++;
+    ls->p = qe;
+  }
+  if (top != base)  /* Unreferenced dumps. */
+    bcread_error(ls, LJ_ERR_BCBAD);
+  for (i = 0; i < n; i++) {
+    GCproto *cpt;
+    stk = (const char **)ls->sb.b + (base+i)*3;
+    if (depth) {
+      ls->p = stk[0];
+      cpt = bcread_lazy(ls, stk[2], base+n, depth-1);
+    } else {
+      cpt = bcread_stub(ls, stk[0], stk[1], stk[2]);
+    }
+    setprotoV(L, L->top, cpt);
+    incr_top(L);
+  }
+  ls->p = q;
+  pt = lj_bcread_proto(ls);
+  if (ls->p != qe)
+    bcread_error(ls, LJ_ERR_BCBAD);
+  for (i = 0; !depth && n && i < pt->sizekgc; i++) {
+    GCobj *o = proto_kgc(pt, ~(ptrdiff_t)i);
+    if (o->gch.gct == ~LJ_TPROTO) {  /* Remember the slot of the stub. */
+      proto_lazy(gco2pt(o))->slot = i;
+      n--;
+    }
+  }
+  return pt;
+}
+
+static TValue *cpbclazy(lua_State *L, lua_CFunction dummy, void *ud)
+{
+  LexState *ls = (LexState *)ud;
+  UNUSED(dummy);
+  cframe_errfunc(L->cframe) = -1;  /* Inherit error function. */
+  bcread_savetop(L, ls, L->top);
+  setprotoV(L, L->top, bcread_lazy(ls, ls->pe, 0, 0));
+  incr_top(L);
+  return NULL;
+}
+
+/* Decode a stub and replace it in the constants of its parent. */
+GCproto *lj_bcread_lazy(lua_State *L, GCproto *parent, GCproto *pt)
+{
+  BCLazy *lz = proto_lazy(pt);
+  LexState ls;
+  GCproto *npt;
+  GCRef *ref;
+  int status;
+  memset(&ls, 0, sizeof(ls));
+  ls.L = L;
+  ls.p = lz->p;
+  ls.pe = lz->pe;
+  ls.c = -1;  /* No reader. */
+  ls.chunkname = proto_chunkname(pt);
+  ls.chunkarg = strdata(ls.chunkname);
+  ls.fr2 = (lz->flags & BCDUMP_F_FR2) ? 1 : 0;
+  ls.persist = 1;
+  ls.level = lz->flags;
+  lj_buf_init(L, &ls.sb);
+  status = lj_vm_cpcall(L, NULL, &ls, cpbclazy);
+  lj_lex_cleanup(L, &ls);
+  if (status)
+    lj_err_throw(L, status);
+  npt = protoV(L->top-1);
+  ref = &mref(parent->k, GCRef)[~(ptrdiff_t)lz->slot];
+  lj_assertL(gcref(*ref) == obj2gco(pt), "stub not in parent");
+  setgcref(*ref, obj2gco(npt));
+  lj_gc_objbarrier(L, parent, npt);
+  L->top--;
+  return npt;
+}
+
 static int bcread_header(LexState *ls)
 {
   uint32_t flags;
@@ -427,7 +660,11 @@ GCproto *lj_bcread(LexState *ls)
   /* Check for a valid bytecode dump header. */
   if (!bcread_header(ls))
     bcread_error(ls, LJ_ERR_BCFMT);
-  for (;;) {  /* Process all prototypes in the bytecode dump. */
+  if (ls->persist) {  /* Decode the grandchildren of the chunk lazily. */
+    setprotoV(L, L->top, bcread_lazy(ls, ls->pe, 0, 1));
+    incr_top(L);
+    if (ls->p < ls->pe && ls->p[0] == 0) ls->p++;  /* Skip EOF. */
+  } else for (;;) {  /* Process all prototypes in the bytecode dump. */
     GCproto *pt;
     MSize len;
     const char *startp;
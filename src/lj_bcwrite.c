@@ -18,6 +18,7 @@
 #include "lj_jit.h"
 #endif
 #include "lj_strfmt.h"
+#include "lj_debug.h"
 #include "lj_bcdump.h"
 #include "lj_vm.h"
 
@@ -316,6 +317,24 @@ static char *bcwrite_bytecode(BCWriteCtx *ctx, char *p, GCproto *pt)
   return p;
 }
 
+/* Get size of the debug info. */
+static MSize bcwrite_sizedbg(GCproto *pt)
+{
+  const char *lineinfo = (const char *)proto_lineinfo(pt);
+  const char *p;
+  if (lineinfo >= (char *)pt && lineinfo < (char *)pt + pt->sizept)
+    return pt->sizept - (MSize)(lineinfo - (char *)pt);  /* Colocated. */
+  /* Referenced in place from persistent input: find the end of varinfo. */
+  p = (const char *)proto_varinfo(pt);
+  while (*(const uint8_t *)p != VARNAME_END) {
+    if (*(const uint8_t *)p++ >= VARNAME__MAX)
+      while (*p++) ;  /* Skip over variable name. */
+    lj_buf_ruleb128(&p);
+    lj_buf_ruleb128(&p);
+  }
+  return (MSize)(p + 1 - lineinfo);
+}
+
 /* Write prototype. */
 static void bcwrite_proto(BCWriteCtx *ctx, GCproto *pt)
 {
@@ -328,8 +347,12 @@ static void bcwrite_proto(BCWriteCtx *ctx, GCproto *pt)
     GCRef *kr = mref(pt->k, GCRef) - 1;
     for (i = 0; i < n; i++, kr--) {
       GCobj *o = gcref(*kr);
-      if (o->gch.gct == ~LJ_TPROTO)
-	bcwrite_proto(ctx, gco2pt(o));
+      if (o->gch.gct == ~LJ_TPROTO) {
+	GCproto *cpt = gco2pt(o);
+	if (proto_islazy(cpt))
+	  cpt = lj_bcread_lazy(sbufL(&ctx->sb), pt, cpt);
+	bcwrite_proto(ctx, cpt);
+      }
     }
   }
 
@@ -348,7 +371,7 @@ static void bcwrite_proto(BCWriteCtx *ctx, GCproto *pt)
   p = lj_strfmt_wuleb128(p, pt->sizebc-1);
   if (!(ctx->flags & BCDUMP_F_STRIP)) {
     if (proto_lineinfo(pt))
-      sizedbg = pt->sizept - (MSize)((char *)proto_lineinfo(pt) - (char *)pt);
+      sizedbg = bcwrite_sizedbg(pt);
     p = lj_strfmt_wuleb128(p, sizedbg);
     if (sizedbg) {
       p = lj_strfmt_wuleb128(p, pt->firstline);
@@ -13,6 +13,7 @@
 #include "lj_state.h"
 #include "lj_frame.h"
 #include "lj_ctype.h"
+#include "lj_cdata.h"
 #include "lj_cconv.h"
 #include "lj_ccall.h"
 #include "lj_ccallback.h"
@@ -613,6 +614,108 @@ void lj_ccallback_mcode_free(CTState *cts)
 #error "Missing calling convention definitions for this architecture"
 #endif
 
+/* Cached argument conversions. */
+enum {
+  CBCONV_GENERIC,	/* Generic conversion with lj_cconv_tv_ct(). */
+  CBCONV_INT,		/* Signed integer up to 32 bits. */
+  CBCONV_UINT,		/* Unsigned integer up to 32 bits. */
+  CBCONV_NUM,		/* double. */
+  CBCONV_FLOAT,		/* float. */
+  CBCONV_BOOL,		/* bool. */
+  CBCONV_BOX		/* Boxed value, e.g. pointer or 64 bit integer. */
+};
+
+#define CBCONV_STACK	0x8000	/* Offset is relative to the stack. */
+
+/* Get cached signature or an entry to fill in for a callback type. */
+static CCallbackSig *callback_sig(CTState *cts, CTypeID id, int *hit)
+{
+  CCallbackSig *sig = cts->cb.sig;
+  if (LJ_UNLIKELY(!sig)) {
+    sig = lj_mem_newvec(cts->L, CCALLBACK_NSIG, CCallbackSig);
+    memset(sig, 0, CCALLBACK_NSIG*sizeof(CCallbackSig));
+    cts->cb.sig = sig;
+  }
+  sig += (id & (CCALLBACK_NSIG-1));
+  *hit = (sig->id == id);
+  return sig;
+}
+
+/* Record the conversion of an argument for the signature cache. */
+static void callback_sig_arg(CTState *cts, CCallbackArg *ca, CType *cta,
+			     uint8_t *sp, intptr_t *stack)
+{
+  CTInfo info = cta->info;
+  ptrdiff_t ofs = sp - (uint8_t *)&cts->cb;
+  if (ofs >= 0 && ofs < (ptrdiff_t)sizeof(CCallback))
+    ca->ofs = (uint16_t)ofs;
+  else
+    ca->ofs = (uint16_t)((sp - (uint8_t *)stack) | CBCONV_STACK);
+  ca->size = (uint8_t)cta->size;
+  ca->id = (CTypeID1)ctype_typeid(cts, cta);
+  if (ctype_isbool(info))
+    ca->conv = CBCONV_BOOL;
+  else if (ctype_isfp(info))
+    ca->conv = cta->size == sizeof(double) ? CBCONV_NUM : CBCONV_FLOAT;
+  else if (ctype_isinteger(info) && cta->size <= 4)
+    ca->conv = (info & CTF_UNSIGNED) ? CBCONV_UINT : CBCONV_INT;
+  else if (ctype_isptr(info) || ctype_isinteger(info))
+    ca->conv = CBCONV_BOX;
+  else
+    ca->conv = CBCONV_GENERIC;
+}
+
+/* Convert callback arguments with a cached signature. */
+static int callback_conv_sig(CTState *cts, CCallbackSig *sig, TValue *o,
+			     intptr_t *stack)
+{
+  CCallbackArg *ca = sig->arg, *cae = ca + sig->narg;
+  int gcsteps = 0;
+  for (; ca < cae; ca++, o++) {
+    uint8_t *sp = (ca->ofs & CBCONV_STACK) ?
+		  (uint8_t *)stack + (ca->ofs & ~CBCONV_STACK) :
+		  (uint8_t *)&cts->cb + ca->ofs;
+    switch (ca->conv) {
+    case CBCONV_INT:
+      setintV(o, ca->size == 1 ? (int32_t)*(int8_t *)sp :
+		 ca->size == 2 ? (int32_t)*(int16_t *)sp : *(int32_t *)sp);
+      break;
+    case CBCONV_UINT: {
+      uint32_t u = ca->size == 1 ? (uint32_t)*(uint8_t *)sp :
+		   ca->size == 2 ? (uint32_t)*(uint16_t *)sp : *(uint32_t *)sp;
+      if (LJ_DUALNUM && (int32_t)u >= 0)
+	setintV(o, (int32_t)u);
+      else
+	setnumV(o, (lua_Number)u);
+      break;
+      }
+    case CBCONV_NUM:
+      memcpy(&o->n, sp, sizeof(double));
+      break;
+    case CBCONV_FLOAT:
+      setnumV(o, (lua_Number)*(float *)sp);
+      break;
+    case CBCONV_BOOL: {
+      uint32_t b = ca->size == 1 ? (*sp != 0) : (*(int *)sp != 0);
+      setboolV(o, b);
+      setboolV(&cts->g->tmptv2, b);  /* Remember for trace recorder. */
+      break;
+      }
+    case CBCONV_BOX: {
+      GCcdata *cd = lj_cdata_new(cts, ca->id, ca->size);
+      setcdataV(cts->L, o, cd);
+      memcpy(cdataptr(cd), sp, ca->size);
+      gcsteps++;
+      break;
+      }
+    default:
+      gcsteps += lj_cconv_tv_ct(cts, ctype_get(cts, ca->id), 0, o, sp);
+      break;
+    }
+  }
+  return gcsteps;
+}
+
 /* Convert and push callback arguments to Lua stack. */
 static void callback_conv_args(CTState *cts, lua_State *L)
 {
@@ -620,8 +723,9 @@ static void callback_conv_args(CTState *cts, lua_State *L)
   intptr_t *stack = cts->cb.stack;
   MSize slot = cts->cb.slot;
   CTypeID id = 0, rid, fid;
-  int gcsteps = 0;
+  int gcsteps = 0, hit;
   CType *ct;
+  CCallbackSig *sig;
   GCfunc *fn;
   int fntp;
   MSize ngpr = 0, nsp = 0, maxgpr = CCALL_NARG_GPR;
@@ -672,6 +776,15 @@ static void callback_conv_args(CTState *cts, lua_State *L)
   }
 #endif
 
+  sig = callback_sig(cts, id, &hit);
+  if (LJ_LIKELY(hit)) {
+    gcsteps = callback_conv_sig(cts, sig, o, stack);
+    o += sig->narg;
+    nsp = sig->nsp;
+    goto convdone;
+  }
+  sig->id = 0;  /* Fill in entry while converting the arguments. */
+  sig->narg = 0;
   fid = ct->sib;
   while (fid) {
     CType *ctf = ctype_get(cts, fid);
@@ -702,10 +815,14 @@ static void callback_conv_args(CTState *cts, lua_State *L)
 #endif
 	 )
 	sp = (void *)((uint8_t *)sp + CTSIZE_PTR-cta->size);
+      callback_sig_arg(cts, &sig->arg[sig->narg++], cta, sp, stack);
       gcsteps += lj_cconv_tv_ct(cts, cta, 0, o++, sp);
     }
     fid = ctf->sib;
   }
+  sig->id = (CTypeID1)id;
+  sig->nsp = (uint8_t)nsp;
+convdone:
   L->top = o;
 #if LJ_TARGET_X86
   /* Store stack adjustment for returns from non-cdecl callbacks. */
@@ -734,6 +851,7 @@ static void callback_conv_result(CTState *cts, lua_State *L, TValue *o)
 #endif
   if (!ctype_isvoid(ctr->info)) {
     uint8_t *dp = (uint8_t *)&cts->cb.gpr[0];
+    int32_t i;
 #if CCALL_NUM_FPR
     if (ctype_isfp(ctr->info))
       dp = (uint8_t *)&cts->cb.fpr[0];
@@ -742,7 +860,18 @@ static void callback_conv_result(CTState *cts, lua_State *L, TValue *o)
     if (ctype_isfp(ctr->info) && ctr->size == sizeof(float))
       dp = (uint8_t *)&cts->cb.fpr[0].f[1];
 #endif
-    lj_cconv_ct_tv(cts, ctr, dp, o, 0);
+    /* Fast paths for common results. Same results as the generic code. */
+    if (ctype_isinteger(ctr->info) && ctr->size == 4 && tvisint(o)) {
+      *(int32_t *)dp = intV(o);
+    } else if (ctype_isinteger(ctr->info) && ctr->size == 4 && tvisnum(o) &&
+	       (lua_Number)(i = lj_num2int(numV(o))) == numV(o)) {
+      *(int32_t *)dp = i;
+    } else if (ctype_isfp(ctr->info) && ctr->size == sizeof(double) &&
+	       tvisnum(o)) {
+      *(double *)dp = numV(o);
+    } else {
+      lj_cconv_ct_tv(cts, ctr, dp, o, 0);
+    }
 #ifdef CALLBACK_HANDLE_RET
     CALLBACK_HANDLE_RET
 #endif
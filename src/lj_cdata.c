@@ -80,7 +80,16 @@ void LJ_FASTCALL lj_cdata_free(global_State *g, GCcdata *cd)
     CTSize sz = ctype_hassize(ct->info) ? ct->size : CTSIZE_PTR;
     lj_assertG(ctype_hassize(ct->info) || ctype_isfunc(ct->info) ||
 	       ctype_isextern(ct->info), "free of ctype without a size");
-    lj_mem_free(g, cd, sizeof(GCcdata) + sz);
+    if (sizeof(GCcdata) + sz == LJ_GC_CDSMALL &&
+	g->gc.cdfreenum < LJ_MAX_CDFREE) {
+      /* Keep boxed 64 bit scalars around for the next allocation. */
+      setgcrefr(cd->nextgc, g->gc.cdfree);
+      setgcref(g->gc.cdfree, obj2gco(cd));
+      g->gc.cdfreenum++;
+      g->gc.total -= LJ_GC_CDSMALL;
+    } else {
+      lj_mem_free(g, cd, sizeof(GCcdata) + sz);
+    }
 #ifdef COUNTS
     g->gc.cdatanum--;
 #endif
@@ -111,6 +120,174 @@ void lj_cdata_setfin(lua_State *L, GCcdata *cd, GCobj *obj, uint32_t it)
   }
 }
 
+/* -- C data pools -------------------------------------------------------- */
+
+/* Header of a pool chunk. The slots follow, suitably aligned. */
+typedef struct CPoolChunk {
+  struct CPoolChunk *next;	/* Next chunk. */
+  GCSize sz;			/* Allocated size of this chunk. */
+} CPoolChunk;
+
+/* Initialize a pool for elements of a fixed-size C type. */
+void lj_cdata_pool_init(CTState *cts, CPool *cp, CTypeID id,
+			CTSize sz, CTInfo info)
+{
+  CTSize align = ctype_align(info), esize;
+  if (align < ctype_align(CTALIGN_PTR))  /* Room for the free link. */
+    align = ctype_align(CTALIGN_PTR);
+  esize = sz < CTSIZE_PTR ? CTSIZE_PTR : sz;
+  esize = (esize + (1u << align) - 1) & ~((1u << align) - 1);
+  cp->free = NULL;
+  cp->chunk = NULL;
+  cp->id = id;
+  cp->pid = lj_ctype_intern(cts, CTINFO(CT_PTR, CTALIGN_PTR|id), CTSIZE_PTR);
+  cp->size = sz;
+  cp->esize = esize;
+  cp->align = align;
+  cp->n = 0;
+}
+
+/* Add a chunk to an exhausted pool and return its first slot. */
+void *lj_cdata_pool_grow(lua_State *L, CPool *cp)
+{
+  uintptr_t amask = ((uintptr_t)1 << cp->align) - 1;
+  GCSize sz = (GCSize)(sizeof(CPoolChunk) + amask + (GCSize)cp->n*cp->esize);
+  CPoolChunk *c = (CPoolChunk *)lj_mem_new(L, sz);
+  char *p = (char *)(((uintptr_t)(c+1) + amask) & ~amask);
+  MSize i;
+  c->next = (CPoolChunk *)cp->chunk;
+  c->sz = sz;
+  cp->chunk = c;
+  for (i = cp->n-1; i > 0; i--) {  /* Hand out low addresses first. */
+    void *s = p + i*cp->esize;
+    *(void **)s = cp->free;
+    cp->free = s;
+  }
+  return p;
+}
+
+/* Free all chunks of a pool. Outstanding pointers become invalid. */
+void lj_cdata_pool_release(global_State *g, CPool *cp)
+{
+  CPoolChunk *c = (CPoolChunk *)cp->chunk;
+  while (c) {
+    CPoolChunk *next = c->next;
+    lj_mem_free(g, c, c->sz);
+    c = next;
+  }
+  cp->chunk = NULL;
+  cp->free = NULL;
+}
+
+/* -- Bulk conversions ---------------------------------------------------- */
+
+/* Convert n elements of C type id at sp to a new Lua table. */
+GCtab *lj_cdata_totab(lua_State *L, CTypeID id, uint8_t *sp, MSize n)
+{
+  CTState *cts = ctype_cts(L);
+  CType *s = ctype_raw(cts, id);
+  CTInfo info = s->info;
+  CTSize esize = s->size;
+  GCtab *t = lj_tab_new_ah(L, (int32_t)n, 0);
+  TValue *o;
+  MSize i;
+  if (n == 0) return t;
+  o = tvref(t->array) + 1;
+  /* Numbers are NOT canonicalized here, just like in lj_cconv_tv_ct(). */
+  if (ctype_isfp(info) && esize == sizeof(double)) {
+    const double *p = (const double *)sp;
+    for (i = 0; i < n; i++) setnumV(&o[i], p[i]);
+  } else if (ctype_isfp(info) && esize == sizeof(float)) {
+    const float *p = (const float *)sp;
+    for (i = 0; i < n; i++) setnumV(&o[i], (lua_Number)p[i]);
+  } else if (ctype_isinteger(info) && esize == 4 && !(info & CTF_UNSIGNED)) {
+    const int32_t *p = (const int32_t *)sp;
+    for (i = 0; i < n; i++) setintV(&o[i], p[i]);
+  } else if (ctype_isinteger(info) && esize == 4 && !LJ_DUALNUM) {
+    const uint32_t *p = (const uint32_t *)sp;
+    for (i = 0; i < n; i++) setnumV(&o[i], (lua_Number)p[i]);
+  } else if (ctype_isinteger(info) && esize == 2) {
+    if ((info & CTF_UNSIGNED)) {
+      const uint16_t *p = (const uint16_t *)sp;
+      for (i = 0; i < n; i++) setintV(&o[i], p[i]);
+    } else {
+      const int16_t *p = (const int16_t *)sp;
+      for (i = 0; i < n; i++) setintV(&o[i], p[i]);
+    }
+  } else if (ctype_isinteger(info) && esize == 1) {
+    if ((info & CTF_UNSIGNED)) {
+      const uint8_t *p = (const uint8_t *)sp;
+      for (i = 0; i < n; i++) setintV(&o[i], p[i]);
+    } else {
+      const int8_t *p = (const int8_t *)sp;
+      for (i = 0; i < n; i++) setintV(&o[i], p[i]);
+    }
+  } else {
+    CTypeID sid = ctype_typeid(cts, s);
+    for (i = 0; i < n; i++, sp += esize)
+      lj_cconv_tv_ct(cts, s, sid, &o[i], sp);
+  }
+  return t;
+}
+
+/* Convert the elements of a Lua table to n elements of C type id at dp.
+** Elements beyond the length of the table are zero-filled.
+*/
+void lj_cdata_fromtab(lua_State *L, CTypeID id, uint8_t *dp, GCtab *t,
+		      MSize n)
+{
+  CTState *cts = ctype_cts(L);
+  CType *d = ctype_raw(cts, id);
+  CTInfo info = d->info;
+  CTSize esize = d->size;
+  MSize m = lj_tab_len(t), i;
+  if (m > n) m = n;
+  if (m < t->asize) {  /* Dense: read the array part directly. */
+    TValue *o = tvref(t->array) + 1;
+    if (ctype_isfp(info) && esize == sizeof(double)) {
+      double *p = (double *)dp;
+      int other = 0;
+      for (i = 0; i < m; i++) other |= !tvisnum(&o[i]);
+      if (LJ_LIKELY(!other)) {  /* Only numbers: a plain copy. */
+	for (i = 0; i < m; i++) p[i] = o[i].n;
+      } else {
+	for (i = 0; i < m; i++) {
+	  if (tvisnumber(&o[i]))
+	    p[i] = numberVnum(&o[i]);
+	  else
+	    lj_cconv_ct_tv(cts, d, (uint8_t *)&p[i], &o[i], 0);
+	}
+      }
+    } else if (ctype_isfp(info) && esize == sizeof(float)) {
+      float *p = (float *)dp;
+      for (i = 0; i < m; i++) {
+	if (LJ_LIKELY(tvisnumber(&o[i])))
+	  p[i] = (float)numberVnum(&o[i]);
+	else
+	  lj_cconv_ct_tv(cts, d, (uint8_t *)&p[i], &o[i], 0);
+      }
+    } else if (ctype_isinteger(info) && esize == 4 && !(info & CTF_UNSIGNED)) {
+      int32_t *p = (int32_t *)dp;
+      for (i = 0; i < m; i++) {
+	if (LJ_LIKELY(tvisnumber(&o[i])))
+	  p[i] = (int32_t)numberVnum(&o[i]);  /* Same as lj_cconv_ct_ct(). */
+	else
+	  lj_cconv_ct_tv(cts, d, (uint8_t *)&p[i], &o[i], 0);
+      }
+    } else {
+      for (i = 0; i < m; i++)
+	lj_cconv_ct_tv(cts, d, dp + i*esize, &o[i], 0);
+    }
+  } else {
+    for (i = 0; i < m; i++) {
+      cTValue *o = lj_tab_getint(t, (int32_t)(i+1));
+      lj_cconv_ct_tv(cts, d, dp + i*esize, (TValue *)(o ? o : niltv(L)), 0);
+    }
+  }
+  if (m < n)
+    memset(dp + m*esize, 0, (n-m)*esize);
+}
+
 /* -- C data indexing ----------------------------------------------------- */
 
 /* Index C data by a TValue. Return CType and pointer. */
@@ -64,6 +64,18 @@ static LJ_AINLINE GCcdata *lj_cdata_new_(lua_State *L, CTypeID id, CTSize sz)
   return cd;
 }
 
+/* Pool of fixed-size C data slots. The chunks are invisible to the GC. */
+typedef struct CPool {
+  void *free;		/* Free slots, linked through their first word. */
+  void *chunk;		/* List of allocated chunks. */
+  CTypeID id;		/* Element type. */
+  CTypeID pid;		/* Pointer to element type. */
+  CTSize size;		/* Element size. */
+  CTSize esize;		/* Slot size. */
+  CTSize align;		/* Log2 of slot alignment. */
+  MSize n;		/* Number of slots per chunk. */
+} CPool;
+
 LJ_FUNC GCcdata *lj_cdata_newref(CTState *cts, const void *pp, CTypeID id);
 LJ_FUNC GCcdata *lj_cdata_newv(lua_State *L, CTypeID id, CTSize sz,
 			       CTSize align);
@@ -74,6 +86,15 @@ LJ_FUNC void LJ_FASTCALL lj_cdata_free(global_State *g, GCcdata *cd);
 LJ_FUNC void lj_cdata_setfin(lua_State *L, GCcdata *cd, GCobj *obj,
 			     uint32_t it);
 
+LJ_FUNC void lj_cdata_pool_init(CTState *cts, CPool *cp, CTypeID id,
+				CTSize sz, CTInfo info);
+LJ_FUNC void *lj_cdata_pool_grow(lua_State *L, CPool *cp);
+LJ_FUNC void lj_cdata_pool_release(global_State *g, CPool *cp);
+
+LJ_FUNC GCtab *lj_cdata_totab(lua_State *L, CTypeID id, uint8_t *sp, MSize n);
+LJ_FUNC void lj_cdata_fromtab(lua_State *L, CTypeID id, uint8_t *dp, GCtab *t,
+			      MSize n);
+
 LJ_FUNC CType *lj_cdata_index(CTState *cts, GCcdata *cd, cTValue *key,
 			      uint8_t **pp, CTInfo *qual);
 LJ_FUNC int lj_cdata_get(CTState *cts, CType *s, TValue *o, uint8_t *sp);
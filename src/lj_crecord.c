@@ -145,37 +145,57 @@ typedef struct CRecMemList {
   TRef trval;		/* TRef of load value. */
 } CRecMemList;
 
-/* Generate copy list for element-wise struct copy. */
-static MSize crec_copy_struct(CRecMemList *ml, CTState *cts, CType *ct)
+/* Add the scalar members of an aggregate to the copy list. */
+static int crec_copy_members(CRecMemList *ml, MSize *mlp, CTState *cts,
+			     CType *ct, CTSize ofs)
 {
-  CTypeID fid = ct->sib;
-  MSize mlp = 0;
-  while (fid) {
-    CType *df = ctype_get(cts, fid);
-    fid = df->sib;
-    if (ctype_isfield(df->info)) {
-      CType *cct;
-      IRType tp;
-      if (!gcref(df->name)) continue;  /* Ignore unnamed fields. */
-      cct = ctype_rawchild(cts, df);  /* Field type. */
-      tp = crec_ct2irt(cts, cct);
-      if (tp == IRT_CDATA) return 0;  /* NYI: aggregates. */
-      if (mlp >= CREC_COPY_MAXUNROLL) return 0;
-      ml[mlp].ofs = df->size;
-      ml[mlp].tp = tp;
-      mlp++;
-      if (ctype_iscomplex(cct->info)) {
-	if (mlp >= CREC_COPY_MAXUNROLL) return 0;
-	ml[mlp].ofs = df->size + (cct->size >> 1);
-	ml[mlp].tp = tp;
-	mlp++;
+  if (ctype_isstruct(ct->info)) {
+    CTypeID fid = ct->sib;
+    if ((ct->info & CTF_UNION)) return 0;  /* NYI: unions. */
+    while (fid) {
+      CType *df = ctype_get(cts, fid);
+      fid = df->sib;
+      if (ctype_isfield(df->info)) {
+	if (!gcref(df->name)) continue;  /* Ignore unnamed fields. */
+      } else if (!ctype_isxattrib(df->info, CTA_SUBTYPE)) {
+	if (ctype_isconstval(df->info)) continue;
+	return 0;  /* NYI: bitfields. */
       }
-    } else if (!ctype_isconstval(df->info)) {
-      /* NYI: bitfields and sub-structures. */
+      if (!crec_copy_members(ml, mlp, cts, ctype_rawchild(cts, df),
+			     ofs + df->size))
+	return 0;
+    }
+  } else if (ctype_isrefarray(ct->info) && !(ct->info & CTF_VLA)) {
+    CType *cct = ctype_rawchild(cts, ct);
+    CTSize i;
+    if (cct->size == 0 || ct->size == CTSIZE_INVALID) return 0;
+    for (i = 0; i < ct->size; i += cct->size)
+      if (!crec_copy_members(ml, mlp, cts, cct, ofs + i))
+	return 0;
+  } else {
+    IRType tp = crec_ct2irt(cts, ct);
+    MSize n = *mlp;
+    if (tp == IRT_CDATA) return 0;  /* NYI: vectors and >64 bit integers. */
+    if (n + (ctype_iscomplex(ct->info) ? 2 : 1) > CREC_COPY_MAXUNROLL)
       return 0;
+    ml[n].ofs = ofs;
+    ml[n].tp = tp;
+    n++;
+    if (ctype_iscomplex(ct->info)) {
+      ml[n].ofs = ofs + (ct->size >> 1);
+      ml[n].tp = tp;
+      n++;
     }
+    *mlp = n;
   }
-  return mlp;
+  return 1;
+}
+
+/* Generate copy list for element-wise struct or array copy. */
+static MSize crec_copy_struct(CRecMemList *ml, CTState *cts, CType *ct)
+{
+  MSize mlp = 0;
+  return crec_copy_members(ml, &mlp, cts, ct, 0) ? mlp : 0;
 }
 
 /* Generate unrolled copy list, from highest to lowest step size/alignment. */
@@ -243,15 +263,17 @@ static void crec_copy(jit_State *J, TRef trdst, TRef trsrc, TRef trlen,
       if (ctype_isarray(ct->info)) {
 	CType *cct = ctype_rawchild(cts, ct);
 	tp = crec_ct2irt(cts, cct);
-	if (tp == IRT_CDATA) goto rawcopy;
+	if (tp == IRT_CDATA) goto membercopy;
 	step = lj_ir_type_size[tp];
 	lj_assertJ((len & (step-1)) == 0, "copy of fractional size");
-      } else if ((ct->info & CTF_UNION)) {
-	step = (1u << ctype_align(ct->info));
-	goto rawcopy;
       } else {
+      membercopy:
 	mlp = crec_copy_struct(ml, cts, ct);
-	goto emitcopy;
+	if (mlp) goto emitcopy;
+	/* Otherwise copy unions, bitfields etc. with raw loads/stores. */
+	tp = IRT_CDATA;
+	step = (1u << ctype_align(ct->info));
+	goto rawcopy;
       }
     } else {
     rawcopy:
@@ -586,8 +608,15 @@ static TRef crec_tv_ct(jit_State *J, CType *s, CTypeID sid, TRef sp)
     ptr = emitir(IRT(IR_ADD, IRT_PTR), dp, lj_ir_kintp(J, sizeof(GCcdata)+esz));
     emitir(IRT(IR_XSTORE, t), ptr, tr2);
     return dp;
+  } else if (ctype_isvector(sinfo) && s->size <= CREC_COPY_MAXLEN) {
+    TRef dp = emitir(IRTG(IR_CNEW, IRT_CDATA), lj_ir_kint(J, sid),
+		     ctype_align(sinfo) > CT_MEMALIGN ?
+		     lj_ir_kint(J, (int32_t)s->size) : TREF_NIL);
+    TRef ptr = emitir(IRT(IR_ADD, IRT_PTR), dp,
+		      lj_ir_kintp(J, sizeof(GCcdata)));
+    crec_copy(J, ptr, sp, lj_ir_kint(J, (int32_t)s->size), s);
+    return dp;
   } else {
-    /* NYI: copyval of vectors. */
   err_nyi:
     lj_trace_err(J, LJ_TRERR_NYICONV);
   }
@@ -954,6 +983,63 @@ static void crec_finalizer(jit_State *J, TRef trcd, TRef trfin, cTValue *fin)
   J->needsnap = 1;
 }
 
+/* Store struct initializers into zero-filled memory. */
+static void crec_init_struct(jit_State *J, RecordFFData *rd, CType *d,
+			     TRef trcd, CTSize ofs, MSize *ip)
+{
+  CTState *cts = ctype_ctsG(J2G(J));
+  CTypeID fid = d->sib;
+  while (fid) {
+    CType *df = ctype_get(cts, fid);
+    fid = df->sib;
+    if (ctype_isfield(df->info) || ctype_isbitfield(df->info)) {
+      MSize i = *ip;
+      TRef dp;
+      if (!gcref(df->name)) continue;  /* Ignore unnamed fields. */
+      if (!J->base[i]) break;
+      if (ctype_isbitfield(df->info))
+	lj_trace_err(J, LJ_TRERR_NYICONV);  /* NYI: init bitfields. */
+      *ip = i + 1;
+      dp = emitir(IRT(IR_ADD, IRT_PTR), trcd,
+		  lj_ir_kintp(J, ofs + df->size + sizeof(GCcdata)));
+      crec_ct_tv(J, ctype_rawchild(cts, df), dp, J->base[i], &rd->argv[i]);
+      if ((d->info & CTF_UNION)) break;
+    } else if (ctype_isxattrib(df->info, CTA_SUBTYPE)) {
+      crec_init_struct(J, rd, ctype_rawchild(cts, df), trcd,
+		       ofs + df->size, ip);
+      if ((d->info & CTF_UNION)) break;
+    }
+  }
+}
+
+/* Store array or struct initializers into zero-filled memory. */
+static void crec_init_filled(jit_State *J, RecordFFData *rd, CType *d,
+			     TRef trcd, CTSize sz, MSize i)
+{
+  CTState *cts = ctype_ctsG(J2G(J));
+  if (ctype_isstruct(d->info)) {
+    crec_init_struct(J, rd, d, trcd, 0, &i);
+    if (J->base[i])
+      lj_trace_err(J, LJ_TRERR_NYICONV);  /* Too many initializers. */
+  } else if (!J->base[i+1]) {  /* A single initializer is replicated. */
+    cTValue *o = &rd->argv[i];
+    if (!lj_cconv_multi_init(cts, d, &rd->argv[i]) || !tref_isk(J->base[i]) ||
+	!(tvisint(o) ? intV(o) == 0 : (tvisnum(o) && o->u64 == 0)))
+      lj_trace_err(J, LJ_TRERR_NYICONV);  /* NYI: replicate non-zero. */
+  } else {
+    CType *dc = ctype_rawchild(cts, d);  /* Array element type. */
+    CTSize ofs;
+    for (ofs = 0; J->base[i]; i++, ofs += dc->size) {
+      TRef dp;
+      if (ofs + dc->size > sz)
+	lj_trace_err(J, LJ_TRERR_NYICONV);  /* Too many initializers. */
+      dp = emitir(IRT(IR_ADD, IRT_PTR), trcd,
+		  lj_ir_kintp(J, ofs + sizeof(GCcdata)));
+      crec_ct_tv(J, dc, dp, J->base[i], &rd->argv[i]);
+    }
+  }
+}
+
 /* Record cdata allocation. */
 static void crec_alloc(jit_State *J, RecordFFData *rd, CTypeID id)
 {
@@ -973,35 +1059,43 @@ static void crec_alloc(jit_State *J, RecordFFData *rd, CTypeID id)
     return;
   } else {
     TRef trsz = TREF_NIL;
+    MSize i0 = 1;  /* Index of first initializer. */
     if ((info & CTF_VLA)) {  /* Calculate VLA/VLS size at runtime. */
       CTSize sz0, sz1;
-      if (!J->base[1] || J->base[2])
-	lj_trace_err(J, LJ_TRERR_NYICONV);  /* NYI: init VLA/VLS. */
-      trsz = crec_ct_tv(J, ctype_get(cts, CTID_INT32), 0,
-			J->base[1], &rd->argv[1]);
+      TRef trn;
+      if (!J->base[1] || (J->base[2] && !ctype_isarray(d->info)))
+	lj_trace_err(J, LJ_TRERR_NYICONV);  /* NYI: init VLS. */
+      trn = crec_ct_tv(J, ctype_get(cts, CTID_INT32), 0,
+		       J->base[1], &rd->argv[1]);
+      if (J->base[2] && J->base[3]) {  /* Check number of initializers. */
+	MSize n = 3;
+	while (J->base[n]) n++;
+	emitir(IRTGI(IR_GE), trn, lj_ir_kint(J, (int32_t)(n-2)));
+      }
       sz0 = lj_ctype_vlsize(cts, d, 0);
       sz1 = lj_ctype_vlsize(cts, d, 1);
-      trsz = emitir(IRTGI(IR_MULOV), trsz, lj_ir_kint(J, (int32_t)(sz1-sz0)));
+      trsz = emitir(IRTGI(IR_MULOV), trn, lj_ir_kint(J, (int32_t)(sz1-sz0)));
       trsz = emitir(IRTGI(IR_ADDOV), trsz, lj_ir_kint(J, (int32_t)sz0));
-      J->base[1] = 0;  /* Simplify logic below. */
+      i0 = 2;
     } else if (ctype_align(info) > CT_MEMALIGN) {
       trsz = lj_ir_kint(J, sz);
     }
     trcd = emitir(IRTG(IR_CNEW, IRT_CDATA), trid, trsz);
-    if (sz > 128 || (info & CTF_VLA)) {
+    if (i0 == 1 && J->base[1] && !J->base[2] &&
+	!lj_cconv_multi_init(cts, d, &rd->argv[1])) {
+      goto single_init;
+    } else if (sz > 128 || (info & CTF_VLA)) {
       TRef dp;
       CTSize align;
-    special:  /* Only handle bulk zero-fill for large/VLA/VLS types. */
-      if (J->base[1])
-	lj_trace_err(J, LJ_TRERR_NYICONV);  /* NYI: init large/VLA/VLS types. */
+    special:  /* Bulk zero-fill, then store the initializers (if any). */
       dp = emitir(IRT(IR_ADD, IRT_PTR), trcd, lj_ir_kintp(J, sizeof(GCcdata)));
       if (trsz == TREF_NIL) trsz = lj_ir_kint(J, sz);
       align = ctype_align(info);
       if (align < CT_MEMALIGN) align = CT_MEMALIGN;
       crec_fill(J, dp, trsz, lj_ir_kint(J, 0), (1u << align));
-    } else if (J->base[1] && !J->base[2] &&
-	!lj_cconv_multi_init(cts, d, &rd->argv[1])) {
-      goto single_init;
+      if (J->base[i0])
+	crec_init_filled(J, rd, d, trcd, (info & CTF_VLA) ? ~(CTSize)0 : sz,
+			 i0);
     } else if (ctype_isarray(d->info)) {
       CType *dc = ctype_rawchild(cts, d);  /* Array element type. */
       CTSize ofs, esize = dc->size;
@@ -1028,21 +1122,22 @@ static void crec_alloc(jit_State *J, RecordFFData *rd, CTypeID id)
     } else if (ctype_isstruct(d->info)) {
       CTypeID fid;
       MSize i = 1;
-      if (!J->base[1]) {  /* Handle zero-fill of struct-of-NYI. */
-	fid = d->sib;
-	while (fid) {
-	  CType *df = ctype_get(cts, fid);
-	  fid = df->sib;
-	  if (ctype_isfield(df->info)) {
-	    CType *dc;
-	    if (!gcref(df->name)) continue;  /* Ignore unnamed fields. */
-	    dc = ctype_rawchild(cts, df);  /* Field type. */
-	    if (!(ctype_isnum(dc->info) || ctype_isptr(dc->info) ||
-		  ctype_isenum(dc->info)))
-	      goto special;
-	  } else if (!ctype_isconstval(df->info)) {
+      /* Use bulk zero-fill for aggregates, sub-structures, partial unions. */
+      fid = d->sib;
+      while (fid) {
+	CType *df = ctype_get(cts, fid);
+	fid = df->sib;
+	if (ctype_isfield(df->info)) {
+	  CType *dc;
+	  if (!gcref(df->name)) continue;  /* Ignore unnamed fields. */
+	  dc = ctype_rawchild(cts, df);  /* Field type. */
+	  if (!(ctype_isnum(dc->info) || ctype_isptr(dc->info) ||
+		ctype_isenum(dc->info)) ||
+	      ((d->info & CTF_UNION) && d->size != dc->size))
 	    goto special;
-	  }
+	  if ((d->info & CTF_UNION)) break;
+	} else if (!ctype_isconstval(df->info)) {
+	  goto special;
 	}
       }
       fid = d->sib;
@@ -1057,9 +1152,6 @@ static void crec_alloc(jit_State *J, RecordFFData *rd, CTypeID id)
 	  setintV(&tv, 0);
 	  if (!gcref(df->name)) continue;  /* Ignore unnamed fields. */
 	  dc = ctype_rawchild(cts, df);  /* Field type. */
-	  if (!(ctype_isnum(dc->info) || ctype_isptr(dc->info) ||
-		ctype_isenum(dc->info)))
-	    lj_trace_err(J, LJ_TRERR_NYICONV);  /* NYI: init aggregates. */
 	  if (J->base[i]) {
 	    sp = J->base[i];
 	    sval = &rd->argv[i];
@@ -1070,14 +1162,8 @@ static void crec_alloc(jit_State *J, RecordFFData *rd, CTypeID id)
 	  dp = emitir(IRT(IR_ADD, IRT_PTR), trcd,
 		      lj_ir_kintp(J, df->size + sizeof(GCcdata)));
 	  crec_ct_tv(J, dc, dp, sp, sval);
-	  if ((d->info & CTF_UNION)) {
-	    if (d->size != dc->size)  /* NYI: partial init of union. */
-	      lj_trace_err(J, LJ_TRERR_NYICONV);
+	  if ((d->info & CTF_UNION))
 	    break;
-	  }
-	} else if (!ctype_isconstval(df->info)) {
-	  /* NYI: init bitfields and sub-structures. */
-	  lj_trace_err(J, LJ_TRERR_NYICONV);
 	}
       }
     } else {
@@ -1100,6 +1186,113 @@ static void crec_alloc(jit_State *J, RecordFFData *rd, CTypeID id)
     crec_finalizer(J, trcd, 0, fin);
 }
 
+#if LJ_TARGET_X64 || (LJ_TARGET_ARM64 && LJ_LE)
+#define CREC_CALL_STRUCT	1
+
+/* Max. number of registers used for a struct passed by value. */
+#define CREC_STRUCT_MAXREG	4
+
+/*
+** Split a struct passed or returned by value into the register-sized
+** parts used by the calling convention. Returns the number of parts or 0
+** if NYI, e.g. for structs passed in memory. The flag is set if the parts
+** don't match the members, which disables alias analysis for them.
+*/
+static MSize crec_struct_regs(CTState *cts, CType *ct, CRecMemList *rl,
+			      int *pun)
+{
+  CRecMemList ml[CREC_COPY_MAXUNROLL];
+  CTSize sz = ct->size;
+  MSize i, n, mlp = 0;
+  if (sz == 0 || sz > 16 || (sz & 3) || ctype_align(ct->info) > 3 ||
+      !crec_copy_members(ml, &mlp, cts, ct, 0))
+    return 0;
+  for (i = 0; i < mlp; i++)  /* Reject packed structs. */
+    if ((ml[i].ofs & (lj_ir_type_size[ml[i].tp]-1)))
+      return 0;
+#if LJ_TARGET_ARM64
+  if (mlp >= 1 && mlp <= 4 &&
+      (ml[0].tp == IRT_NUM || ml[0].tp == IRT_FLOAT)) {
+    for (i = 1; i < mlp; i++)
+      if (ml[i].tp != ml[0].tp) break;
+    if (i == mlp) {  /* Homogeneous FP aggregate: one FPR per member. */
+      memcpy(rl, ml, mlp*sizeof(CRecMemList));
+      *pun = 0;
+      return mlp;
+    }
+  }
+#elif LJ_ABI_WIN
+  if (sz != 4 && sz != 8) return 0;
+#endif
+  /* Otherwise split into 8 byte parts (SSE or INTEGER class on x64). */
+  *pun = 0;
+  for (n = 0; n*8 < sz; n++) {
+    CTSize psz = sz - n*8 >= 8 ? 8 : 4;
+    MSize nm = 0, k = 0;
+#if LJ_TARGET_X64 && !LJ_ABI_WIN
+    int fp = 1;
+#else
+    int fp = 0;
+#endif
+    for (i = 0; i < mlp; i++)
+      if ((ml[i].ofs >> 3) == n) {
+	if (!(ml[i].tp == IRT_NUM || ml[i].tp == IRT_FLOAT)) fp = 0;
+	nm++; k = i;
+      }
+    rl[n].ofs = n*8;
+    /* A part holding a single member keeps its type, unless an FP member
+    ** goes in a GPR, e.g. for a non-HFA struct on ARM64 or on Win64.
+    */
+    if (nm == 1 && ml[k].ofs == n*8 && lj_ir_type_size[ml[k].tp] == psz &&
+	(fp || !(ml[k].tp == IRT_NUM || ml[k].tp == IRT_FLOAT))) {
+      rl[n].tp = ml[k].tp;
+    } else {
+      rl[n].tp = fp ? (psz == 8 ? IRT_NUM : IRT_FLOAT) :
+		      (psz == 8 ? IRT_U64 : IRT_U32);
+      *pun = 1;
+    }
+  }
+  return n;
+}
+
+/* Get the address of a struct argument passed by value. */
+static TRef crec_struct_ptr(jit_State *J, CType *d, TRef sp, cTValue *sval)
+{
+  CTState *cts = ctype_ctsG(J2G(J));
+  CType *s = ctype_raw(cts, argv2cdata(J, sp, sval)->ctypeid);
+  if (ctype_isref(s->info)) {
+    sp = emitir(IRT(IR_FLOAD, IRT_PTR), sp, IRFL_CDATA_PTR);
+    s = ctype_rawchild(cts, s);
+  } else {
+    sp = emitir(IRT(IR_ADD, IRT_PTR), sp, lj_ir_kintp(J, sizeof(GCcdata)));
+  }
+  if (s != d)
+    lj_trace_err(J, LJ_TRERR_NYICONV);
+  return sp;
+}
+
+/* Box a struct returned by value in one or two registers. */
+static TRef crec_struct_result(jit_State *J, CTypeID id, TRef tr,
+			       CRecMemList *rl, MSize nr, int pun)
+{
+  TRef trcd, ptr, trhi = 0;
+  if (nr > 1)  /* Must immediately follow the call. */
+    trhi = emitir(IRT(IR_HIOP, rl[1].tp), tr, tr);
+  trcd = emitir(IRTG(IR_CNEW, IRT_CDATA), lj_ir_kint(J, id), TREF_NIL);
+  ptr = emitir(IRT(IR_ADD, IRT_PTR), trcd,
+	       lj_ir_kintp(J, rl[0].ofs + sizeof(GCcdata)));
+  emitir(IRT(IR_XSTORE, rl[0].tp), ptr, tr);
+  if (trhi) {
+    ptr = emitir(IRT(IR_ADD, IRT_PTR), trcd,
+		 lj_ir_kintp(J, rl[1].ofs + sizeof(GCcdata)));
+    emitir(IRT(IR_XSTORE, rl[1].tp), ptr, trhi);
+  }
+  if (pun)
+    emitir(IRT(IR_XBAR, IRT_NIL), 0, 0);
+  return trcd;
+}
+#endif
+
 /* Record argument conversions. */
 static TRef crec_call_args(jit_State *J, RecordFFData *rd,
 			   CTState *cts, CType *ct)
@@ -1121,6 +1314,9 @@ static TRef crec_call_args(jit_State *J, RecordFFData *rd,
 #elif LJ_TARGET_ARM64 && LJ_TARGET_OSX
   int ngpr = CCALL_NARG_GPR;
 #endif
+#if CREC_CALL_STRUCT && !LJ_ABI_WIN
+  MSize sgpr = 0, sfpr = 0;  /* Number of argument registers used. */
+#endif
 
   /* Skip initial attributes. */
   fid = ct->sib;
@@ -1133,6 +1329,9 @@ static TRef crec_call_args(jit_State *J, RecordFFData *rd,
   for (n = 0, base = J->base+1, o = rd->argv+1; *base; n++, base++, o++) {
     CTypeID did;
     CType *d;
+#if CREC_CALL_STRUCT
+    int fixarg = (fid != 0);
+#endif
 
     if (n >= CCI_NARGS_MAX)
       lj_trace_err(J, LJ_TRERR_NYICALL);
@@ -1156,6 +1355,41 @@ static TRef crec_call_args(jit_State *J, RecordFFData *rd,
       did = lj_ccall_ctid_vararg(cts, o);  /* Infer vararg type. */
     }
     d = ctype_raw(cts, did);
+#if CREC_CALL_STRUCT
+    if (ctype_isstruct(d->info)) {  /* Struct passed by value. */
+      CRecMemList rl[CREC_STRUCT_MAXREG];
+      MSize k, ng = 0, nf = 0;
+      int pun;
+      MSize nr = crec_struct_regs(cts, d, rl, &pun);
+      if (!nr || !fixarg || n + nr > CCI_NARGS_MAX)
+	lj_trace_err(J, LJ_TRERR_NYICALL);
+      for (k = 0; k < nr; k++) {
+	if (rl[k].tp == IRT_NUM || rl[k].tp == IRT_FLOAT) nf++; else ng++;
+      }
+#if !LJ_ABI_WIN
+      /* NYI: structs passed on the stack. */
+      if (sgpr + ng > CCALL_NARG_GPR || sfpr + nf > CCALL_NARG_FPR)
+	lj_trace_err(J, LJ_TRERR_NYICALL);
+      sgpr += ng; sfpr += nf;
+#endif
+#if LJ_TARGET_ARM64 && LJ_TARGET_OSX
+      ngpr -= (int)ng;
+#endif
+      tr = crec_struct_ptr(J, d, *base, o);
+      if (pun)
+	emitir(IRT(IR_XBAR, IRT_NIL), 0, 0);
+      for (k = 0; k < nr; k++) {
+	TRef ptr = emitir(IRT(IR_ADD, IRT_PTR), tr,
+			  lj_ir_kintp(J, rl[k].ofs));
+	args[n+k] = emitir(IRT(IR_XLOAD, rl[k].tp), ptr, 0);
+      }
+      n += nr-1;
+      continue;
+    }
+#if !LJ_ABI_WIN
+    if (ctype_isfp(d->info)) sfpr++; else sgpr++;
+#endif
+#endif
     if (!(ctype_isnum(d->info) || ctype_isptr(d->info) ||
 	  ctype_isenum(d->info)))
       lj_trace_err(J, LJ_TRERR_NYICALL);
@@ -1258,6 +1492,11 @@ static int crec_call(jit_State *J, RecordFFData *rd, GCcdata *cd)
     IRType t = crec_ct2irt(cts, ctr);
     TRef tr;
     TValue tv;
+#if CREC_CALL_STRUCT
+    CRecMemList rl[CREC_STRUCT_MAXREG];
+    MSize nres = 0;
+    int pun = 0;
+#endif
     /* Check for blacklisted C functions that might call a callback. */
     tv.u64 = ((uintptr_t)cdata_getptr(cdataptr(cd), (LJ_64 && tp == IRT_P64) ? 8 : 4) >> 2) | U64x(800000000, 00000000);
     if (tvistrue(lj_tab_get(J->L, cts->miscmap, &tv)))
@@ -1265,6 +1504,13 @@ static int crec_call(jit_State *J, RecordFFData *rd, GCcdata *cd)
     if (ctype_isvoid(ctr->info)) {
       t = IRT_NIL;
       rd->nres = 0;
+#if CREC_CALL_STRUCT
+    } else if (ctype_isstruct(ctr->info)) {
+      nres = crec_struct_regs(cts, ctr, rl, &pun);
+      if (nres == 0 || nres > 2)  /* NYI: results in memory, large HFAs. */
+	lj_trace_err(J, LJ_TRERR_NYICALL);
+      t = rl[0].tp;
+#endif
     } else if (!(ctype_isnum(ctr->info) || ctype_isptr(ctr->info) ||
 		 ctype_isenum(ctr->info)) || t == IRT_CDATA) {
       lj_trace_err(J, LJ_TRERR_NYICALL);
@@ -1277,6 +1523,11 @@ static int crec_call(jit_State *J, RecordFFData *rd, GCcdata *cd)
       func = emitir(IRT(IR_CARG, IRT_NIL), func,
 		    lj_ir_kint(J, ctype_typeid(cts, ct)));
     tr = emitir(IRT(IR_CALLXS, t), crec_call_args(J, rd, cts, ct), func);
+#if CREC_CALL_STRUCT
+    if (nres) {
+      tr = crec_struct_result(J, ctype_cid(ct->info), tr, rl, nres, pun);
+    } else
+#endif
     if (ctype_isbool(ctr->info)) {
       if (frame_islua(J->L->base-1) && bc_b(frame_pc(J->L->base-1)[-1]) == 1) {
 	/* Don't check result if ignored. */
@@ -1789,6 +2040,138 @@ void LJ_FASTCALL recff_ffi_gc(jit_State *J, RecordFFData *rd)
   crec_finalizer(J, J->base[0], J->base[1], &rd->argv[1]);
 }
 
+void LJ_FASTCALL recff_ffi_totable(jit_State *J, RecordFFData *rd)
+{
+  CTState *cts = ctype_ctsG(J2G(J));
+  TRef tr = J->base[0], trn = J->base[1];
+  GCcdata *cd = argv2cdata(J, tr, &rd->argv[0]);
+  CType *ct = ctype_raw(cts, cd->ctypeid), *e;
+  CTypeID eid;
+  if (ctype_isref(ct->info))
+    ct = ctype_rawchild(cts, ct);
+  if (!(ctype_isptr(ct->info) || ctype_isrefarray(ct->info)))
+    lj_trace_err(J, LJ_TRERR_BADTYPE);  /* Interpreter will throw. */
+  eid = ctype_cid(ct->info);
+  e = ctype_raw(cts, eid);
+  if (e->size == CTSIZE_INVALID || ctype_isfunc(e->info))
+    lj_trace_err(J, LJ_TRERR_BADTYPE);
+  if (trn && !tref_isnil(trn)) {
+    trn = crec_toint(J, cts, trn, &rd->argv[1]);
+    emitir(IRTGI(IR_ULE), trn, lj_ir_kint(J, LJ_MAX_ASIZE-2));
+  } else if (ctype_isrefarray(ct->info) && !(ct->info & CTF_VLA) &&
+	     ct->size != CTSIZE_INVALID) {
+    trn = lj_ir_kint(J, e->size ? (int32_t)(ct->size / e->size) : 0);
+  } else {
+    lj_trace_err(J, LJ_TRERR_NYICONV);  /* NYI: length of VLA. */
+  }
+  tr = crec_ct_tv(J, ctype_get(cts, CTID_P_CVOID), 0, tr, &rd->argv[0]);
+  J->base[0] = lj_ir_call(J, IRCALL_lj_cdata_totab,
+			  lj_ir_kint(J, eid), tr, trn);
+  emitir(IRT(IR_XBAR, IRT_NIL), 0, 0);
+}
+
+void LJ_FASTCALL recff_ffi_fromtable(jit_State *J, RecordFFData *rd)
+{
+  CTState *cts = ctype_ctsG(J2G(J));
+  CTypeID id = argv2ctype(J, J->base[0], &rd->argv[0]);
+  CType *d = ctype_raw(cts, id);
+  TRef trtab = J->base[1], trsz = TREF_NIL, trn, trcd, trdp;
+  CTSize sz;
+  CTInfo info = lj_ctype_info(cts, id, &sz);
+  CTSize esize;
+  if (!(ctype_isrefarray(d->info) && tref_istab(trtab)))
+    lj_trace_err(J, LJ_TRERR_BADTYPE);  /* Interpreter will throw. */
+  esize = ctype_rawchild(cts, d)->size;
+  if ((info & CTF_VLA)) {  /* Size the array by the length of the table. */
+    CTSize sz0 = lj_ctype_vlsize(cts, d, 0);
+    CTSize sz1 = lj_ctype_vlsize(cts, d, 1);
+    trn = lj_ir_call(J, IRCALL_lj_tab_len, trtab);
+    trsz = emitir(IRTGI(IR_MULOV), trn, lj_ir_kint(J, (int32_t)(sz1-sz0)));
+    trsz = emitir(IRTGI(IR_ADDOV), trsz, lj_ir_kint(J, (int32_t)sz0));
+  } else {
+    if (sz == CTSIZE_INVALID)
+      lj_trace_err(J, LJ_TRERR_BADTYPE);
+    trn = lj_ir_kint(J, esize ? (int32_t)(sz / esize) : 0);
+    if (ctype_align(info) > CT_MEMALIGN)
+      trsz = lj_ir_kint(J, sz);
+  }
+  trcd = emitir(IRTG(IR_CNEW, IRT_CDATA), lj_ir_kint(J, id), trsz);
+  trdp = emitir(IRT(IR_ADD, IRT_PTR), trcd, lj_ir_kintp(J, sizeof(GCcdata)));
+  lj_ir_call(J, IRCALL_lj_cdata_fromtab, lj_ir_kint(J, ctype_cid(d->info)),
+	     trdp, trtab, trn);
+  emitir(IRT(IR_XBAR, IRT_NIL), 0, 0);
+  J->base[0] = trcd;
+}
+
+/* -- FFI pool methods ---------------------------------------------------- */
+
+#define crec_pool_ref(J, tr, field) \
+  emitir(IRT(IR_ADD, IRT_PTR), (tr), lj_ir_kintp((J), offsetof(CPool, field)))
+
+/* Emit typecheck for FFI pool and return a pointer to the pool header. */
+static TRef crec_pool(jit_State *J, RecordFFData *rd, CPool **cpp)
+{
+  TRef tr, ud = J->base[0];
+  CPool *cp;
+  if (!(tref_isudata(ud) && udataV(&rd->argv[0])->udtype == UDTYPE_FFI_POOL))
+    lj_trace_err(J, LJ_TRERR_BADTYPE);
+  tr = emitir(IRT(IR_FLOAD, IRT_U8), ud, IRFL_UDATA_UDTYPE);
+  emitir(IRTGI(IR_EQ), tr, lj_ir_kint(J, UDTYPE_FFI_POOL));
+  cp = (CPool *)uddata(udataV(&rd->argv[0]));
+  tr = emitir(IRT(IR_FLOAD, IRT_PTR), ud, IRFL_UDATA_PAYLOAD);
+  /* Specialize to the element type. Everything else follows from it. */
+  emitir(IRTGI(IR_EQ), emitir(IRTI(IR_XLOAD), crec_pool_ref(J, tr, id),
+			      IRXLOAD_READONLY), lj_ir_kint(J, cp->id));
+  *cpp = cp;
+  return tr;
+}
+
+void LJ_FASTCALL recff_ffi_pool_method_alloc(jit_State *J, RecordFFData *rd)
+{
+  CPool *cp;
+  TRef trcp = crec_pool(J, rd, &cp);
+  TRef trfree = crec_pool_ref(J, trcp, free);
+  TRef trp = emitir(IRT(IR_XLOAD, IRT_PTR), trfree, 0);
+  if (J->base[1])
+    lj_trace_err(J, LJ_TRERR_NYICONV);  /* NYI: initializers. */
+  if (cp->free) {  /* Pop the first free slot. */
+    emitir(IRTG(IR_NE, IRT_PTR), trp, lj_ir_kptr(J, NULL));
+    emitir(IRT(IR_XSTORE, IRT_PTR), trfree,
+	   emitir(IRT(IR_XLOAD, IRT_PTR), trp, 0));
+  } else {  /* Add a new chunk. */
+    emitir(IRTG(IR_EQ, IRT_PTR), trp, lj_ir_kptr(J, NULL));
+    trp = lj_ir_call(J, IRCALL_lj_cdata_pool_grow, trcp);
+    emitir(IRT(IR_XBAR, IRT_NIL), 0, 0);
+  }
+  crec_fill(J, trp, lj_ir_kint(J, (int32_t)cp->size), lj_ir_kint(J, 0),
+	    1u << cp->align);
+  J->base[0] = emitir(IRTG(IR_CNEWI, IRT_CDATA), lj_ir_kint(J, cp->pid), trp);
+}
+
+void LJ_FASTCALL recff_ffi_pool_method_free(jit_State *J, RecordFFData *rd)
+{
+  CTState *cts = ctype_ctsG(J2G(J));
+  CPool *cp;
+  TRef trcp = crec_pool(J, rd, &cp);
+  TRef trp = J->base[1];
+  GCcdata *cd = argv2cdata(J, trp, &rd->argv[1]);
+  CType *ct = ctype_raw(cts, cd->ctypeid);
+  if (!(ctype_isptr(ct->info) && ct->size == CTSIZE_PTR &&
+	ctype_rawchild(cts, ct) == ctype_raw(cts, cp->id)))
+    lj_trace_err(J, LJ_TRERR_BADTYPE);  /* Interpreter will throw. */
+  trp = emitir(IRT(IR_FLOAD, IRT_PTR), trp, IRFL_CDATA_PTR);
+  if (*(void **)cdataptr(cd)) {  /* Push the slot onto the free list. */
+    TRef trfree = crec_pool_ref(J, trcp, free);
+    emitir(IRTG(IR_NE, IRT_PTR), trp, lj_ir_kptr(J, NULL));
+    emitir(IRT(IR_XSTORE, IRT_PTR), trp,
+	   emitir(IRT(IR_XLOAD, IRT_PTR), trfree, 0));
+    emitir(IRT(IR_XSTORE, IRT_PTR), trfree, trp);
+  } else {
+    emitir(IRTG(IR_EQ, IRT_PTR), trp, lj_ir_kptr(J, NULL));
+  }
+  rd->nres = 0;
+}
+
 /* -- 64 bit bit.* library functions -------------------------------------- */
 
 /* Determine bit operation type from argument type. */
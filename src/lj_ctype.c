@@ -15,6 +15,7 @@
 #include "lj_ctype.h"
 #include "lj_ccallback.h"
 #include "lj_buf.h"
+#include "lj_vm.h"
 
 /* -- C type definitions -------------------------------------------------- */
 
@@ -144,9 +145,41 @@ CTKWDEF(CTKWNAMEDEF)
 
 /* -- C type interning ---------------------------------------------------- */
 
-#define ct_hashtype(info, size)	(hashrot(info, size) & CTHASH_MASK)
-#define ct_hashname(name) \
-  (hashrot(u32ptr(name), u32ptr(name) + HASH_BIAS) & CTHASH_MASK)
+#define ct_hashtype(cts, info, size)	(hashrot(info, size) & (cts)->hmask)
+#define ct_hashname(cts, name) \
+  (hashrot(u32ptr(name), u32ptr(name) + HASH_BIAS) & (cts)->hmask)
+
+/* Named elements are hashed by name, all others by type. */
+#define ct_hashct(cts, ct) \
+  (gcref((ct)->name) ? ct_hashname((cts), gcref((ct)->name)) : \
+		       ct_hashtype((cts), (ct)->info, (ct)->size))
+
+LJ_STATIC_ASSERT(CTTYPEINFO_NUM < CTHASH_MIN);
+
+/* Double the number of hash anchors. */
+static void ctype_growhash(CTState *cts)
+{
+  MSize i, osize = cts->hmask+1;
+  CTypeID1 *ohash = cts->hash;
+  cts->hash = lj_mem_newvec(cts->L, 2*osize, CTypeID1);
+  cts->hmask = 2*osize-1;
+  for (i = 0; i < osize; i++) {
+    /* Each chain splits into two. Append to keep shadowed names behind. */
+    CTypeID1 *tail[2];
+    CTypeID id = ohash[i];
+    tail[0] = &cts->hash[i];
+    tail[1] = &cts->hash[i+osize];
+    while (id) {
+      CType *ct = ctype_get(cts, id);
+      int hi = (ct_hashct(cts, ct) != i);
+      *tail[hi] = (CTypeID1)id;
+      tail[hi] = &ct->next;
+      id = ct->next;
+    }
+    *tail[0] = *tail[1] = 0;
+  }
+  lj_mem_freevec(cts->g, ohash, osize, CTypeID1);
+}
 
 /* Create new type element. */
 CTypeID lj_ctype_new(CTState *cts, CType **ctp)
@@ -180,7 +213,7 @@ CTypeID lj_ctype_new(CTState *cts, CType **ctp)
 /* Intern a type element. */
 CTypeID lj_ctype_intern(CTState *cts, CTInfo info, CTSize size)
 {
-  uint32_t h = ct_hashtype(info, size);
+  uint32_t h = ct_hashtype(cts, info, size);
   CTypeID id = cts->hash[h];
   lj_assertCTS(cts->L, "uninitialized cts->L");
   while (id) {
@@ -213,29 +246,53 @@ CTypeID lj_ctype_intern(CTState *cts, CTInfo info, CTSize size)
   cts->tab[id].next = cts->hash[h];
   setgcrefnull(cts->tab[id].name);
   cts->hash[h] = (CTypeID1)id;
+  if (LJ_UNLIKELY(++cts->hnum > cts->hmask))
+    ctype_growhash(cts);
   return id;
 }
 
 /* Add type element to hash table. */
 static void ctype_addtype(CTState *cts, CType *ct, CTypeID id)
 {
-  uint32_t h = ct_hashtype(ct->info, ct->size);
+  uint32_t h = ct_hashtype(cts, ct->info, ct->size);
   ct->next = cts->hash[h];
   cts->hash[h] = (CTypeID1)id;
+  cts->hnum++;
 }
 
 /* Add named element to hash table. */
 void lj_ctype_addname(CTState *cts, CType *ct, CTypeID id)
 {
-  uint32_t h = ct_hashname(gcref(ct->name));
+  uint32_t h = ct_hashname(cts, gcref(ct->name));
   ct->next = cts->hash[h];
   cts->hash[h] = (CTypeID1)id;
+  if (LJ_UNLIKELY(++cts->hnum > cts->hmask))
+    ctype_growhash(cts);
+}
+
+/* Drop all elements above top from the hash table, e.g. after an error. */
+void lj_ctype_restore(CTState *cts, CTypeID top)
+{
+  MSize i, n = 0;
+  cts->top = top;
+  for (i = 0; i <= cts->hmask; i++) {
+    CTypeID1 *p = &cts->hash[i];
+    while (*p) {
+      if (*p >= top) {
+	*p = cts->tab[*p].next;
+      } else {
+	p = &cts->tab[*p].next;
+	n++;
+      }
+    }
+  }
+  cts->hnum = n;
 }
 
 /* Get a C type by name, matching the type mask. */
 CTypeID lj_ctype_getname(CTState *cts, CType **ctp, GCstr *name, uint32_t tmask)
 {
-  CTypeID id = cts->hash[ct_hashname(name)];
+  CTypeID id = cts->hash[ct_hashname(cts, name)];
   while (id) {
     CType *ct = ctype_get(cts, id);
     if (gcref(ct->name) == obj2gco(name) &&
@@ -607,6 +664,341 @@ GCstr *lj_ctype_repr_complex(lua_State *L, void *sp, CTSize size)
   return lj_buf_str(L, sb);
 }
 
+/* -- C type cache -------------------------------------------------------- */
+
+/*
+** Serialized C declarations, as produced by ffi.cdef_dump():
+**
+**   header: "\033LJC" version "arch os" ninfo nent
+**   entry:  kind info [cid] size sib name
+**
+** All numbers are ULEB128, the name is its length+1 followed by the
+** characters (0 means no name). A cid or sib below ninfo refers to a
+** builtin C type, others are ninfo + the index of the referenced entry.
+** Interned types only refer to earlier entries, so they can be
+** re-interned while loading. Everything else is patched afterwards.
+*/
+
+#define CTDUMP_VERSION	1
+
+/* Kinds of serialized C type entries. */
+enum {
+  CTDUMP_NEW,		/* Anonymous or non-hashed element (e.g. a field). */
+  CTDUMP_NAMED,		/* Element hashed by name. */
+  CTDUMP_INTERN,	/* Interned type. */
+  CTDUMP_EXTERN		/* Named type declared before the dumped range. */
+};
+
+#define ctype_hascid(info) \
+  ((1u << ctype_type((info))) & ((1u<<CT_PTR)|(1u<<CT_ARRAY)|(1u<<CT_ENUM)| \
+    (1u<<CT_FUNC)|(1u<<CT_TYPEDEF)|(1u<<CT_ATTRIB)|(1u<<CT_FIELD)| \
+    (1u<<CT_CONSTVAL)|(1u<<CT_EXTERN)))
+
+/* Namespace of a named element. Must match CPNS_* in lj_cparse.c. */
+#define ctype_nsmask(info) \
+  (((1u << ctype_type((info))) & ((1u<<CT_STRUCT)|(1u<<CT_ENUM))) ? \
+   ((1u<<CT_STRUCT)|(1u<<CT_ENUM)) : \
+   ((1u<<CT_TYPEDEF)|(1u<<CT_FUNC)|(1u<<CT_EXTERN)|(1u<<CT_CONSTVAL)))
+
+/* Check whether a C type element is linked into the hash table. */
+static int ctype_inhash(CTState *cts, CTypeID id)
+{
+  CTypeID i = cts->hash[ct_hashct(cts, ctype_get(cts, id))];
+  for (; i; i = cts->tab[i].next)
+    if (i == id) return 1;
+  return 0;
+}
+
+typedef struct CTDumpState {
+  CTState *cts;
+  SBuf *sb;		/* Output buffer. */
+  CTypeID base;		/* First C type ID of the dumped range. */
+  CTypeID top;		/* Top of the dumped range. */
+  MSize n;		/* Number of entries. */
+  uint32_t *idx;	/* Entry index+1 for each C type ID or 0. */
+  CTypeID1 *order;	/* C type ID for each entry. */
+  uint8_t *kind;	/* Entry kinds. */
+} CTDumpState;
+
+/* Add an entry for a C type ID and the types it depends on. */
+static void ctdump_add(CTDumpState *ds, CTypeID id)
+{
+  CTState *cts = ds->cts;
+  CType *ct;
+  int kind;
+  if (id < CTTYPEINFO_NUM || ds->idx[id]) return;
+  ct = ctype_get(cts, id);
+  if (gcref(ct->name) && ctype_inhash(cts, id)) {
+    kind = CTDUMP_NAMED;
+    if (id < ds->base &&
+	!((ctype_isstruct(ct->info) || ctype_isenum(ct->info)) &&
+	  ct->sib >= ds->base))
+      kind = CTDUMP_EXTERN;  /* Unless it was completed in the range. */
+  } else if (!gcref(ct->name) && ctype_inhash(cts, id)) {
+    kind = CTDUMP_INTERN;
+  } else if (id >= ds->base) {
+    kind = CTDUMP_NEW;
+  } else {
+    lj_err_callerv(cts->L, LJ_ERR_FFI_DUMPANON,
+		   strdata(lj_ctype_repr(cts->L, id, NULL)));
+  }
+  if (kind != CTDUMP_EXTERN && ctype_hascid(ct->info))
+    ctdump_add(ds, ctype_cid(ct->info));
+  ds->order[ds->n] = (CTypeID1)id;
+  ds->kind[ds->n] = (uint8_t)kind;
+  ds->idx[id] = ++ds->n;
+}
+
+/* Write a reference to a C type ID. */
+static char *ctdump_ref(CTDumpState *ds, char *p, CTypeID id)
+{
+  if (id >= CTTYPEINFO_NUM) {
+    if (!ds->idx[id])
+      lj_err_callerv(ds->cts->L, LJ_ERR_FFI_DUMPANON,
+		     strdata(lj_ctype_repr(ds->cts->L, id, NULL)));
+    id = CTTYPEINFO_NUM + ds->idx[id]-1;
+  }
+  return lj_strfmt_wuleb128(p, id);
+}
+
+/* Protected callback for the C type dumper. */
+static TValue *cpdump(lua_State *L, lua_CFunction dummy, void *ud)
+{
+  static const char arch[] = LJ_ARCH_NAME " " LJ_OS_NAME;
+  CTDumpState *ds = (CTDumpState *)ud;
+  CTState *cts = ds->cts;
+  CTypeID id;
+  MSize i;
+  char *p;
+  UNUSED(L); UNUSED(dummy);
+  for (id = ds->base; id < ds->top; id++)
+    ctdump_add(ds, id);
+  p = lj_buf_more(ds->sb, 5+5+sizeof(arch)+5+5);
+  p = lj_buf_wmem(p, "\033LJC", 4);
+  *p++ = CTDUMP_VERSION;
+  p = lj_strfmt_wuleb128(p, sizeof(arch)-1);
+  p = lj_buf_wmem(p, arch, sizeof(arch)-1);
+  p = lj_strfmt_wuleb128(p, CTTYPEINFO_NUM);
+  p = lj_strfmt_wuleb128(p, ds->n);
+  ds->sb->w = p;
+  for (i = 0; i < ds->n; i++) {
+    CType *ct = ctype_get(cts, ds->order[i]);
+    GCstr *name = gcrefp(ct->name, GCstr);
+    CTInfo info = ct->info;
+    p = lj_buf_more(ds->sb, 1+5*5);
+    *p++ = (char)ds->kind[i];
+    if (ctype_hascid(info)) {
+      p = lj_strfmt_wuleb128(p, info & ~CTMASK_CID);
+      p = ctdump_ref(ds, p, ctype_cid(info));
+    } else {
+      p = lj_strfmt_wuleb128(p, info);
+    }
+    p = lj_strfmt_wuleb128(p, ct->size);
+    p = ctdump_ref(ds, p, ds->kind[i] == CTDUMP_EXTERN ? 0 : ct->sib);
+    p = lj_strfmt_wuleb128(p, name ? name->len+1 : 0);
+    ds->sb->w = p;
+    if (name) lj_buf_putmem(ds->sb, strdata(name), name->len);
+  }
+  return NULL;
+}
+
+/* Serialize all C types from base to the top of the C type table. */
+int lj_ctype_dump(CTState *cts, SBuf *sb, CTypeID base)
+{
+  lua_State *L = cts->L;
+  CTDumpState ds;
+  MSize sz = cts->top*(sizeof(uint32_t)+sizeof(CTypeID1)+1);
+  char *mem = lj_mem_newvec(L, sz, char);
+  int errcode;
+  memset(mem, 0, cts->top*sizeof(uint32_t));
+  ds.cts = cts;
+  ds.sb = sb;
+  ds.base = base;
+  ds.top = cts->top;
+  ds.n = 0;
+  ds.idx = (uint32_t *)mem;
+  ds.order = (CTypeID1 *)(ds.idx + cts->top);
+  ds.kind = (uint8_t *)(ds.order + cts->top);
+  errcode = lj_vm_cpcall(L, NULL, &ds, cpdump);
+  lj_mem_freevec(G(L), mem, sz, char);
+  return errcode;
+}
+
+typedef struct CTLoadState {
+  CTState *cts;
+  const char *p, *pe;	/* Current and end of input. */
+  MSize n;		/* Number of entries. */
+  CTypeID1 *id;		/* C type ID for each entry. */
+  uint32_t *fix;	/* cid and sib refs of entries to patch, or ~0. */
+  char *mem;		/* Memory for id and fix. */
+  MSize sz;		/* Size of mem. */
+} CTLoadState;
+
+/* Signal malformed or incompatible input. */
+static LJ_NORET LJ_NOINLINE void ctload_err(CTLoadState *ls)
+{
+  lj_err_msg(ls->cts->L, LJ_ERR_FFI_BADDUMP);
+}
+
+/* Read ULEB128 value with bounds check. */
+static uint32_t ctload_uleb(CTLoadState *ls)
+{
+  uint32_t v = 0;
+  int sh = 0;
+  do {
+    if (ls->p >= ls->pe || sh > 28) ctload_err(ls);
+    v |= (uint32_t)(*ls->p & 0x7f) << sh;
+    sh += 7;
+  } while (*ls->p++ & 0x80);
+  return v;
+}
+
+/* Read a name. */
+static GCstr *ctload_name(CTLoadState *ls)
+{
+  uint32_t len = ctload_uleb(ls);
+  GCstr *s;
+  if (len-- == 0) return NULL;
+  if (len > (MSize)(ls->pe - ls->p)) ctload_err(ls);
+  s = lj_str_new(ls->cts->L, ls->p, len);
+  ls->p += len;
+  return s;
+}
+
+/* Resolve a reference to a C type ID, limited to the first lim entries. */
+static CTypeID ctload_ref(CTLoadState *ls, uint32_t ref, MSize lim)
+{
+  if (ref < CTTYPEINFO_NUM) return ref;
+  if (ref - CTTYPEINFO_NUM >= lim) ctload_err(ls);
+  return ls->id[ref - CTTYPEINFO_NUM];
+}
+
+/* Read header and allocate per-entry state. */
+static void ctload_header(CTLoadState *ls)
+{
+  const char *arch = LJ_ARCH_NAME " " LJ_OS_NAME;
+  MSize len;
+  if (ls->pe - ls->p < 5 || memcmp(ls->p, "\033LJC", 4) ||
+      ls->p[4] != CTDUMP_VERSION)
+    ctload_err(ls);
+  ls->p += 5;
+  len = ctload_uleb(ls);
+  if (len != strlen(arch) || len > (MSize)(ls->pe - ls->p) ||
+      memcmp(ls->p, arch, len))
+    ctload_err(ls);
+  ls->p += len;
+  if (ctload_uleb(ls) != CTTYPEINFO_NUM) ctload_err(ls);
+  ls->n = ctload_uleb(ls);
+  if (ls->n > CTID_MAX) ctload_err(ls);
+  ls->sz = ls->n*(2*sizeof(uint32_t)+sizeof(CTypeID1));
+  ls->mem = lj_mem_newvec(ls->cts->L, ls->sz, char);
+  ls->fix = (uint32_t *)ls->mem;
+  ls->id = (CTypeID1 *)(ls->fix + 2*ls->n);
+}
+
+/* Protected callback for the C type loader. */
+static TValue *cpload(lua_State *L, lua_CFunction dummy, void *ud)
+{
+  CTLoadState *ls = (CTLoadState *)ud;
+  CTState *cts = ls->cts;
+  MSize i;
+  UNUSED(dummy);
+  ctload_header(ls);
+  for (i = 0; i < ls->n; i++) {
+    int kind, tag;
+    CTInfo info;
+    CTSize size;
+    uint32_t cidref = 0, sibref;
+    GCstr *name;
+    CType *ct;
+    CTypeID id = 0;
+    if (ls->p >= ls->pe) ctload_err(ls);
+    kind = (uint8_t)*ls->p++;
+    info = ctload_uleb(ls);
+    if (kind > CTDUMP_EXTERN || ctype_type(info) > CT_EXTERN)
+      ctload_err(ls);
+    if (ctype_hascid(info)) cidref = ctload_uleb(ls);
+    size = ctload_uleb(ls);
+    sibref = ctload_uleb(ls);
+    name = ctload_name(ls);
+    ls->fix[2*i] = ~0u;
+    if (kind == CTDUMP_INTERN) {
+      ls->id[i] = (CTypeID1)lj_ctype_intern(cts,
+				info + ctload_ref(ls, cidref, i), size);
+      continue;
+    }
+    tag = ctype_isstruct(info) || ctype_isenum(info);
+    if (kind != CTDUMP_NEW) {
+      if (!name) ctload_err(ls);
+      id = lj_ctype_getname(cts, &ct, name, ctype_nsmask(info));
+      if (id && tag && ((ct->info ^ info) & (CTMASK_NUM|CTF_UNION)))
+	lj_err_callerv(L, LJ_ERR_FFI_REDEF, strdata(name));
+      if (kind == CTDUMP_EXTERN) {
+	if (!id) {
+	  if (!tag) lj_err_callerv(L, LJ_ERR_FFI_NODECL, strdata(name));
+	  /* Implicitly declare the tag, like the C parser does. */
+	  id = lj_ctype_new(cts, &ct);
+	  ct->info = info;
+	  ct->size = CTSIZE_INVALID;
+	  ctype_setname(ct, name);
+	  lj_ctype_addname(cts, ct, id);
+	}
+	ls->id[i] = (CTypeID1)id;
+	continue;
+      }
+    }
+    if (id && tag) {  /* Complete a declared tag or keep the definition. */
+      if (ct->size != CTSIZE_INVALID || ct->sib) {
+	ls->id[i] = (CTypeID1)id;
+	continue;
+      }
+    } else {  /* Other redeclarations are ignored, like in the C parser. */
+      CTypeID nid = lj_ctype_new(cts, &ct);
+      if (name) {
+	ctype_setname(ct, name);
+	if (kind == CTDUMP_NAMED && !id) lj_ctype_addname(cts, ct, nid);
+      }
+      id = nid;
+    }
+    ct = ctype_get(cts, id);
+    ct->info = info;
+    ct->size = size;
+    ls->id[i] = (CTypeID1)id;
+    ls->fix[2*i] = cidref;
+    ls->fix[2*i+1] = sibref;
+  }
+  if (ls->p != ls->pe) ctload_err(ls);
+  for (i = 0; i < ls->n; i++) {  /* Patch references to later entries. */
+    if (ls->fix[2*i] != ~0u) {
+      CType *ct = ctype_get(cts, ls->id[i]);
+      if (ctype_hascid(ct->info))
+	ct->info += ctload_ref(ls, ls->fix[2*i], ls->n);
+      ct->sib = (CTypeID1)ctload_ref(ls, ls->fix[2*i+1], ls->n);
+    }
+  }
+  return NULL;
+}
+
+/* Load C types serialized by lj_ctype_dump(). */
+int lj_ctype_load(CTState *cts, const char *p, MSize len)
+{
+  lua_State *L = cts->L;
+  CTLoadState ls;
+  int errcode;
+  LJ_CTYPE_SAVE(cts);
+  ls.cts = cts;
+  ls.p = p;
+  ls.pe = p + len;
+  ls.mem = NULL;
+  ls.sz = 0;
+  errcode = lj_vm_cpcall(L, NULL, &ls, cpload);
+  if (ls.mem)
+    lj_mem_freevec(G(L), ls.mem, ls.sz, char);
+  if (errcode)
+    LJ_CTYPE_RESTORE(cts);
+  return errcode;
+}
+
 /* -- C type state -------------------------------------------------------- */
 
 /* Initialize C type table and state. */
@@ -617,6 +1009,9 @@ CTState *lj_ctype_init(lua_State *L)
   const char *name = lj_ctype_typenames;
   CTypeID id;
   memset(cts, 0, sizeof(CTState));
+  cts->hash = lj_mem_newvec(L, CTHASH_MIN, CTypeID1);
+  memset(cts->hash, 0, CTHASH_MIN*sizeof(CTypeID1));
+  cts->hmask = CTHASH_MIN-1;
   cts->tab = ct;
   cts->sizetab = CTTYPETAB_MIN;
   cts->top = CTTYPEINFO_NUM;
@@ -662,7 +1057,10 @@ void lj_ctype_freestate(global_State *g)
   if (cts) {
     lj_ccallback_mcode_free(cts);
     lj_mem_freevec(g, cts->tab, cts->sizetab, CType);
+    lj_mem_freevec(g, cts->hash, cts->hmask+1, CTypeID1);
     lj_mem_freevec(g, cts->cb.cbid, cts->cb.sizeid, CTypeID1);
+    if (cts->cb.sig)
+      lj_mem_freevec(g, cts->cb.sig, CCALLBACK_NSIG, CCallbackSig);
     lj_mem_freet(g, cts);
   }
 }
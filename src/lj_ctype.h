@@ -148,8 +148,7 @@ typedef struct CType {
   GCRef name;		/* Element name (GCstr). */
 } CType;
 
-#define CTHASH_SIZE	128	/* Number of hash anchors. */
-#define CTHASH_MASK	(CTHASH_SIZE-1)
+#define CTHASH_MIN	256	/* Min. number of hash anchors (pow2). */
 
 /* Simplify target-specific configuration. Checked in lj_ccall.h. */
 #define CCALL_MAX_GPR		8
@@ -159,6 +158,25 @@ typedef LJ_ALIGN(8) union FPRCBArg { double d; float f[2]; } FPRCBArg;
 
 /* C callback state. Defined here, to avoid dragging in lj_ccall.h. */
 
+#define CCALLBACK_MAXARG	(LUA_MINSTACK-4)  /* Max. callback arguments. */
+#define CCALLBACK_NSIG		16	/* Number of cached signatures. */
+
+/* Cached conversion of a callback argument. */
+typedef struct CCallbackArg {
+  uint8_t conv;		/* Conversion. See lj_ccallback.c. */
+  uint8_t size;		/* Size of argument. */
+  uint16_t ofs;		/* Offset into callback state or stack. */
+  CTypeID1 id;		/* Argument type for boxed or generic conversions. */
+} CCallbackArg;
+
+/* Cached signature of a callback function type. */
+typedef struct CCallbackSig {
+  CTypeID1 id;		/* Function type or 0 for an unused entry. */
+  uint8_t narg;		/* Number of arguments. */
+  uint8_t nsp;		/* Number of stack slots used by arguments. */
+  CCallbackArg arg[CCALLBACK_MAXARG];
+} CCallbackSig;
+
 typedef LJ_ALIGN(8) struct CCallback {
   FPRCBArg fpr[CCALL_MAX_FPR];	/* Arguments/results in FPRs. */
   intptr_t gpr[CCALL_MAX_GPR];	/* Arguments/results in GPRs. */
@@ -168,6 +186,7 @@ typedef LJ_ALIGN(8) struct CCallback {
   MSize sizeid;			/* Size of callback type table. */
   MSize topid;			/* Highest unused callback type table slot. */
   MSize slot;			/* Current callback slot. */
+  CCallbackSig *sig;		/* Signature cache (or NULL). */
 } CCallback;
 
 /* C type state. */
@@ -179,7 +198,9 @@ typedef struct CTState {
   global_State *g;	/* Global state. */
   GCtab *miscmap;	/* Map of -CTypeID to metatable and cb slot to func. */
   CCallback cb;		/* Temporary callback state. */
-  CTypeID1 hash[CTHASH_SIZE];  /* Hash anchors for C type table. */
+  CTypeID1 *hash;	/* Hash anchors for C type table. */
+  MSize hmask;		/* Hash mask (number of hash anchors - 1). */
+  MSize hnum;		/* Number of hashed elements. */
 } CTState;
 
 #define CTINFO(ct, flags)	(((CTInfo)(ct) << CTSHIFT_NUM) + (flags))
@@ -402,10 +423,8 @@ static LJ_AINLINE CTState *ctype_cts(lua_State *L)
   } while (0)
 
 /* Save and restore state of C type table. */
-#define LJ_CTYPE_SAVE(cts)	CTState savects_ = *(cts)
-#define LJ_CTYPE_RESTORE(cts) \
-  ((cts)->top = savects_.top, \
-   memcpy((cts)->hash, savects_.hash, sizeof(savects_.hash)))
+#define LJ_CTYPE_SAVE(cts)	CTypeID savetop_ = (cts)->top
+#define LJ_CTYPE_RESTORE(cts)	lj_ctype_restore((cts), savetop_)
 
 /* Check C type ID for validity when assertions are enabled. */
 static LJ_AINLINE CTypeID ctype_check(CTState *cts, CTypeID id)
@@ -459,6 +478,7 @@ static LJ_AINLINE void ctype_setname(CType *ct, GCstr *s)
 LJ_FUNC CTypeID lj_ctype_new(CTState *cts, CType **ctp);
 LJ_FUNC CTypeID lj_ctype_intern(CTState *cts, CTInfo info, CTSize size);
 LJ_FUNC void lj_ctype_addname(CTState *cts, CType *ct, CTypeID id);
+LJ_FUNC void lj_ctype_restore(CTState *cts, CTypeID top);
 LJ_FUNC CTypeID lj_ctype_getname(CTState *cts, CType **ctp, GCstr *name,
 				 uint32_t tmask);
 LJ_FUNC CType *lj_ctype_getfieldq(CTState *cts, CType *ct, GCstr *name,
@@ -474,6 +494,8 @@ LJ_FUNC cTValue *lj_ctype_meta(CTState *cts, CTypeID id, MMS mm);
 LJ_FUNC GCstr *lj_ctype_repr(lua_State *L, CTypeID id, GCstr *name);
 LJ_FUNC GCstr *lj_ctype_repr_int64(lua_State *L, uint64_t n, int isunsigned);
 LJ_FUNC GCstr *lj_ctype_repr_complex(lua_State *L, void *sp, CTSize size);
+LJ_FUNC int lj_ctype_dump(CTState *cts, SBuf *sb, CTypeID base);
+LJ_FUNC int lj_ctype_load(CTState *cts, const char *p, MSize len);
 LJ_FUNC CTState *lj_ctype_init(lua_State *L);
 LJ_FUNC void lj_ctype_initfin(lua_State *L);
 LJ_FUNC void lj_ctype_freestate(global_State *g);
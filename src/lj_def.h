@@ -87,6 +87,7 @@ typedef unsigned int uintptr_t;
 #define LJ_MIN_STRTAB	64		/* Min. string table size (pow2). */
 #define LJ_MIN_SBUF	32		/* Min. string buffer length. */
 #define LJ_MIN_VECSZ	8		/* Min. size for growable vectors. */
+#define LJ_MAX_CDFREE	4096		/* Max. # of cached small cdata blocks. */
 #define LJ_MIN_IRSZ	32		/* Min. size for growable IR. */
 
 /* JIT compiler limits. */
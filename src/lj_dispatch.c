@@ -17,6 +17,7 @@
 #include "lj_state.h"
 #include "lj_frame.h"
 #include "lj_bc.h"
+#include "lj_bcdump.h"
 #include "lj_ff.h"
 #include "lj_strfmt.h"
 #if LJ_HASJIT
@@ -227,15 +228,18 @@ static void setptmode(global_State *g, GCproto *pt, int mode)
 }
 
 /* Recursively set the JIT mode for all children of a prototype. */
-static void setptmode_all(global_State *g, GCproto *pt, int mode)
+static void setptmode_all(lua_State *L, GCproto *pt, int mode)
 {
   ptrdiff_t i;
   if (!(pt->flags & PROTO_CHILD)) return;
   for (i = -(ptrdiff_t)pt->sizekgc; i < 0; i++) {
     GCobj *o = proto_kgc(pt, i);
     if (o->gch.gct == ~LJ_TPROTO) {
-      setptmode(g, gco2pt(o), mode);
-      setptmode_all(g, gco2pt(o), mode);
+      GCproto *cpt = gco2pt(o);
+      if (proto_islazy(cpt))  /* The mode must stick to the decoded one. */
+	cpt = lj_bcread_lazy(L, pt, cpt);
+      setptmode(G(L), cpt, mode);
+      setptmode_all(L, cpt, mode);
     }
   }
 }
@@ -278,7 +282,7 @@ int luaJIT_setmode(lua_State *L, int idx, int mode)
     if (mm != LUAJIT_MODE_ALLSUBFUNC)
       setptmode(g, pt, mode);
     if (mm != LUAJIT_MODE_FUNC)
-      setptmode_all(g, pt, mode);
+      setptmode_all(L, pt, mode);
     break;
     }
   case LUAJIT_MODE_TRACE:
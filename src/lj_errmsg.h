@@ -172,6 +172,8 @@ ERRDEF(FFI_BADIDXW,	LUA_QS " cannot be indexed with " LUA_QS)
 ERRDEF(FFI_BADMM,	LUA_QS " has no " LUA_QS " metamethod")
 ERRDEF(FFI_WRCONST,	"attempt to write to constant location")
 ERRDEF(FFI_NODECL,	"missing declaration for symbol " LUA_QS)
+ERRDEF(FFI_DUMPANON,	"cannot dump declaration depending on " LUA_QS)
+ERRDEF(FFI_BADDUMP,	"cannot load incompatible or malformed C declarations")
 ERRDEF(FFI_BADCBACK,	"bad callback")
 #if LJ_OS_NOJIT
 ERRDEF(FFI_CBACKOV,	"no support for callbacks on this OS")
@@ -576,6 +576,17 @@ static void LJ_FASTCALL recff_next(jit_State *J, RecordFFData *rd)
 static void LJ_FASTCALL recff_unpack(jit_State *J, RecordFFData *rd)
 {
   TRef tab = J->base[0], trstart = J->base[1], trend = J->base[2];
+  if (tref_istab(tab) && (!trend || tref_isnil(trend)) &&
+      (!trstart || tref_isk(trstart))) {
+    /* Specialize to the length. Constant for tables with known contents. */
+    trend = emitir(IRTI(IR_ALEN), tab, TREF_NIL);
+    if (!tref_isk(trend)) {
+      TRef trlen = lj_ir_kint(J, (int32_t)lj_tab_len(tabV(&rd->argv[0])));
+      emitir(IRTGI(IR_EQ), trend, trlen);
+      trend = trlen;
+    }
+    if (!trstart) trstart = TREF_NIL;
+  }
   if (tref_istab(tab) && trstart && trend && tref_isk2(trstart, trend) &&
 			 !tref_isnil(trend)) {
     if (!tref_isnil(trstart))
@@ -1483,6 +1494,53 @@ static void LJ_FASTCALL recff_table_insert(jit_State *J, RecordFFData *rd)
   }  /* else: Interpreter will throw. */
 }
 
+/* Max. number of elements for unrolling table.concat(). */
+#define CONCAT_MAXUNROLL	16
+
+/* Unroll table.concat() for a new table. Its loads can be forwarded,
+** which avoids the escape to lj_buf_puttab() and allows sinking it.
+** The loads are raw (idxchain = 0), like the accesses of lj_buf_puttab().
+*/
+static TRef recff_table_concat_unroll(jit_State *J, RecordFFData *rd,
+				      TRef tab, TRef sep, TRef tri, TRef tre)
+{
+  TRef trv[CONCAT_MAXUNROLL];
+  IROp op = IR(tref_ref(tab))->o;
+  int32_t i, start, n;
+  if (!(op == IR_TNEW || op == IR_TDUP) || !tref_isk2(tri, tre))
+    return 0;
+  start = IR(tref_ref(tri))->i;
+  n = IR(tref_ref(tre))->i - start + 1;
+  if (n <= 0) {
+    return lj_ir_kstr(J, J2G(J)->strempty);
+  } else if (n <= CONCAT_MAXUNROLL) {
+    RecordIndex ix;
+    TRef hdr, tr;
+    ix.tab = tab;
+    settabV(J->L, &ix.tabv, tabV(&rd->argv[0]));
+    ix.val = 0;
+    ix.idxchain = 0;
+    for (i = 0; i < n; i++) {
+      ix.key = lj_ir_kint(J, start + i);
+      setintV(&ix.keyv, start + i);
+      trv[i] = lj_record_idx(J, &ix);
+      if (!tref_isnumber_str(trv[i]))
+	return 0;  /* Let lj_buf_puttab() fail. */
+    }
+    if (tref_isk(sep) && (IR(tref_ref(sep))->o == IR_KNULL ||
+			  ir_kstr(IR(tref_ref(sep)))->len == 0))
+      sep = 0;  /* No separator. */
+    tr = hdr = recff_bufhdr(J);
+    for (i = 0; i < n; i++) {
+      if (i > 0 && sep)
+	tr = emitir(IRTG(IR_BUFPUT, IRT_PGC), tr, sep);
+      tr = emitir(IRTG(IR_BUFPUT, IRT_PGC), tr, lj_ir_tostr(J, trv[i]));
+    }
+    return emitir(IRTG(IR_BUFSTR, IRT_STR), tr, hdr);
+  }
+  return 0;
+}
+
 static void LJ_FASTCALL recff_table_concat(jit_State *J, RecordFFData *rd)
 {
   TRef tab = J->base[0];
@@ -1494,12 +1552,16 @@ static void LJ_FASTCALL recff_table_concat(jit_State *J, RecordFFData *rd)
     TRef tre = (J->base[1] && J->base[2] && !tref_isnil(J->base[3])) ?
 	       lj_opt_narrow_toint(J, J->base[3]) :
 	       emitir(IRTI(IR_ALEN), tab, TREF_NIL);
-    TRef hdr = recff_bufhdr(J);
-    TRef tr = lj_ir_call(J, IRCALL_lj_buf_puttab, hdr, tab, sep, tri, tre);
+    TRef hdr, tr = recff_table_concat_unroll(J, rd, tab, sep, tri, tre);
+    if (tr) {
+      J->base[0] = tr;
+      return;
+    }
+    hdr = recff_bufhdr(J);
+    tr = lj_ir_call(J, IRCALL_lj_buf_puttab, hdr, tab, sep, tri, tre);
     emitir(IRTG(IR_NE, IRT_PTR), tr, lj_ir_kptr(J, NULL));
     J->base[0] = emitir(IRTG(IR_BUFSTR, IRT_STR), tr, hdr);
   }  /* else: Interpreter will throw. */
-  UNUSED(rd);
 }
 
 static void LJ_FASTCALL recff_table_new(jit_State *J, RecordFFData *rd)
@@ -14,6 +14,7 @@
 #include "lj_func.h"
 #include "lj_trace.h"
 #include "lj_vm.h"
+#include "lj_bcdump.h"
 
 /* -- Prototypes ---------------------------------------------------------- */
 
@@ -138,6 +139,10 @@ GCfunc *lj_func_newL_gc(lua_State *L, GCproto *pt, GCfuncL *parent)
   GCRef *puv;
   MSize i, nuv;
   TValue *base;
+  if (LJ_UNLIKELY(proto_islazy(pt))) {  /* Decode on first instantiation. */
+    L->top = curr_topL(L);
+    pt = lj_bcread_lazy(L, funcproto((GCfunc *)parent), pt);
+  }
   lj_gc_check_fixtop(L);
   fn = func_newL(L, pt, tabref(parent->env));
   /* NOBARRIER: The GCfunc is new (marked white). */
@@ -482,27 +482,25 @@ static size_t traverse_upvals(global_State *g, GCAupval *a, size_t threshold)
 static size_t traverse_funcs(global_State *g, GCAfunc *a, size_t threshold)
 {
   size_t ret = 0;
-  for (uint32_t i = tzcount64(a->gray_h); a->gray_h; a->gray_h = reset_lowest64(a->gray_h), i = tzcount64(a->gray_h)) {
-    /* It is not allowed to synchronously change a->gray[i] */
-    uint64_t v = a->gray[i];
-    while (v) {
-      uint32_t j = tzcount64(v);
+  /* C function upvalues may refer to Lua functions in this arena, so
+   * gc_traverse_func can set bits in the current or previous words. */
+  while (a->gray_h) {
+    uint32_t i = tzcount64(a->gray_h);
+    for (uint32_t j = tzcount64(a->gray[i]); a->gray[i]; j = tzcount64(a->gray[i])) {
       GCfunc *fn = aobj(a, GCfunc, (i << 6) + j);
       MSize size = isluafunc(fn) ? sizeLfunc((MSize)fn->l.nupvalues) : sizeCfunc((MSize)fn->c.nupvalues);
       gray2black(g, obj2gco(fn));
+      a->gray[i] = reset_lowest64(a->gray[i]);
       if (!(fn->gen.gcflags & LJ_GC_MARK_MASK)) {
         maybe_mark_blob(g, mrefu(fn->gen.data), size);
       }
-      v = reset_lowest64(v);
       ret += sizeof(GCfunc) + size;
       a->mark[i] |= flags2bitmask(obj2gco(fn), j);
       gc_traverse_func(g, fn);
-      if (ret >= threshold) {
-        a->gray[i] = v;
+      if (ret >= threshold)
         return ret;
-      }
     }
-    a->gray[i] = 0;
+    a->gray_h ^= 1ull << i;
   }
   g->gc.gray_head = a->hdr.gray;
   return ret;
@@ -807,7 +805,8 @@ static void gc_free_arena(global_State *g, GCArenaHdr *a)
   }
 
 /* The first arena in the list is the primary one. It is being allocated out of
- * and can never be put on the freelist or released */
+ * and can never be put on the freelist or released. The trailing statements
+ * run before a released arena x is freed, when a already points past it. */
 #define sweep_free(atype, src, freevar, cond, ...)                             \
   if (LJ_LIKELY(g->gc.src != &a->hdr)) {                                       \
     if (LJ_UNLIKELY(_simd_eq64_mask(any, zero) == 0xF)) {                      \
@@ -1223,6 +1222,8 @@ static void gc_sweep_udata_obj(global_State *g, GCAudata *a, uint32_t i, bitmap_
   GCudata *base = aobj(a, GCudata, i << 6);
   for (uint32_t j = tzcount64(f); f; f = reset_lowest64(f), j = tzcount64(f)) {
     GCudata *ud = &base[j];
+    /* Skip the slots holding the payload of a merged userdata. */
+    f &= ~flags2bitmask(obj2gco(ud), j);
     if (!(ud->gcflags & LJ_GC_MARK_MASK) && ud->len > 0) {
       g->gc.malloc -= ud->len;
       g->allocf(g->allocd, uddata(ud), ud->len, 0);
@@ -1266,7 +1267,7 @@ static void *gc_sweep_udata1(global_State *g, GCAudata *a)
       a->mark[i] = 0;
     a->fin[i] &= m;
     a->fin_req[i] &= m;
-    gc_sweep_udata_obj(g, a, 0, f);
+    gc_sweep_udata_obj(g, a, i, f);
     if (f)
       free |= 1u << i;
   }
@@ -1282,7 +1283,7 @@ static void *gc_sweep_udata1(global_State *g, GCAudata *a)
     a->mark[i] = 0;
   a->fin[i] &= m;
   a->fin_req[i] &= m;
-  gc_sweep_udata_obj(g, a, 0, f);
+  gc_sweep_udata_obj(g, a, i, f);
   if (f)
     free |= 1u << i;
 
@@ -1450,8 +1451,8 @@ static void *gc_sweep_str_small(global_State *g, GCAstr *a, uint32_t lim)
     sweep_fixup2(GCAstr, GCstr);
 
     sweep_free(GCAstr, str_small, free_str_small, free && !a->free_h,
-      if (a->hdr.flags & LJ_GC_SWEEP_DIRTY) free_str_small(g, x);
-      else clean_str_small(g, (GCstr *)a, free_mask, temp);
+      if (x->flags & LJ_GC_SWEEP_DIRTY) free_str_small(g, x);
+      else clean_str_small(g, (GCstr *)x, free_mask, temp);
     );
 
     g->str.num_small += count;
@@ -1826,16 +1827,26 @@ void lj_gc_freeall(global_State *g)
   g->gc.safecolor = LJ_GC_SFIXED;
   gc_fullsweep(g, &g->gc.root);
 
+  /* Release the small cdata freelist. */
+  while (gcref(g->gc.cdfree)) {
+    GCobj *o = gcref(g->gc.cdfree);
+    setgcrefr(g->gc.cdfree, o->gch.nextgc);
+    g->gc.malloc -= LJ_GC_CDSMALL;
+    g->allocf(g->allocd, o, LJ_GC_CDSMALL, 0);
+  }
+  g->gc.cdfreenum = 0;
+
   /* Only track malloced data from this point. */
   g->gc.total = g->gc.malloc;
 
   g->gc.currentsweep ^= LJ_GC_SWEEPS;
 
   /* Some objects may contain malloced data and may not get collected. */
-  for (a = g->gc.udata; a; a = a->next) {
+  g->gc.gray_head = NULL;  /* Arenas may still be queued by finalization. */
+  for (a = g->gc.udata; a; ) {
     GCAudata *ud = (GCAudata *)a;
     memset(ud->mark, 0, sizeof(ud->mark));
-    gc_sweep_udata1(g, ud);
+    a = (GCArenaHdr *)gc_sweep_udata1(g, ud);  /* May free the arena. */
   }
 }
 
@@ -1845,6 +1856,7 @@ void lj_gc_freeall(global_State *g)
 static void atomic(global_State *g, lua_State *L)
 {
   size_t udsize;
+  GCobj *udfin;
 
   setgcrefnull(g->gc.weak);
   setgcrefnull(g->gc.ephemeron);
@@ -1863,11 +1875,13 @@ static void atomic(global_State *g, lua_State *L)
   setgcrefnull(g->gc.grayagain);
 
   setgcrefnull(g->gc.fin_list);
-  gc_presweep_fintab(g, (GCAtab*)g->gc.fintab);
   gc_presweep_udata(g, (GCAudata *)g->gc.udata);
+  udfin = gcref(g->gc.fin_list);
+  gc_presweep_fintab(g, (GCAtab*)g->gc.fintab);
   udsize = gc_propagate_gray(g);
 
-  setgcrefnull(g->gc.fin_list);
+  /* Propagation reuses the gclist of tables, but not the one of userdata. */
+  setgcref(g->gc.fin_list, udfin);
   gc_presweep_fintab(g, (GCAtab*)g->gc.fintab);
   gc_presweep_udata(g, (GCAudata *)g->gc.udata);
   udsize += gc_propagate_gray(g);
@@ -2266,12 +2280,20 @@ void *lj_mem_realloc(lua_State *L, void *p, GCSize osz, GCSize nsz)
 void * LJ_FASTCALL lj_mem_newgco(lua_State *L, GCSize size)
 {
   global_State *g = G(L);
-  GCobj *o = (GCobj *)g->allocf(g->allocd, NULL, 0, size);
-  if (o == NULL)
-    lj_err_mem(L);
-  lj_assertG(checkptrGC(o), "allocated memory address %p outside required range", o);
-  g->gc.total += size;
-  g->gc.malloc += size;
+  GCobj *o;
+  if (size == LJ_GC_CDSMALL && (o = gcref(g->gc.cdfree)) != NULL) {
+    /* Reuse a block from the small cdata freelist. */
+    setgcrefr(g->gc.cdfree, o->gch.nextgc);
+    g->gc.cdfreenum--;
+    g->gc.total += size;
+  } else {
+    o = (GCobj *)g->allocf(g->allocd, NULL, 0, size);
+    if (o == NULL)
+      lj_err_mem(L);
+    lj_assertG(checkptrGC(o), "allocated memory address %p outside required range", o);
+    g->gc.total += size;
+    g->gc.malloc += size;
+  }
   setgcrefr(o->gch.nextgc, g->gc.root);
   setgcref(g->gc.root, o);
   newwhite(o);
@@ -135,6 +135,8 @@ static LJ_AINLINE void lj_gc_barrierback(global_State *g, GCtab *t)
 #define lj_gc_objbarrier(L, p, o) { if (iswhite(G(L), obj2gco(o)) && isblack(G(L), obj2gco(p))) lj_gc_barrierf(G(L), obj2gco(p), obj2gco(o)); }
 
 /* Allocator. */
+#define LJ_GC_CDSMALL	(sizeof(GCcdata) + 8)  /* Size of cached cdata blocks. */
+
 LJ_FUNC void *lj_mem_realloc(lua_State *L, void *p, GCSize osz, GCSize nsz);
 LJ_FUNC void * LJ_FASTCALL lj_mem_newgco(lua_State *L, GCSize size);
 LJ_FUNC void *lj_mem_grow(lua_State *L, void *p, MSize *szp, MSize lim, MSize esz);
@@ -9,6 +9,7 @@
 #include "lj_obj.h"
 #include "lj_ir.h"
 #include "lj_jit.h"
+#include "lj_vec.h"
 
 /* C call info for CALL* instructions. */
 typedef struct CCallInfo {
@@ -113,6 +114,12 @@ typedef struct CCallInfo {
 #define IRCALLCOND_FFI32(x)		NULL
 #endif
 
+#if LJ_HASVEC
+#define IRCALLCOND_VEC(x)		x
+#else
+#define IRCALLCOND_VEC(x)		NULL
+#endif
+
 #if LJ_HASBUFFER
 #define IRCALLCOND_BUFFER(x)		x
 #else
@@ -259,10 +266,14 @@ typedef struct CCallInfo {
   _(FFI,	lj_carith_powu64,	2,   N, U64, XA2_64|CCI_NOFPRCLOBBER) \
   _(FFI,	lj_cdata_newv,		4,   S, CDATA, CCI_L) \
   _(FFI,	lj_cdata_setfin,	4,   S, NIL, CCI_L) \
+  _(FFI,	lj_cdata_pool_grow,	2,   S, PTR, CCI_L) \
+  _(FFI,	lj_cdata_totab,		4,   A, TAB, CCI_L|CCI_T) \
+  _(FFI,	lj_cdata_fromtab,	5,   S, NIL, CCI_L|CCI_T) \
   _(FFI,	strlen,			1,   L, INTP, 0) \
   _(FFI,	memcpy,			3,   S, PTR, 0) \
   _(FFI,	memset,			3,   S, PTR, 0) \
   _(FFI,	lj_vm_errno,		0,   S, INT, CCI_NOFPRCLOBBER) \
+  _(VEC,	lj_vec_loop,		9,   S, INT, 0) \
   _(FFI32,	lj_carith_mul64,	2,   N, I64, XA2_64|CCI_NOFPRCLOBBER) \
   _(FFI32,	lj_carith_shl64,	2,   N, U64, XA_64|CCI_NOFPRCLOBBER) \
   _(FFI32,	lj_carith_shr64,	2,   N, U64, XA_64|CCI_NOFPRCLOBBER) \
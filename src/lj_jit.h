@@ -74,9 +74,9 @@
 
 #endif
 
-/* Optimization flags. 12 bits. */
+/* Optimization flags. 16 bits. */
 #define JIT_F_OPT		0x00010000
-#define JIT_F_OPT_MASK		0x0fff0000
+#define JIT_F_OPT_MASK		0xffff0000
 
 #define JIT_F_OPT_FOLD		(JIT_F_OPT << 0)
 #define JIT_F_OPT_CSE		(JIT_F_OPT << 1)
@@ -89,10 +89,12 @@
 #define JIT_F_OPT_SINK		(JIT_F_OPT << 8)
 #define JIT_F_OPT_FUSE		(JIT_F_OPT << 9)
 #define JIT_F_OPT_FMA		(JIT_F_OPT << 10)
+#define JIT_F_OPT_VEC		(JIT_F_OPT << 11)
+#define JIT_F_OPT_RALIVE	(JIT_F_OPT << 12)
 
 /* Optimizations names for -O. Must match the order above. */
 #define JIT_F_OPTSTRING	\
-  "\4fold\3cse\3dce\3fwd\3dse\6narrow\4loop\3abc\4sink\4fuse\3fma"
+  "\4fold\3cse\3dce\3fwd\3dse\6narrow\4loop\3abc\4sink\4fuse\3fma\3vec\6ralive"
 
 /* Optimization levels set a fixed combination of flags. */
 #define JIT_F_OPT_0	0
@@ -101,7 +103,7 @@
 #define JIT_F_OPT_3	(JIT_F_OPT_2|\
   JIT_F_OPT_FWD|JIT_F_OPT_DSE|JIT_F_OPT_ABC|JIT_F_OPT_SINK|JIT_F_OPT_FUSE)
 #define JIT_F_OPT_DEFAULT	JIT_F_OPT_3
-/* Note: FMA is not set by default. */
+/* Note: FMA and VEC are not set by default. */
 
 /* -- JIT engine parameters ----------------------------------------------- */
 #if LJ_TARGET_PSP2
@@ -295,6 +297,9 @@ typedef struct GCtrace {
   uint8_t topslot;	/* Top stack slot already checked to be allocated. */
   uint8_t linktype;	/* Type of link. */
   uint8_t unused1;
+  uint32_t exitcount;	/* Number of taken exits (decays on eviction). */
+  uint16_t nspill;	/* Number of spilled IR instructions. */
+  uint16_t nreload;	/* Number of reloads from spill slots. */
 #ifdef LUAJIT_USE_GDBJIT
   void *gdbjit_entry;	/* GDB JIT entry. */
 #endif
@@ -483,6 +488,8 @@ typedef struct jit_State {
   GCRef *trace;		/* Array of traces. */
   TraceNo freetrace;	/* Start of scan for next free trace. */
   MSize sizetrace;	/* Size of trace array. */
+  uint32_t *evictbuf;	/* Scratch buffer for mcode eviction. */
+  MSize sizeevictbuf;	/* Size of eviction buffer. */
   IRRef1 ktrace;	/* Reference to KGC with GCtrace. */
 
   IRRef1 chain[IR__MAX];  /* IR instruction skip-list chain anchors. */
@@ -89,6 +89,45 @@ static void lex_newline(LexState *ls)
     lj_lex_error(ls, ls->tok, LJ_ERR_XLINES);
 }
 
+/* -- Bulk scanning ------------------------------------------------------- */
+
+/* The bulk scanners work directly on the buffered input chunk [p, pe).
+** The current char ls->c is always the one at p[-1], unless it's LEX_EOF.
+*/
+
+/* Scan an identifier that ends inside the buffered chunk. Returns length. */
+static LJ_AINLINE MSize lex_scanident(LexState *ls)
+{
+  const char *p = ls->p, *pe = ls->pe;
+  MSize len;
+  while (p < pe && lj_char_isident((uint8_t)*p)) p++;
+  if (LJ_UNLIKELY(p >= pe)) return 0;  /* May continue in next chunk. */
+  len = (MSize)(p - ls->p) + 1;
+  ls->c = (LexChar)(uint8_t)*p;
+  ls->p = p + 1;
+  return len;
+}
+
+/* Skip horizontal whitespace. */
+static void lex_skipspace(LexState *ls)
+{
+  const char *p = ls->p, *pe = ls->pe;
+  while (p < pe && (*p == ' ' || *p == '\t')) p++;
+  ls->p = p;
+  lex_next(ls);
+}
+
+/* Skip the rest of a line, but not the line break. */
+static void lex_skipline(LexState *ls)
+{
+  while (!lex_iseol(ls) && ls->c != LEX_EOF) {
+    const char *p = ls->p, *pe = ls->pe;
+    while (p < pe && *p != '\n' && *p != '\r') p++;
+    ls->p = p;
+    lex_next(ls);
+  }
+}
+
 /* -- Scanner for terminals ----------------------------------------------- */
 
 /* Parse a number literal. */
@@ -294,15 +333,21 @@ static LexToken lex_scan(LexState *ls, TValue *tv)
   for (;;) {
     if (lj_char_isident(ls->c)) {
       GCstr *s;
+      MSize len;
       if (lj_char_isdigit(ls->c)) {  /* Numeric literal. */
 	lex_number(ls, tv);
 	return TK_number;
       }
       /* Identifier or reserved word. */
-      do {
-	lex_savenext(ls);
-      } while (lj_char_isident(ls->c));
-      s = lj_parse_keepstr(ls, ls->sb.b, sbuflen(&ls->sb));
+      len = lex_scanident(ls);
+      if (LJ_LIKELY(len)) {
+	s = lj_parse_keepstr(ls, ls->p - 1 - len, len);
+      } else {
+	do {
+	  lex_savenext(ls);
+	} while (lj_char_isident(ls->c));
+	s = lj_parse_keepstr(ls, ls->sb.b, sbuflen(&ls->sb));
+      }
       setstrV(ls->L, tv, s);
       if (s->reserved > 0)  /* Reserved word? */
 	return TK_OFS + s->reserved;
@@ -317,7 +362,7 @@ static LexToken lex_scan(LexState *ls, TValue *tv)
     case '\t':
     case '\v':
     case '\f':
-      lex_next(ls);
+      lex_skipspace(ls);
       continue;
     case '-':
       lex_next(ls);
@@ -333,8 +378,7 @@ static LexToken lex_scan(LexState *ls, TValue *tv)
 	}
       }
       /* Short comment "--.*\n". */
-      while (!lex_iseol(ls) && ls->c != LEX_EOF)
-	lex_next(ls);
+      lex_skipline(ls);
       continue;
     case '[': {
       int sep = lex_skipeq(ls);
@@ -517,6 +561,10 @@ void lj_lex_error(LexState *ls, LexToken tok, ErrMsg em, ...)
   if (tok == 0) {
     tokstr = NULL;
   } else if (tok == TK_name || tok == TK_string || tok == TK_number) {
+    if (tok == TK_name && !sbuflen(&ls->sb)) {  /* Scanned in place. */
+      TValue *tv = ls->lookahead != TK_eof ? &ls->lookaheadval : &ls->tokval;
+      if (tvisstr(tv)) lj_buf_putstr(&ls->sb, strV(tv));
+    }
     lex_save(ls, '\0');
     tokstr = ls->sb.b;
   } else {
@@ -74,6 +74,7 @@ typedef struct LexState {
   MSize sizebcstack;	/* Size of bytecode stack. */
   uint32_t level;	/* Syntactical nesting level. */
   int endmark;		/* Trust bytecode end marker, even if not at EOF. */
+  int persist;		/* Input outlives the VM: reference debug info in place. */
   int fr2;		/* Generate bytecode for LJ_FR2 mode. */
 } LexState;
 
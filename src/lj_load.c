@@ -68,6 +68,7 @@ LUA_API int lua_loadx(lua_State *L, lua_Reader reader, void *data,
   ls.rdata = data;
   ls.chunkarg = chunkname ? chunkname : "?";
   ls.mode = mode;
+  ls.persist = 0;
   lj_buf_init(L, &ls.sb);
   status = lj_vm_cpcall(L, NULL, &ls, cpparser);
   lj_lex_cleanup(L, &ls);
@@ -168,6 +169,29 @@ LUALIB_API int luaL_loadstring(lua_State *L, const char *s)
   return luaL_loadbuffer(L, s, strlen(s), s);
 }
 
+/* Load from memory which stays valid and unmodified until the VM is closed.
+** The debug info of bytecode prototypes is referenced in place, not copied.
+*/
+int lj_load_persistent(lua_State *L, const char *buf, size_t size,
+		       const char *chunkname)
+{
+  StringReaderCtx ctx;
+  LexState ls;
+  int status;
+  ctx.str = buf;
+  ctx.size = size;
+  ls.rfunc = reader_string;
+  ls.rdata = &ctx;
+  ls.chunkarg = chunkname ? chunkname : "?";
+  ls.mode = NULL;
+  ls.persist = 1;
+  lj_buf_init(L, &ls.sb);
+  status = lj_vm_cpcall(L, NULL, &ls, cpparser);
+  lj_lex_cleanup(L, &ls);
+  lj_gc_check(L);
+  return status;
+}
+
 /* -- Dump bytecode ------------------------------------------------------- */
 
 LUA_API int lua_dump(lua_State *L, lua_Writer writer, void *data)
@@ -366,6 +366,29 @@ void lj_mcode_free(jit_State *J)
   }
 }
 
+/* Free a single MCode area other than the current one. */
+void lj_mcode_freearea(jit_State *J, MCode *area)
+{
+  MCode *mc = J->mcarea;
+  lj_assertJ(area != mc, "cannot free current MCode area");
+  while (mc) {
+    MCode *next = ((MCLink *)mc)->next;
+    if (next == area) {
+      size_t sz = ((MCLink *)area)->size;
+      /* Unlink from chain. The link lives in the (protected) area itself. */
+      lj_mcode_patch(J, mc, 0);
+      ((MCLink *)mc)->next = ((MCLink *)area)->next;
+      lj_mcode_patch(J, mc, 1);
+      J->szallmcarea -= sz;
+      lj_err_deregister_mcode(area, sz, (uint8_t *)area + sizeof(MCLink));
+      mcode_free(J, area, sz);
+      return;
+    }
+    mc = next;
+  }
+  lj_assertJ(0, "MCode area not in chain");
+}
+
 /* -- MCode transactions -------------------------------------------------- */
 
 /* Reserve the remainder of the current MCode area. */
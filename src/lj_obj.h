@@ -343,6 +343,7 @@ enum {
   UDTYPE_IO_FILE,	/* I/O library FILE. */
   UDTYPE_FFI_CLIB,	/* FFI C library namespace. */
   UDTYPE_BUFFER,	/* String buffer. */
+  UDTYPE_FFI_POOL,	/* FFI memory pool. */
   UDTYPE__MAX
 };
 
@@ -429,6 +430,7 @@ typedef struct GCproto {
 #define proto_bc(pt)		((BCIns *)((char *)(pt) + sizeof(GCproto)))
 #define proto_bcpos(pt, pc)	((BCPos)((pc) - proto_bc(pt)))
 #define proto_uv(pt)		(mref((pt)->uv, uint16_t))
+#define proto_islazy(pt)	((pt)->sizebc == 0)  /* Not decoded, yet. */
 
 #define proto_chunkname(pt)	(strref((pt)->chunkname))
 #define proto_chunknamestr(pt)	(strdata(proto_chunkname((pt))))
@@ -676,6 +678,10 @@ typedef struct GCState {
 
   /* Huge string list. Chains with 'gray' */
   GCArenaHdr *str_huge;
+
+  /* Freed 64 bit scalar cdata blocks. Chains with 'nextgc' */
+  GCRef cdfree;
+  MSize cdfreenum;
 } GCState;
 
 /* String interning state. */
@@ -12,12 +12,14 @@
 
 #include "lj_err.h"
 #include "lj_buf.h"
+#include "lj_str.h"
 #include "lj_ir.h"
 #include "lj_jit.h"
 #include "lj_iropt.h"
 #include "lj_trace.h"
 #include "lj_snap.h"
 #include "lj_vm.h"
+#include "lj_ircall.h"
 
 /* Loop optimization:
 **
@@ -259,6 +261,15 @@ typedef struct LoopState {
   jit_State *J;
   IRRef1 *subst;
   MSize sizesubst;
+  IRRef nins;		/* State before loop optimization. */
+  SnapNo nsnap;
+  MSize nsnapmap;
+#if LJ_HASVEC
+  IRRef vecref;		/* Start of vector kernel call or 0. */
+  IRRef ivref;		/* Loop index before the kernel call. */
+  IRRef ivnew;		/* Loop index returned by the kernel call. */
+  TRef ivtr;		/* Original slot value of the loop index. */
+#endif
 } LoopState;
 
 /* Unroll loop. */
@@ -271,7 +282,7 @@ static void loop_unroll(LoopState *lps)
   SnapNo onsnap;
   SnapShot *osnap, *loopsnap;
   SnapEntry *loopmap, *psentinel;
-  IRRef ins, invar;
+  IRRef ins, insend, invar;
 
   /* Allocate substitution table.
   ** Only non-constant refs in [REF_BIAS,invar) are valid indexes.
@@ -281,6 +292,11 @@ static void loop_unroll(LoopState *lps)
   lps->subst = lj_mem_newvec(J->L, lps->sizesubst, IRRef1);
   subst = lps->subst - REF_BIAS;
   subst[REF_BASE] = REF_BASE;
+#if LJ_HASVEC
+  insend = lps->vecref ? lps->vecref : invar;  /* Don't copy kernel call. */
+#else
+  insend = invar;
+#endif
 
   /* LOOP separates the pre-roll from the loop body. */
   emitir_raw(IRTG(IR_LOOP, IRT_NIL), 0, 0);
@@ -308,7 +324,7 @@ static void loop_unroll(LoopState *lps)
   osnap = &J->cur.snap[1];
 
   /* Copy and substitute all recorded instructions and snapshots. */
-  for (ins = REF_FIRST; ins < invar; ins++) {
+  for (ins = REF_FIRST; ins < insend; ins++) {
     IRIns *ir;
     IRRef op1, op2;
 
@@ -376,6 +392,10 @@ static void loop_unroll(LoopState *lps)
     J->cur.nsnapmap = (uint32_t)J->cur.snap[--J->cur.nsnap].mapofs;
   lj_assertJ(J->cur.nsnapmap <= J->sizesnapmap, "bad snapshot map index");
   *psentinel = J->cur.snapmap[J->cur.snap[0].nent];  /* Restore PC. */
+#if LJ_HASVEC
+  if (lps->vecref)  /* The loop index continues from the kernel result. */
+    subst[lps->ivnew] = subst[lps->ivref];
+#endif
 
   loop_emit_phi(J, subst, phi, nphi, onsnap);
 }
@@ -403,11 +423,325 @@ static void loop_undo(jit_State *J, IRRef ins, SnapNo nsnap, MSize nsnapmap)
   }
 }
 
+/* -- Loop vectorization -------------------------------------------------- */
+
+#if LJ_HASVEC
+
+/* Simple loops over FFI arrays of doubles can be run in blocks by a
+** vector kernel (see lj_vec.c). The kernel is called from the end of the
+** pre-roll, returns the new loop index and the compiled loop handles the
+** remaining iterations. All of this needs a loop body with:
+**
+** - A single integer PHI, the loop index, which is incremented by one.
+** - The loop exit test as the only guard.
+** - Only num loads, stores and arithmetic, plus address arithmetic.
+** - Every load and store address is invariant base + k + 8*(index + k).
+*/
+
+typedef struct VecState {
+  IRRef loopref;		/* LOOP instruction. */
+  IRRef iv;			/* Loop index at the start of the body. */
+  IRRef stop;			/* Loop limit. */
+  uint32_t nptr, nnum, nk, nreg, nins, nstore;
+  IRRef1 ptr[VEC_MAXPTR];	/* Base pointers. */
+  IRRef1 num[VEC_MAXNUM];	/* Invariant numbers. */
+  IRRef1 k[VEC_MAXK];		/* Number constants. */
+  IRRef1 reg[VEC_MAXREG];	/* Variant numbers. */
+  uint32_t regst[VEC_MAXREG];	/* Held in array until this store or 0. */
+  VecIns ins[VEC_MAXINS];	/* Kernel program. */
+} VecState;
+
+/* Map num operand to kernel register. Returns -1 if not possible. */
+static int loop_vec_operand(jit_State *J, VecState *vs, IRRef ref)
+{
+  IRIns *ir = IR(ref);
+  uint32_t i;
+  if (!irt_isnum(ir->t)) return -1;
+  if (irref_isk(ref)) {
+    for (i = 0; i < vs->nk; i++)
+      if (vs->k[i] == ref) return VEC_REGK+i;
+    if (vs->nk >= VEC_MAXK) return -1;
+    vs->k[vs->nk] = (IRRef1)ref;
+    return VEC_REGK + vs->nk++;
+  } else if (ref < vs->loopref) {
+    for (i = 0; i < vs->nnum; i++)
+      if (vs->num[i] == ref) return VEC_REGNUM+i;
+    if (vs->nnum >= VEC_MAXNUM) return -1;
+    vs->num[vs->nnum] = (IRRef1)ref;
+    return VEC_REGNUM + vs->nnum++;
+  } else {
+    for (i = 0; i < vs->nreg; i++)
+      if (vs->reg[i] == ref)
+	return vs->regst[i] && vs->nstore >= vs->regst[i] ? -1 : (int)i;
+    return -1;
+  }
+}
+
+/* Allocate kernel register for the result of a body instruction. */
+static int loop_vec_dest(VecState *vs, IRRef ref, uint32_t st)
+{
+  if (vs->nreg >= VEC_MAXREG) return -1;
+  vs->reg[vs->nreg] = (IRRef1)ref;
+  vs->regst[vs->nreg] = st;
+  return (int)vs->nreg++;
+}
+
+/* Decompose address into base pointer, constant offset and scaled index. */
+static int loop_vec_addr(jit_State *J, VecState *vs, IRRef ref,
+			 IRRef *base, int64_t *ofs, int *nidx, int depth)
+{
+  IRIns *ir = IR(ref);
+  if (depth > 8) return 0;
+  if (irref_isk(ref)) {
+    if (ir->o == IR_KINT) *ofs += ir->i;
+    else if (ir->o == IR_KINT64) *ofs += (int64_t)ir_kint64(ir)->u64;
+    else return 0;
+    return 1;
+  } else if (ref < vs->loopref) {  /* Invariant base pointer. */
+    if (*base || !(irt_type(ir->t) == IRT_P64 || irt_iscdata(ir->t)))
+      return 0;
+    *base = ref;
+    return 1;
+  } else if (ir->o == IR_ADD) {
+    return loop_vec_addr(J, vs, ir->op1, base, ofs, nidx, depth+1) &&
+	   loop_vec_addr(J, vs, ir->op2, base, ofs, nidx, depth+1);
+  } else if (ir->o == IR_BSHL && irref_isk(ir->op2) &&
+	     IR(ir->op2)->o == IR_KINT && IR(ir->op2)->i == 3) {
+    IRRef idx = ir->op1;
+    int32_t k = 0;
+    if (idx > vs->loopref && IR(idx)->o == IR_CONV) idx = IR(idx)->op1;
+    if (idx > vs->loopref && IR(idx)->o == IR_ADD && irref_isk(IR(idx)->op2) &&
+	IR(IR(idx)->op2)->o == IR_KINT) {
+      k = IR(IR(idx)->op2)->i;
+      idx = IR(idx)->op1;
+    }
+    if (idx > vs->loopref && IR(idx)->o == IR_CONV) idx = IR(idx)->op1;
+    if (idx != vs->iv) return 0;
+    *ofs += (int64_t)k*8;
+    (*nidx)++;
+    return 1;
+  }
+  return 0;
+}
+
+/* Emit kernel load or store. */
+static int loop_vec_mem(jit_State *J, VecState *vs, VecIns *vi, IRRef addr)
+{
+  IRRef base = 0;
+  int64_t ofs = 0;
+  int nidx = 0;
+  uint32_t i;
+  if (!loop_vec_addr(J, vs, addr, &base, &ofs, &nidx, 0) ||
+      !base || nidx != 1 || ofs != (int64_t)(int32_t)ofs)
+    return 0;
+  for (i = 0; i < vs->nptr; i++)
+    if (vs->ptr[i] == base) break;
+  if (i == vs->nptr) {
+    if (vs->nptr >= VEC_MAXPTR) return 0;
+    vs->ptr[vs->nptr++] = (IRRef1)base;
+  }
+  vi->a = (uint8_t)i;
+  vi->ofs = (int32_t)ofs;
+  return 1;
+}
+
+/* Analyze the unrolled loop and build the kernel program. */
+static int loop_vec_analyze(LoopState *lps, VecState *vs)
+{
+  jit_State *J = lps->J;
+  IRRef1 *subst = lps->subst - REF_BIAS;
+  IRRef ref, nins = J->cur.nins, inc, guard;
+  IRIns *ir;
+  SnapShot *snap;
+  SnapEntry *map;
+  MSize n;
+  memset(vs, 0, offsetof(VecState, ins));
+  vs->loopref = J->chain[IR_LOOP];
+  /* Single PHI for the loop index, which is incremented by one. */
+  ir = IR(nins-1);
+  if (ir->o != IR_PHI || IR(nins-2)->o == IR_PHI || !irt_isint(ir->t))
+    return 0;
+  vs->iv = ir->op1;
+  inc = ir->op2;
+  ir = IR(inc);
+  if (ir->o != IR_ADD || ir->op1 != vs->iv || !irref_isk(ir->op2) ||
+      IR(ir->op2)->o != IR_KINT || IR(ir->op2)->i != 1)
+    return 0;
+  /* Loop exit test against an invariant limit. */
+  guard = nins-2;
+  ir = IR(guard);
+  if (ir->o != IR_LE || !irt_isguard(ir->t) || ir->op1 != inc ||
+      ir->op2 >= vs->loopref || !irt_isint(IR(ir->op2)->t))
+    return 0;
+  vs->stop = ir->op2;
+  /* The loop snapshot must not hold any other variant value. */
+  snap = &J->cur.snap[lps->nsnap-1];
+  map = &J->cur.snapmap[snap->mapofs];
+  for (n = 0; n < snap->nent; n++) {
+    ref = snap_ref(map[n]);
+    if (!irref_isk(ref) && ref != vs->iv && subst[ref] != ref)
+      return 0;
+  }
+  /* Translate the loop body. */
+  for (ref = vs->loopref+1; ref < guard; ref++) {
+    VecIns *vi = &vs->ins[vs->nins];
+    int a = 0, b = 0, d = 0;
+    ir = IR(ref);
+    if (ref == inc) continue;
+    if (irt_isguard(ir->t) || vs->nins >= VEC_MAXINS) return 0;
+    vi->dst = vi->a = vi->b = 0;
+    vi->ofs = 0;
+    switch (ir->o) {
+    case IR_XLOAD:
+      if (!irt_isnum(ir->t) || ir->op2 || !loop_vec_mem(J, vs, vi, ir->op1))
+	return 0;
+      vi->op = VEC_LOAD;
+      d = loop_vec_dest(vs, ref, vs->nstore+1);  /* Read in place. */
+      break;
+    case IR_XSTORE:
+      if (!irt_isnum(IR(ir->op2)->t) || !loop_vec_mem(J, vs, vi, ir->op1))
+	return 0;
+      vi->op = VEC_STORE;
+      b = loop_vec_operand(J, vs, ir->op2);
+      if (b >= 0 && vs->nins && vi[-1].op >= VEC_ADD && vi[-1].dst == b)
+	vs->regst[b] = vs->nstore+2;  /* Computed in place. */
+      vs->nstore++;
+      break;
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+      if (!irt_isnum(ir->t)) continue;  /* Address arithmetic. */
+      vi->op = (uint8_t)(VEC_ADD + (ir->o - IR_ADD));  /* ORDER ARITH */
+      a = loop_vec_operand(J, vs, ir->op1);
+      b = loop_vec_operand(J, vs, ir->op2);
+      d = loop_vec_dest(vs, ref, 0);
+      break;
+    case IR_NEG: case IR_ABS:
+      if (!irt_isnum(ir->t)) return 0;
+      vi->op = ir->o == IR_NEG ? VEC_NEG : VEC_ABS;
+      a = loop_vec_operand(J, vs, ir->op1);
+      d = loop_vec_dest(vs, ref, 0);
+      break;
+    case IR_BSHL: case IR_CONV:
+      if (irt_isnum(ir->t)) return 0;
+      continue;  /* Address arithmetic. */
+    default:
+      return 0;
+    }
+    if (a < 0 || b < 0 || d < 0) return 0;
+    if (vi->op != VEC_LOAD && vi->op != VEC_STORE) vi->a = (uint8_t)a;
+    vi->b = (uint8_t)b;
+    vi->dst = (uint8_t)d;
+    vs->nins++;
+  }
+  return vs->nstore > 0;
+}
+
+/* Add a copy of the loop snapshot with the loop index after the kernel. */
+static void loop_vec_snap(jit_State *J, IRRef ivref, IRRef ivnew)
+{
+  SnapNo nsnap = J->cur.nsnap;
+  MSize mapofs = J->cur.nsnapmap, sz, n;
+  SnapShot *snap;
+  SnapEntry *omap, *nmap;
+  lj_snap_grow_buf(J, nsnap+1);
+  sz = mapofs - J->cur.snap[nsnap-1].mapofs;  /* Entries + PC + frames. */
+  lj_snap_grow_map(J, mapofs+sz);
+  snap = &J->cur.snap[nsnap];
+  *snap = snap[-1];
+  snap->mapofs = (uint32_t)mapofs;
+  snap->ref = (IRRef1)J->cur.nins;
+  snap->mcofs = 0;
+  snap->count = 0;
+  omap = &J->cur.snapmap[snap[-1].mapofs];
+  nmap = &J->cur.snapmap[mapofs];
+  for (n = 0; n < sz; n++) {
+    SnapEntry sn = omap[n];
+    if (n < snap->nent && snap_ref(sn) == ivref)
+      sn = snap_setref(sn, ivnew);
+    nmap[n] = sn;
+  }
+  J->cur.nsnap = nsnap+1;
+  J->cur.nsnapmap = mapofs+sz;
+}
+
+/* Try to vectorize the unrolled loop. Returns 1 if it must be unrolled again. */
+static int loop_vec(LoopState *lps)
+{
+  jit_State *J = lps->J;
+  VecState vs;
+  VecProg vp;
+  char buf[sizeof(VecProg)+VEC_MAXK*sizeof(double)+VEC_MAXINS*sizeof(VecIns)];
+  char *p = buf;
+  GCstr *prog;
+  TRef ptr[VEC_MAXPTR], num[VEC_MAXNUM], tr;
+  IRRef ivnew;
+  uint8_t needsnap;
+  BCReg s, nslots = J->baseslot+J->maxslot;
+  uint32_t i;
+  if (!loop_vec_analyze(lps, &vs))
+    return 0;
+  for (s = 0; s < nslots; s++)  /* The loop index slots must agree. */
+    if (tref_ref(J->slot[s]) == vs.iv) {
+      if (lps->ivtr && J->slot[s] != lps->ivtr) return 0;
+      lps->ivtr = J->slot[s];
+    }
+  /* Serialize the kernel program. */
+  vp.nins = vs.nins;
+  vp.nk = vs.nk;
+  memcpy(p, &vp, sizeof(VecProg)); p += sizeof(VecProg);
+  for (i = 0; i < vs.nk; i++, p += sizeof(double))
+    memcpy(p, &ir_knum(IR(vs.k[i]))->n, sizeof(double));
+  memcpy(p, vs.ins, vs.nins*sizeof(VecIns)); p += vs.nins*sizeof(VecIns);
+  prog = lj_str_new(J->L, buf, (size_t)(p - buf));
+  /* Discard the unrolled loop and call the kernel at the end of the pre-roll. */
+  lj_mem_freevec(J2G(J), lps->subst, lps->sizesubst, IRRef1);
+  lps->subst = NULL;
+  lps->sizesubst = 0;
+  loop_undo(J, lps->nins, lps->nsnap, lps->nsnapmap);
+  for (i = 0; i < VEC_MAXPTR; i++)
+    ptr[i] = i < vs.nptr ? TREF(vs.ptr[i], irt_type(IR(vs.ptr[i])->t)) :
+			   lj_ir_kptr(J, NULL);
+  for (i = 0; i < VEC_MAXNUM; i++)
+    num[i] = i < vs.nnum ? TREF(vs.num[i], IRT_NUM) : lj_ir_knum_zero(J);
+  needsnap = J->needsnap;
+  tr = lj_ir_call(J, IRCALL_lj_vec_loop, lj_ir_kstr(J, prog),
+		  TREF(vs.iv, IRT_INT), TREF(vs.stop, IRT_INT),
+		  ptr[0], ptr[1], ptr[2], ptr[3], num[0], num[1]);
+  emitir(IRT(IR_XBAR, IRT_NIL), 0, 0);  /* Kernel stores invalidate loads. */
+  J->needsnap = needsnap;
+  ivnew = tref_ref(tr);
+  loop_vec_snap(J, vs.iv, ivnew);
+  /* The copied loop body starts with the loop index after the kernel. */
+  for (s = 0; s < nslots; s++)
+    if (J->slot[s] == lps->ivtr)
+      J->slot[s] = TREF(ivnew, IRT_INT);
+  lps->vecref = lps->nins;
+  lps->ivref = vs.iv;
+  lps->ivnew = ivnew;
+  return 1;
+}
+
+/* Restore slots changed by loop vectorization. */
+static void loop_vec_restore(LoopState *lps)
+{
+  jit_State *J = lps->J;
+  BCReg s, nslots = J->baseslot+J->maxslot;
+  for (s = 0; s < nslots; s++)
+    if (J->slot[s] == TREF(lps->ivnew, IRT_INT))
+      J->slot[s] = lps->ivtr;
+}
+
+#endif
+
 /* Protected callback for loop optimization. */
 static TValue *cploop_opt(lua_State *L, lua_CFunction dummy, void *ud)
 {
+  LoopState *lps = (LoopState *)ud;
   UNUSED(L); UNUSED(dummy);
-  loop_unroll((LoopState *)ud);
+  loop_unroll(lps);
+#if LJ_HASVEC
+  if ((lps->J->flags & JIT_F_OPT_VEC) && loop_vec(lps))
+    loop_unroll(lps);  /* Unroll again behind the kernel call. */
+#endif
   return NULL;
 }
 
@@ -422,8 +756,19 @@ int lj_opt_loop(jit_State *J)
   lps.J = J;
   lps.subst = NULL;
   lps.sizesubst = 0;
+  lps.nins = nins;
+  lps.nsnap = nsnap;
+  lps.nsnapmap = nsnapmap;
+#if LJ_HASVEC
+  lps.vecref = 0;
+  lps.ivtr = 0;
+#endif
   errcode = lj_vm_cpcall(J->L, NULL, &lps, cploop_opt);
   lj_mem_freevec(J2G(J), lps.subst, lps.sizesubst, IRRef1);
+#if LJ_HASVEC
+  if (lps.vecref)
+    loop_vec_restore(&lps);
+#endif
   if (LJ_UNLIKELY(errcode)) {
     lua_State *L = J->L;
     if (errcode == LUA_ERRRUN && tvisnumber(L->top-1)) {  /* Trace error? */
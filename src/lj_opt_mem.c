@@ -391,6 +391,91 @@ doemit:
   return EMITFOLD;  /* Otherwise we have a conflict or simply no match. */
 }
 
+/* Max. number of different array stores tracked for ALEN of allocations. */
+#define FWD_ALEN_MAXST	16
+
+/* Check whether a numeric key might be stored into a new table. */
+static int fwd_alen_numkey(jit_State *J, IRRef tab, IRRef t, IRIns *key)
+{
+  if (key->o == IR_KSLOT) key = IR(key->op1);
+  return (irt_isnum(key->t) || irt_isint(key->t)) &&
+	 (t == tab || aa_table(J, tab, t) != ALIAS_NO);
+}
+
+/* Const-fold ALEN of TNEW/TDUP with constant array stores. Returns -1 if
+** the contents are not fully known or the table has no unique border.
+*/
+static int32_t fwd_alen_new(jit_State *J, IRRef tab)
+{
+  IRIns *ir = IR(tab);
+  GCtab *kt = ir->o == IR_TDUP ? ir_ktab(IR(ir->op1)) : NULL;
+  int32_t idx[FWD_ALEN_MAXST], len;
+  uint8_t notnil[FWD_ALEN_MAXST];
+  uint32_t i, nst = 0;
+  IRRef ref;
+  if (!fwd_aa_tab_clear(J, tab, tab))
+    return -1;
+  /* Numeric keys in the hash part are not tracked. */
+  for (ref = J->chain[IR_NEWREF]; ref > tab; ref = IR(ref)->prev)
+    if (fwd_alen_numkey(J, tab, IR(ref)->op1, IR(IR(ref)->op2)))
+      return -1;
+  for (ref = J->chain[IR_HSTORE]; ref > tab; ref = IR(ref)->prev) {
+    IRIns *href = IR(IR(ref)->op1);
+    if (fwd_alen_numkey(J, tab, href->op1, IR(href->op2)))
+      return -1;
+  }
+  /* Collect the most recent store for each array index. */
+  for (ref = J->chain[IR_ASTORE]; ref > tab; ref = IR(ref)->prev) {
+    IRIns *store = IR(ref);
+    IRIns *aref = IR(store->op1);
+    IRRef t = IR(aref->op1)->op1;
+    if (t == tab) {
+      IRIns *key = IR(aref->op2);
+      if (key->o != IR_KINT)
+	return -1;
+      for (i = 0; i < nst; i++)
+	if (idx[i] == key->i) break;
+      if (i == nst) {
+	if (nst >= FWD_ALEN_MAXST)
+	  return -1;
+	idx[nst] = key->i;
+	notnil[nst++] = !irt_isnil(store->t);
+      }
+    } else if (aa_table(J, tab, t) != ALIAS_NO) {
+      return -1;
+    }
+  }
+  /* Find the border and check that it's unique. */
+  for (len = 0; ; len++) {
+    for (i = 0; i < nst; i++)
+      if (idx[i] == len+1) break;
+    if (i < nst) {
+      if (!notnil[i]) break;
+    } else {
+      cTValue *tv = kt ? lj_tab_getint(kt, len+1) : NULL;
+      if (!tv || tvisnil(tv)) break;
+    }
+  }
+  for (i = 0; i < nst; i++)
+    if (notnil[i] && idx[i] > len)
+      return -1;
+  if (kt) {
+    Node *node = noderef(kt->node);
+    for (i = (uint32_t)len+1; i < kt->asize; i++)
+      if (!tvisnil(arrayslot(kt, i))) {
+	uint32_t j;
+	for (j = 0; j < nst; j++)
+	  if (idx[j] == (int32_t)i) break;
+	if (j == nst || notnil[j])
+	  return -1;
+      }
+    for (i = 0; i <= kt->hmask; i++)
+      if (!tvisnil(&node[i].val) && tvisnumber(&node[i].key))
+	return -1;
+  }
+  return len;
+}
+
 /* ALEN forwarding. */
 TRef LJ_FASTCALL lj_opt_fwd_alen(jit_State *J)
 {
@@ -398,6 +483,13 @@ TRef LJ_FASTCALL lj_opt_fwd_alen(jit_State *J)
   IRRef lim = tab;  /* Search limit. */
   IRRef ref;
 
+  /* Const-fold the length of new tables with known contents. */
+  if (IR(tab)->o == IR_TNEW || IR(tab)->o == IR_TDUP) {
+    int32_t len = fwd_alen_new(J, tab);
+    if (len >= 0)
+      return lj_ir_kint(J, len);
+  }
+
   /* Search for conflicting HSTORE with numeric key. */
   ref = J->chain[IR_HSTORE];
   while (ref > lim) {
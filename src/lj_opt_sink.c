@@ -69,6 +69,36 @@ static int sink_checkphi(jit_State *J, IRIns *ira, IRRef ref)
   return 1;  /* Constant (non-PHI). */
 }
 
+#if LJ_HASFFI && LJ_64
+/* Add PHIs for the values of loop-carried CNEWI boxes.
+**
+** A boxed 64 bit value which is carried around the loop is a PHI of two
+** CNEWI, but its payload usually isn't a PHI itself, because the loop body
+** only references the box. Give the payload its own PHI, so the box can be
+** sunk and is only materialized on a side exit.
+*/
+static void sink_phi_cnewi(jit_State *J)
+{
+  IRRef ref, nins = J->cur.nins;
+  MSize nphi = 0;
+  for (ref = nins-1; IR(ref)->o == IR_PHI; ref--) nphi++;
+  for (ref = nins-1; IR(ref)->o == IR_PHI && nphi < LJ_MAX_PHI; ref--) {
+    IRIns *irl = IR(IR(ref)->op1), *irr = IR(IR(ref)->op2);
+    if (irl->o == IR_CNEWI && irr->o == IR_CNEWI && irl->op1 == irr->op1 &&
+	!irref_isk(irl->op2) && !irref_isk(irr->op2) &&
+	irl->op2 < J->loopref && irr->op2 > J->loopref &&
+	!irt_isphi(IR(irl->op2)->t) && !irt_isphi(IR(irr->op2)->t)) {
+      IRRef lref = irl->op2, rref = irr->op2;
+      lj_ir_set(J, IRT(IR_PHI, irt_type(IR(rref)->t)), lref, rref);
+      lj_ir_emit(J);
+      irt_setphi(IR(lref)->t);
+      irt_setphi(IR(rref)->t);
+      nphi++;
+    }
+  }
+}
+#endif
+
 /* Mark non-sinkable allocations using single-pass backward propagation.
 **
 ** Roots for the marking process are:
@@ -101,6 +131,12 @@ static void sink_mark_ins(jit_State *J)
       break;
       }
 #if LJ_HASFFI
+    case IR_CNEW:
+      if (!irref_isk(ir->op2)) {  /* Don't sink VLA/VLS of variable size. */
+	irt_setmark(ir->t);
+	irt_setmark(IR(ir->op2)->t);
+      }
+      break;
     case IR_CNEWI:
       if (irt_isphi(ir->t) &&
 	  (!sink_checkphi(J, ir, ir->op2) ||
@@ -246,6 +282,10 @@ void lj_opt_sink(jit_State *J)
        (LJ_HASFFI && (J->chain[IR_CNEW] || J->chain[IR_CNEWI])))) {
     if (!J->loopref)
       sink_mark_snap(J, &J->cur.snap[J->cur.nsnap-1]);
+#if LJ_HASFFI && LJ_64
+    else if (J->chain[IR_CNEWI])
+      sink_phi_cnewi(J);
+#endif
     sink_mark_ins(J);
     if (J->loopref)
       sink_remark_phi(J);
@@ -241,8 +241,10 @@ GCstr *lj_parse_keepstr(LexState *ls, const char *str, size_t len)
   /* NOBARRIER: the key is new or kept alive. */
   lua_State *L = ls->L;
   GCstr *s = lj_str_new(L, str, len);
-  TValue *tv = lj_tab_setstr(L, ls->fs->kt, s);
-  if (tvisnil(tv)) setboolV(tv, 1);
+  if (!s->reserved) {  /* Reserved words are fixed and need no anchor. */
+    TValue *tv = lj_tab_setstr(L, ls->fs->kt, s);
+    if (tvisnil(tv)) setboolV(tv, 1);
+  }
   lj_gc_check(L);
   return s;
 }
@@ -336,6 +336,15 @@ LUA_API void luaJIT_profile_start(lua_State *L, const char *mode,
   profile_timer_start(ps);
 }
 
+/* Check whether the profiler runs and who started it. */
+LUA_API int luaJIT_profile_running(lua_State *L, luaJIT_profile_callback cb,
+				   void *data)
+{
+  ProfileState *ps = &profile_state;
+  if (!ps->g) return 0;
+  return (ps->g == G(L) && ps->cb == cb && ps->data == data) ? 1 : -1;
+}
+
 /* Stop profiling. */
 LUA_API void luaJIT_profile_stop(lua_State *L)
 {
@@ -1538,10 +1538,11 @@ TRef lj_record_idx(jit_State *J, RecordIndex *ix)
 	return 0;  /* No result yet. */
       }
     }
-#if LJ_HASBUFFER
-    /* The index table of buffer objects is treated as immutable. */
-    if (ix->mt == TREF_NIL && !ix->val &&
-	tref_isudata(ix->tab) && udataV(&ix->tabv)->udtype == UDTYPE_BUFFER &&
+#if LJ_HASBUFFER || LJ_HASFFI
+    /* The index tables of buffers and FFI pools are treated as immutable. */
+    if (ix->mt == TREF_NIL && !ix->val && tref_isudata(ix->tab) &&
+	((LJ_HASBUFFER && udataV(&ix->tabv)->udtype == UDTYPE_BUFFER) ||
+	 (LJ_HASFFI && udataV(&ix->tabv)->udtype == UDTYPE_FFI_POOL)) &&
 	tref_istab(ix->mobj) && tref_isstr(ix->key) && tref_isk(ix->key)) {
       cTValue *val = lj_tab_getstr(tabV(&ix->mobjv), strV(&ix->keyv));
       TRef tr = lj_record_constify(J, val);
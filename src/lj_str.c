@@ -271,7 +271,9 @@ void lj_str_resize(lua_State *L, MSize newmask)
       do {
         for (j = 0; j < 15; j++) {
           GCstr *s = st_ref(tab->strs[j]);
-          MSize hash = st_alg(tab->strs[j]) ? hash_sparse(g->str.seed, strdata(s), s->len) : tab->hashes[j];
+          MSize hash;
+          if (!s) continue;
+          hash = st_alg(tab->strs[j]) ? hash_sparse(g->str.seed, strdata(s), s->len) : tab->hashes[j];
           newtab[hash & newmask].prev_len++;
         }
         tab = tab->next;
@@ -300,7 +302,18 @@ void lj_str_resize(lua_State *L, MSize newmask)
       for (j = 0; j < 15; j++) {
         GCstr *s = st_ref(tab->strs[j]);
         if (s) {
-          lj_str_insert(L, s, tab->hashes[j], st_alg(tab->strs[j]));
+          StrHash hash = tab->hashes[j];
+          int hashalg = (int)st_alg(tab->strs[j]);
+#if LUAJIT_SECURITY_STRHASH
+          if (hashalg) {  /* Revert to primary hash, unless still needed. */
+            StrHash shash = hash_sparse(g->str.seed, strdata(s), s->len);
+            if (!(newtab[shash & newmask].prev_len & LJ_STR_SECONDARY)) {
+              hash = shash;
+              hashalg = 0;
+            }
+          }
+#endif
+          lj_str_insert(L, s, hash, hashalg);
         }
       }
       tab = tab->next;
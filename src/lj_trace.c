@@ -315,6 +315,149 @@ int lj_trace_flushall(lua_State *L)
   return 0;
 }
 
+/* -- Trace eviction ------------------------------------------------------ */
+
+/* When the machine code budget is exhausted, evict the coldest MCode area
+** instead of flushing all traces. The unit of eviction is a trace tree,
+** i.e. a root trace plus all of its side traces, since side traces are
+** patched into the exits of their parents. Any trace which links to an
+** evicted trace must be evicted, too.
+**
+** The heat of a tree is the number of taken exits of all of its traces.
+** The heat of an area is the heat of the hottest tree with code in it.
+** The current area and areas holding shared exit stubs are never evicted.
+*/
+
+#define TRACE_EVICTED	(~(uint32_t)0)
+
+#define trace_treeno(T, i)	((T)->root ? (T)->root : (TraceNo)(i))
+
+/* Check whether an MCode area holds shared exit stubs. */
+static int trace_evict_hasstubs(jit_State *J, MCode *area, size_t sz)
+{
+  MSize i;
+  for (i = 0; i < LJ_MAX_EXITSTUBGR; i++) {
+    MCode *p = J->exitstubgroup[i];
+    if (p >= area && p < (MCode *)((char *)area + sz))
+      return 1;
+  }
+  return 0;
+}
+
+/* Pick the coldest evictable MCode area. Returns NULL if there's none. */
+static MCode *trace_evict_pick(jit_State *J, uint32_t *heat)
+{
+  MCode *area, *victim = NULL;
+  uint32_t minheat = TRACE_EVICTED;
+  for (area = ((MCLink *)J->mcarea)->next; area;
+       area = ((MCLink *)area)->next) {
+    size_t sz = ((MCLink *)area)->size;
+    uint32_t h = 0;
+    ptrdiff_t i;
+    if (trace_evict_hasstubs(J, area, sz))
+      continue;
+    for (i = 1; i < (ptrdiff_t)J->sizetrace; i++) {
+      GCtrace *T = traceref(J, i);
+      if (T && T->mcode >= area && T->mcode < (MCode *)((char *)area + sz) &&
+	  heat[trace_treeno(T, i)] > h)
+	h = heat[trace_treeno(T, i)];
+    }
+    if (h <= minheat) {  /* Prefer older areas on ties. */
+      minheat = h;
+      victim = area;
+    }
+  }
+  return victim;
+}
+
+/* Evict the coldest MCode area and all traces depending on it. */
+static int trace_evict(jit_State *J)
+{
+  lua_State *L = J->L;
+  global_State *g = J2G(J);
+  MSize sz = J->sizetrace, nevict = 0;
+  uint32_t *heat, *evicted;
+  MCode *victim;
+  ptrdiff_t i;
+  int changed;
+  if ((g->hookmask & HOOK_GC) || !J->mcarea)
+    return 0;
+  if (J->sizeevictbuf < 2*sz) {
+    /* Called on the trace abort path, so the allocation must not throw. */
+    void *p = g->allocf(g->allocd, J->evictbuf,
+			J->sizeevictbuf*sizeof(uint32_t), 2*sz*sizeof(uint32_t));
+    if (!p)
+      return 0;
+    J->evictbuf = (uint32_t *)p;
+    J->sizeevictbuf = 2*sz;
+  }
+  heat = J->evictbuf;
+  evicted = heat + sz;
+  memset(heat, 0, sz*sizeof(uint32_t));
+  for (i = 1; i < (ptrdiff_t)sz; i++) {
+    GCtrace *T = traceref(J, i);
+    if (T) {
+      TraceNo n = trace_treeno(T, i);
+      uint32_t h = heat[n] + T->exitcount;
+      heat[n] = (h < heat[n] || h == TRACE_EVICTED) ? TRACE_EVICTED-1 : h;
+    }
+  }
+  victim = trace_evict_pick(J, heat);
+  if (!victim)
+    return 0;
+  /* Mark all trees with code in the victim area. */
+  for (i = 1; i < (ptrdiff_t)sz; i++) {
+    GCtrace *T = traceref(J, i);
+    if (T && T->mcode >= victim &&
+	T->mcode < (MCode *)((char *)victim + ((MCLink *)victim)->size))
+      heat[trace_treeno(T, i)] = TRACE_EVICTED;
+  }
+  /* Propagate to all trees linking to a marked tree. */
+  do {
+    changed = 0;
+    for (i = 1; i < (ptrdiff_t)sz; i++) {
+      GCtrace *T = traceref(J, i);
+      if (T && heat[trace_treeno(T, i)] != TRACE_EVICTED &&
+	  T->link && T->link != i && T->link < sz) {
+	GCtrace *T2 = traceref(J, T->link);
+	if (T2 && heat[trace_treeno(T2, T->link)] == TRACE_EVICTED) {
+	  heat[trace_treeno(T, i)] = TRACE_EVICTED;
+	  changed = 1;
+	}
+      }
+    }
+  } while (changed);
+  /* Flush marked trees and age the survivors. */
+  for (i = (ptrdiff_t)sz-1; i > 0; i--) {
+    GCtrace *T = traceref(J, i);
+    if (T) {
+      if (heat[trace_treeno(T, i)] == TRACE_EVICTED) {
+	if (T->root == 0)
+	  trace_flushroot(J, T);
+	lj_gdbjit_deltrace(J, T);
+	T->traceno = T->link = 0;  /* Blacklist the link for cont_stitch. */
+	setgcrefnull(J->trace[i]);
+	if ((TraceNo)i < J->freetrace)
+	  J->freetrace = (TraceNo)i;
+	evicted[nevict++] = (uint32_t)i;
+      } else {
+	T->exitcount >>= 1;
+      }
+    }
+  }
+  lj_mcode_freearea(J, victim);
+  /* Report each evicted trace as flushed. No traces are recorded while the
+  ** handlers run, so the buffer stays intact.
+  */
+  for (i = 0; i < (ptrdiff_t)nevict; i++) {
+    lj_vmevent_send(L, TRACE,
+      setstrV(L, L->top++, lj_str_newlit(L, "flush"));
+      setintV(L->top++, (int32_t)evicted[i]);
+    );
+  }
+  return 1;
+}
+
 /* Initialize JIT compiler state. */
 void lj_trace_initstate(global_State *g)
 {
@@ -376,6 +519,8 @@ void lj_trace_freestate(global_State *g)
   lj_mem_freevec(g, J->snapbuf, J->sizesnap, SnapShot);
   lj_mem_freevec(g, J->irbuf + J->irbotlim, J->irtoplim - J->irbotlim, IRIns);
   lj_mem_freevec(g, J->trace, J->sizetrace, GCRef);
+  if (J->evictbuf)
+    g->allocf(g->allocd, J->evictbuf, J->sizeevictbuf*sizeof(uint32_t), 0);
 }
 
 /* -- Penalties and blacklisting ------------------------------------------ */
@@ -663,7 +808,7 @@ static int trace_abort(jit_State *J)
   L->top--;  /* Remove error object */
   if (e == LJ_TRERR_DOWNREC)
     return trace_downrec(J);
-  else if (e == LJ_TRERR_MCODEAL)
+  else if (e == LJ_TRERR_MCODEAL && !trace_evict(J))
     lj_trace_flushall(L);
 #ifdef COUNTS
   J->ntraceabort++;
@@ -922,6 +1067,8 @@ int LJ_FASTCALL lj_trace_exit(jit_State *J, void *exptr)
   }
 #endif
   lj_assertJ(T != NULL && J->exitno < T->nsnap, "bad trace or exit number");
+  if (LJ_LIKELY(T->exitcount < 0x7fffffffu))
+    T->exitcount++;
   exd.J = J;
   exd.exptr = exptr;
   errcode = lj_vm_cpcall(L, NULL, &exd, trace_exit_cp);
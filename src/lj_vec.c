@@ -0,0 +1,172 @@
+/*
+** Vectorized loop kernels.
+** Copyright (C) 2005-2023 Mike Pall. See Copyright Notice in luajit.h
+*/
+
+#define lj_vec_c
+#define LUA_CORE
+
+#include <math.h>
+
+#include "lj_obj.h"
+#include "lj_vec.h"
+
+#if LJ_HASVEC
+
+/* The loop optimizer turns simple loops over FFI arrays of doubles into
+** a kernel program, which is run by lj_vec_loop() before entering the
+** compiled loop. The kernel applies every instruction to a whole block
+** of elements before going on to the next one. Elements with the same
+** address are accessed in the same order as by the scalar loop, so this
+** is only valid if the accessed ranges do not partially overlap, which
+** is checked at runtime.
+**
+** Loaded values are read in place and results that are stored right
+** away are computed in place. The loop optimizer ensures such values are
+** not used after any later store.
+**
+** The kernel leaves at least one iteration to the compiled loop, which
+** also handles the remaining iterations that do not fill a block.
+*/
+
+#define VEC_W		4		/* Lanes per vector. */
+#define VEC_NV		32		/* Vectors per block. */
+#define VEC_BLOCK	(VEC_W*VEC_NV)	/* Elements per block. */
+
+#if defined(__GNUC__) || defined(__clang__)
+typedef double VecV __attribute__((vector_size(VEC_W*sizeof(double))));
+typedef int64_t VecI __attribute__((vector_size(VEC_W*sizeof(int64_t))));
+/* Operands may point into unaligned arrays. */
+typedef double VecU __attribute__((vector_size(VEC_W*sizeof(double)),
+				   aligned(sizeof(double)), may_alias));
+#define vec_lane(v, k)		((v)[k])
+#define vec_store(p, x)		(*(VecU *)(p) = (x))
+#define vec_arith(d, x, y, op)	((d) = (x) op (y))
+#define vec_neg(d, x)		((d) = -(x))
+#define vec_abs(d, x) \
+  ((d) = (VecV)((VecI)(x) & (int64_t)U64x(7fffffff,ffffffff)))
+#else
+typedef struct VecV { double v[VEC_W]; } VecV;
+typedef VecV VecU;
+#define vec_lane(v, k)		((v).v[k])
+#define vec_store(p, x)		memcpy((p), &(x), sizeof(VecV))
+#define vec_lanes(d, expr) \
+  { int k_; for (k_ = 0; k_ < VEC_W; k_++) vec_lane(d, k_) = (expr); }
+#define vec_arith(d, x, y, op) \
+  vec_lanes(d, vec_lane(x, k_) op vec_lane(y, k_))
+#define vec_neg(d, x)		vec_lanes(d, -vec_lane(x, k_))
+#define vec_abs(d, x)		vec_lanes(d, fabs(vec_lane(x, k_)))
+#endif
+
+/* Check for partially overlapping accesses in the iteration range. */
+static int vec_overlap(const VecIns *pc, const VecIns *pce, char **ptr,
+		       intptr_t len)
+{
+  const VecIns *st, *ins;
+  for (st = pc; st < pce; st++) {
+    if (st->op != VEC_STORE) continue;
+    for (ins = pc; ins < pce; ins++) {
+      if (ins != st && (ins->op == VEC_LOAD || ins->op == VEC_STORE)) {
+	intptr_t d = (ptr[ins->a] + ins->ofs) - (ptr[st->a] + st->ofs);
+	if (d != 0 && (d < 0 ? -d : d) < len)
+	  return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* Run kernel program. Returns the next loop index. */
+static LJ_AINLINE int32_t vec_run(const VecProg *vp, int32_t i, int32_t n,
+				  char **ptr, double d0, double d1)
+{
+  VecV r[VEC_NREG][VEC_NV];
+  const VecU *src[VEC_NREG];  /* Operands. May point into the arrays. */
+  const char *kp = (const char *)(vp+1);
+  const VecIns *pc0 = (const VecIns *)(kp + vp->nk*sizeof(double));
+  const VecIns *pce = pc0 + vp->nins, *pc;
+  int64_t rem = (int64_t)n - i;  /* May overflow int32_t for n < 0. */
+  int32_t m, j;
+  uint32_t k, v;
+  if (i < 0 || rem < VEC_BLOCK)
+    return i;
+  m = (int32_t)rem & ~(VEC_BLOCK-1);  /* Leave at least one iteration. */
+  if (vec_overlap(pc0, pce, ptr, (intptr_t)m*(intptr_t)sizeof(double)))
+    return i;
+  for (k = 0; k < VEC_NREG; k++)
+    src[k] = (const VecU *)r[k];
+  /* Broadcast scalar arguments and constants. */
+  for (v = 0; v < VEC_NV; v++) {
+    for (k = 0; k < VEC_W; k++) {
+      vec_lane(r[VEC_REGNUM][v], k) = d0;
+      vec_lane(r[VEC_REGNUM+1][v], k) = d1;
+    }
+  }
+  for (j = 0; j < (int32_t)vp->nk; j++) {
+    double kv;
+    memcpy(&kv, kp + j*sizeof(double), sizeof(double));
+    for (v = 0; v < VEC_NV; v++)
+      for (k = 0; k < VEC_W; k++)
+	vec_lane(r[VEC_REGK+j][v], k) = kv;
+  }
+  for (j = 0; j < m; j += VEC_BLOCK) {
+    intptr_t ofs = ((intptr_t)i + j) * (intptr_t)sizeof(double);
+    for (pc = pc0; pc < pce; pc++) {
+      VecU *d = (VecU *)r[pc->dst];
+      const VecU *x = src[pc->a], *y = src[pc->b];
+      if (pc->op >= VEC_ADD && pc+1 < pce &&
+	  pc[1].op == VEC_STORE && pc[1].b == pc->dst) {
+	/* Store result directly. Later uses read it from the array, too. */
+	d = (VecU *)(ptr[pc[1].a] + pc[1].ofs + ofs);
+	src[pc->dst] = d;
+      }
+      switch (pc->op) {
+      case VEC_LOAD:
+	src[pc->dst] = (const VecU *)(ptr[pc->a] + pc->ofs + ofs);
+	break;
+      case VEC_STORE: {
+	char *p = ptr[pc->a] + pc->ofs + ofs;
+	if ((const VecU *)p != y)
+	  for (v = 0; v < VEC_NV; v++)
+	    vec_store(p + v*sizeof(VecV), y[v]);
+	break;
+	}
+      case VEC_ADD: for (v = 0; v < VEC_NV; v++) vec_arith(d[v], x[v], y[v], +); break;
+      case VEC_SUB: for (v = 0; v < VEC_NV; v++) vec_arith(d[v], x[v], y[v], -); break;
+      case VEC_MUL: for (v = 0; v < VEC_NV; v++) vec_arith(d[v], x[v], y[v], *); break;
+      case VEC_DIV: for (v = 0; v < VEC_NV; v++) vec_arith(d[v], x[v], y[v], /); break;
+      case VEC_NEG: for (v = 0; v < VEC_NV; v++) vec_neg(d[v], x[v]); break;
+      case VEC_ABS: for (v = 0; v < VEC_NV; v++) vec_abs(d[v], x[v]); break;
+      default: break;
+      }
+    }
+  }
+  return i + m;
+}
+
+#if LJ_TARGET_X64 && (defined(__clang__) || (defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define VEC_AVX2	1
+/* Same kernel compiled for 256 bit vectors, selected at runtime. */
+static __attribute__((target("avx2"))) int32_t vec_run_avx2(
+  const VecProg *vp, int32_t i, int32_t n, char **ptr, double d0, double d1)
+{
+  return vec_run(vp, i, n, ptr, d0, d1);
+}
+#endif
+
+int32_t lj_vec_loop(GCstr *prog, int32_t i, int32_t n,
+		    char *p0, char *p1, char *p2, char *p3,
+		    double d0, double d1)
+{
+  const VecProg *vp = (const VecProg *)strdata(prog);
+  char *ptr[VEC_MAXPTR];
+  ptr[0] = p0; ptr[1] = p1; ptr[2] = p2; ptr[3] = p3;
+#ifdef VEC_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return vec_run_avx2(vp, i, n, ptr, d0, d1);
+#endif
+  return vec_run(vp, i, n, ptr, d0, d1);
+}
+
+#endif
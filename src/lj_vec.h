@@ -0,0 +1,55 @@
+/*
+** Vectorized loop kernels.
+** Copyright (C) 2005-2023 Mike Pall. See Copyright Notice in luajit.h
+*/
+
+#ifndef _LJ_VEC_H
+#define _LJ_VEC_H
+
+#include "lj_obj.h"
+
+#define LJ_HASVEC	(LJ_HASJIT && LJ_HASFFI && LJ_64 && !LJ_SOFTFP)
+
+#if LJ_HASVEC
+
+/* Vector kernel operations. */
+typedef enum {
+  VEC_LOAD,	/* dst = ptr[a][i+ofs] */
+  VEC_STORE,	/* ptr[a][i+ofs] = b */
+  VEC_ADD, VEC_SUB, VEC_MUL, VEC_DIV,	/* dst = a op b. ORDER ARITH */
+  VEC_NEG, VEC_ABS	/* dst = op a */
+} VecOp;
+
+/* Vector kernel instruction. All elements are doubles. */
+typedef struct VecIns {
+  uint8_t op;		/* VecOp. */
+  uint8_t dst;		/* Destination register. */
+  uint8_t a;		/* Left operand register or pointer number. */
+  uint8_t b;		/* Right operand register. */
+  int32_t ofs;		/* Byte offset for loads and stores. */
+} VecIns;
+
+#define VEC_MAXREG	12	/* Max. registers for variant values. */
+#define VEC_MAXPTR	4	/* Max. base pointer arguments. */
+#define VEC_MAXNUM	2	/* Max. number arguments. */
+#define VEC_MAXK	4	/* Max. number constants. */
+#define VEC_MAXINS	64	/* Max. instructions. */
+
+/* Registers holding broadcast scalars follow the variant registers. */
+#define VEC_REGNUM	VEC_MAXREG
+#define VEC_REGK	(VEC_REGNUM+VEC_MAXNUM)
+#define VEC_NREG	(VEC_REGK+VEC_MAXK)
+
+/* Kernel program. Followed by nk constants and nins instructions. */
+typedef struct VecProg {
+  uint32_t nins;	/* Number of instructions. */
+  uint32_t nk;		/* Number of constants. */
+} VecProg;
+
+LJ_FUNC int32_t lj_vec_loop(GCstr *prog, int32_t i, int32_t n,
+			    char *p0, char *p1, char *p2, char *p3,
+			    double d0, double d1);
+
+#endif
+
+#endif
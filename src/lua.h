@@ -256,6 +256,22 @@ LUA_API void *lua_getexdata(lua_State *L);
 LUA_API void lua_setexdata2(lua_State *L, void *exdata2);
 LUA_API void *lua_getexdata2(lua_State *L);
 
+#define HAVE_LUA_BUFFER 1
+LUA_API int lua_isbuffer(lua_State *L, int idx);
+LUA_API const char *lua_tobuffer(lua_State *L, int idx, size_t *len);
+LUA_API char *lua_reservebuffer(lua_State *L, int idx, size_t sz, size_t *len);
+LUA_API void lua_commitbuffer(lua_State *L, int idx, size_t len);
+LUA_API const char *lua_pinbuffer(lua_State *L, int idx, size_t *len);
+LUA_API void lua_detachbuffer(lua_State *L, int idx);
+LUA_API void lua_attachbuffer(lua_State *L, int idx, int from);
+
+#define HAVE_LUA_TOCPOINTER 1
+LUA_API void *lua_tocpointer(lua_State *L, int idx);
+
+#define HAVE_LUA_SERIALIZE 1
+LUA_API int lua_serialize(lua_State *L, int idx, const char **p, size_t *len);
+LUA_API void lua_deserialize(lua_State *L, const char *p, size_t len);
+
 /*
 ** ===============================================================
 ** some useful macros
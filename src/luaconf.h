@@ -73,6 +73,7 @@
 /* Environment variable names for path overrides and initialization code. */
 #define LUA_PATH	"LUA_PATH"
 #define LUA_CPATH	"LUA_CPATH"
+#define LUA_BUNDLE	"LUA_BUNDLE"
 #define LUA_INIT	"LUA_INIT"
 
 /* Special file system characters. */
@@ -72,6 +72,8 @@ typedef void (*luaJIT_profile_callback)(void *data, lua_State *L,
 LUA_API void luaJIT_profile_start(lua_State *L, const char *mode,
 				  luaJIT_profile_callback cb, void *data);
 LUA_API void luaJIT_profile_stop(lua_State *L);
+LUA_API int luaJIT_profile_running(lua_State *L, luaJIT_profile_callback cb,
+				   void *data);
 LUA_API const char *luaJIT_profile_dumpstack(lua_State *L, const char *fmt,
 					     int depth, size_t *len);
 
@@ -16,6 +16,12 @@
  */
 #include "private.h"
 
+/* Extra data of an async handle */
+typedef struct {
+  luv_thread_arg_t arg;  /* arguments of async:send() */
+  luv_chan_t* chans;     /* channels notifying the handle, see chan:notify */
+} luv_async_extra_t;
+
 static uv_async_t* luv_check_async(lua_State* L, int index) {
   uv_async_t* handle = (uv_async_t*)luv_checkudata(L, index, "uv_async");
   luaL_argcheck(L, handle->type == UV_ASYNC && handle->data, index, "Expected uv_async_t");
@@ -25,9 +31,10 @@ static uv_async_t* luv_check_async(lua_State* L, int index) {
 static void luv_async_cb(uv_async_t* handle) {
   luv_handle_t* data = (luv_handle_t*)handle->data;
   lua_State* L = data->ctx->L;
-  int n = luv_thread_arg_push(L, (luv_thread_arg_t*)data->extra, LUVF_THREAD_SIDE_MAIN);
+  luv_thread_arg_t* arg = &((luv_async_extra_t*)data->extra)->arg;
+  int n = luv_thread_arg_push(L, arg, LUVF_THREAD_SIDE_MAIN);
   luv_call_callback(L, data, LUV_ASYNC, n);
-  luv_thread_arg_clear(L, (luv_thread_arg_t*)data->extra, LUVF_THREAD_SIDE_MAIN);
+  luv_thread_arg_clear(L, arg, LUVF_THREAD_SIDE_MAIN);
 }
 
 static int luv_new_async(lua_State* L) {
@@ -43,9 +50,9 @@ static int luv_new_async(lua_State* L) {
     return luv_error(L, ret);
   }
   data = luv_setup_handle(L, ctx);
-  data->extra = (luv_thread_arg_t*)malloc(sizeof(luv_thread_arg_t));
+  data->extra = (luv_async_extra_t*)malloc(sizeof(luv_async_extra_t));
   data->extra_gc = free;
-  memset(data->extra, 0, sizeof(luv_thread_arg_t));
+  memset(data->extra, 0, sizeof(luv_async_extra_t));
   handle->data = data;
   luv_check_callback(L, (luv_handle_t*)handle->data, LUV_ASYNC, 1);
   return 1;
@@ -54,7 +61,7 @@ static int luv_new_async(lua_State* L) {
 static int luv_async_send(lua_State* L) {
   int ret;
   uv_async_t* handle = luv_check_async(L, 1);
-  luv_thread_arg_t* arg = (luv_thread_arg_t *)((luv_handle_t*) handle->data)->extra;
+  luv_thread_arg_t* arg = &((luv_async_extra_t*)((luv_handle_t*)handle->data)->extra)->arg;
 
   luv_thread_arg_set(L, arg, 2, lua_gettop(L), LUVF_THREAD_MODE_ASYNC|LUVF_THREAD_SIDE_CHILD);
   ret = uv_async_send(handle);
@@ -0,0 +1,479 @@
+/*
+ *  Copyright 2014 The Luvit Authors. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include "private.h"
+
+// Channels carry messages between the Lua states of luv threads and the work
+// pool. A channel is a bounded ring of message pointers, after Dmitry
+// Vyukov's MPMC queue: every cell has a sequence number telling whether it
+// may be written or read at a given position, so senders and receivers only
+// race on their own position counter, and do not even do that in spsc mode.
+// A mutex and condition variables are only used to sleep in a blocking send
+// or recv, and senders and receivers look at the number of sleepers before
+// touching them.
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define luv_atomic_load(p) (*(volatile size_t*)(p))
+#define luv_atomic_store(p, v) (*(volatile size_t*)(p) = (size_t)(v))
+#define luv_atomic_cas(p, old, new) \
+  ((size_t)InterlockedCompareExchangePointer((void* volatile*)(p), (void*)(new), (void*)(old)) == (old))
+#define luv_atomic_add(p, v) InterlockedExchangeAddSizeT((volatile size_t*)(p), (v))
+#define luv_atomic_fence() MemoryBarrier()
+#else
+#define luv_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define luv_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define luv_atomic_cas(p, old, new) \
+  __atomic_compare_exchange_n((p), &(old), (new), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define luv_atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define luv_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+#define LUV_CHAN_LINE 64
+
+/* A message, the bytes of a string or string.buffer or a serialized value */
+typedef struct {
+  int type;  /* LUA_TSTRING, LUV_TBUFFER or LUV_TSERIALIZED */
+  size_t len;
+  char data[1];
+} luv_chan_msg_t;
+
+typedef struct {
+  size_t seq;
+  luv_chan_msg_t* msg;
+} luv_chan_cell_t;
+
+struct luv_chan_s {
+  luv_chan_cell_t* cells;
+  size_t mask;
+  int spsc;
+  char pad0[LUV_CHAN_LINE];
+  size_t send_pos;
+  char pad1[LUV_CHAN_LINE];
+  size_t recv_pos;
+  char pad2[LUV_CHAN_LINE];
+
+  size_t refs;                /* userdata and thread args holding the channel */
+  size_t senders, receivers;  /* threads sleeping in send or recv */
+  size_t closed;
+  uv_mutex_t mutex;
+  uv_cond_t not_full, not_empty;
+  uv_async_t* notify;         /* sent to after each message, or NULL, set
+                                 and used under the mutex */
+  luv_chan_t* notify_next;    /* next channel notifying the same handle */
+};
+
+static void luv_chan_retain(luv_chan_t* chan) {
+  luv_atomic_add(&chan->refs, 1);
+}
+
+static void luv_chan_release(luv_chan_t* chan) {
+  size_t i;
+  if (luv_atomic_add(&chan->refs, (size_t)-1) != 1)
+    return;
+  for (i = 0; i <= chan->mask; i++)
+    free(chan->cells[i].msg);
+  free(chan->cells);
+  uv_cond_destroy(&chan->not_full);
+  uv_cond_destroy(&chan->not_empty);
+  uv_mutex_destroy(&chan->mutex);
+  free(chan);
+}
+
+static int luv_chan_push(luv_chan_t* chan, luv_chan_msg_t* msg) {
+  luv_chan_cell_t* cell;
+  size_t pos = chan->spsc ? chan->send_pos : luv_atomic_load(&chan->send_pos);
+  for (;;) {
+    intptr_t dif;
+    cell = &chan->cells[pos & chan->mask];
+    dif = (intptr_t)luv_atomic_load(&cell->seq) - (intptr_t)pos;
+    if (dif == 0) {
+      if (chan->spsc) {
+        luv_atomic_store(&chan->send_pos, pos + 1);
+        break;
+      }
+      if (luv_atomic_cas(&chan->send_pos, pos, pos + 1))
+        break;
+    }
+    else if (dif < 0)
+      return 0;  // full
+    else
+      pos = luv_atomic_load(&chan->send_pos);
+  }
+  cell->msg = msg;
+  luv_atomic_store(&cell->seq, pos + 1);
+  return 1;
+}
+
+static luv_chan_msg_t* luv_chan_pop(luv_chan_t* chan) {
+  luv_chan_cell_t* cell;
+  luv_chan_msg_t* msg;
+  size_t pos = chan->spsc ? chan->recv_pos : luv_atomic_load(&chan->recv_pos);
+  for (;;) {
+    intptr_t dif;
+    cell = &chan->cells[pos & chan->mask];
+    dif = (intptr_t)luv_atomic_load(&cell->seq) - (intptr_t)(pos + 1);
+    if (dif == 0) {
+      if (chan->spsc) {
+        luv_atomic_store(&chan->recv_pos, pos + 1);
+        break;
+      }
+      if (luv_atomic_cas(&chan->recv_pos, pos, pos + 1))
+        break;
+    }
+    else if (dif < 0)
+      return NULL;  // empty
+    else
+      pos = luv_atomic_load(&chan->recv_pos);
+  }
+  msg = cell->msg;
+  cell->msg = NULL;
+  luv_atomic_store(&cell->seq, pos + chan->mask + 1);
+  return msg;
+}
+
+// Wakes a thread sleeping on cond, if there may be one.
+static void luv_chan_wake(luv_chan_t* chan, size_t* sleepers, uv_cond_t* cond) {
+  // pairs with the increment of the sleepers, made before they check again
+  luv_atomic_fence();
+  if (luv_atomic_load(sleepers) > 0) {
+    uv_mutex_lock(&chan->mutex);
+    uv_cond_signal(cond);
+    uv_mutex_unlock(&chan->mutex);
+  }
+}
+
+/* -- Lua API ------------------------------------------------------------- */
+
+static luv_chan_t* luv_check_chan(lua_State* L, int index) {
+  luv_chan_t* chan = *(luv_chan_t**)luaL_checkudata(L, index, "uv_chan");
+  return chan;
+}
+
+// Pushes a new userdata for the channel, holding a reference to it.
+static void luv_chan_push_udata(lua_State* L, luv_chan_t* chan) {
+  *(luv_chan_t**)lua_newuserdata(L, sizeof(chan)) = chan;
+  luaL_getmetatable(L, "uv_chan");
+  lua_setmetatable(L, -2);
+  luv_chan_retain(chan);
+}
+
+// uv.new_channel(capacity[, mode]) creates a channel holding up to capacity
+// messages, rounded up to a power of two. mode is "mpmc" (the default), or
+// "spsc" when a single thread sends and a single thread receives.
+static int luv_new_channel(lua_State* L) {
+  static const char* const modes[] = {"mpmc", "spsc", NULL};
+  lua_Integer capacity = luaL_checkinteger(L, 1);
+  int spsc = luaL_checkoption(L, 2, "mpmc", modes);
+  luv_chan_t* chan;
+  size_t i, size = 2;
+  luaL_argcheck(L, capacity > 0 && capacity <= (1 << 30), 1, "capacity out of range");
+  while (size < (size_t)capacity)
+    size <<= 1;
+  chan = (luv_chan_t*)malloc(sizeof(*chan));
+  if (chan == NULL)
+    return luaL_error(L, "Failure to allocate channel");
+  memset(chan, 0, sizeof(*chan));
+  chan->cells = (luv_chan_cell_t*)malloc(size * sizeof(luv_chan_cell_t));
+  if (chan->cells == NULL) {
+    free(chan);
+    return luaL_error(L, "Failure to allocate channel");
+  }
+  for (i = 0; i < size; i++) {
+    chan->cells[i].seq = i;
+    chan->cells[i].msg = NULL;
+  }
+  chan->mask = size - 1;
+  chan->spsc = spsc;
+  uv_mutex_init(&chan->mutex);
+  uv_cond_init(&chan->not_full);
+  uv_cond_init(&chan->not_empty);
+  luv_chan_push_udata(L, chan);
+  return 1;
+}
+
+static luv_chan_msg_t* luv_chan_encode(lua_State* L, int idx) {
+  luv_chan_msg_t* msg;
+  const char* p;
+  size_t len;
+  int type = lua_type(L, idx);
+#ifdef HAVE_LUA_BUFFER
+  if (lua_isbuffer(L, idx)) {
+    type = LUV_TBUFFER;
+    p = lua_tobuffer(L, idx, &len);
+  }
+  else
+#endif
+  if (type == LUA_TSTRING)
+    p = lua_tolstring(L, idx, &len);
+  else {
+#ifdef HAVE_LUA_SERIALIZE
+    if (lua_serialize(L, idx, &p, &len) != 0)
+      luaL_error(L, "channel message %s", lua_tostring(L, -1));
+    type = LUV_TSERIALIZED;
+#else
+    luaL_argerror(L, idx, "expected string");
+#endif
+  }
+  msg = (luv_chan_msg_t*)malloc(offsetof(luv_chan_msg_t, data) + len);
+  if (msg == NULL)
+    luaL_error(L, "Failure to allocate channel message");
+  msg->type = type;
+  msg->len = len;
+  memcpy(msg->data, p, len);
+  return msg;
+}
+
+static void luv_chan_decode(lua_State* L, luv_chan_msg_t* msg) {
+  switch (msg->type) {
+#ifdef HAVE_LUA_BUFFER
+  case LUV_TBUFFER:
+    luv_thread_push_buffer(L, msg->data, msg->len);
+    break;
+#endif
+#ifdef HAVE_LUA_SERIALIZE
+  case LUV_TSERIALIZED:
+    lua_deserialize(L, msg->data, msg->len);
+    break;
+#endif
+  default:
+    lua_pushlstring(L, msg->data, msg->len);
+    break;
+  }
+}
+
+// Sleeps until pred succeeds, the channel is closed or the timeout in ms
+// (negative for none) has passed. Returns the result of the last pred call.
+static int luv_chan_wait(luv_chan_t* chan, size_t* sleepers, uv_cond_t* cond, double timeout,
+                         int (*pred)(luv_chan_t* chan, void* arg), void* arg) {
+  uint64_t deadline = timeout >= 0 ? uv_hrtime() + (uint64_t)(timeout * 1e6) : 0;
+  int ok;
+  uv_mutex_lock(&chan->mutex);
+  luv_atomic_add(sleepers, 1);
+  luv_atomic_fence();
+  while (!(ok = pred(chan, arg)) && !luv_atomic_load(&chan->closed)) {
+    if (timeout < 0)
+      uv_cond_wait(cond, &chan->mutex);
+    else {
+      uint64_t now = uv_hrtime();
+      if (now >= deadline ||
+          uv_cond_timedwait(cond, &chan->mutex, deadline - now) == UV_ETIMEDOUT) {
+        ok = pred(chan, arg);
+        break;
+      }
+    }
+  }
+  luv_atomic_add(sleepers, (size_t)-1);
+  uv_mutex_unlock(&chan->mutex);
+  return ok;
+}
+
+static int luv_chan_try_push(luv_chan_t* chan, void* arg) {
+  return luv_chan_push(chan, (luv_chan_msg_t*)arg);
+}
+
+static int luv_chan_try_pop(luv_chan_t* chan, void* arg) {
+  return (*(luv_chan_msg_t**)arg = luv_chan_pop(chan)) != NULL;
+}
+
+static double luv_chan_opttimeout(lua_State* L, int index) {
+  double timeout = luaL_optnumber(L, index, -1);
+  return timeout < 0 ? -1 : timeout;
+}
+
+// chan:send(value[, timeout]) sends a string or string.buffer as raw bytes,
+// and other values in the string.buffer serialization format. Blocks while
+// the channel is full, for at most timeout ms if given, and returns whether
+// the message was sent.
+static int luv_chan_send(lua_State* L) {
+  luv_chan_t* chan = luv_check_chan(L, 1);
+  double timeout = luv_chan_opttimeout(L, 3);
+  luv_chan_msg_t* msg;
+  uv_async_t* notify;
+  int ok;
+  luaL_checkany(L, 2);
+  if (luv_atomic_load(&chan->closed))
+    return luaL_error(L, "channel is closed");
+  msg = luv_chan_encode(L, 2);
+  ok = luv_chan_push(chan, msg);
+  if (!ok && timeout != 0)
+    ok = luv_chan_wait(chan, &chan->senders, &chan->not_full, timeout, luv_chan_try_push, msg);
+  if (!ok) {
+    free(msg);
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  luv_chan_wake(chan, &chan->receivers, &chan->not_empty);
+  if (luv_atomic_load(&chan->notify)) {
+    // the lock keeps the handle from being closed while it is sent to
+    uv_mutex_lock(&chan->mutex);
+    notify = chan->notify;
+    if (notify)
+      uv_async_send(notify);
+    uv_mutex_unlock(&chan->mutex);
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+// chan:recv([timeout]) blocks until a message arrives, for at most timeout ms
+// if given, and returns true and the message, or false when there was none
+// or the channel is closed and empty.
+static int luv_chan_recv(lua_State* L) {
+  luv_chan_t* chan = luv_check_chan(L, 1);
+  double timeout = luv_chan_opttimeout(L, 2);
+  luv_chan_msg_t* msg = luv_chan_pop(chan);
+  if (msg == NULL && timeout != 0)
+    luv_chan_wait(chan, &chan->receivers, &chan->not_empty, timeout, luv_chan_try_pop, &msg);
+  if (msg == NULL) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  luv_chan_wake(chan, &chan->senders, &chan->not_full);
+  lua_pushboolean(L, 1);
+  luv_chan_decode(L, msg);
+  free(msg);
+  return 2;
+}
+
+// chan:close() makes further sends fail and wakes all blocked threads.
+// Messages already sent can still be received.
+static int luv_chan_close(lua_State* L) {
+  luv_chan_t* chan = luv_check_chan(L, 1);
+  uv_mutex_lock(&chan->mutex);
+  luv_atomic_store(&chan->closed, 1);
+  uv_cond_broadcast(&chan->not_full);
+  uv_cond_broadcast(&chan->not_empty);
+  uv_mutex_unlock(&chan->mutex);
+  return 0;
+}
+
+static luv_chan_t** luv_chan_notify_list(uv_async_t* handle) {
+  return &((luv_async_extra_t*)((luv_handle_t*)handle->data)->extra)->chans;
+}
+
+// chan:notify(async) has each send call async:send(), so a loop can receive
+// with a timeout of 0 in the async callback instead of blocking, and
+// chan:notify(nil) turns it off. Each async handle keeps a list of the
+// channels notifying it, which hold a reference to the channel, and closing
+// the handle turns them off. The list is only used on the loop thread of the
+// handle, so a channel notifying a handle of another loop can't be changed.
+static int luv_chan_notify(lua_State* L) {
+  luv_chan_t* chan = luv_check_chan(L, 1);
+  uv_async_t* notify = NULL;
+  uv_async_t* old;
+  luv_chan_t** p;
+  if (!lua_isnoneornil(L, 2)) {
+    notify = luv_check_async(L, 2);
+    luaL_argcheck(L, !uv_is_closing((uv_handle_t*)notify), 2, "handle is closing");
+  }
+  uv_mutex_lock(&chan->mutex);
+  old = chan->notify;
+  if (old == notify) {
+    uv_mutex_unlock(&chan->mutex);
+    return 0;
+  }
+  if (old && ((luv_handle_t*)old->data)->ctx != luv_context(L)) {
+    uv_mutex_unlock(&chan->mutex);
+    return luaL_error(L, "channel notifies a handle of another loop");
+  }
+  if (old) {
+    for (p = luv_chan_notify_list(old); *p != chan; p = &(*p)->notify_next);
+    *p = chan->notify_next;
+    chan->notify_next = NULL;
+  }
+  if (notify) {
+    p = luv_chan_notify_list(notify);
+    chan->notify_next = *p;
+    *p = chan;
+  }
+  luv_atomic_store(&chan->notify, notify);
+  uv_mutex_unlock(&chan->mutex);
+  if (!old)
+    luv_chan_retain(chan);
+  else if (!notify)
+    luv_chan_release(chan);
+  return 0;
+}
+
+// Called from the close callback of an async handle, turns off the channels
+// notifying it.
+static void luv_chan_async_closed(uv_async_t* handle) {
+  luv_chan_t** p = luv_chan_notify_list(handle);
+  luv_chan_t* chan = *p;
+  *p = NULL;
+  while (chan) {
+    luv_chan_t* next;
+    uv_mutex_lock(&chan->mutex);
+    next = chan->notify_next;
+    chan->notify_next = NULL;
+    luv_atomic_store(&chan->notify, NULL);
+    uv_mutex_unlock(&chan->mutex);
+    luv_chan_release(chan);
+    chan = next;
+  }
+}
+
+static int luv_chan_count(lua_State* L) {
+  luv_chan_t* chan = luv_check_chan(L, 1);
+  size_t sent = luv_atomic_load(&chan->send_pos);
+  size_t received = luv_atomic_load(&chan->recv_pos);
+  lua_pushinteger(L, sent > received ? sent - received : 0);
+  return 1;
+}
+
+static int luv_chan_gc(lua_State* L) {
+  luv_chan_t** chan = (luv_chan_t**)lua_touserdata(L, 1);
+  if (*chan) {
+    luv_chan_release(*chan);
+    *chan = NULL;
+  }
+  return 0;
+}
+
+static int luv_chan_tostring(lua_State* L) {
+  luv_chan_t* chan = luv_check_chan(L, 1);
+  lua_pushfstring(L, "uv_chan_t: %p", chan);
+  return 1;
+}
+
+static int luv_chan_equal(lua_State* L) {
+  lua_pushboolean(L, luv_check_chan(L, 1) == luv_check_chan(L, 2));
+  return 1;
+}
+
+static const luaL_Reg luv_chan_methods[] = {
+  {"send", luv_chan_send},
+  {"recv", luv_chan_recv},
+  {"close", luv_chan_close},
+  {"notify", luv_chan_notify},
+  {"count", luv_chan_count},
+  {NULL, NULL}
+};
+
+static void luv_chan_init(lua_State* L) {
+  luaL_newmetatable(L, "uv_chan");
+  lua_pushcfunction(L, luv_chan_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pushcfunction(L, luv_chan_equal);
+  lua_setfield(L, -2, "__eq");
+  lua_pushcfunction(L, luv_chan_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_newtable(L);
+  luaL_setfuncs(L, luv_chan_methods, 0);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+}
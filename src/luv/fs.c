@@ -245,6 +245,20 @@ static int fs_req_has_dest_path(uv_fs_t* req) {
 static int push_fs_result(lua_State* L, uv_fs_t* req) {
   luv_req_t* data = (luv_req_t*)req->data;
 
+#ifdef HAVE_LUA_BUFFER
+  // an asynchronous fs_read_buffer read into memory taken out of the buffer,
+  // which is handed back to it now, with the data read and on errors too
+  if (req->fs_type == UV_FS_READ && data->data_ref == LUV_REQ_MULTIREF) {
+    int* refs = (int*)data->data;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, refs[0]);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, refs[1]);
+    if (req->result > 0)
+      lua_commitbuffer(L, -1, req->result);
+    lua_attachbuffer(L, -2, -1);
+    lua_pop(L, 2);
+  }
+#endif
+
   if (req->fs_type == UV_FS_ACCESS) {
     lua_pushboolean(L, req->result >= 0);
     return 1;
@@ -332,6 +346,18 @@ static int push_fs_result(lua_State* L, uv_fs_t* req) {
       return 1;
 
     case UV_FS_READ:
+#ifdef HAVE_LUA_BUFFER
+      // fs_read_buffer read into the spare capacity of the referenced buffer
+      if (data->data_ref != LUA_NOREF) {
+        if (data->data_ref != LUV_REQ_MULTIREF) {
+          lua_rawgeti(L, LUA_REGISTRYINDEX, data->data_ref);
+          lua_commitbuffer(L, -1, req->result);
+          lua_pop(L, 1);
+        }
+        lua_pushinteger(L, req->result);
+        return 1;
+      }
+#endif
       lua_pushlstring(L, (const char*)data->data, req->result);
       return 1;
 
@@ -533,6 +559,66 @@ static int luv_fs_read(lua_State* L) {
   FS_CALL(uv_fs_read, req, file, &buf, 1, offset);
 }
 
+#ifdef HAVE_LUA_BUFFER
+// Like fs_read, but appends the data to a string.buffer instead of returning
+// a new string. libuv reads straight into the spare capacity of the buffer.
+// While an asynchronous read is in flight, the memory of the buffer is
+// detached into a hidden buffer owned by the request, so the buffer can be
+// used meanwhile without touching it. It is attached again when done.
+static int luv_fs_read_buffer(lua_State* L) {
+  luv_ctx_t* ctx = luv_context(L);
+  uv_file file = luaL_checkinteger(L, 1);
+  int64_t len = luaL_checkinteger(L, 3);
+  // -1 offset means "the current file offset is used and updated"
+  int64_t offset = -1;
+  int cbidx, ref, sync, hidx = 0, nargs;
+  char* base;
+  luaL_argcheck(L, lua_isbuffer(L, 2), 2, "expected a string.buffer");
+  luaL_argcheck(L, len >= 0 && len <= UINT_MAX, 3, "read size out of range");
+  // both offset and callback are optional
+  if (luv_is_callable(L, 4) && lua_isnoneornil(L, 5)) {
+    cbidx = 4;
+  }
+  else {
+    offset = luaL_optinteger(L, 4, offset);
+    cbidx = 5;
+  }
+  sync = lua_isnoneornil(L, cbidx);
+  if (!sync && !lua_isthread(L, cbidx))
+    luv_check_callable(L, cbidx);
+  // reserve and detach before anything is ref'd, as both may throw
+  base = lua_reservebuffer(L, 2, (size_t)len, NULL);
+  luaL_argcheck(L, base != NULL, 3, "read size out of range");
+  if (!sync) {
+    lua_detachbuffer(L, 2);
+    hidx = lua_gettop(L);
+  }
+  ref = luv_check_continuation(L, cbidx);
+  uv_buf_t buf = uv_buf_init(base, (unsigned int)len);
+  uv_fs_t* req = (uv_fs_t*)lua_newuserdata(L, uv_req_size(UV_FS));
+  luv_req_t* data = luv_setup_req(L, ctx, ref);
+  req->data = data;
+  if (sync) {
+    lua_pushvalue(L, 2);
+    data->data_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  } else {
+    int* refs = (int*)malloc(sizeof(int) * 3);
+    lua_pushvalue(L, 2);
+    refs[0] = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_pushvalue(L, hidx);
+    refs[1] = luaL_ref(L, LUA_REGISTRYINDEX);
+    refs[2] = LUA_NOREF;
+    data->data = refs;
+    data->data_ref = LUV_REQ_MULTIREF;
+  }
+  FS_CALL_NORETURN(uv_fs_read, req, file, &buf, 1, offset);
+  // the request failed right away, give the memory back
+  if (!sync && nargs != 1)
+    lua_attachbuffer(L, 2, hidx);
+  return nargs;
+}
+#endif
+
 static int luv_fs_unlink(lua_State* L) {
   luv_ctx_t* ctx = luv_context(L);
   const char* path = luaL_checkstring(L, 1);
@@ -95,6 +95,8 @@ static void luv_close_cb(uv_handle_t* handle) {
   luv_handle_t* data = (luv_handle_t*)handle->data;
   if (!data) return;
   L = data->ctx->L;
+  if (handle->type == UV_ASYNC)
+    luv_chan_async_closed((uv_async_t*)handle);
   if(data->ref > 0) {
     luv_call_callback(L, data, LUV_CLOSED, 0);
     luv_unref_handle(L, data);
@@ -109,7 +111,7 @@ static int luv_close(lua_State* L) {
     luaL_error(L, "handle %p is already closing", handle);
   }
   if (!lua_isnoneornil(L, 2)) {
-    luv_check_callback(L, (luv_handle_t*)handle->data, LUV_CLOSED, 2);
+    luv_check_once_callback(L, (luv_handle_t*)handle->data, LUV_CLOSED, 2);
   }
   uv_close(handle, luv_close_cb);
   return 0;
@@ -52,14 +52,26 @@ static luv_handle_t* luv_setup_handle(lua_State* L, luv_ctx_t* ctx) {
   data->ref = luaL_ref(L, LUA_REGISTRYINDEX);
   data->callbacks[0] = LUA_NOREF;
   data->callbacks[1] = LUA_NOREF;
+  data->bufref = LUA_NOREF;
+  data->type = handle->type;
   data->ctx = ctx;
   data->extra = NULL;
   data->extra_gc = NULL;
   return data;
 }
 
+// A coroutine is only resumed by the event it waits for with uv.await, so it
+// can't be the callback of one that repeats.
 static void luv_check_callback(lua_State* L, luv_handle_t* data, luv_callback_id id, int index) {
-  luv_check_callable(L, index);
+  if (lua_isthread(L, index))
+    luaL_argerror(L, index, "coroutine can't be the callback of a repeating event");
+  luv_check_once_callback(L, data, id, index);
+}
+
+// Like luv_check_callback for an event firing once, which takes a coroutine.
+static void luv_check_once_callback(lua_State* L, luv_handle_t* data, luv_callback_id id, int index) {
+  if (!lua_isthread(L, index))
+    luv_check_callable(L, index);
   luaL_unref(L, LUA_REGISTRYINDEX, data->callbacks[id]);
   lua_pushvalue(L, index);
   data->callbacks[id] = luaL_ref(L, LUA_REGISTRYINDEX);
@@ -95,6 +107,14 @@ static void luv_call_callback(lua_State* L, luv_handle_t* data, luv_callback_id
   else {
     // Get the callback
     lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    if (ctx->metrics) {
+      luv_metrics_call(L, ctx, data->type, nargs, data->ref);
+      return;
+    }
+    if (lua_isthread(L, -1)) {
+      luv_co_continue(L, ctx, nargs, data->ref);
+      return;
+    }
     // And insert it before the args if there are any.
     if (nargs) {
       lua_insert(L, -1 - nargs);
@@ -109,6 +129,15 @@ static void luv_unref_handle(lua_State* L, luv_handle_t* data) {
   data->ref = LUA_NOREF;
   luaL_unref(L, LUA_REGISTRYINDEX, data->callbacks[0]);
   luaL_unref(L, LUA_REGISTRYINDEX, data->callbacks[1]);
+  luaL_unref(L, LUA_REGISTRYINDEX, data->bufref);
+  data->bufref = LUA_NOREF;
+}
+
+// Handles luv creates for itself have no luv_handle_t and are left out of
+// uv.walk and the closing of all handles when the loop is collected.
+static int luv_is_internal_handle(luv_ctx_t* ctx, uv_handle_t* handle) {
+  return luv_work_is_done_handle(ctx, handle) || luv_sched_is_handle(ctx, handle) ||
+         luv_metrics_is_handle(ctx, handle) || luv_udp_is_flush_handle(ctx, handle);
 }
 
 static void luv_find_handle(lua_State* L, luv_handle_t* data) {
@@ -45,6 +45,8 @@ typedef void (*luv_handle_extra_gc) (void* ptr);
 typedef struct {
   int ref;
   int callbacks[2];
+  int bufref;       /* string.buffer filled by read_start_buffer */
+  uv_handle_type type;
   luv_ctx_t* ctx;
   void* extra;
   luv_handle_extra_gc extra_gc;
@@ -93,6 +93,9 @@ static void luv_walk_cb(uv_handle_t* handle, void* arg) {
   lua_State* L = (lua_State*)arg;
   luv_handle_t* data = (luv_handle_t*)handle->data;
 
+  if (luv_is_internal_handle(luv_context(L), handle))
+    return;
+
   // Sanity check
   // Most invalid values are large and refs are small, 0x1000000 is arbitrary.
   assert(data && data->ref < 0x1000000);
@@ -19,7 +19,8 @@
 
 static int luv_check_continuation(lua_State* L, int index) {
   if (lua_isnoneornil(L, index)) return LUA_NOREF;
-  luv_check_callable(L, index);
+  if (!lua_isthread(L, index))
+    luv_check_callable(L, index);
   lua_pushvalue(L, index);
   return luaL_ref(L, LUA_REGISTRYINDEX);
 }
@@ -41,6 +42,7 @@ static luv_req_t* luv_setup_req_with_mt(lua_State* L, luv_ctx_t* ctx, int cb_ref
   data->req_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   data->callback_ref = cb_ref;
   data->data_ref = LUA_NOREF;
+  data->req = (uv_req_t*)lua_touserdata(L, -1);
   data->ctx = ctx;
   data->data = NULL;
 
@@ -59,6 +61,14 @@ static void luv_fulfill_req(lua_State* L, luv_req_t* data, int nargs) {
   else {
     // Get the callback
     lua_rawgeti(L, LUA_REGISTRYINDEX, data->callback_ref);
+    if (data->ctx->metrics) {
+      luv_metrics_call(L, data->ctx, UV_HANDLE_TYPE_MAX + data->req->type, nargs, data->req_ref);
+      return;
+    }
+    if (lua_isthread(L, -1)) {
+      luv_co_continue(L, data->ctx, nargs, data->req_ref);
+      return;
+    }
     // And insert it before the args if there are any.
     if (nargs) {
       lua_insert(L, -1 - nargs);
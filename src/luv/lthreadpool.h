@@ -19,11 +19,15 @@
 
 #include "luv.h"
 
-#define LUV_THREAD_MAXNUM_ARG 9
+// pseudo types for values that are not passed as plain Lua values
+#define LUV_TSERIALIZED (-2)  // table or cdata in the string.buffer serialization format
+#define LUV_TBUFFER     (-3)  // contents of a string.buffer
+#define LUV_TCHANNEL    (-4)  // a channel, see chan.c
 
 typedef struct {
   // support basic lua type LUA_TNIL, LUA_TBOOLEAN, LUA_TNUMBER, LUA_TSTRING
-  // and support uv_handle_t userdata
+  // and support uv_handle_t userdata; with LuaJIT also string.buffer objects
+  // and anything string.buffer can serialize, and channels
   int type;
   union
   {
@@ -46,7 +50,8 @@ typedef struct {
   int argc;
   int flags;          // control gc
 
-  luv_val_t argv[LUV_THREAD_MAXNUM_ARG];
+  // argv is followed by all copied and serialized data in one allocation
+  luv_val_t* argv;
 } luv_thread_arg_t;
 
 //luajit miss LUA_OK
@@ -22,6 +22,7 @@
 #include "luv.h"
 
 #include "async.c"
+#include "chan.c"
 #include "check.c"
 #include "constants.c"
 #include "dns.c"
@@ -40,11 +41,13 @@
 #include "prepare.c"
 #include "process.c"
 #include "req.c"
+#include "sched.c"
 #include "signal.c"
 #include "stream.c"
 #include "tcp.c"
 #include "thread.c"
 #include "timer.c"
+#include "timer_wheel.c"
 #include "tty.c"
 #include "udp.c"
 #include "util.c"
@@ -97,6 +100,9 @@ static const luaL_Reg luv_functions[] = {
   {"timer_get_due_in", luv_timer_get_due_in},
 #endif
 
+  // timer_wheel.c
+  {"new_timer_wheel", luv_new_timer_wheel},
+
   // prepare.c
   {"new_prepare", luv_new_prepare},
   {"prepare_start", luv_prepare_start},
@@ -144,6 +150,9 @@ static const luaL_Reg luv_functions[] = {
   {"listen", luv_listen},
   {"accept", luv_accept},
   {"read_start", luv_read_start},
+#ifdef HAVE_LUA_BUFFER
+  {"read_start_buffer", luv_read_start_buffer},
+#endif
   {"read_stop", luv_read_stop},
   {"write", luv_write},
   {"write2", luv_write2},
@@ -229,6 +238,10 @@ static const luaL_Reg luv_functions[] = {
   {"udp_try_send", luv_udp_try_send},
   {"udp_recv_start", luv_udp_recv_start},
   {"udp_recv_stop", luv_udp_recv_stop},
+#ifdef HAVE_LUA_BUFFER
+  {"udp_recv_batch_start", luv_udp_recv_batch_start},
+  {"udp_send_batch", luv_udp_send_batch},
+#endif
 #if LUV_UV_VERSION_GEQ(1, 27, 0)
   {"udp_connect", luv_udp_connect},
   {"udp_getpeername", luv_udp_getpeername},
@@ -250,6 +263,9 @@ static const luaL_Reg luv_functions[] = {
   {"fs_close", luv_fs_close},
   {"fs_open", luv_fs_open},
   {"fs_read", luv_fs_read},
+#ifdef HAVE_LUA_BUFFER
+  {"fs_read_buffer", luv_fs_read_buffer},
+#endif
   {"fs_unlink", luv_fs_unlink},
   {"fs_write", luv_fs_write},
   {"fs_mkdir", luv_fs_mkdir},
@@ -393,9 +409,18 @@ static const luaL_Reg luv_functions[] = {
   {"thread_getcpu", luv_thread_getcpu},
 #endif
 
+  // chan.c
+  {"new_channel", luv_new_channel},
+
   // work.c
   {"new_work", luv_new_work},
   {"queue_work", luv_queue_work},
+  {"queue_work_batch", luv_queue_work_batch},
+  {"work_pool_size", luv_work_pool_size},
+
+  // sched.c
+  {"co_spawn", luv_co_spawn},
+  {"await", luv_await},
 
   // util.c
 #if LUV_UV_VERSION_GEQ(1, 10, 0)
@@ -409,6 +434,9 @@ static const luaL_Reg luv_functions[] = {
 #if LUV_UV_VERSION_GEQ(1, 45, 0)
   {"metrics_info", luv_metrics_info},
 #endif
+  {"metrics_start", luv_metrics_start},
+  {"metrics_stop", luv_metrics_stop},
+  {"metrics_stats", luv_metrics_stats},
 
   {NULL, NULL}
 };
@@ -466,6 +494,9 @@ static const luaL_Reg luv_stream_methods[] = {
   {"listen", luv_listen},
   {"accept", luv_accept},
   {"read_start", luv_read_start},
+#ifdef HAVE_LUA_BUFFER
+  {"read_start_buffer", luv_read_start_buffer},
+#endif
   {"read_stop", luv_read_stop},
   {"write", luv_write},
   {"write2", luv_write2},
@@ -551,6 +582,14 @@ static const luaL_Reg luv_timer_methods[] = {
   {NULL, NULL}
 };
 
+static const luaL_Reg luv_timer_wheel_methods[] = {
+  {"start", luv_timer_wheel_start},
+  {"stop", luv_timer_wheel_stop},
+  {"get_due_in", luv_timer_wheel_get_due_in},
+  {"count", luv_timer_wheel_count},
+  {NULL, NULL}
+};
+
 static const luaL_Reg luv_tty_methods[] = {
   {"set_mode", luv_tty_set_mode},
   {"get_winsize", luv_tty_get_winsize},
@@ -576,6 +615,10 @@ static const luaL_Reg luv_udp_methods[] = {
   {"try_send", luv_udp_try_send},
   {"recv_start", luv_udp_recv_start},
   {"recv_stop", luv_udp_recv_stop},
+#ifdef HAVE_LUA_BUFFER
+  {"recv_batch_start", luv_udp_recv_batch_start},
+  {"send_batch", luv_udp_send_batch},
+#endif
 #if LUV_UV_VERSION_GEQ(1, 27, 0)
   {"connect", luv_udp_connect},
   {"getpeername", luv_udp_getpeername},
@@ -625,6 +668,18 @@ static void luv_handle_init(lua_State* L) {
 
   UV_HANDLE_TYPE_MAP(XX)
 #undef XX
+
+  // a timer wheel is a uv_timer_t with methods of its own
+  luaL_newmetatable(L, "uv_timer_wheel");
+  lua_pushcfunction(L, luv_timer_wheel_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pushcfunction(L, luv_handle_gc);
+  lua_setfield(L, -2, "__gc");
+  luaL_newlib(L, luv_timer_wheel_methods);
+  luaL_setfuncs(L, luv_handle_methods, 0);
+  lua_setfield(L, -2, "__index");
+  lua_pushboolean(L, 1);
+  lua_rawset(L, -3);
   lua_setfield(L, LUA_REGISTRYINDEX, "uv_handle");
 
   lua_newtable(L);
@@ -804,8 +859,8 @@ LUALIB_API void luv_set_cthread(lua_State* L, luv_CFcpcall cpcall) {
 
 static void walk_cb(uv_handle_t *handle, void *arg)
 {
-  (void)arg;
-  if (!uv_is_closing(handle)) {
+  // the work pool completion handle is closed once no work is pending
+  if (!uv_is_closing(handle) && !luv_is_internal_handle((luv_ctx_t*)arg, handle)) {
     uv_close(handle, luv_close_cb);
   }
 }
@@ -816,11 +871,16 @@ static int loop_gc(lua_State *L) {
   if (loop==NULL)
     return 0;
   // Call uv_close on every active handle
-  uv_walk(loop, walk_cb, NULL);
+  uv_walk(loop, walk_cb, ctx);
+  luv_sched_loop_close(ctx);
+  luv_udp_loop_close(ctx);
+  luv_metrics_loop_close(L, ctx);
   // Run the event loop until all handles are successfully closed
   while (uv_loop_close(loop)) {
     uv_run(loop, UV_RUN_DEFAULT);
+    luv_work_loop_close(ctx);
   }
+  luv_slab_release(ctx);
   return 0;
 }
 
@@ -886,6 +946,7 @@ LUALIB_API int luaopen_luv (lua_State* L) {
   luv_dir_init(L);
 #endif
   luv_thread_init(L);
+  luv_chan_init(L);
   luv_work_init(L);
 
   luv_constants(L);
@@ -101,6 +101,13 @@ typedef struct {
 
   int          mode;        /* the mode used to run the loop (-1 if not running) */
 
+  void*        slabs;       /* free list of pooled read buffers */
+  int          nslabs;      /* number of buffers in the free list */
+  void*        work;        /* finished work pool items of this loop */
+  void*        sched;       /* run queue of coroutines, see uv.co_spawn */
+  void*        metrics;     /* loop and callback metrics, see uv.metrics_start */
+  void*        udp;         /* udp handles with a batch to call back, see udp:recv_batch_start */
+
   void* extra;              /* extra data */
 } luv_ctx_t;
 
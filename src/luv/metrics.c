@@ -18,6 +18,7 @@
 #include "private.h"
 #include "luv.h"
 #include "util.h"
+#include "lj_arch.h"  /* LJ_HASPROFILE */
 
 #if LUV_UV_VERSION_GEQ(1, 39, 0)
 static int luv_metrics_idle_time(lua_State* L) {
@@ -50,3 +51,322 @@ static int luv_metrics_info(lua_State *L) {
   return 1;
 }
 #endif
+
+// Loop and callback metrics, collected between uv.metrics_start and
+// uv.metrics_stop. libuv has no hooks for its loop phases, so a prepare and
+// a check handle mark the start and the end of the poll phase: the time from
+// the check handle to the next prepare handle is the check phase, less the
+// time spent in timer callbacks. Every callback luv makes goes through
+// luv_metrics_call, which times it by handle or request type. GC time and the
+// stacks of slow callbacks come from samples of the LuaJIT profiler.
+
+#if LJ_HASPROFILE
+#include "luajit.h"
+#endif
+
+#define LUV_METRICS_BUCKETS 24
+#define LUV_METRICS_TYPES (UV_HANDLE_TYPE_MAX + UV_REQ_TYPE_MAX)
+#define LUV_METRICS_STACK 2048
+
+typedef struct {
+  uint64_t count, total, max;
+  uint64_t buckets[LUV_METRICS_BUCKETS];  /* i: less than 2^i us */
+} luv_cb_stats_t;
+
+/* Metrics of one loop, see luv_ctx_t.metrics */
+typedef struct {
+  uv_prepare_t prepare_handle;
+  uv_check_t check_handle;
+  int closing;             /* handles still to be closed by metrics_stop */
+
+  uint64_t iterations;
+  uint64_t prepared, checked;  /* when the prepare and check handles ran */
+  uint64_t idle_start;     /* loop idle time when the poll phase started */
+  uint64_t timers, poll, idle, check, gc;  /* time spent in each phase */
+  uint64_t seg_timers;     /* timer callbacks since the check handle ran */
+  uint64_t gc_iter, gc_max;  /* gc time of this and of the worst iteration */
+  luv_cb_stats_t cbs[LUV_METRICS_TYPES];
+
+  int depth;               /* callbacks running */
+  uint64_t cb_start;       /* when the outermost of them started */
+  uint64_t slow;           /* slow callback threshold, 0 if not tracing */
+  uint64_t nslow;
+  int slow_cb;             /* ref of the function told about slow callbacks */
+  uint64_t interval;       /* profiler sample interval, 0 if not sampling */
+  size_t stack_len;        /* stack sampled in the outermost callback */
+  char stack[LUV_METRICS_STACK];
+} luv_metrics_t;
+
+static const char* luv_metrics_type_name(int type) {
+  if (type < UV_HANDLE_TYPE_MAX)
+    return uv_handle_type_name((uv_handle_type)type);
+  return uv_req_type_name((uv_req_type)(type - UV_HANDLE_TYPE_MAX));
+}
+
+static void luv_metrics_prepare_cb(uv_prepare_t* handle) {
+  luv_metrics_t* m = (luv_metrics_t*)handle->data;
+  uint64_t now = uv_hrtime();
+  if (m->checked) {
+    uint64_t seg = now - m->checked;
+    m->check += seg > m->seg_timers ? seg - m->seg_timers : 0;
+    m->timers += m->seg_timers;
+  }
+  m->seg_timers = 0;
+  m->iterations++;
+  if (m->gc_iter > m->gc_max)
+    m->gc_max = m->gc_iter;
+  m->gc_iter = 0;
+  m->prepared = now;
+#if LUV_UV_VERSION_GEQ(1, 39, 0)
+  m->idle_start = uv_metrics_idle_time(handle->loop);
+#endif
+}
+
+static void luv_metrics_check_cb(uv_check_t* handle) {
+  luv_metrics_t* m = (luv_metrics_t*)handle->data;
+  uint64_t now = uv_hrtime(), idle = 0;
+#if LUV_UV_VERSION_GEQ(1, 39, 0)
+  idle = uv_metrics_idle_time(handle->loop) - m->idle_start;
+#endif
+  if (m->prepared) {
+    uint64_t seg = now - m->prepared;
+    m->idle += idle;
+    m->poll += seg > idle ? seg - idle : 0;
+  }
+  m->checked = now;
+}
+
+#if LJ_HASPROFILE
+// Runs in the VM for each batch of profiler samples.
+static void luv_metrics_profile_cb(void* data, lua_State* L, int samples, int vmstate) {
+  luv_metrics_t* m = (luv_metrics_t*)data;
+  if (vmstate == 'G') {
+    m->gc += samples * m->interval;
+    m->gc_iter += samples * m->interval;
+  }
+  if (m->slow && m->depth > 0 && m->stack_len == 0 &&
+      uv_hrtime() - m->cb_start >= m->slow) {
+    size_t len;
+    const char* stack = luaJIT_profile_dumpstack(L, "plZ\n", 32, &len);
+    if (len > LUV_METRICS_STACK)
+      len = LUV_METRICS_STACK;
+    memcpy(m->stack, stack, len);
+    m->stack_len = len;
+  }
+}
+#endif
+
+// Tells the slow callback function about a callback that took time ns.
+static void luv_metrics_report(lua_State* L, luv_ctx_t* ctx, luv_metrics_t* m, int type, uint64_t time) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, m->slow_cb);
+  lua_createtable(L, 0, 3);
+  lua_pushstring(L, luv_metrics_type_name(type));
+  lua_setfield(L, -2, "type");
+  lua_pushinteger(L, time);
+  lua_setfield(L, -2, "time");
+  if (m->stack_len) {
+    lua_pushlstring(L, m->stack, m->stack_len);
+    lua_setfield(L, -2, "stack");
+  }
+  ctx->cb_pcall(L, 1, 0, 0);
+}
+
+// Like the end of luv_call_callback and luv_fulfill_req: calls the callback
+// or resumes the coroutine on top of the stack with the nargs values below it,
+// and accounts for the time it took.
+static void luv_metrics_call(lua_State* L, luv_ctx_t* ctx, int type, int nargs, int src) {
+  luv_metrics_t* m = (luv_metrics_t*)ctx->metrics;
+  uint64_t start = uv_hrtime(), time, us;
+  luv_cb_stats_t* s;
+  int b;
+  if (m->depth++ == 0) {
+    m->cb_start = start;
+    m->stack_len = 0;
+  }
+  if (lua_isthread(L, -1))
+    luv_co_continue(L, ctx, nargs, src);
+  else {
+    if (nargs)
+      lua_insert(L, -1 - nargs);
+    ctx->cb_pcall(L, nargs, 0, 0);
+  }
+  // the callback may have stopped or restarted the metrics
+  if (ctx->metrics != m)
+    return;
+  time = uv_hrtime() - start;
+  if ((unsigned int)type >= LUV_METRICS_TYPES)
+    type = UV_UNKNOWN_HANDLE;
+  s = &m->cbs[type];
+  s->count++;
+  s->total += time;
+  if (time > s->max)
+    s->max = time;
+  us = time / 1000;
+  for (b = 0; b < LUV_METRICS_BUCKETS - 1 && us >= ((uint64_t)1 << b); b++);
+  s->buckets[b]++;
+  if (--m->depth > 0)
+    return;
+  if (type == UV_TIMER)
+    m->seg_timers += time;
+  if (m->slow && time >= m->slow) {
+    m->nslow++;
+    if (m->slow_cb != LUA_NOREF)
+      luv_metrics_report(L, ctx, m, type, time);
+  }
+}
+
+static void luv_metrics_close_cb(uv_handle_t* handle) {
+  luv_metrics_t* m = (luv_metrics_t*)handle->data;
+  if (--m->closing == 0)
+    free(m);
+}
+
+static void luv_metrics_stop_ctx(lua_State* L, luv_ctx_t* ctx) {
+  luv_metrics_t* m = (luv_metrics_t*)ctx->metrics;
+  if (m == NULL)
+    return;
+  ctx->metrics = NULL;
+#if LJ_HASPROFILE
+  // only stop the profiler if it still runs for these metrics
+  if (m->interval && luaJIT_profile_running(L, luv_metrics_profile_cb, m) > 0)
+    luaJIT_profile_stop(L);
+#endif
+  luaL_unref(L, LUA_REGISTRYINDEX, m->slow_cb);
+  m->closing = 2;
+  uv_close((uv_handle_t*)&m->prepare_handle, luv_metrics_close_cb);
+  uv_close((uv_handle_t*)&m->check_handle, luv_metrics_close_cb);
+}
+
+static void luv_metrics_loop_close(lua_State* L, luv_ctx_t* ctx) {
+  luv_metrics_stop_ctx(L, ctx);
+}
+
+static int luv_metrics_is_handle(luv_ctx_t* ctx, uv_handle_t* handle) {
+  luv_metrics_t* m = (luv_metrics_t*)ctx->metrics;
+  return m != NULL && (handle == (uv_handle_t*)&m->prepare_handle ||
+                       handle == (uv_handle_t*)&m->check_handle);
+}
+
+// uv.metrics_start([options]) starts collecting loop metrics, or starts
+// over. options.slow is a threshold in ms above which a callback counts as
+// slow, and options.on_slow a function called after each slow callback.
+// options.sample sets the interval in ms of the profiler samples used for
+// the GC time and the stacks of slow callbacks (default 1, 0 turns it off).
+// Returns whether the profiler samples, which it doesn't while someone else,
+// like jit.p or another VM, is using it.
+static int luv_metrics_start(lua_State* L) {
+  luv_ctx_t* ctx = luv_context(L);
+  luv_metrics_t* m;
+  double slow = 0, sample = 1;
+  int slow_cb = LUA_NOREF;
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_getfield(L, 1, "slow");
+    lua_getfield(L, 1, "sample");
+    lua_getfield(L, 1, "on_slow");
+    luaL_argcheck(L, lua_isnil(L, 2) || lua_isnumber(L, 2), 1, "slow must be a number");
+    luaL_argcheck(L, lua_isnil(L, 3) || lua_isnumber(L, 3), 1, "sample must be a number");
+    slow = luaL_optnumber(L, 2, 0);
+    sample = luaL_optnumber(L, 3, 1);
+    luaL_argcheck(L, slow >= 0 && sample >= 0, 1, "negative time");
+    if (!lua_isnil(L, 4)) {
+      luaL_argcheck(L, luv_is_callable(L, 4), 1, "on_slow must be callable");
+      slow_cb = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    lua_settop(L, 1);
+  }
+  luv_metrics_stop_ctx(L, ctx);
+
+  m = (luv_metrics_t*)malloc(sizeof(*m));
+  if (m == NULL) {
+    luaL_unref(L, LUA_REGISTRYINDEX, slow_cb);
+    return luaL_error(L, "Failure to allocate metrics");
+  }
+  memset(m, 0, sizeof(*m));
+  m->slow = (uint64_t)(slow * 1e6);
+  m->slow_cb = slow_cb;
+  uv_prepare_init(ctx->loop, &m->prepare_handle);
+  uv_check_init(ctx->loop, &m->check_handle);
+  m->prepare_handle.data = m->check_handle.data = m;
+  uv_prepare_start(&m->prepare_handle, luv_metrics_prepare_cb);
+  uv_check_start(&m->check_handle, luv_metrics_check_cb);
+  // the metrics do not keep the loop alive
+  uv_unref((uv_handle_t*)&m->prepare_handle);
+  uv_unref((uv_handle_t*)&m->check_handle);
+#if LUV_UV_VERSION_GEQ(1, 39, 0)
+  uv_loop_configure(ctx->loop, UV_METRICS_IDLE_TIME);
+#endif
+#if LJ_HASPROFILE
+  if (sample > 0 && luaJIT_profile_running(ctx->L, luv_metrics_profile_cb, m) == 0) {
+    char mode[32];
+    int ms = sample < 1 ? 1 : (int)sample;
+    snprintf(mode, sizeof(mode), "i%d", ms);
+    m->interval = (uint64_t)ms * 1000000;
+    luaJIT_profile_start(ctx->L, mode, luv_metrics_profile_cb, m);
+  }
+#endif
+  ctx->metrics = m;
+  lua_pushboolean(L, m->interval != 0);
+  return 1;
+}
+
+static int luv_metrics_stop(lua_State* L) {
+  luv_metrics_stop_ctx(L, luv_context(L));
+  return 0;
+}
+
+#define LUV_METRICS_FIELD(name, value) \
+  lua_pushinteger(L, value); \
+  lua_setfield(L, -2, name)
+
+// uv.metrics_stats([reset]) returns the metrics collected since
+// uv.metrics_start or the last reset, or nil when they are not collected.
+// All times are in ns.
+static int luv_metrics_stats(lua_State* L) {
+  luv_metrics_t* m = (luv_metrics_t*)luv_context(L)->metrics;
+  int t, b;
+  if (m == NULL) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_createtable(L, 0, 6);
+  LUV_METRICS_FIELD("iterations", m->iterations);
+  LUV_METRICS_FIELD("gc_max", m->gc_max > m->gc_iter ? m->gc_max : m->gc_iter);
+  LUV_METRICS_FIELD("slow", m->nslow);
+
+  lua_createtable(L, 0, 5);
+  LUV_METRICS_FIELD("timers", m->timers + m->seg_timers);
+  LUV_METRICS_FIELD("poll", m->poll);
+  LUV_METRICS_FIELD("idle", m->idle);
+  LUV_METRICS_FIELD("check", m->check);
+  LUV_METRICS_FIELD("gc", m->gc);
+  lua_setfield(L, -2, "phases");
+
+  lua_newtable(L);
+  for (t = 0; t < LUV_METRICS_TYPES; t++) {
+    luv_cb_stats_t* s = &m->cbs[t];
+    if (s->count == 0)
+      continue;
+    lua_createtable(L, 0, 4);
+    LUV_METRICS_FIELD("count", s->count);
+    LUV_METRICS_FIELD("total", s->total);
+    LUV_METRICS_FIELD("max", s->max);
+    lua_createtable(L, LUV_METRICS_BUCKETS, 0);
+    for (b = 0; b < LUV_METRICS_BUCKETS; b++) {
+      lua_pushinteger(L, s->buckets[b]);
+      lua_rawseti(L, -2, b + 1);
+    }
+    lua_setfield(L, -2, "histogram");
+    lua_setfield(L, -2, luv_metrics_type_name(t));
+  }
+  lua_setfield(L, -2, "callbacks");
+
+  if (lua_toboolean(L, 1)) {
+    m->iterations = 0;
+    m->timers = m->poll = m->idle = m->check = m->gc = 0;
+    m->seg_timers = m->gc_iter = m->gc_max = 0;
+    m->nslow = 0;
+    memset(m->cbs, 0, sizeof(m->cbs));
+  }
+  return 1;
+}
@@ -45,43 +45,108 @@ static int luv_version_string(lua_State* L) {
  return 1;
 }
 
-// requires the value at idx to be a string or number
+// true if the value at idx can be written as a single buffer
+static int luv_is_buf(lua_State *L, int idx) {
+#ifdef HAVE_LUA_BUFFER
+  if (lua_isbuffer(L, idx)) return 1;
+#endif
+  return lua_isstring(L, idx);
+}
+
+// requires the value at idx to be a string, number or string.buffer;
+// a string.buffer is written in place, without converting it to a string
 static void luv_prep_buf(lua_State *L, int idx, uv_buf_t *pbuf) {
   size_t len;
+#ifdef HAVE_LUA_BUFFER
+  if (lua_isbuffer(L, idx)) {
+    pbuf->base = (char*)lua_tobuffer(L, idx, &len);
+    pbuf->len = len;
+    return;
+  }
+#endif
   // note: if the value is a number, lua_tolstring converts the stack value to a string
   pbuf->base = (char*)lua_tolstring(L, idx, &len);
   pbuf->len = len;
 }
 
+// like luv_prep_buf, but pushes the value to ref until the request completes;
+// for a string.buffer this is the object owning its pinned contents, so that
+// modifying the buffer meanwhile can't change or free the data
+static void luv_prep_buf_ref(lua_State *L, int idx, uv_buf_t *pbuf) {
+#ifdef HAVE_LUA_BUFFER
+  if (lua_isbuffer(L, idx)) {
+    size_t len;
+    pbuf->base = (char*)lua_pinbuffer(L, idx, &len);
+    pbuf->len = len;
+    return;
+  }
+#endif
+  luv_prep_buf(L, idx, pbuf);
+  lua_pushvalue(L, idx);
+}
+
+// Returns the address held by a raw pointer value (light userdata or, with
+// LuaJIT, cdata), or NULL. In a table of bufs such a pointer must be
+// followed by its length.
+static void* luv_toptr(lua_State *L, int idx) {
+#ifdef HAVE_LUA_TOCPOINTER
+  return lua_tocpointer(L, idx);
+#else
+  return lua_islightuserdata(L, idx) ? lua_touserdata(L, idx) : NULL;
+#endif
+}
+
 // - number of buffers is stored in *count
 // - if refs is non-NULL, then *refs is set to a heap-allocated, LUA_NOREF-terminated array
-//   of ref integers (refs are to each string in the bufs)
+//   of ref integers (refs are to each string, pinned string.buffer contents and pointer
+//   in the bufs)
+// - a (pointer, length) pair of entries in the table makes up a single buffer
 // returns: heap-allocated array of uv_buf_t
 static uv_buf_t* luv_prep_bufs(lua_State* L, int index, size_t *count, int **refs) {
   uv_buf_t *bufs;
-  size_t i;
-  *count = lua_rawlen(L, index);
-  bufs = (uv_buf_t*)malloc(sizeof(uv_buf_t) * *count);
+  size_t i, n, len;
+  len = lua_rawlen(L, index);
+  bufs = (uv_buf_t*)malloc(sizeof(uv_buf_t) * (len ? len : 1));
   int *refs_array = NULL;
   if (refs)
-    refs_array = (int*)malloc(sizeof(int) * (*count + 1));
-  for (i = 0; i < *count; ++i) {
+    refs_array = (int*)malloc(sizeof(int) * (len + 1));
+  for (i = n = 0; i < len; ++i, ++n) {
     lua_rawgeti(L, index, i + 1);
-    if (!lua_isstring(L, -1)) {
+    if ((bufs[n].base = (char*)luv_toptr(L, -1)) != NULL) {
+      lua_rawgeti(L, index, i + 2);
+      if (!lua_isnumber(L, -1) || lua_tointeger(L, -1) < 0) {
+        free(bufs);
+        free(refs_array);
+        luaL_argerror(L, index, lua_pushfstring(L, "expected length after pointer, found %s in the table", luaL_typename(L, -1)));
+        return NULL;
+      }
+      bufs[n].len = (size_t)lua_tointeger(L, -1);
+      lua_pop(L, 1);
+      i++;
+      // push the value again to ref it, will be popped by luaL_ref
+      if (refs)
+        lua_pushvalue(L, -1);
+    }
+    else if (luv_is_buf(L, -1)) {
+      if (refs)
+        luv_prep_buf_ref(L, -1, &bufs[n]);
+      else
+        luv_prep_buf(L, -1, &bufs[n]);
+    }
+    else {
+      free(bufs);
+      free(refs_array);
       luaL_argerror(L, index, lua_pushfstring(L, "expected table of strings, found %s in the table", luaL_typename(L, -1)));
       return NULL;
     }
-    luv_prep_buf(L, -1, &bufs[i]);
-    if (refs) {
-      // push the string again to ref it, will be popped by luaL_ref
-      lua_pushvalue(L, -1);
-      refs_array[i] = luaL_ref(L, LUA_REGISTRYINDEX);
-    }
+    if (refs)
+      refs_array[n] = luaL_ref(L, LUA_REGISTRYINDEX);
     lua_pop(L, 1);
   }
+  *count = n;
   if (refs) {
     // refs array is LUA_NOREF-terminated
-    refs_array[*count] = LUA_NOREF;
+    refs_array[n] = LUA_NOREF;
     *refs = refs_array;
   }
   return bufs;
@@ -89,7 +154,8 @@ static uv_buf_t* luv_prep_bufs(lua_State* L, int index, size_t *count, int **ref
 
 // Sets up a uv_bufs_t array to pass to write/send libuv functions that take a uv_buf_t*
 // - count: set to length of the returned uv_buf_t array
-// - req_data: refs to the strings used are stored in req_data->data/req_data->data_ref
+// - req_data: refs to the values used are stored in req_data->data/req_data->data_ref,
+//   which keeps them alive until the request completes
 // returns: heap-allocated array of uv_buf_t
 static uv_buf_t* luv_check_bufs(lua_State* L, int index, size_t* count, luv_req_t* req_data) {
   uv_buf_t* bufs = NULL;
@@ -99,15 +165,16 @@ static uv_buf_t* luv_check_bufs(lua_State* L, int index, size_t* count, luv_req_
     req_data->data = refs;
     req_data->data_ref = LUV_REQ_MULTIREF;
   }
-  else if (lua_isstring(L, index)) {
+  else if (luv_is_buf(L, index)) {
+    uv_buf_t buf;
+    luv_prep_buf_ref(L, index, &buf);
+    req_data->data_ref = luaL_ref(L, LUA_REGISTRYINDEX);
     *count = 1;
     bufs = (uv_buf_t*)malloc(sizeof(uv_buf_t));
-    luv_prep_buf(L, index, bufs);
-    lua_pushvalue(L, index);
-    req_data->data_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    *bufs = buf;
   }
   else {
-    luaL_argerror(L, index, lua_pushfstring(L, "data must be string or table of strings, got %s", luaL_typename(L, index)));
+    luaL_argerror(L, index, lua_pushfstring(L, "data must be string, string.buffer or table of them, got %s", luaL_typename(L, index)));
   }
   return bufs;
 }
@@ -119,13 +186,13 @@ static uv_buf_t* luv_check_bufs_noref(lua_State* L, int index, size_t* count) {
   if (lua_istable(L, index)) {
     bufs = luv_prep_bufs(L, index, count, NULL);
   }
-  else if (lua_isstring(L, index)) {
+  else if (luv_is_buf(L, index)) {
     *count = 1;
     bufs = (uv_buf_t*)malloc(sizeof(uv_buf_t));
     luv_prep_buf(L, index, bufs);
   }
   else {
-    luaL_argerror(L, index, lua_pushfstring(L, "data must be string or table of strings, got %s", luaL_typename(L, index)));
+    luaL_argerror(L, index, lua_pushfstring(L, "data must be string, string.buffer or table of them, got %s", luaL_typename(L, index)));
   }
   return bufs;
 }
@@ -19,6 +19,9 @@
 /* From stream.c */
 static uv_stream_t* luv_check_stream(lua_State* L, int index);
 static void luv_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
+static void luv_slab_alloc(luv_ctx_t* ctx, size_t size, uv_buf_t* buf);
+static void luv_slab_free(luv_ctx_t* ctx, const uv_buf_t* buf);
+static void luv_slab_release(luv_ctx_t* ctx);
 
 /* From lhandle.c */
 /* Traceback for lua_pcall */
@@ -31,6 +34,7 @@ static luv_handle_t* luv_setup_handle(lua_State* L, luv_ctx_t* ctx);
    Either replace an existing callback by id or append a new one at the end.
 */
 static void luv_check_callback(lua_State* L, luv_handle_t* data, luv_callback_id id, int index);
+static void luv_check_once_callback(lua_State* L, luv_handle_t* data, luv_callback_id id, int index);
 
 /* Lookup a function and call it with nargs
    If there is no such function, pop the args.
@@ -43,6 +47,9 @@ static void luv_find_handle(lua_State* L, luv_handle_t* data);
 /* Unref the handle from the lua world, allowing it to GC */
 static void luv_unref_handle(lua_State* L, luv_handle_t* data);
 
+/* Whether the handle belongs to luv itself rather than to a lua object */
+static int luv_is_internal_handle(luv_ctx_t* ctx, uv_handle_t* handle);
+
 /* From lreq.c */
 /* Used in the top of a setup function to check the arg
    and ref the callback to an integer.
@@ -63,7 +70,9 @@ static void* luv_newuserdata(lua_State* L, size_t sz);
 
 
 /* From misc.c */
+static int luv_is_buf(lua_State *L, int idx);
 static void luv_prep_buf(lua_State *L, int idx, uv_buf_t *pbuf);
+static void* luv_toptr(lua_State *L, int idx);
 static uv_buf_t* luv_prep_bufs(lua_State* L, int index, size_t *count, int **refs);
 static uv_buf_t* luv_check_bufs(lua_State* L, int index, size_t *count, luv_req_t* req_data);
 static uv_buf_t* luv_check_bufs_noref(lua_State* L, int index, size_t *count);
@@ -112,6 +121,16 @@ static int luv_optboolean(lua_State*L, int idx, int defaultval);
 /* From thread.c */
 static lua_State* luv_thread_acquire_vm(void);
 
+/* From async.c */
+static uv_async_t* luv_check_async(lua_State* L, int index);
+
+/* From chan.c */
+typedef struct luv_chan_s luv_chan_t;
+static void luv_chan_retain(luv_chan_t* chan);
+static void luv_chan_release(luv_chan_t* chan);
+static void luv_chan_push_udata(lua_State* L, luv_chan_t* chan);
+static void luv_chan_async_closed(uv_async_t* handle);
+
 /* From process.c */
 static int luv_parse_signal(lua_State* L, int slot);
 
@@ -122,6 +141,29 @@ static int luv_thread_arg_set(lua_State* L, luv_thread_arg_t* args, int idx, int
 static int luv_thread_arg_push(lua_State* L, luv_thread_arg_t* args, int flags);
 static void luv_thread_arg_clear(lua_State* L, luv_thread_arg_t* args, int flags);
 static int luv_thread_arg_error(lua_State* L);
+#ifdef HAVE_LUA_BUFFER
+static void luv_thread_push_buffer(lua_State* L, const char* p, size_t len);
+#endif
+static int luv_work_is_done_handle(luv_ctx_t* lctx, uv_handle_t* handle);
+
+/* From sched.c */
+/* Resume the coroutine on top of the stack with the nargs values below it if
+   it waits for the request or handle with the registry ref src, popping all
+   of them */
+static void luv_co_continue(lua_State* L, luv_ctx_t* ctx, int nargs, int src);
+static void luv_sched_loop_close(luv_ctx_t* ctx);
+static int luv_sched_is_handle(luv_ctx_t* ctx, uv_handle_t* handle);
+
+/* From udp.c */
+static void luv_udp_loop_close(luv_ctx_t* ctx);
+static int luv_udp_is_flush_handle(luv_ctx_t* ctx, uv_handle_t* handle);
+
+/* From metrics.c */
+/* Like luv_co_continue for a function or coroutine, and times the call as a
+   callback of the given handle type, or UV_HANDLE_TYPE_MAX + request type */
+static void luv_metrics_call(lua_State* L, luv_ctx_t* ctx, int type, int nargs, int src);
+static void luv_metrics_loop_close(lua_State* L, luv_ctx_t* ctx);
+static int luv_metrics_is_handle(luv_ctx_t* ctx, uv_handle_t* handle);
 
 static luv_acquire_vm acquire_vm_cb = NULL;
 static luv_release_vm release_vm_cb = NULL;
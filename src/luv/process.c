@@ -282,7 +282,7 @@ static int luv_spawn(lua_State* L) {
   handle->data = luv_setup_handle(L, ctx);
 
   if (!lua_isnoneornil(L, 3)) {
-    luv_check_callback(L, (luv_handle_t*)handle->data, LUV_EXIT, 3);
+    luv_check_once_callback(L, (luv_handle_t*)handle->data, LUV_EXIT, 3);
   }
 
   ret = uv_spawn(ctx->loop, handle, &options);
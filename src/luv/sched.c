@@ -0,0 +1,211 @@
+/*
+ *  Copyright 2014 The Luvit Authors. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include "private.h"
+
+// A coroutine can be given to any luv function in place of a callback. When
+// the request completes or the handle event fires, the coroutine is resumed
+// directly with the arguments the callback would get, once it has suspended
+// itself with uv.await waiting for that request or handle. Coroutines started
+// with uv.co_spawn, and those giving way with uv.await(), wait in a run queue
+// that is drained by an idle handle once per loop iteration.
+
+/* Run queue of one loop, see luv_ctx_t.sched */
+typedef struct {
+  uv_idle_t idle;
+  int* refs;             /* ring buffer of coroutine refs, in [head, tail),
+                            shifted left with the low bit set for new ones */
+  unsigned int head, tail, cap;
+} luv_sched_t;
+
+static int luv_co_error(lua_State* L) {
+  return lua_error(L);
+}
+
+// Resumes co with the nargs values on top of its stack. An error ending the
+// coroutine is reported like an error raised by a callback.
+static void luv_co_resume(lua_State* L, luv_ctx_t* ctx, lua_State* co, int nargs) {
+  int ret = lua_resume(co, L, nargs);
+  if (ret == LUA_YIELD)
+    // the value yielded by uv.await stays as the wait state
+    return;
+  if (ret == LUA_OK) {
+    lua_settop(co, 0);
+    return;
+  }
+  luaL_traceback(L, co, lua_tostring(co, -1), 0);
+  lua_settop(co, 0);
+  lua_pushcfunction(L, luv_co_error);
+  lua_insert(L, -2);
+  ctx->cb_pcall(L, 1, 0, LUVF_CALLBACK_NOTRACEBACK);
+}
+
+// Returns whether co is suspended by uv.await waiting for the request or
+// handle with the registry ref src, or for the run queue when src is
+// LUA_NOREF. uv.await yields what it waits for, or true for the run queue,
+// and that value is left on the stack of co until it is resumed.
+static int luv_co_waits_for(lua_State* co, int src) {
+  int match;
+  if (lua_status(co) != LUA_YIELD || lua_gettop(co) != 1)
+    return 0;
+  if (src == LUA_NOREF)
+    return lua_isboolean(co, 1);
+  lua_rawgeti(co, LUA_REGISTRYINDEX, src);
+  match = lua_rawequal(co, 1, 2);
+  lua_pop(co, 1);
+  return match;
+}
+
+// Called with the coroutine given as a callback on top of L, above the nargs
+// callback arguments, and the registry ref of the request or handle calling
+// back in src. Pops all of them. The coroutine is only resumed if it waits
+// for src; an event it doesn't wait for, like one of a dead coroutine, is
+// dropped.
+static void luv_co_continue(lua_State* L, luv_ctx_t* ctx, int nargs, int src) {
+  lua_State* co = lua_tothread(L, -1);
+  if (!luv_co_waits_for(co, src)) {
+    lua_pop(L, nargs + 1);
+    return;
+  }
+  // co stays on the stack of L while it runs, a coroutine from the run queue
+  // has no other reference
+  lua_insert(L, -1 - nargs);
+  lua_settop(co, 0);
+  lua_xmove(L, co, nargs);
+  luv_co_resume(L, ctx, co, nargs);
+  lua_pop(L, 1);
+}
+
+static void luv_sched_idle_cb(uv_idle_t* handle) {
+  luv_sched_t* sched = (luv_sched_t*)handle;
+  luv_ctx_t* ctx = (luv_ctx_t*)handle->data;
+  lua_State* L = ctx->L;
+  // coroutines queued while these run wait for the next iteration
+  unsigned int tail = sched->tail;
+  while (sched->head != tail) {
+    int ref = sched->refs[sched->head++ % sched->cap];
+    lua_State* co;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref >> 1);
+    luaL_unref(L, LUA_REGISTRYINDEX, ref >> 1);
+    co = lua_tothread(L, -1);
+    if ((ref & 1) && lua_status(co) == LUA_OK && lua_gettop(co) > 0) {
+      // a new coroutine has its body and arguments on its stack
+      luv_co_resume(L, ctx, co, lua_gettop(co) - 1);
+      lua_pop(L, 1);
+    }
+    else {
+      // skipped if resumed by someone else in the meantime
+      luv_co_continue(L, ctx, 0, LUA_NOREF);
+    }
+  }
+  if (sched->head == sched->tail)
+    uv_idle_stop(&sched->idle);
+}
+
+static luv_sched_t* luv_sched(lua_State* L) {
+  luv_ctx_t* ctx = luv_context(L);
+  luv_sched_t* sched = (luv_sched_t*)ctx->sched;
+  if (sched == NULL) {
+    sched = (luv_sched_t*)malloc(sizeof(*sched));
+    assert(sched);
+    memset(sched, 0, sizeof(*sched));
+    uv_idle_init(ctx->loop, &sched->idle);
+    sched->idle.data = ctx;
+    ctx->sched = sched;
+  }
+  return sched;
+}
+
+// Queues the coroutine on top of the stack, popping it.
+static void luv_sched_push(lua_State* L, luv_sched_t* sched, int fresh) {
+  if (sched->tail - sched->head == sched->cap) {
+    unsigned int i, n = sched->cap, cap = n ? n * 2 : 16;
+    int* refs = (int*)malloc(cap * sizeof(int));
+    assert(refs);
+    for (i = 0; i < n; i++)
+      refs[i] = sched->refs[(sched->head + i) % n];
+    free(sched->refs);
+    sched->refs = refs;
+    sched->cap = cap;
+    sched->head = 0;
+    sched->tail = n;
+  }
+  sched->refs[sched->tail++ % sched->cap] = luaL_ref(L, LUA_REGISTRYINDEX) << 1 | fresh;
+  uv_idle_start(&sched->idle, luv_sched_idle_cb);
+}
+
+static void luv_sched_close_cb(uv_handle_t* handle) {
+  luv_sched_t* sched = (luv_sched_t*)handle;
+  free(sched->refs);
+  free(sched);
+}
+
+// Called while the loop is being closed, queued coroutines never run.
+static void luv_sched_loop_close(luv_ctx_t* ctx) {
+  luv_sched_t* sched = (luv_sched_t*)ctx->sched;
+  if (sched == NULL)
+    return;
+  ctx->sched = NULL;
+  uv_close((uv_handle_t*)&sched->idle, luv_sched_close_cb);
+}
+
+static int luv_sched_is_handle(luv_ctx_t* ctx, uv_handle_t* handle) {
+  return ctx->sched != NULL && handle == (uv_handle_t*)ctx->sched;
+}
+
+/* -- Lua API ------------------------------------------------------------- */
+
+// uv.co_spawn(fn, ...) creates a coroutine running fn(...) and starts it on the
+// next loop iteration. Returns the coroutine.
+static int luv_co_spawn(lua_State* L) {
+  int nargs = lua_gettop(L);
+  luv_sched_t* sched;
+  lua_State* co;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  sched = luv_sched(L);
+  co = lua_newthread(L);
+  lua_insert(L, 1);
+  lua_xmove(L, co, nargs);
+  lua_pushvalue(L, 1);
+  luv_sched_push(L, sched, 1);
+  return 1;
+}
+
+// uv.await(...) suspends the running coroutine until the request or handle it
+// was given to as the callback resumes it, and returns the arguments of that
+// callback. Pass the results of the call starting the request, or the handle:
+// when the call failed, that is nil and an error message, and the message is
+// returned right away like the error argument of the callback. Without
+// arguments, the coroutine goes back to the run queue and resumes on the next
+// loop iteration.
+static int luv_await(lua_State* L) {
+  int nargs = lua_gettop(L);
+  if (lua_pushthread(L))
+    return luaL_error(L, "uv.await must be called from a coroutine");
+  if (nargs == 0) {
+    luv_sched_push(L, luv_sched(L), 0);
+    lua_pushboolean(L, 1);
+    return lua_yield(L, 1);
+  }
+  lua_pop(L, 1);
+  if (lua_isnil(L, 1)) {
+    lua_settop(L, 2);
+    return 1;
+  }
+  luaL_argcheck(L, lua_isuserdata(L, 1), 1, "expected a request or handle");
+  lua_settop(L, 1);
+  return lua_yield(L, 1);
+}
@@ -96,11 +96,47 @@ static int luv_accept(lua_State* L) {
   return luv_result(L, ret);
 }
 
+// libuv asks for a fresh buffer right before every read and hands it back
+// right after, so read buffers of the usual size are recycled through a
+// small per-loop pool instead of going through malloc/free each time.
+#define LUV_SLAB_SIZE (64*1024)
+#define LUV_SLAB_MAX 16
+
+static void luv_slab_alloc(luv_ctx_t* ctx, size_t size, uv_buf_t* buf) {
+  if (size == LUV_SLAB_SIZE && ctx->slabs) {
+    buf->base = (char*)ctx->slabs;
+    ctx->slabs = *(void**)ctx->slabs;
+    ctx->nslabs--;
+  }
+  else {
+    buf->base = (char*)malloc(size);
+    assert(buf->base);
+  }
+  buf->len = size;
+}
+
+static void luv_slab_free(luv_ctx_t* ctx, const uv_buf_t* buf) {
+  if (buf->len == LUV_SLAB_SIZE && ctx->nslabs < LUV_SLAB_MAX) {
+    *(void**)buf->base = ctx->slabs;
+    ctx->slabs = buf->base;
+    ctx->nslabs++;
+  }
+  else {
+    free(buf->base);
+  }
+}
+
+static void luv_slab_release(luv_ctx_t* ctx) {
+  while (ctx->slabs) {
+    void* slab = ctx->slabs;
+    ctx->slabs = *(void**)slab;
+    free(slab);
+  }
+  ctx->nslabs = 0;
+}
+
 static void luv_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
-  (void)handle;
-  buf->base = (char*)malloc(suggested_size);
-  assert(buf->base);
-  buf->len = suggested_size;
+  luv_slab_alloc(((luv_handle_t*)handle->data)->ctx, suggested_size, buf);
 }
 
 static void luv_read_cb(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf) {
@@ -114,7 +150,7 @@ static void luv_read_cb(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf)
     nargs = 2;
   }
 
-  free(buf->base);
+  if (buf->base) luv_slab_free(data->ctx, buf);
   if (nread == 0) return;
 
   if (nread == UV_EOF) {
@@ -130,15 +166,76 @@ static void luv_read_cb(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf)
 
 static int luv_read_start(lua_State* L) {
   uv_stream_t* handle = luv_check_stream(L, 1);
+  luv_handle_t* data = (luv_handle_t*)handle->data;
   int ret;
-  luv_check_callback(L, (luv_handle_t*)handle->data, LUV_READ, 2);
+  luv_check_callback(L, data, LUV_READ, 2);
+  luaL_unref(L, LUA_REGISTRYINDEX, data->bufref);
+  data->bufref = LUA_NOREF;
   ret = uv_read_start(handle, luv_alloc_cb, luv_read_cb);
   return luv_result(L, ret);
 }
 
+#ifdef HAVE_LUA_BUFFER
+// Reads straight into the spare capacity of a string.buffer, so the data
+// never passes through an intermediate Lua string.
+static void luv_buffer_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+  luv_handle_t* data = (luv_handle_t*)handle->data;
+  lua_State* L = data->ctx->L;
+  size_t len = 0;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, data->bufref);
+  buf->base = lua_reservebuffer(L, -1, suggested_size, &len);
+  buf->len = buf->base ? len : 0;
+  lua_pop(L, 1);
+}
+
+static void luv_buffer_read_cb(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf) {
+  luv_handle_t* data = (luv_handle_t*)handle->data;
+  lua_State* L = data->ctx->L;
+  int nargs;
+  (void)buf;
+
+  if (nread == 0) return;
+
+  if (nread > 0) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, data->bufref);
+    lua_commitbuffer(L, -1, nread);
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_pushinteger(L, nread);
+    nargs = 2;
+  }
+  else if (nread == UV_EOF) {
+    nargs = 0;
+  }
+  else {
+    luv_status(L, nread);
+    nargs = 1;
+  }
+
+  luv_call_callback(L, data, LUV_READ, nargs);
+}
+
+static int luv_read_start_buffer(lua_State* L) {
+  uv_stream_t* handle = luv_check_stream(L, 1);
+  luv_handle_t* data = (luv_handle_t*)handle->data;
+  int ret;
+  if (!lua_isbuffer(L, 2))
+    return luaL_argerror(L, 2, "Expected string.buffer");
+  luv_check_callback(L, data, LUV_READ, 3);
+  luaL_unref(L, LUA_REGISTRYINDEX, data->bufref);
+  lua_pushvalue(L, 2);
+  data->bufref = luaL_ref(L, LUA_REGISTRYINDEX);
+  ret = uv_read_start(handle, luv_buffer_alloc_cb, luv_buffer_read_cb);
+  return luv_result(L, ret);
+}
+#endif
+
 static int luv_read_stop(lua_State* L) {
   uv_stream_t* handle = luv_check_stream(L, 1);
+  luv_handle_t* data = (luv_handle_t*)handle->data;
   int ret = uv_read_stop(handle);
+  luaL_unref(L, LUA_REGISTRYINDEX, data->bufref);
+  data->bufref = LUA_NOREF;
   return luv_result(L, ret);
 }
 
@@ -215,7 +215,7 @@ static int luv_tcp_close_reset(lua_State* L) {
   int ret;
   uv_tcp_t* handle = luv_check_tcp(L, 1);
   if (!lua_isnoneornil(L, 2)) {
-    luv_check_callback(L, (luv_handle_t*)handle->data, LUV_RESET, 2);
+    luv_check_once_callback(L, (luv_handle_t*)handle->data, LUV_RESET, 2);
   }
   ret = uv_tcp_close_reset(handle, luv_close_reset_cb);
   return luv_result(L, ret);
@@ -62,17 +62,52 @@ static const char* luv_getmtname(lua_State *L, int idx) {
   return name;
 }
 
+// Appends len bytes to the argument block, growing it as needed, and
+// returns their offset in the block.
+static size_t luv_thread_arg_append(char** block, size_t* size, size_t* cap, const char* p, size_t len) {
+  size_t ofs = *size;
+  if (*size + len > *cap) {
+    size_t ncap = *cap * 2;
+    if (ncap < *size + len) ncap = *size + len;
+    *block = (char*)realloc(*block, ncap);
+    assert(*block);
+    *cap = ncap;
+  }
+  memcpy(*block + ofs, p, len);
+  *size += len;
+  return ofs;
+}
+
+// The values are described by an array of luv_val_t. Strings are referenced
+// in place, unless the args are set asynchronously, when the setter does not
+// keep them alive. Copies of such strings and of the contents of a
+// string.buffer, which the sender may modify at any time, as well as tables
+// and other values in the serialization format of string.buffer, are appended
+// to the array, so all args live in a single allocation.
 static int luv_thread_arg_set(lua_State* L, luv_thread_arg_t* args, int idx, int top, int flags) {
-  int i;
+  int i, argc, ret = 0;
   int side = LUVF_THREAD_SIDE(flags);
   int async = LUVF_THREAD_ASYNC(flags);
+  char* block;
+  size_t size, cap;
 
   idx = idx > 0 ? idx : 1;
-  i = idx;
+  argc = top >= idx ? top - idx + 1 : 0;
   args->flags = flags;
-  while (i <= top && i < LUV_THREAD_MAXNUM_ARG + idx)
+  args->argc = 0;
+  args->argv = NULL;
+  if (argc == 0)
+    return 0;
+  size = sizeof(luv_val_t) * argc;
+  cap = size + 256;
+  block = (char*)malloc(cap);
+  assert(block);
+
+  for (i = idx; i <= top; i++)
   {
-    luv_val_t *arg = args->argv + i - idx;
+    luv_val_t *arg = (luv_val_t*)block + i - idx;
+    const char* p;
+    size_t len;
     arg->type = lua_type(L, i);
     arg->ref[0] = arg->ref[1] = LUA_NOREF;
     switch (arg->type)
@@ -85,19 +120,21 @@ static int luv_thread_arg_set(lua_State* L, luv_thread_arg_t* args, int idx, int
     case LUA_TNUMBER:
       arg->val.num = lua_tonumber(L, i);
       break;
-    case LUA_TSTRING:
-      if (async)
-      {
-        const char* p = lua_tolstring(L, i, &arg->val.str.len);
-        arg->val.str.base = malloc(arg->val.str.len);
-        memcpy((void*)arg->val.str.base, p, arg->val.str.len);
-      } else {
-        arg->val.str.base = lua_tolstring(L, i, &arg->val.str.len);
-        lua_pushvalue(L, i);
-        arg->ref[side] = luaL_ref(L, LUA_REGISTRYINDEX);
-      }
-      break;
     case LUA_TUSERDATA:
+#ifdef HAVE_LUA_BUFFER
+      if (lua_isbuffer(L, i)) {
+        arg->type = LUV_TBUFFER;
+        p = lua_tobuffer(L, i, &len);
+        goto bytes;
+      }
+#endif
+      if (luaL_testudata(L, i, "uv_chan")) {
+        // the args hold a reference until they are freed
+        arg->type = LUV_TCHANNEL;
+        arg->val.udata.data = *(luv_chan_t**)lua_touserdata(L, i);
+        luv_chan_retain((luv_chan_t*)arg->val.udata.data);
+        break;
+      }
       arg->val.udata.data = lua_topointer(L, i);
       arg->val.udata.size = lua_rawlen(L, i);
       arg->val.udata.metaname = luv_getmtname(L, i);
@@ -107,25 +144,69 @@ static int luv_thread_arg_set(lua_State* L, luv_thread_arg_t* args, int idx, int
         arg->ref[side] = luaL_ref(L, LUA_REGISTRYINDEX);
       }
       break;
+    case LUA_TSTRING:
+      p = lua_tolstring(L, i, &len);
+#ifdef HAVE_LUA_BUFFER
+    bytes:
+#endif
+      arg->val.str.len = len;
+      if (async || arg->type == LUV_TBUFFER)
+      {
+        // stores the offset for now, see below
+        size_t ofs = luv_thread_arg_append(&block, &size, &cap, p, len);
+        arg = (luv_val_t*)block + i - idx;
+        arg->val.str.base = (const char*)(uintptr_t)ofs;
+      } else {
+        arg->val.str.base = p;
+        lua_pushvalue(L, i);
+        arg->ref[side] = luaL_ref(L, LUA_REGISTRYINDEX);
+      }
+      break;
     default:
-      args->argc = i - idx;
+#ifdef HAVE_LUA_SERIALIZE
+      if (lua_serialize(L, i, &p, &len) == 0) {
+        size_t ofs = luv_thread_arg_append(&block, &size, &cap, p, len);
+        arg = (luv_val_t*)block + i - idx;
+        arg->type = LUV_TSERIALIZED;
+        arg->val.str.base = (const char*)(uintptr_t)ofs;
+        arg->val.str.len = len;
+        break;
+      }
+      // leave the error message on the stack for luv_thread_arg_error
+#else
       lua_pushinteger(L, arg->type);
       lua_pushinteger(L, i - idx + 1);
-      return -1;
+#endif
+      ret = -1;
+      break;
     }
-    i++;
+    if (ret < 0)
+      break;
+    args->argc++;
+  }
+
+  // the block may have moved while growing, so data in it is located by
+  // offset until here
+  for (i = 0; i < args->argc; i++) {
+    luv_val_t* arg = (luv_val_t*)block + i;
+    if (arg->type == LUV_TSERIALIZED || arg->type == LUV_TBUFFER ||
+        (async && arg->type == LUA_TSTRING))
+      arg->val.str.base = block + (uintptr_t)arg->val.str.base;
   }
-  args->argc = i - idx;
-  return args->argc;
+  args->argv = (luv_val_t*)block;
+  return ret < 0 ? ret : args->argc;
 }
 
+// The setter side drops its refs right away when the args were set
+// asynchronously, so then the receiving side frees the args. Otherwise the
+// setter side frees them once the receiving side is done with them.
 static void luv_thread_arg_clear(lua_State* L, luv_thread_arg_t* args, int flags) {
   int i;
   int side = LUVF_THREAD_SIDE(flags);
   int set = LUVF_THREAD_SIDE(args->flags);
   int async = LUVF_THREAD_ASYNC(args->flags);
 
-  if (args->argc == 0)
+  if (args->argv == NULL)
     return;
 
   for (i = 0; i < args->argc; i++) {
@@ -136,13 +217,6 @@ static void luv_thread_arg_clear(lua_State* L, luv_thread_arg_t* args, int flags
       {
         luaL_unref(L, LUA_REGISTRYINDEX, arg->ref[side]);
         arg->ref[side] = LUA_NOREF;
-      } else {
-        if(async && set!=side)
-        {
-          free((void*)arg->val.str.base);
-          arg->val.str.base = NULL;
-          arg->val.str.len = 0;
-        }
       }
       break;
     case LUA_TUSERDATA:
@@ -164,7 +238,33 @@ static void luv_thread_arg_clear(lua_State* L, luv_thread_arg_t* args, int flags
       break;
     }
   }
+
+  if (async ? side != set : side == set) {
+    for (i = 0; i < args->argc; i++) {
+      if (args->argv[i].type == LUV_TCHANNEL)
+        luv_chan_release((luv_chan_t*)args->argv[i].val.udata.data);
+    }
+    free(args->argv);
+    args->argv = NULL;
+    args->argc = 0;
+  }
+}
+
+#ifdef HAVE_LUA_BUFFER
+// Pushes a new string.buffer holding a copy of the given bytes.
+static void luv_thread_push_buffer(lua_State* L, const char* p, size_t len) {
+  lua_getglobal(L, "require");
+  lua_pushliteral(L, "string.buffer");
+  lua_call(L, 1, 1);
+  lua_getfield(L, -1, "new");
+  lua_remove(L, -2);
+  lua_call(L, 0, 1);
+  if (len) {
+    memcpy(lua_reservebuffer(L, -1, len, NULL), p, len);
+    lua_commitbuffer(L, -1, len);
+  }
 }
+#endif
 
 // called only in thread
 static int luv_thread_arg_push(lua_State* L, luv_thread_arg_t* args, int flags) {
@@ -186,6 +286,19 @@ static int luv_thread_arg_push(lua_State* L, luv_thread_arg_t* args, int flags)
     case LUA_TSTRING:
       lua_pushlstring(L, arg->val.str.base, arg->val.str.len);
       break;
+#ifdef HAVE_LUA_BUFFER
+    case LUV_TBUFFER:
+      luv_thread_push_buffer(L, arg->val.str.base, arg->val.str.len);
+      break;
+#endif
+#ifdef HAVE_LUA_SERIALIZE
+    case LUV_TSERIALIZED:
+      lua_deserialize(L, arg->val.str.base, arg->val.str.len);
+      break;
+#endif
+    case LUV_TCHANNEL:
+      luv_chan_push_udata(L, (luv_chan_t*)arg->val.udata.data);
+      break;
     case LUA_TUSERDATA:
       if (arg->val.udata.size)
       {
@@ -212,8 +325,11 @@ static int luv_thread_arg_push(lua_State* L, luv_thread_arg_t* args, int flags)
 }
 
 static int luv_thread_arg_error(lua_State *L) {
-  int type = lua_tointeger(L, -2);
-  int pos = lua_tointeger(L, -1);
+  int type, pos;
+  if (lua_type(L, -1) == LUA_TSTRING)
+    return luaL_error(L, "Error: thread arg %s", lua_tostring(L, -1));
+  type = lua_tointeger(L, -2);
+  pos = lua_tointeger(L, -1);
   lua_pop(L, 2);
   return luaL_error(L, "Error: thread arg not support type '%s' at %d",
     lua_typename(L, type), pos);
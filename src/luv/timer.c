@@ -47,7 +47,10 @@ static int luv_timer_start(lua_State* L) {
   int ret;
   timeout = luaL_checkinteger(L, 2);
   repeat = luaL_checkinteger(L, 3);
-  luv_check_callback(L, (luv_handle_t*)handle->data, LUV_TIMEOUT, 4);
+  if (repeat == 0)
+    luv_check_once_callback(L, (luv_handle_t*)handle->data, LUV_TIMEOUT, 4);
+  else
+    luv_check_callback(L, (luv_handle_t*)handle->data, LUV_TIMEOUT, 4);
   ret = uv_timer_start(handle, luv_timer_cb, timeout, repeat);
   return luv_result(L, ret);
 }
@@ -0,0 +1,425 @@
+/*
+ *  Copyright 2014 The Luvit Authors. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include "private.h"
+
+// A timer wheel keeps any number of timeouts on a single uv_timer_t. Each
+// timeout is identified by a Lua key, and starting, restarting or stopping one
+// takes constant time. Time is counted in ticks of the wheel's granularity and
+// the timeouts are kept in a hierarchy of five wheels like the classic Linux
+// timer wheel: the first has one slot per tick for the next 256 ticks, the
+// others have 64 slots each covering 64 times more ticks than a slot below.
+// When the first wheel comes round, the next slot of the second is cascaded
+// into it, and so on up. Timeouts expiring at the same time are handed to
+// the callback together.
+
+#define LUV_WHEEL_BITS1 8
+#define LUV_WHEEL_BITS 6
+#define LUV_WHEEL_SIZE1 (1 << LUV_WHEEL_BITS1)
+#define LUV_WHEEL_SIZE (1 << LUV_WHEEL_BITS)
+#define LUV_WHEEL_MASK1 (LUV_WHEEL_SIZE1 - 1)
+#define LUV_WHEEL_MASK (LUV_WHEEL_SIZE - 1)
+#define LUV_WHEEL_SLOTS (LUV_WHEEL_SIZE1 + 4 * LUV_WHEEL_SIZE)
+#define LUV_WHEEL_MAX_TICKS 0xffffffffULL
+
+// First slot and shift of the ticks of the wheel above the first at level 1-4
+#define LUV_WHEEL_SLOT(n) (LUV_WHEEL_SIZE1 + ((n) - 1) * LUV_WHEEL_SIZE)
+#define LUV_WHEEL_SHIFT(n) (LUV_WHEEL_BITS1 + ((n) - 1) * LUV_WHEEL_BITS)
+
+typedef struct {
+  uint64_t expires;      /* tick the timeout is due at */
+  int next, prev;        /* slot list links, next also links free entries */
+  int slot;              /* -1 while free */
+} luv_wheel_entry_t;
+
+typedef struct {
+  uint64_t tick;         /* granularity in ms */
+  uint64_t base;         /* loop time of tick 0 */
+  uint64_t now;          /* next tick to run, all before it have run */
+  uint64_t wake;         /* tick the timer is started for, or UINT64_MAX */
+  luv_wheel_entry_t* entries;
+  int cap, free;
+  int count, near;       /* pending timeouts, and those in the first wheel */
+  int heads[LUV_WHEEL_SLOTS];
+} luv_timer_wheel_t;
+
+// The uservalue of a wheel holds two tables, the entry index of each pending
+// key by key and the keys by entry index + 1.
+
+static uv_timer_t* luv_check_timer_wheel(lua_State* L, int index) {
+  uv_timer_t* handle = (uv_timer_t*) luv_checkudata(L, index, "uv_timer_wheel");
+  luaL_argcheck(L, handle->data && !uv_is_closing((uv_handle_t*)handle), index,
+                "Expected open uv_timer_wheel");
+  return handle;
+}
+
+static luv_timer_wheel_t* luv_wheel(uv_timer_t* handle) {
+  return (luv_timer_wheel_t*)((luv_handle_t*)handle->data)->extra;
+}
+
+static void luv_wheel_free(void* ptr) {
+  luv_timer_wheel_t* wheel = (luv_timer_wheel_t*)ptr;
+  free(wheel->entries);
+  free(wheel);
+}
+
+static void luv_wheel_link(luv_timer_wheel_t* wheel, int i) {
+  luv_wheel_entry_t* e = &wheel->entries[i];
+  uint64_t expires = e->expires;
+  uint64_t delta = expires - wheel->now;
+  int slot;
+  if (expires < wheel->now) {
+    slot = wheel->now & LUV_WHEEL_MASK1;
+  } else if (delta < LUV_WHEEL_SIZE1) {
+    slot = expires & LUV_WHEEL_MASK1;
+  } else {
+    int n = 1;
+    if (delta > LUV_WHEEL_MAX_TICKS) {
+      expires = wheel->now + LUV_WHEEL_MAX_TICKS;
+      delta = LUV_WHEEL_MAX_TICKS;
+    }
+    while (n < 4 && delta >= 1ULL << LUV_WHEEL_SHIFT(n + 1))
+      n++;
+    slot = LUV_WHEEL_SLOT(n) + ((expires >> LUV_WHEEL_SHIFT(n)) & LUV_WHEEL_MASK);
+  }
+  if (slot < LUV_WHEEL_SIZE1)
+    wheel->near++;
+  e->slot = slot;
+  e->prev = -1;
+  e->next = wheel->heads[slot];
+  if (e->next >= 0)
+    wheel->entries[e->next].prev = i;
+  wheel->heads[slot] = i;
+}
+
+static void luv_wheel_unlink(luv_timer_wheel_t* wheel, int i) {
+  luv_wheel_entry_t* e = &wheel->entries[i];
+  if (e->slot < LUV_WHEEL_SIZE1)
+    wheel->near--;
+  if (e->prev >= 0)
+    wheel->entries[e->prev].next = e->next;
+  else
+    wheel->heads[e->slot] = e->next;
+  if (e->next >= 0)
+    wheel->entries[e->next].prev = e->prev;
+}
+
+// Makes sure there is a free entry and returns its index, or -1 when out of
+// memory. The entry is only taken by luv_wheel_alloc.
+static int luv_wheel_reserve(luv_timer_wheel_t* wheel) {
+  int i;
+  if (wheel->free < 0) {
+    int n = wheel->cap, cap = n ? n * 2 : 64;
+    luv_wheel_entry_t* entries = (luv_wheel_entry_t*)realloc(wheel->entries,
+                                                           cap * sizeof(*entries));
+    if (!entries)
+      return -1;
+    for (i = n; i < cap; i++) {
+      entries[i].slot = -1;
+      entries[i].next = i + 1 < cap ? i + 1 : -1;
+    }
+    wheel->entries = entries;
+    wheel->cap = cap;
+    wheel->free = n;
+  }
+  return wheel->free;
+}
+
+static void luv_wheel_alloc(luv_timer_wheel_t* wheel, int i) {
+  wheel->free = wheel->entries[i].next;
+  wheel->count++;
+}
+
+static void luv_wheel_release(luv_timer_wheel_t* wheel, int i) {
+  wheel->entries[i].slot = -1;
+  wheel->entries[i].next = wheel->free;
+  wheel->free = i;
+  wheel->count--;
+}
+
+// Pushes the index and key tables of the wheel at index.
+static void luv_wheel_tables(lua_State* L, int index) {
+  lua_getuservalue(L, index);
+  lua_rawgeti(L, -1, 1);
+  lua_rawgeti(L, -2, 2);
+  lua_remove(L, -3);
+}
+
+static uint64_t luv_wheel_now(uv_timer_t* handle, luv_timer_wheel_t* wheel) {
+  return (uv_now(handle->loop) - wheel->base) / wheel->tick;
+}
+
+static void luv_wheel_cb(uv_timer_t* handle);
+
+// Starts the timer for the given tick, which is due on the loop time the
+// tick begins.
+static void luv_wheel_arm(uv_timer_t* handle, luv_timer_wheel_t* wheel, uint64_t wake) {
+  uint64_t due = wheel->base + wake * wheel->tick, now = uv_now(handle->loop);
+  wheel->wake = wake;
+  uv_timer_start(handle, luv_wheel_cb, due > now ? due - now : 0, 0);
+}
+
+// Finds the next tick that has timeouts to run or cascades the wheels above
+// and starts the timer for it.
+static void luv_wheel_schedule(uv_timer_t* handle, luv_timer_wheel_t* wheel) {
+  uint64_t t = wheel->now;
+  if (wheel->count == 0) {
+    wheel->wake = UINT64_MAX;
+    uv_timer_stop(handle);
+    return;
+  }
+  // the wheels above are cascaded at the end of the first one, what comes
+  // down may be due right away
+  if ((t & LUV_WHEEL_MASK1) != 0 || wheel->count == wheel->near) {
+    for (;; t++) {
+      if (wheel->heads[t & LUV_WHEEL_MASK1] >= 0)
+        break;
+      if ((t & LUV_WHEEL_MASK1) == LUV_WHEEL_MASK1 && wheel->count > wheel->near) {
+        t++;
+        break;
+      }
+    }
+  }
+  luv_wheel_arm(handle, wheel, t);
+}
+
+// Moves the timeouts of the current slot of wheel n down the hierarchy and
+// returns the index of that slot.
+static int luv_wheel_cascade(luv_timer_wheel_t* wheel, int n) {
+  int index = (wheel->now >> LUV_WHEEL_SHIFT(n)) & LUV_WHEEL_MASK;
+  int slot = LUV_WHEEL_SLOT(n) + index;
+  int i = wheel->heads[slot];
+  wheel->heads[slot] = -1;
+  while (i >= 0) {
+    int next = wheel->entries[i].next;
+    luv_wheel_link(wheel, i);
+    i = next;
+  }
+  return index;
+}
+
+static void luv_wheel_cb(uv_timer_t* handle) {
+  luv_handle_t* data = (luv_handle_t*)handle->data;
+  luv_timer_wheel_t* wheel = (luv_timer_wheel_t*)data->extra;
+  lua_State* L = data->ctx->L;
+  uint64_t target = luv_wheel_now(handle, wheel);
+  int n = 0;
+  wheel->wake = UINT64_MAX;
+  if (wheel->count == 0 && wheel->now <= target)
+    wheel->now = target + 1;
+  if (wheel->now > target) {
+    luv_wheel_schedule(handle, wheel);
+    return;
+  }
+  luv_find_handle(L, data);
+  luv_wheel_tables(L, -1);
+  lua_remove(L, -3);
+  lua_newtable(L);
+  while (wheel->now <= target) {
+    int index = wheel->now & LUV_WHEEL_MASK1, i;
+    if (index == 0 && luv_wheel_cascade(wheel, 1) == 0 &&
+        luv_wheel_cascade(wheel, 2) == 0 && luv_wheel_cascade(wheel, 3) == 0)
+      luv_wheel_cascade(wheel, 4);
+    i = wheel->heads[index];
+    wheel->heads[index] = -1;
+    while (i >= 0) {
+      int next = wheel->entries[i].next;
+      wheel->near--;
+      luv_wheel_release(wheel, i);
+      lua_rawgeti(L, -2, i + 1);
+      lua_pushvalue(L, -1);
+      lua_pushnil(L);
+      lua_rawset(L, -6);
+      lua_rawseti(L, -2, ++n);
+      lua_pushnil(L);
+      lua_rawseti(L, -3, i + 1);
+      i = next;
+    }
+    wheel->now++;
+    // nothing left to find, skip the remaining empty ticks
+    if (wheel->count == 0 && wheel->now <= target)
+      wheel->now = target + 1;
+  }
+  lua_replace(L, -3);
+  lua_pop(L, 1);
+  luv_wheel_schedule(handle, wheel);
+  if (n > 0)
+    luv_call_callback(L, data, LUV_TIMEOUT, 1);
+  else
+    lua_pop(L, 1);
+}
+
+/* -- Lua API ------------------------------------------------------------- */
+
+// uv.new_timer_wheel(callback[, granularity]) creates a timer wheel counting
+// time in steps of granularity milliseconds (default 1). callback(keys) is
+// called with an array of the keys whose timeouts expired.
+static int luv_new_timer_wheel(lua_State* L) {
+  luv_ctx_t* ctx = luv_context(L);
+  lua_Integer tick = luaL_optinteger(L, 2, 1);
+  luv_timer_wheel_t* wheel;
+  luv_handle_t* data;
+  uv_timer_t* handle;
+  int ret, i;
+  if (lua_isthread(L, 1))
+    luaL_argerror(L, 1, "coroutine can't be the callback of a repeating event");
+  luv_check_callable(L, 1);
+  luaL_argcheck(L, tick > 0, 2, "granularity must be positive");
+  handle = (uv_timer_t*) luv_newuserdata(L, uv_handle_size(UV_TIMER));
+  ret = uv_timer_init(ctx->loop, handle);
+  if (ret < 0) {
+    lua_pop(L, 1);
+    return luv_error(L, ret);
+  }
+  data = luv_setup_handle(L, ctx);
+  handle->data = data;
+  luaL_getmetatable(L, "uv_timer_wheel");
+  lua_setmetatable(L, -2);
+  // allocated once the handle owns it, so that nothing below can leak it
+  wheel = (luv_timer_wheel_t*)malloc(sizeof(*wheel));
+  if (!wheel) {
+    uv_close((uv_handle_t*)handle, luv_close_cb);
+    return luaL_error(L, "Can't allocate timer wheel");
+  }
+  data->extra = wheel;
+  data->extra_gc = luv_wheel_free;
+  wheel->tick = tick;
+  wheel->base = uv_now(ctx->loop);
+  wheel->now = 0;
+  wheel->wake = UINT64_MAX;
+  wheel->entries = NULL;
+  wheel->cap = 0;
+  wheel->free = -1;
+  wheel->count = 0;
+  wheel->near = 0;
+  for (i = 0; i < LUV_WHEEL_SLOTS; i++)
+    wheel->heads[i] = -1;
+
+  lua_createtable(L, 2, 0);
+  lua_newtable(L);
+  lua_rawseti(L, -2, 1);
+  lua_newtable(L);
+  lua_rawseti(L, -2, 2);
+  lua_setuservalue(L, -2);
+  luv_check_callback(L, data, LUV_TIMEOUT, 1);
+  return 1;
+}
+
+// Pushes the tables of the wheel and returns the entry index of the key at
+// index 2, or -1.
+static int luv_wheel_find(lua_State* L) {
+  int i;
+  luaL_checkany(L, 2);
+  luaL_argcheck(L, !lua_isnil(L, 2), 2, "key must not be nil");
+  luaL_argcheck(L, lua_rawequal(L, 2, 2), 2, "key must not be NaN");
+  luv_wheel_tables(L, 1);
+  lua_pushvalue(L, 2);
+  lua_rawget(L, -3);
+  i = lua_isnil(L, -1) ? -1 : (int)lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  return i;
+}
+
+// wheel:start(key, timeout) starts the timeout of key, or restarts it when it
+// is pending, to expire in timeout milliseconds.
+static int luv_timer_wheel_start(lua_State* L) {
+  uv_timer_t* handle = luv_check_timer_wheel(L, 1);
+  luv_timer_wheel_t* wheel = luv_wheel(handle);
+  lua_Integer timeout = luaL_checkinteger(L, 3);
+  int i = luv_wheel_find(L);
+  uint64_t expires;
+  luaL_argcheck(L, timeout >= 0, 3, "timeout must not be negative");
+  if (i >= 0) {
+    luv_wheel_unlink(wheel, i);
+  } else {
+    // an empty wheel can skip the ticks it slept through
+    if (wheel->count == 0)
+      wheel->now = luv_wheel_now(handle, wheel);
+    i = luv_wheel_reserve(wheel);
+    if (i < 0)
+      return luaL_error(L, "Can't allocate timer wheel entry");
+    // the key is stored before the entry is taken, a memory error while
+    // growing the tables leaves the wheel as it was
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, i + 1);
+    lua_pushvalue(L, 2);
+    lua_pushinteger(L, i);
+    lua_rawset(L, -4);
+    luv_wheel_alloc(wheel, i);
+  }
+  // round up, a timeout never expires early
+  expires = (uv_now(handle->loop) - wheel->base + timeout + wheel->tick - 1) / wheel->tick;
+  wheel->entries[i].expires = expires;
+  luv_wheel_link(wheel, i);
+  if (expires < wheel->now)
+    expires = wheel->now;
+  if (expires < wheel->wake)
+    luv_wheel_arm(handle, wheel, expires);
+  lua_pushinteger(L, 0);
+  return 1;
+}
+
+// wheel:stop(key) stops the timeout of key. Returns whether it was pending.
+static int luv_timer_wheel_stop(lua_State* L) {
+  uv_timer_t* handle = luv_check_timer_wheel(L, 1);
+  luv_timer_wheel_t* wheel = luv_wheel(handle);
+  int i = luv_wheel_find(L);
+  if (i >= 0) {
+    luv_wheel_unlink(wheel, i);
+    luv_wheel_release(wheel, i);
+    lua_pushvalue(L, 2);
+    lua_pushnil(L);
+    lua_rawset(L, -4);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, i + 1);
+    // the timer runs on until it is due, and stops when nothing is left
+    if (wheel->count == 0) {
+      wheel->wake = UINT64_MAX;
+      uv_timer_stop(handle);
+    }
+  }
+  lua_pushboolean(L, i >= 0);
+  return 1;
+}
+
+// wheel:get_due_in(key) returns the milliseconds until the timeout of key
+// expires, or nil when it is not pending.
+static int luv_timer_wheel_get_due_in(lua_State* L) {
+  uv_timer_t* handle = luv_check_timer_wheel(L, 1);
+  luv_timer_wheel_t* wheel = luv_wheel(handle);
+  int i = luv_wheel_find(L);
+  uint64_t due, now;
+  if (i < 0) {
+    lua_pushnil(L);
+    return 1;
+  }
+  due = wheel->base + wheel->entries[i].expires * wheel->tick;
+  now = uv_now(handle->loop);
+  lua_pushinteger(L, due > now ? due - now : 0);
+  return 1;
+}
+
+static int luv_timer_wheel_count(lua_State* L) {
+  uv_timer_t* handle = luv_check_timer_wheel(L, 1);
+  lua_pushinteger(L, luv_wheel(handle)->count);
+  return 1;
+}
+
+static int luv_timer_wheel_tostring(lua_State* L) {
+  uv_timer_t* handle = (uv_timer_t*) luv_checkudata(L, 1, "uv_timer_wheel");
+  lua_pushfstring(L, "uv_timer_wheel: %p", handle);
+  return 1;
+}
@@ -16,6 +16,89 @@
  */
 #include "private.h"
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// A datagram received by recv_batch_start, waiting to be handed to Lua.
+typedef struct {
+  size_t len;
+  struct sockaddr_storage addr;
+} luv_udp_dgram_t;
+
+// Extra data of udp handles using recvmmsg or recv_batch_start.
+typedef struct luv_udp_data_s {
+  int num_msgs;          // messages per recvmmsg call, 1 without recvmmsg
+  unsigned int max;      // batch size of recv_batch_start, 0 if not batching
+  unsigned int count;    // datagrams waiting in the buffer
+  char* base;            // space in the buffer libuv currently reads into
+  size_t used;           // bytes of it taken by datagrams of this read
+  luv_udp_dgram_t* dgrams;
+  uv_udp_t* handle;
+  luv_ctx_t* ctx;
+  struct luv_udp_data_s* next;  // in the flush list, if queued
+  int queued;
+} luv_udp_data_t;
+
+/* Handles with datagrams not called back yet, see luv_ctx_t.udp */
+typedef struct {
+  uv_check_t check;
+  luv_udp_data_t* head;
+} luv_udp_flush_t;
+
+static void luv_udp_unqueue(luv_udp_data_t* d) {
+  luv_udp_data_t** p;
+  if (!d->queued)
+    return;
+  for (p = &((luv_udp_flush_t*)d->ctx->udp)->head; *p != d; p = &(*p)->next)
+    ;
+  *p = d->next;
+  d->queued = 0;
+}
+
+static void luv_udp_data_gc(void* ptr) {
+  luv_udp_data_t* d = (luv_udp_data_t*)ptr;
+  luv_udp_unqueue(d);
+  free(d->dgrams);
+  free(d);
+}
+
+static void luv_udp_flush_close_cb(uv_handle_t* handle) {
+  free(handle);
+}
+
+static void luv_udp_loop_close(luv_ctx_t* ctx) {
+  luv_udp_flush_t* flush = (luv_udp_flush_t*)ctx->udp;
+  if (flush == NULL)
+    return;
+  while (flush->head) {
+    flush->head->queued = 0;
+    flush->head = flush->head->next;
+  }
+  ctx->udp = NULL;
+  uv_close((uv_handle_t*)&flush->check, luv_udp_flush_close_cb);
+}
+
+static int luv_udp_is_flush_handle(luv_ctx_t* ctx, uv_handle_t* handle) {
+  return ctx->udp != NULL && handle == (uv_handle_t*)ctx->udp;
+}
+
+static luv_udp_data_t* luv_udp_data(uv_udp_t* handle) {
+  luv_handle_t* data = (luv_handle_t*)handle->data;
+  if (data->extra == NULL) {
+    luv_udp_data_t* d = (luv_udp_data_t*)malloc(sizeof(*d));
+    assert(d);
+    memset(d, 0, sizeof(*d));
+    d->num_msgs = 1;
+    d->handle = handle;
+    d->ctx = data->ctx;
+    data->extra = d;
+    data->extra_gc = luv_udp_data_gc;
+  }
+  return (luv_udp_data_t*)data->extra;
+}
+
 static uv_udp_t* luv_check_udp(lua_State* L, int index) {
   uv_udp_t* handle = (uv_udp_t*)luv_checkudata(L, index, "uv_udp");
   luaL_argcheck(L, handle->type == UV_UDP && handle->data, index, "Expected uv_udp_t");
@@ -101,11 +184,7 @@ static int luv_new_udp(lua_State* L) {
 #if LUV_UV_VERSION_GEQ(1, 39, 0)
   if (flags & UV_UDP_RECVMMSG) {
     // store the number of msgs to be received for use in alloc_cb
-    int* extra_data = malloc(sizeof(int));
-    assert(extra_data);
-    *extra_data = mmsg_num_msgs;
-    ((luv_handle_t*)handle->data)->extra = extra_data;
-    ((luv_handle_t*)handle->data)->extra_gc = free;
+    luv_udp_data(handle)->num_msgs = mmsg_num_msgs;
   }
 #endif
   return 1;
@@ -333,7 +412,7 @@ static void luv_udp_recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf
   // and return early because we know the only purpose of this recv_cb call
   // is to free the buffer that was being used by recvmmsg
   if (flags & UV_UDP_MMSG_FREE) {
-    free(buf->base);
+    luv_slab_free(data->ctx, buf);
     return;
   }
 #endif
@@ -364,11 +443,11 @@ static void luv_udp_recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf
 #if LUV_UV_VERSION_GEQ(1, 35, 0)
   // UV_UDP_MMSG_CHUNK Indicates that the message was received by recvmmsg, so the buffer provided
   // must not be freed by the recv_cb callback.
-  if (buf && !(flags & UV_UDP_MMSG_CHUNK)) {
-    free(buf->base);
+  if (buf && buf->base && !(flags & UV_UDP_MMSG_CHUNK)) {
+    luv_slab_free(data->ctx, buf);
   }
 #else
-  if (buf) free(buf->base);
+  if (buf && buf->base) luv_slab_free(data->ctx, buf);
 #endif
 
   // address
@@ -401,12 +480,10 @@ static void luv_udp_recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf
 static void luv_udp_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
   size_t buffer_size = suggested_size;
   if (uv_udp_using_recvmmsg((uv_udp_t*)handle)) {
-    int num_msgs = *(int*)(((luv_handle_t*)handle->data)->extra);
+    int num_msgs = ((luv_udp_data_t*)((luv_handle_t*)handle->data)->extra)->num_msgs;
     buffer_size = MAX_DGRAM_SIZE * num_msgs;
   }
-  buf->base = (char*)malloc(buffer_size);
-  assert(buf->base);
-  buf->len = buffer_size;
+  luv_slab_alloc(((luv_handle_t*)handle->data)->ctx, buffer_size, buf);
 }
 #endif
 
@@ -429,9 +506,316 @@ static int luv_udp_recv_start(lua_State* L) {
   return luv_result(L, ret);
 }
 
+#ifdef HAVE_LUA_BUFFER
+#define LUV_UDP_BATCH_MAX 1024
+
+static int luv_udp_same_addr(const struct sockaddr_storage* a, const struct sockaddr_storage* b) {
+  if (a->ss_family != b->ss_family)
+    return 0;
+  if (a->ss_family == AF_INET)
+    return memcmp(a, b, sizeof(struct sockaddr_in)) == 0;
+  if (a->ss_family == AF_INET6)
+    return memcmp(a, b, sizeof(struct sockaddr_in6)) == 0;
+  return 0;
+}
+
+// Calls back with all datagrams received so far: their number, an array of
+// their sizes and an array of their addresses. Consecutive datagrams from the
+// same peer share one address table.
+static void luv_udp_batch_deliver(lua_State* L, uv_udp_t* handle, luv_udp_data_t* d) {
+  unsigned int i, n = d->count;
+  if (n == 0)
+    return;
+  d->count = 0;
+  lua_pushnil(L);
+  lua_pushinteger(L, n);
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    lua_pushinteger(L, d->dgrams[i].len);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    if (i > 0 && luv_udp_same_addr(&d->dgrams[i].addr, &d->dgrams[i - 1].addr))
+      lua_rawgeti(L, -1, i);
+    else
+      parse_sockaddr(L, &d->dgrams[i].addr);
+    lua_rawseti(L, -2, i + 1);
+  }
+  luv_call_callback(L, (luv_handle_t*)handle->data, LUV_RECV, 4);
+}
+
+// libuv reads a limited number of datagrams per poll event, and doesn't tell
+// when it stops before the socket is drained. A batch that isn't full is
+// therefore called back by a check handle, after all I/O of this loop
+// iteration has been processed.
+static void luv_udp_flush_cb(uv_check_t* check) {
+  luv_udp_flush_t* flush = (luv_udp_flush_t*)check;
+  lua_State* L = ((luv_ctx_t*)check->data)->L;
+  while (flush->head) {
+    luv_udp_data_t* d = flush->head;
+    flush->head = d->next;
+    d->queued = 0;
+    if (!uv_is_closing((uv_handle_t*)d->handle))
+      luv_udp_batch_deliver(L, d->handle, d);
+  }
+  uv_check_stop(check);
+}
+
+static void luv_udp_flush_later(luv_udp_data_t* d) {
+  luv_ctx_t* ctx = d->ctx;
+  luv_udp_flush_t* flush = (luv_udp_flush_t*)ctx->udp;
+  if (d->queued)
+    return;
+  if (flush == NULL) {
+    flush = (luv_udp_flush_t*)malloc(sizeof(*flush));
+    assert(flush);
+    uv_check_init(ctx->loop, &flush->check);
+    uv_unref((uv_handle_t*)&flush->check);
+    flush->check.data = ctx;
+    flush->head = NULL;
+    ctx->udp = flush;
+  }
+  d->next = flush->head;
+  flush->head = d;
+  d->queued = 1;
+  uv_check_start(&flush->check, luv_udp_flush_cb);
+}
+
+// Calls back right away when the batch is full, or else after this round of
+// I/O, see luv_udp_flush_cb.
+static void luv_udp_batch_added(lua_State* L, uv_udp_t* handle, luv_udp_data_t* d) {
+  if (d->count == d->max)
+    luv_udp_batch_deliver(L, handle, d);
+  else
+    luv_udp_flush_later(d);
+}
+
+static void luv_udp_batch_commit(lua_State* L, luv_handle_t* data, size_t len) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, data->bufref);
+  lua_commitbuffer(L, -1, len);
+  lua_pop(L, 1);
+}
+
+// Datagrams are read straight into the spare capacity of the buffer. With
+// recvmmsg, libuv splits the space into one slot per message, so at most as
+// many slots as the batch has room for are asked for.
+static void luv_udp_batch_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+  luv_handle_t* data = (luv_handle_t*)handle->data;
+  luv_udp_data_t* d = (luv_udp_data_t*)data->extra;
+  lua_State* L = data->ctx->L;
+  size_t size = suggested_size;
+#if LUV_UV_VERSION_GEQ(1, 40, 0)
+  if (uv_udp_using_recvmmsg((uv_udp_t*)handle)) {
+    unsigned int k = d->max - d->count;
+    if (k > (unsigned int)d->num_msgs)
+      k = d->num_msgs;
+    size = MAX_DGRAM_SIZE * k;
+  }
+#endif
+  lua_rawgeti(L, LUA_REGISTRYINDEX, data->bufref);
+  d->base = lua_reservebuffer(L, -1, size, NULL);
+  lua_pop(L, 1);
+  d->used = 0;
+  *buf = uv_buf_init(d->base, size);
+}
+
+static void luv_udp_batch_recv_cb(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf, const struct sockaddr* addr, unsigned flags) {
+  luv_handle_t* data = (luv_handle_t*)handle->data;
+  luv_udp_data_t* d = (luv_udp_data_t*)data->extra;
+  lua_State* L = data->ctx->L;
+  luv_udp_dgram_t* dg;
+
+#if LUV_UV_VERSION_GEQ(1, 40, 0)
+  // the datagrams of one recvmmsg call have all been moved to the front of
+  // its space, they can be committed now
+  if (flags & UV_UDP_MMSG_FREE) {
+    luv_udp_batch_commit(L, data, d->used);
+    luv_udp_batch_added(L, handle, d);
+    return;
+  }
+#endif
+
+  if (nread < 0 || addr == NULL) {
+    // an error, or nothing left to read: libuv stops reading until the
+    // socket is readable again
+    luv_udp_batch_deliver(L, handle, d);
+    if (nread < 0) {
+      luv_status(L, nread);
+      luv_call_callback(L, data, LUV_RECV, 1);
+    }
+    return;
+  }
+
+  dg = &d->dgrams[d->count++];
+  dg->len = nread;
+  memcpy(&dg->addr, addr, addr->sa_family == AF_INET6 ?
+    sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+#if LUV_UV_VERSION_GEQ(1, 40, 0)
+  if (flags & UV_UDP_MMSG_CHUNK) {
+    memmove(d->base + d->used, buf->base, nread);
+    d->used += nread;
+    return;
+  }
+#endif
+  luv_udp_batch_commit(L, data, nread);
+  luv_udp_batch_added(L, handle, d);
+}
+
+// Like recv_start, but appends the datagrams to a string.buffer and calls
+// back once for up to n of them, see luv_udp_batch_deliver.
+static int luv_udp_recv_batch_start(lua_State* L) {
+  uv_udp_t* handle = luv_check_udp(L, 1);
+  luv_handle_t* data = (luv_handle_t*)handle->data;
+  luv_udp_data_t* d;
+  int n, ret;
+  luaL_argcheck(L, lua_isbuffer(L, 2), 2, "expected a string.buffer");
+  n = luaL_checkinteger(L, 3);
+  luaL_argcheck(L, n > 0 && n <= LUV_UDP_BATCH_MAX, 3, "batch size out of range");
+  luv_check_callback(L, data, LUV_RECV, 4);
+  d = luv_udp_data(handle);
+  if ((unsigned int)n != d->max) {
+    luv_udp_dgram_t* dgrams = (luv_udp_dgram_t*)realloc(d->dgrams, n * sizeof(*dgrams));
+    if (dgrams == NULL)
+      return luaL_error(L, "Failure to allocate buffer");
+    d->dgrams = dgrams;
+  }
+  d->max = n;
+  d->count = 0;
+  luv_udp_unqueue(d);
+  luaL_unref(L, LUA_REGISTRYINDEX, data->bufref);
+  lua_pushvalue(L, 2);
+  data->bufref = luaL_ref(L, LUA_REGISTRYINDEX);
+  ret = uv_udp_recv_start(handle, luv_udp_batch_alloc_cb, luv_udp_batch_recv_cb);
+  if (ret < 0) {
+    luaL_unref(L, LUA_REGISTRYINDEX, data->bufref);
+    data->bufref = LUA_NOREF;
+    d->max = 0;
+  }
+  return luv_result(L, ret);
+}
+
+#define LUV_UDP_SEND_BATCH 64
+
+#if defined(__linux__) && defined(__NR_sendmmsg)
+// struct mmsghdr is only declared with _GNU_SOURCE
+struct luv_mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
+#endif
+
+// Sends a list of datagrams right away like try_send, each given as data,
+// or as {data, host, port}. On Linux up to 64 go out with one sendmmsg call.
+// Returns how many were sent, which is fewer than asked when the socket
+// buffer fills up. The whole list is checked before anything is sent.
+static int luv_udp_send_batch(lua_State* L) {
+  uv_udp_t* handle = luv_check_udp(L, 1);
+  struct sockaddr_storage* all_addrs;
+  uv_buf_t* all_bufs;
+  struct sockaddr** all_addr_ptrs;
+  int i, k, n, total = 0;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  n = (int)lua_rawlen(L, 2);
+  if (uv_udp_get_send_queue_count(handle) != 0)
+    return luv_error(L, UV_EAGAIN);
+
+  // a userdata, so that it isn't leaked by errors in the list
+  all_addrs = (struct sockaddr_storage*)lua_newuserdata(L,
+    n * (sizeof(*all_addrs) + sizeof(*all_bufs) + sizeof(*all_addr_ptrs)));
+  all_bufs = (uv_buf_t*)(all_addrs + n);
+  all_addr_ptrs = (struct sockaddr**)(all_bufs + n);
+  // the data stays referenced by the list while it is sent
+  for (i = 0; i < n; i++) {
+    int top = lua_gettop(L), idx = top + 1;
+    lua_rawgeti(L, 2, i + 1);
+    if (lua_istable(L, idx)) {
+      lua_rawgeti(L, idx, 1);
+      lua_rawgeti(L, idx, 2);
+      lua_rawgeti(L, idx, 3);
+      all_addr_ptrs[i] = luv_check_addr(L, &all_addrs[i], top + 3, top + 4);
+      idx = top + 2;
+    }
+    else {
+      all_addr_ptrs[i] = NULL;
+    }
+    // a number would be converted in the stack slot, which is popped below
+    if (lua_type(L, idx) == LUA_TNUMBER || !luv_is_buf(L, idx))
+      return luaL_argerror(L, 2, lua_pushfstring(L, "expected string or string.buffer data, found %s in the list", luaL_typename(L, idx)));
+    luv_prep_buf(L, idx, &all_bufs[i]);
+    lua_settop(L, top);
+  }
+
+  for (i = 0; i < n; i += k) {
+    uv_buf_t* bufs = all_bufs + i;
+    struct sockaddr** addr_ptrs = all_addr_ptrs + i;
+    int sent = 0;
+    k = n - i < LUV_UDP_SEND_BATCH ? n - i : LUV_UDP_SEND_BATCH;
+#if defined(__linux__) && defined(__NR_sendmmsg)
+    {
+      struct luv_mmsghdr msgs[LUV_UDP_SEND_BATCH];
+      uv_os_fd_t fd;
+      int j, first = 0, ret = uv_fileno((uv_handle_t*)handle, &fd);
+      if (ret == UV_EBADF) {
+        // libuv creates and binds the socket on its first send
+        ret = uv_udp_try_send(handle, &bufs[0], 1, addr_ptrs[0]);
+        if (ret < 0)
+          return luv_error(L, ret);
+        first = 1;
+        ret = uv_fileno((uv_handle_t*)handle, &fd);
+      }
+      if (ret < 0)
+        return luv_error(L, ret);
+      memset(msgs, 0, k * sizeof(*msgs));
+      for (j = first; j < k; j++) {
+        msgs[j].msg_hdr.msg_iov = (struct iovec*)&bufs[j];
+        msgs[j].msg_hdr.msg_iovlen = 1;
+        if (addr_ptrs[j]) {
+          msgs[j].msg_hdr.msg_name = addr_ptrs[j];
+          msgs[j].msg_hdr.msg_namelen = addr_ptrs[j]->sa_family == AF_INET6 ?
+            sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+        }
+      }
+      do
+        sent = first == k ? 0 : syscall(__NR_sendmmsg, fd, msgs + first, k - first, 0);
+      while (sent == -1 && errno == EINTR);
+      if (sent < 0) {
+        if (total + first > 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          sent = 0;
+        else
+          return luv_error(L, -errno);
+      }
+      sent += first;
+    }
+#else
+    for (; sent < k; sent++) {
+      int ret = uv_udp_try_send(handle, &bufs[sent], 1, addr_ptrs[sent]);
+      if (ret < 0) {
+        if (total + sent > 0 && ret == UV_EAGAIN)
+          break;
+        return luv_error(L, ret);
+      }
+    }
+#endif
+    total += sent;
+    if (sent < k)
+      break;
+  }
+  lua_pushinteger(L, total);
+  return 1;
+}
+#endif
+
 static int luv_udp_recv_stop(lua_State* L) {
   uv_udp_t* handle = luv_check_udp(L, 1);
+  luv_handle_t* data = (luv_handle_t*)handle->data;
   int ret = uv_udp_recv_stop(handle);
+  if (data->extra) {
+    ((luv_udp_data_t*)data->extra)->max = 0;
+    luv_udp_unqueue((luv_udp_data_t*)data->extra);
+  }
+  luaL_unref(L, LUA_REGISTRYINDEX, data->bufref);
+  data->bufref = LUA_NOREF;
   return luv_result(L, ret);
 }
 
@@ -16,6 +16,12 @@
 */
 #include "private.h"
 
+// Work items run on luv's own pool of worker threads, each with its own Lua
+// VM. Every worker has a deque of items: it takes work from the front of its
+// own deque, and when that is empty it steals from the back of the others.
+// Finished items are handed back to the loop that queued them through an
+// async handle, where the after work callback runs.
+
 typedef struct {
   lua_State* L;       /* vm in main */
   char* code;         /* thread entry code */
@@ -24,27 +30,44 @@ typedef struct {
   int after_work_cb;  /* ref, run in main ,call after work cb*/
 } luv_work_ctx_t;
 
-typedef struct {
-  uv_work_t work;
+typedef struct luv_work_done_s luv_work_done_t;
+
+typedef struct luv_work_s {
+  struct luv_work_s* next;  /* link in the list of finished items */
   luv_work_ctx_t* ctx;
+  luv_work_done_t* done;    /* loop the item was queued from */
 
   luv_thread_arg_t args;
   luv_thread_arg_t rets;
-  int ref;            /* ref to luv_work_ctx_t, which create a new uv_work_t*/
+  int ref;            /* ref to luv_work_ctx_t, which create a new luv_work_t*/
 } luv_work_t;
 
-static uv_once_t once_vmkey = UV_ONCE_INIT;
-static uv_key_t tls_vmkey;  /* thread local storage key for Lua state */
-static uv_mutex_t vm_mutex;
-
-static unsigned int idx_vms = 0;
-static unsigned int nvms = 0;
-static lua_State** vms;
-static lua_State* default_vms[4];
+/* Finished items of one loop, see luv_ctx_t.work */
+struct luv_work_done_s {
+  uv_async_t async;
+  uv_mutex_t mutex;
+  luv_work_t* head;      /* finished items, most recent first */
+  unsigned int pending;  /* queued and not yet finished, loop thread only */
+};
 
-#ifndef ARRAY_SIZE
-#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
-#endif
+typedef struct {
+  uv_mutex_t mutex;
+  luv_work_t** items;    /* ring buffer, items in [head, tail) */
+  unsigned int head, tail, cap;
+  uv_thread_t thread;
+  lua_State* L;          /* created on the worker thread on first use */
+} luv_worker_t;
+
+static uv_once_t once_pool = UV_ONCE_INIT;
+static uv_mutex_t pool_mutex;
+static uv_cond_t pool_cond;
+static unsigned int pool_size = 0;    /* 0 until the workers are started */
+static unsigned int pool_queued = 0;  /* items in all deques */
+static unsigned int pool_idle = 0;    /* workers waiting on pool_cond */
+static unsigned int pool_next = 0;    /* deque that gets the next item */
+static int pool_stop = 0;
+static luv_worker_t* workers;
+static unsigned int pool_size_hint = 0;
 
 #if LUV_UV_VERSION_GEQ(1, 30, 0)
 #define MAX_THREADPOOL_SIZE 1024
@@ -71,42 +94,74 @@ static int luv_work_ctx_tostring(lua_State* L) {
   return 1;
 }
 
-static int luv_work_cb(lua_State* L) {
-  uv_work_t* req = lua_touserdata(L, 1);
-  luv_work_t* work = (luv_work_t*)req->data;
-  luv_work_ctx_t* ctx = work->ctx;
-  luv_ctx_t *lctx = luv_context(L);
-  lua_pop(L, 1);
-
-  int top = lua_gettop(L);
+#define LUV_WORK_FNS_MAX 64
 
-  /* push lua function */
+// Pushes the work function, loading it only the first time this VM sees it.
+// Loaded functions are cached in the registry, keyed by their bytecode, with
+// their number at index 0. The cache starts over once it holds
+// LUV_WORK_FNS_MAX functions, so it doesn't grow with every work context ever
+// queued.
+static void luv_work_push_fn(lua_State* L, luv_work_ctx_t* ctx) {
+  lua_getfield(L, LUA_REGISTRYINDEX, "luv_work_fns");
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, "luv_work_fns");
+  }
   lua_pushlstring(L, ctx->code, ctx->len);
-  lua_rawget(L, LUA_REGISTRYINDEX);
+  lua_pushvalue(L, -1);
+  lua_rawget(L, -3);
   if (lua_isnil(L, -1)) {
+    int n;
     lua_pop(L, 1);
-
-    lua_pushlstring(L, ctx->code, ctx->len);
+    lua_rawgeti(L, -2, 0);
+    n = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (n >= LUV_WORK_FNS_MAX) {
+      lua_newtable(L);
+      lua_replace(L, -3);
+      lua_pushvalue(L, -2);
+      lua_setfield(L, LUA_REGISTRYINDEX, "luv_work_fns");
+      n = 0;
+    }
     if (luaL_loadbuffer(L, ctx->code, ctx->len, "=pool") != 0)
     {
       fprintf(stderr, "Uncaught Error in work callback: %s\n", lua_tostring(L, -1));
-      lua_pop(L, 2);
+      lua_pop(L, 1);
 
       lua_pushnil(L);
     } else {
-      lua_pushvalue(L, -1);
-      lua_insert(L, lua_gettop(L) - 2);
-      lua_rawset(L, LUA_REGISTRYINDEX);
+      lua_pushvalue(L, -2);
+      lua_pushvalue(L, -2);
+      lua_rawset(L, -5);
+      lua_pushinteger(L, n + 1);
+      lua_rawseti(L, -4, 0);
     }
   }
+  // cache, code, function
+  lua_replace(L, -3);
+  lua_pop(L, 1);
+}
+
+static int luv_work_cb(lua_State* L) {
+  luv_work_t* work = (luv_work_t*)lua_touserdata(L, 1);
+  luv_work_ctx_t* ctx = work->ctx;
+  luv_ctx_t *lctx = luv_context(L);
+  lua_pop(L, 1);
+
+  int top = lua_gettop(L);
+
+  /* push lua function */
+  luv_work_push_fn(L, ctx);
 
   if (lua_isfunction(L, -1)) {
     int i = luv_thread_arg_push(L, &work->args, LUVF_THREAD_SIDE_CHILD);
     // If exit is called on a thread in the thread pool, abort is called in
-    // uv__threadpool_cleanup, so exit is not called in luv_cfpcall.
+    // luv_work_cleanup, so exit is not called in luv_cfpcall.
     i = lctx->thrd_pcall(L, i, LUA_MULTRET, LUVF_CALLBACK_NOEXIT);
     if ( i>=0 ) {
-      //clear in main threads, luv_after_work_cb
+      //clear in main threads, luv_after_work
       i = luv_thread_arg_set(L, &work->rets, top + 1, lua_gettop(L),
           LUVF_THREAD_MODE_ASYNC|LUVF_THREAD_SIDE_CHILD);
       if (i < 0) {
@@ -127,47 +182,197 @@ static int luv_work_cb(lua_State* L) {
   return LUA_OK;
 }
 
-static lua_State* luv_work_acquire_vm(void)
-{
-  lua_State* L = uv_key_get(&tls_vmkey);
-  if (L == NULL)
-  {
-    L = acquire_vm_cb();
-    uv_key_set(&tls_vmkey, L);
+static void luv_work_run(luv_worker_t* w, luv_work_t* work) {
+  lua_State* L = w->L;
+  luv_ctx_t* lctx;
+  int i;
+
+  if (L == NULL) {
+    L = w->L = acquire_vm_cb();
     lua_pushboolean(L, 1);
     lua_setglobal(L, "_THREAD");
-
-    uv_mutex_lock(&vm_mutex);
-    vms[idx_vms] = L;
-    idx_vms += 1;
-    uv_mutex_unlock(&vm_mutex);
   }
-  return L;
-}
-
-static void luv_work_cb_wrapper(uv_work_t* req) {
-  luv_work_t* work =  (luv_work_t*)req->data;
-  lua_State *L = luv_work_acquire_vm();
-  luv_ctx_t* lctx = luv_context(L);
+  lctx = luv_context(L);
 
   // If exit is called on a thread in the thread pool, abort is called in
-  // uv__threadpool_cleanup, so exit is not called in luv_cfpcall.
-  int i = lctx->thrd_cpcall(L, luv_work_cb, (void*)req, LUVF_CALLBACK_NOEXIT);
+  // luv_work_cleanup, so exit is not called in luv_cfpcall.
+  i = lctx->thrd_cpcall(L, luv_work_cb, (void*)work, LUVF_CALLBACK_NOEXIT);
   if (i != LUA_OK) {
     luv_thread_arg_clear(L, &work->rets, LUVF_THREAD_MODE_ASYNC|LUVF_THREAD_SIDE_CHILD);
     luv_thread_arg_clear(L, &work->args, LUVF_THREAD_SIDE_CHILD);
   }
 }
 
-static void luv_after_work_cb(uv_work_t* req, int status) {
-  luv_work_t* work = (luv_work_t*)req->data;
+/* -- Worker deques ------------------------------------------------------- */
+
+static void luv_worker_push(luv_worker_t* w, luv_work_t* work) {
+  uv_mutex_lock(&w->mutex);
+  if (w->tail - w->head == w->cap) {
+    unsigned int i, ncap = w->cap ? w->cap * 2 : 64;
+    luv_work_t** items = (luv_work_t**)malloc(ncap * sizeof(*items));
+    assert(items);
+    for (i = 0; i < w->cap; i++)
+      items[i] = w->items[(w->head + i) % w->cap];
+    free(w->items);
+    w->items = items;
+    w->head = 0;
+    w->tail = w->cap;
+    w->cap = ncap;
+  }
+  w->items[w->tail++ % w->cap] = work;
+  uv_mutex_unlock(&w->mutex);
+}
+
+/* Takes the oldest item of a worker's own deque. */
+static luv_work_t* luv_worker_pop(luv_worker_t* w) {
+  luv_work_t* work = NULL;
+  uv_mutex_lock(&w->mutex);
+  if (w->head != w->tail)
+    work = w->items[w->head++ % w->cap];
+  uv_mutex_unlock(&w->mutex);
+  return work;
+}
+
+/* Takes the newest item of another worker's deque. */
+static luv_work_t* luv_worker_steal(luv_worker_t* w) {
+  unsigned int i;
+  for (i = 1; i < pool_size; i++) {
+    luv_worker_t* victim = &workers[(w - workers + i) % pool_size];
+    luv_work_t* work = NULL;
+    if (uv_mutex_trylock(&victim->mutex) != 0)
+      continue;
+    if (victim->head != victim->tail)
+      work = victim->items[--victim->tail % victim->cap];
+    uv_mutex_unlock(&victim->mutex);
+    if (work)
+      return work;
+  }
+  return NULL;
+}
+
+static void luv_work_post(luv_work_t* work) {
+  luv_work_done_t* done = work->done;
+  // send while holding the lock, so the loop can't drain the list and close
+  // the handle in between
+  uv_mutex_lock(&done->mutex);
+  work->next = done->head;
+  done->head = work;
+  uv_async_send(&done->async);
+  uv_mutex_unlock(&done->mutex);
+}
+
+static void luv_worker_main(void* arg) {
+  luv_worker_t* w = (luv_worker_t*)arg;
+  for (;;) {
+    luv_work_t* work = luv_worker_pop(w);
+    if (work == NULL)
+      work = luv_worker_steal(w);
+    uv_mutex_lock(&pool_mutex);
+    if (work == NULL) {
+      int stop;
+      while (pool_queued == 0 && !pool_stop) {
+        pool_idle++;
+        uv_cond_wait(&pool_cond, &pool_mutex);
+        pool_idle--;
+      }
+      stop = pool_stop && pool_queued == 0;
+      uv_mutex_unlock(&pool_mutex);
+      if (stop)
+        break;
+      continue;
+    }
+    pool_queued--;
+    uv_mutex_unlock(&pool_mutex);
+
+    luv_work_run(w, work);
+    luv_work_post(work);
+  }
+  if (w->L)
+    release_vm_cb(w->L);
+  w->L = NULL;
+}
+
+static void luv_work_pool_init_once(void) {
+  if (uv_mutex_init(&pool_mutex) != 0 || uv_cond_init(&pool_cond) != 0) {
+    fprintf(stderr, "*** threadpool not works\n");
+    abort();
+  }
+}
+
+// The pool size set with uv.work_pool_size() or $LUV_WORK_POOL_SIZE,
+// and by default one worker per CPU, regardless of $UV_THREADPOOL_SIZE.
+static unsigned int luv_work_pool_default_size(void) {
+  unsigned int n = pool_size_hint;
+  const char* val;
+
+  if (n == 0) {
+    val = getenv("LUV_WORK_POOL_SIZE");
+    if (val != NULL)
+      n = atoi(val);
+  }
+  if (n == 0) {
+#if LUV_UV_VERSION_GEQ(1, 44, 0)
+    n = uv_available_parallelism();
+#else
+    n = 4;
+#endif
+  }
+  if (n > MAX_THREADPOOL_SIZE)
+    n = MAX_THREADPOOL_SIZE;
+  return n;
+}
+
+static void luv_work_pool_start(void) {
+  unsigned int i, n = luv_work_pool_default_size();
+
+  workers = (luv_worker_t*)calloc(n, sizeof(*workers));
+  assert(workers);
+  for (i = 0; i < n; i++) {
+    if (uv_mutex_init(&workers[i].mutex) != 0)
+      abort();
+  }
+  pool_size = n;
+  for (i = 0; i < n; i++) {
+    if (uv_thread_create(&workers[i].thread, luv_worker_main, &workers[i]) != 0) {
+      fprintf(stderr, "*** threadpool not works\n");
+      abort();
+    }
+  }
+}
+
+static void luv_work_submit(luv_work_t** items, unsigned int n) {
+  unsigned int i, next;
+  uv_mutex_lock(&pool_mutex);
+  if (pool_size == 0)
+    luv_work_pool_start();
+  next = pool_next;
+  pool_next = (pool_next + n) % pool_size;
+  // counted before they are pushed, a worker may take them right away
+  pool_queued += n;
+  uv_mutex_unlock(&pool_mutex);
+
+  // spread the items over the deques, idle workers steal what they need
+  for (i = 0; i < n; i++)
+    luv_worker_push(&workers[(next + i) % pool_size], items[i]);
+
+  uv_mutex_lock(&pool_mutex);
+  if (pool_idle > 0) {
+    if (n > 1)
+      uv_cond_broadcast(&pool_cond);
+    else
+      uv_cond_signal(&pool_cond);
+  }
+  uv_mutex_unlock(&pool_mutex);
+}
+
+/* -- Completion in the loop ---------------------------------------------- */
+
+static void luv_after_work(luv_work_t* work) {
   luv_work_ctx_t* ctx = work->ctx;
   lua_State* L = ctx->L;
   luv_ctx_t *lctx = luv_context(L);
   int i;
 
-  (void)status;
-
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->after_work_cb);
   i = luv_thread_arg_push(L, &work->rets, LUVF_THREAD_SIDE_MAIN);
   lctx->cb_pcall(L, i, 0, 0);
@@ -181,6 +386,76 @@ static void luv_after_work_cb(uv_work_t* req, int status) {
   free(work);
 }
 
+static void luv_work_done_cb(uv_async_t* handle) {
+  luv_work_done_t* done = (luv_work_done_t*)handle;
+  luv_work_t *list, *work;
+
+  uv_mutex_lock(&done->mutex);
+  list = done->head;
+  done->head = NULL;
+  uv_mutex_unlock(&done->mutex);
+
+  // run the callbacks in the order the items finished
+  work = NULL;
+  while (list) {
+    luv_work_t* next = list->next;
+    list->next = work;
+    work = list;
+    list = next;
+  }
+  while (work) {
+    luv_work_t* next = work->next;
+    done->pending--;
+    luv_after_work(work);
+    work = next;
+  }
+  // only pending work keeps the loop alive
+  if (done->pending == 0)
+    uv_unref((uv_handle_t*)&done->async);
+}
+
+static luv_work_done_t* luv_work_done(lua_State* L) {
+  luv_ctx_t* lctx = luv_context(L);
+  luv_work_done_t* done = (luv_work_done_t*)lctx->work;
+  if (done == NULL) {
+    int ret;
+    done = (luv_work_done_t*)malloc(sizeof(*done));
+    assert(done);
+    memset(done, 0, sizeof(*done));
+    ret = uv_async_init(lctx->loop, &done->async, luv_work_done_cb);
+    if (ret < 0) {
+      free(done);
+      luaL_error(L, "%s: %s", uv_err_name(ret), uv_strerror(ret));
+    }
+    uv_mutex_init(&done->mutex);
+    uv_unref((uv_handle_t*)&done->async);
+    lctx->work = done;
+  }
+  return done;
+}
+
+static void luv_work_done_close_cb(uv_handle_t* handle) {
+  luv_work_done_t* done = (luv_work_done_t*)handle;
+  uv_mutex_destroy(&done->mutex);
+  free(done);
+}
+
+// Called while the loop is being closed: the completion handle stays open
+// until all work queued from this loop has finished.
+static void luv_work_loop_close(luv_ctx_t* lctx) {
+  luv_work_done_t* done = (luv_work_done_t*)lctx->work;
+  if (done == NULL || done->pending > 0)
+    return;
+  lctx->work = NULL;
+  uv_close((uv_handle_t*)&done->async, luv_work_done_close_cb);
+}
+
+static int luv_work_is_done_handle(luv_ctx_t* lctx, uv_handle_t* handle) {
+  return lctx->work != NULL && handle == (uv_handle_t*)lctx->work;
+}
+
+/* -- Lua API ------------------------------------------------------------- */
+
 static int luv_new_work(lua_State* L) {
   size_t len;
   char* code;
@@ -210,98 +485,140 @@ static int luv_new_work(lua_State* L) {
   return 1;
 }
 
-static int luv_queue_work(lua_State* L) {
-  int top = lua_gettop(L);
-  luv_work_ctx_t* ctx = luv_check_work_ctx(L, 1);
+// Creates a work item for the args in [idx, top], or returns NULL and leaves
+// the error on the stack.
+static luv_work_t* luv_work_new(lua_State* L, luv_work_ctx_t* ctx, luv_work_done_t* done, int idx, int top) {
   luv_work_t* work = (luv_work_t*)malloc(sizeof(*work));
-  int ret;
-
+  assert(work);
   memset(work, 0, sizeof(*work));
-  ret = luv_thread_arg_set(L, &work->args, 2, top, LUVF_THREAD_SIDE_MAIN); //clear in sub threads,luv_work_cb
-  if (ret < 0) {
+  //clear in sub threads,luv_work_cb
+  if (luv_thread_arg_set(L, &work->args, idx, top, LUVF_THREAD_SIDE_MAIN) < 0) {
     luv_thread_arg_clear(L, &work->args, LUVF_THREAD_SIDE_MAIN);
     free(work);
-    return luv_thread_arg_error(L);
+    return NULL;
   }
   work->ctx = ctx;
-  work->work.data = work;
-  ret = uv_queue_work(luv_loop(L), &work->work, luv_work_cb_wrapper, luv_after_work_cb);
-  if (ret < 0) {
-    luv_thread_arg_clear(L, &work->args, LUVF_THREAD_SIDE_MAIN);
-    free(work);
-    return luv_error(L, ret);
+  work->done = done;
+  work->ref = LUA_NOREF;
+  return work;
+}
+
+static void luv_work_queue(lua_State* L, luv_work_done_t* done, luv_work_t** items, unsigned int n) {
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    //ref up to ctx
+    lua_pushvalue(L, 1);
+    items[i]->ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }
+  if (n > 0 && done->pending == 0)
+    uv_ref((uv_handle_t*)&done->async);
+  done->pending += n;
+  luv_work_submit(items, n);
+}
 
-  //ref up to ctx
-  lua_pushvalue(L, 1);
-  work->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+static int luv_queue_work(lua_State* L) {
+  int top = lua_gettop(L);
+  luv_work_ctx_t* ctx = luv_check_work_ctx(L, 1);
+  luv_work_done_t* done = luv_work_done(L);
+  luv_work_t* work = luv_work_new(L, ctx, done, 2, top);
+  if (work == NULL)
+    return luv_thread_arg_error(L);
+  luv_work_queue(L, done, &work, 1);
 
   lua_pushboolean(L, 1);
   return 1;
 }
 
-static const luaL_Reg luv_work_ctx_methods[] = {
-  {"queue", luv_queue_work},
-  {NULL, NULL}
-};
-
-static void luv_key_init_once(void)
-{
-  const char* val;
-  int status = uv_key_create(&tls_vmkey);
-  if (status != 0)
-  {
-    fprintf(stderr, "*** threadpool not works\n");
-    fprintf(stderr, "Error to uv_key_create with %s: %s\n",
-      uv_err_name(status), uv_strerror(status));
-    abort();
-  }
-  status = uv_mutex_init(&vm_mutex);
-  if (status != 0)
-  {
-    fprintf(stderr, "*** threadpool not works\n");
-    fprintf(stderr, "Error to uv_mutex_init with %s: %s\n",
-      uv_err_name(status), uv_strerror(status));
-    abort();
+static void luv_work_free_items(lua_State* L, luv_work_t** items, unsigned int n) {
+  while (n--) {
+    luv_thread_arg_clear(L, &items[n]->args, LUVF_THREAD_SIDE_MAIN);
+    free(items[n]);
   }
+  free(items);
+}
 
-  /* ref to https://github.com/libuv/libuv/blob/v1.x/src/threadpool.c init_threads */
-  nvms = ARRAY_SIZE(default_vms);
-  val = getenv("UV_THREADPOOL_SIZE");
-  if (val != NULL)
-    nvms = atoi(val);
-  if (nvms == 0)
-    nvms = 1;
-  if (nvms > MAX_THREADPOOL_SIZE)
-    nvms = MAX_THREADPOOL_SIZE;
-
-  vms = default_vms;
-  if (nvms > ARRAY_SIZE(default_vms)) {
-    vms = malloc(nvms * sizeof(vms[0]));
-    if (vms == NULL) {
-      nvms = ARRAY_SIZE(default_vms);
-      vms = default_vms;
+// Queues one work item for every table of arguments in the list at index 2,
+// handing them to the workers all at once.
+static int luv_queue_work_batch(lua_State* L) {
+  luv_work_ctx_t* ctx = luv_check_work_ctx(L, 1);
+  luv_work_done_t* done;
+  luv_work_t** items;
+  unsigned int i, n;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  done = luv_work_done(L);
+  n = (unsigned int)lua_rawlen(L, 2);
+  items = (luv_work_t**)malloc((n ? n : 1) * sizeof(*items));
+  assert(items);
+  for (i = 0; i < n; i++) {
+    int j, nargs, base = lua_gettop(L);
+    lua_rawgeti(L, 2, i + 1);
+    nargs = lua_istable(L, -1) ? (int)lua_rawlen(L, -1) : -1;
+    if (nargs < 0 || !lua_checkstack(L, nargs)) {
+      luv_work_free_items(L, items, i);
+      return luaL_argerror(L, 2, nargs < 0 ? "expected a list of argument tables" : "too many work arguments");
+    }
+    for (j = 1; j <= nargs; j++)
+      lua_rawgeti(L, base + 1, j);
+    items[i] = luv_work_new(L, ctx, done, base + 2, base + 1 + nargs);
+    if (items[i] == NULL) {
+      luv_work_free_items(L, items, i);
+      return luv_thread_arg_error(L);
     }
-    memset(vms, 0, sizeof(vms[0]) * nvms);
+    lua_settop(L, base);
   }
-  idx_vms = 0;
+  luv_work_queue(L, done, items, n);
+  free(items);
+
+  lua_pushinteger(L, n);
+  return 1;
 }
 
+// Gets or sets the number of worker threads. It can only be changed before
+// the first work item is queued, when the workers are started.
+static int luv_work_pool_size(lua_State* L) {
+  int size = (int)luaL_optinteger(L, 1, 0);
+  int started;
+  luaL_argcheck(L, size >= 0 && size <= MAX_THREADPOOL_SIZE, 1, "pool size out of range");
+  uv_mutex_lock(&pool_mutex);
+  started = pool_size != 0;
+  if (size > 0 && !started)
+    pool_size_hint = size;
+  size = started ? (int)pool_size : (int)luv_work_pool_default_size();
+  uv_mutex_unlock(&pool_mutex);
+  if (started && !lua_isnoneornil(L, 1))
+    return luaL_error(L, "work pool already started with %d threads", size);
+  lua_pushinteger(L, size);
+  return 1;
+}
+
+static const luaL_Reg luv_work_ctx_methods[] = {
+  {"queue", luv_queue_work},
+  {"queue_batch", luv_queue_work_batch},
+  {NULL, NULL}
+};
+
 static void luv_work_cleanup(void)
 {
   unsigned int i;
 
-  if (nvms == 0)
+  uv_mutex_lock(&pool_mutex);
+  if (pool_size == 0) {
+    uv_mutex_unlock(&pool_mutex);
     return;
-
-  for (i = 0; i < nvms && vms[i]; i++)
-    release_vm_cb(vms[i]);
-
-  if (vms != default_vms)
-    free(vms);
-
-  uv_mutex_destroy(&vm_mutex);
-  nvms = 0;
+  }
+  pool_stop = 1;
+  uv_cond_broadcast(&pool_cond);
+  uv_mutex_unlock(&pool_mutex);
+
+  for (i = 0; i < pool_size; i++)
+    uv_thread_join(&workers[i].thread);
+  for (i = 0; i < pool_size; i++) {
+    uv_mutex_destroy(&workers[i].mutex);
+    free(workers[i].items);
+  }
+  free(workers);
+  workers = NULL;
+  pool_size = 0;
 }
 
 static void luv_work_init(lua_State* L) {
@@ -314,5 +631,5 @@ static void luv_work_init(lua_State* L) {
   lua_setfield(L, -2, "__index");
   lua_pop(L, 1);
 
-  uv_once(&once_vmkey, luv_key_init_once);
+  uv_once(&once_pool, luv_work_pool_init_once);
 }
@@ -0,0 +1,84 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: loop-carried pointers and 64 bit integers with side exits
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ffi = require "ffi"
+local buf = ffi.new("int64_t[64]")
+for i = 0, 63 do buf[i] = i * 3 end
+local p, q = buf, buf + 63
+local s = 0LL
+local seen = {}
+for i = 1, 2000 do
+    p = p + 1
+    if p == q then p = buf end
+    s = s + p[0]
+    local u = ffi.cast("uint64_t", i) * 7ULL
+    if i % 97 == 0 then seen[#seen + 1] = p; seen[#seen + 1] = u end
+    if i % 500 == 0 then collectgarbage() end
+end
+local t = 0LL
+for i = 1, #seen, 2 do t = t + (seen[i] - buf) + seen[i + 1] end
+print(s, t, p - buf)
+--- out
+185013LL	143178ULL	47
+--- err
+
+
+
+=== TEST 2: loop-carried box is sunk
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ffi = require "ffi"
+local jutil = require "jit.util"
+local vmdef = require "jit.vmdef"
+local function unsunk_boxes(tr)
+    local n = 0
+    local info = jutil.traceinfo(tr)
+    for ref = 1, info.nins do
+        local _, ot, _, _, ridsp = jutil.traceir(tr, ref)
+        local oidx = 6 * math.floor(ot / 256)
+        local rid = ridsp % 256
+        if vmdef.irnames:sub(oidx + 1, oidx + 5) == "CNEWI" and rid ~= 253
+           and rid ~= 254 then
+            n = n + 1
+        end
+    end
+    return n
+end
+local p = ffi.new("char[10]")
+local q
+for i = 1, 3000 do
+    q = p + i % 8
+    if i % 1000 == 0 then q = q + 1 end
+end
+print(q - p, unsunk_boxes(1))
+--- out
+1	0
+--- err
+
+
+
+=== TEST 3: freed boxes are reused
+--- lua
+local ffi = require "ffi"
+local t = {}
+for i = 1, 100000 do t[i % 64 + 1] = ffi.cast("int64_t", i) end
+collectgarbage()
+local s = 0LL
+for i = 1, 64 do s = s + t[i] end
+print(s)
+--- out
+6397984LL
+--- err
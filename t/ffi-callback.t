@@ -0,0 +1,82 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: callback argument conversions (cached signature)
+--- lua
+local ffi = require "ffi"
+ffi.cdef[[
+typedef enum { CB_A = 1, CB_B = 7 } cb_enum;
+]]
+local f = ffi.cast("const char *(*)(int8_t, uint8_t, int16_t, uint16_t, int32_t, uint32_t, bool, float, double, const char *, int64_t, cb_enum)",
+  function(...)
+    local t = { ... }
+    t[10] = ffi.string(t[10])
+    for i = 1, #t do t[i] = tostring(t[i]) end
+    _G.keep = table.concat(t, " ")
+    return _G.keep
+  end)
+for _ = 1, 3 do
+  print(ffi.string(f(-3, 250, -30000, 65000, -2000000000, 4000000000, true,
+                     0.5, 1.25, "str", -5, 7)))
+end
+--- out
+-3 250 -30000 65000 -2000000000 4000000000 true 0.5 1.25 str -5LL cdata<enum 97>: 7
+-3 250 -30000 65000 -2000000000 4000000000 true 0.5 1.25 str -5LL cdata<enum 97>: 7
+-3 250 -30000 65000 -2000000000 4000000000 true 0.5 1.25 str -5LL cdata<enum 97>: 7
+--- err
+
+
+
+=== TEST 2: callback with stack arguments and results
+--- lua
+local ffi = require "ffi"
+local f = ffi.cast("double (*)(int, int, int, int, int, int, int, double, double, double, double, double, double, double, double, double)",
+  function(a, b, c, d, e, f, g, x1, x2, x3, x4, x5, x6, x7, x8, x9)
+    return a + b + c + d + e + f + g * 10 + x1 + x2 + x3 + x4 + x5 + x6
+           + x7 + x8 + x9 * 100
+  end)
+local g = ffi.cast("int (*)(double)", function(x) return x end)
+local h = ffi.cast("unsigned (*)(int)", function(x) return x end)
+local s = 0
+for i = 1, 1000 do
+  s = s + f(1, 2, 3, 4, 5, 6, i, 1, 2, 3, 4, 5, 6, 7, 8, i)
+end
+print(s, g(-3.75), g(42), h(-1), h(7))
+--- out
+55112000	-3	42	4294967295	7
+--- err
+
+
+
+=== TEST 3: callbacks from C with compiled callee
+--- lua
+local ffi = require "ffi"
+ffi.cdef[[
+void qsort(void *base, size_t nmemb, size_t size,
+           int (*compar)(const void *, const void *));
+]]
+local n = 1000
+local a = ffi.new("int[?]", n)
+local cmp = ffi.cast("int (*)(const void *, const void *)", function(x, y)
+  local u = ffi.cast("const int *", x)[0]
+  local v = ffi.cast("const int *", y)[0]
+  return u < v and -1 or (u > v and 1 or 0)
+end)
+for r = 1, 20 do
+  for i = 0, n - 1 do a[i] = (i * 7919 + r) % n end
+  ffi.C.qsort(a, n, 4, cmp)
+end
+local ok = true
+for i = 0, n - 1 do if a[i] ~= i then ok = false end end
+print(ok)
+--- out
+true
+--- err
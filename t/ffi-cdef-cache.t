@@ -0,0 +1,86 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: dump and load C declarations
+--- lua
+local ffi = require "ffi"
+ffi.cdef[[ struct fwd; ]]
+local s = ffi.cdef_dump[[
+typedef struct point { double x, y; } point_t;
+struct node { struct node *next; point_t p[2]; int flags : 3; };
+enum color { RED, GREEN = 5, BLUE };
+int abs(int);
+size_t my_strlen(const char *s) __asm__("strlen");
+struct fwd *getfwd(void);
+typedef int (*cb_t)(const point_t *, void *);
+static const int kMax = 42;
+union u { int i; float f; };
+]]
+local path = os.tmpname()
+local f = assert(io.open(path, "wb"))
+f:write(s)
+f:close()
+ffi.cdef_load(path)
+ffi.cdef_load(path)
+os.remove(path)
+local p = ffi.new("point_t", 1, 2)
+local n = ffi.new("struct node")
+n.p[1].y = 3; n.flags = -2
+print(p.x + p.y, n.p[1].y, n.flags, ffi.C.abs(-7), tonumber(ffi.C.my_strlen("hello")))
+print(ffi.C.GREEN, ffi.C.BLUE, ffi.C.kMax, ffi.sizeof("union u"), ffi.sizeof("struct node"))
+local cb = ffi.cast("cb_t", function(pt) return pt.x * 10 end)
+print(cb(p, nil), ffi.typeof("struct fwd *"))
+--- out
+3	3	-2	7	5
+5	6	42	4	48
+10	ctype<struct fwd *>
+--- err
+
+
+
+=== TEST 2: dump and load errors
+--- lua
+local ffi = require "ffi"
+ffi.cdef[[ typedef struct { int a; } anon_t; ]]
+local ok, err = pcall(ffi.cdef_dump, "anon_t *mk(void);")
+print(ok, err:match("^cannot dump declaration depending on 'struct %d+'$") ~= nil)
+print(pcall(ffi.cdef_load, "/nonexistent/x.cdc"))
+local path = os.tmpname()
+local f = assert(io.open(path, "wb"))
+f:write(ffi.cdef_dump("typedef struct { int v[4]; } cut_t;"):sub(1, -3))
+f:close()
+print(pcall(ffi.cdef_load, path))
+os.remove(path)
+--- out
+false	true
+false	cannot open /nonexistent/x.cdc: No such file or directory
+false	cannot load incompatible or malformed C declarations
+--- err
+
+
+
+=== TEST 3: many declarations
+--- lua
+local ffi = require "ffi"
+local parts = {}
+for i = 1, 3000 do
+  parts[#parts + 1] = string.format(
+    "typedef struct s%d { int a[%d]; } s%d_t; enum { E%d = %d };",
+    i, i % 16 + 1, i, i, i)
+end
+ffi.cdef(table.concat(parts, "\n"))
+ffi.cdef[[ typedef struct s1 s1_alias; ]]
+local x = 0
+for i = 1, 3000 do x = x + ffi.sizeof("s" .. i .. "_t") + ffi.C["E" .. i] end
+print(x, ffi.sizeof("s1_alias"))
+--- out
+4603404	8
+--- err
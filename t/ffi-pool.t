@@ -0,0 +1,120 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: allocate, initialize and recycle pool objects
+--- lua
+local ffi = require "ffi"
+ffi.cdef[[
+typedef struct { double x, y; int n; } pool_pt;
+]]
+local pool = ffi.pool("pool_pt", 4)
+local ps = {}
+for i = 1, 10 do
+    local p = pool:alloc()
+    assert(p.x == 0 and p.y == 0 and p.n == 0)
+    p.x, p.y, p.n = i, -i, i * 2
+    ps[i] = p
+end
+local s = 0
+for i = 1, 10 do s = s + ps[i].x + ps[i].y + ps[i].n end
+for i = 1, 10 do pool:free(ps[i]) end
+local q = pool:alloc(1, 2, 3)
+print(s, q.x, q.y, q.n, ffi.cast("void *", q) == ffi.cast("void *", ps[10]))
+pool:free(ffi.cast("pool_pt *", nil))
+local a = ffi.pool("struct { __attribute__((aligned(64))) char c; }", 3)
+local ok = true
+for _ = 1, 10 do
+    if ffi.cast("uintptr_t", a:alloc()) % 64 ~= 0 then ok = false end
+end
+print(ok, getmetatable(pool))
+--- out
+110	1	2	3	true
+true	ffi.pool
+--- err
+
+
+
+=== TEST 2: bad arguments
+--- lua
+local ffi = require "ffi"
+local pool = ffi.pool("int")
+print(pcall(pool.free, pool, ffi.new("double[1]")))
+print(pcall(ffi.pool, "int[?]"))
+print(pcall(ffi.pool, "int", 0))
+print(pcall(pool.alloc, {}))
+--- out
+false	bad argument #2 to '?' (invalid C type)
+false	bad argument #1 to '?' (size of C type is unknown or too large)
+false	bad argument #2 to '?' (size of C type is unknown or too large)
+false	bad argument #1 to '?' (ffi.pool expected, got table)
+--- err
+
+
+
+=== TEST 3: compiled alloc and free
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ffi = require "ffi"
+local jutil = require "jit.util"
+local vmdef = require "jit.vmdef"
+local function unsunk_boxes()
+    local n = 0
+    for tr = 1, 100 do
+        local info = jutil.traceinfo(tr)
+        if not info then break end
+        for ref = 1, info.nins do
+            local _, ot, _, _, ridsp = jutil.traceir(tr, ref)
+            local oidx = 6 * math.floor(ot / 256)
+            local rid = ridsp % 256
+            if vmdef.irnames:sub(oidx + 1, oidx + 6) == "CNEWI "
+               and rid ~= 253 and rid ~= 254 then
+                n = n + 1
+            end
+        end
+    end
+    return n
+end
+local ip = ffi.pool("int64_t")
+local acc = 0
+for i = 1, 1000 do
+    local p = ip:alloc()
+    p[0] = p[0] + i
+    acc = acc + tonumber(p[0])
+    ip:free(p)
+end
+print(acc, unsunk_boxes())
+local pool = ffi.pool("struct { int n; }", 16)
+local held = {}
+for i = 1, 300 do held[i] = pool:alloc(); held[i].n = i end
+local t = 0
+for i = 1, 300 do t = t + held[i].n; pool:free(held[i]) end
+print(t)
+--- out
+500500	0
+45150
+--- err
+
+
+
+
+=== TEST 3: a failed initialization returns the slot to the pool
+--- lua
+local ffi = require "ffi"
+local pool = ffi.pool("double", 2)
+local a = pool:alloc()
+print(pcall(pool.alloc, pool, "x"))
+local b = pool:alloc(1.5)
+print(ffi.cast("uintptr_t", b) - ffi.cast("uintptr_t", a) == 8, b[0])
+--- out
+false	cannot convert 'string' to 'double'
+true	1.5
+--- err
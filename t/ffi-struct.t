@@ -0,0 +1,163 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: nested struct copies and aggregate initializers
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ffi = require "ffi"
+ffi.cdef[[
+typedef struct { double x, y; } vec2;
+typedef struct { vec2 a, b; int n[3]; } seg;
+typedef union { int i; double d; } du;
+typedef float v4f __attribute__((vector_size(16)));
+]]
+local s = ffi.new("seg[2]")
+local v = ffi.new("vec2", 1.5, 2.5)
+local vv = ffi.new("v4f[1]", {{0, 0, 3, 0}})
+local acc = 0
+for i = 1, 100 do
+    s[1].a.x = i; s[1].n[2] = i
+    s[0] = s[1]
+    s[0].b = v
+    local t = ffi.new("seg", v, s[0].b)
+    local u = ffi.new("du", 7)
+    local big = ffi.new("double[40]", i, 2)
+    local vla = ffi.new("double[?]", 4, 0)
+    local w = vv[0]
+    acc = acc + s[0].a.x + s[0].n[2] + s[0].b.y + t.a.x + t.b.y + t.n[1]
+          + u.i + big[0] + big[1] + big[39] + vla[3] + w[2]
+end
+print(acc)
+--- out
+17000
+--- err
+
+
+
+=== TEST 2: struct results and arguments by value
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ffi = require "ffi"
+ffi.cdef[[
+typedef struct { int quot, rem; } div_t;
+typedef struct { long quot, rem; } ldiv_t;
+struct in_addr { uint32_t s_addr; };
+div_t div(int num, int denom);
+ldiv_t ldiv(long num, long denom);
+char *inet_ntoa(struct in_addr in);
+]]
+local addr = ffi.new("struct in_addr")
+local q, r, s = 0, 0, ""
+for i = 1, 100 do
+    local d = ffi.C.div(i * 7, 5)
+    local l = ffi.C.ldiv(-i * 1000003, 7)
+    q = q + d.quot + tonumber(l.quot)
+    r = r + d.rem + tonumber(l.rem)
+    addr.s_addr = i
+    s = ffi.string(ffi.C.inet_ntoa(addr))
+end
+print(q, r, s)
+--- out
+-721423663	-99	100.0.0.0
+--- err
+
+
+
+=== TEST 3: struct calls are compiled
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ffi = require "ffi"
+local jutil = require "jit.util"
+local vmdef = require "jit.vmdef"
+ffi.cdef[[
+typedef struct { long quot, rem; } ldiv_t;
+ldiv_t ldiv(long num, long denom);
+]]
+local function ncalls()
+    local n = 0
+    for tr = 1, 100 do
+        local info = jutil.traceinfo(tr)
+        if not info then break end
+        for ref = 1, info.nins do
+            local _, ot = jutil.traceir(tr, ref)
+            local oidx = 6 * math.floor(ot / 256)
+            if vmdef.irnames:sub(oidx + 1, oidx + 6) == "CALLXS" then
+                n = n + 1
+            end
+        end
+    end
+    return n
+end
+local s = 0
+for i = 1, 100 do
+    s = s + tonumber(ffi.C.ldiv(i, 3).rem)
+end
+print(s, ncalls() > 0)
+--- out
+100	true
+--- err
+
+
+
+=== TEST 4: struct parts use the register class of the ABI
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ffi = require "ffi"
+-- Each struct is passed to or returned from a libc function whose scalar
+-- arguments or results use the same registers on the ABIs it runs on.
+ffi.cdef[[
+typedef struct { double d; } sd;
+typedef struct { float f; } sf;
+typedef struct { double d; int64_t i; } dl;
+typedef struct { long quot, rem; } ldiv_t;
+sd fabs_sd(sd x) asm("fabs");
+sf fabsf_sf(sf x) asm("fabsf");
+double ldexp_dl(dl x) asm("ldexp");
+dl ldiv_dl(long num, long denom) asm("ldiv");
+ldiv_t ldiv_arg(dl x) asm("ldiv");
+]]
+local C = ffi.C
+local sysv = jit.arch == "x64" and jit.os ~= "Windows"
+local arm64 = jit.arch == "arm64"
+local bits = ffi.new("union { double d; int64_t i; }")
+local a, b, c, d = 0, 0, 0, 0
+for i = 1, 100 do
+    if sysv or arm64 then
+        a = a + C.fabs_sd(ffi.new("sd", -i)).d
+        b = b + C.fabsf_sf(ffi.new("sf", -i)).f
+    else
+        a, b = a + i, b + i
+    end
+    if sysv then
+        -- SSE and INTEGER class: passed in xmm0 and rdi.
+        c = c + C.ldexp_dl(ffi.new("dl", i, 2))
+    else
+        c = c + i * 4
+    end
+    if arm64 then
+        -- Not an HFA: passed and returned in x0 and x1.
+        local r = C.ldiv_dl(i * 7, 3)
+        bits.d = r.d
+        d = d + tonumber(bits.i) + tonumber(r.i)
+        bits.i = 1000 + i
+        d = d + tonumber(C.ldiv_arg(ffi.new("dl", bits.d, 10)).quot) - 100
+    else
+        d = d + math.floor(i * 7 / 3) + i * 7 % 3 + math.floor(i / 10)
+    end
+end
+print(a, b, c, d)
+--- out
+5050	5050	20200	12310
+--- err
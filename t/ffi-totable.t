@@ -0,0 +1,91 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: ffi.totable element types
+--- lua
+local ffi = require "ffi"
+print(unpack(ffi.totable(ffi.new("double[3]", 1.5, 2.5))))
+print(unpack(ffi.totable(ffi.cast("int32_t *", ffi.new("int32_t[4]", -1, 2, -3, 4)), 4)))
+print(unpack(ffi.totable(ffi.new("uint8_t[3]", 255, 1, 2))))
+print(unpack(ffi.totable(ffi.new("int16_t[2]", -30000, 7))))
+print(unpack(ffi.totable(ffi.new("uint32_t[2]", 4294967295, 7))))
+print(unpack(ffi.totable(ffi.new("float[2]", 0.5, 1.25))))
+print(unpack(ffi.totable(ffi.new("int64_t[2]", -5, 7))))
+print(unpack(ffi.totable(ffi.new("bool[2]", true, false))))
+print(#ffi.totable(ffi.new("double[?]", 7)), #ffi.totable(ffi.new("int[0]")))
+print(pcall(ffi.totable, ffi.new("int *")))
+print(pcall(ffi.totable, ffi.new("void *"), 2))
+--- out
+1.5	2.5	0
+-1	2	-3	4
+255	1	2
+-30000	7
+4294967295	7
+0.5	1.25
+-5LL	7LL
+true	false
+7	0
+false	bad argument #2 to '?' (number expected, got no value)
+false	bad argument #1 to '?' (invalid C type)
+--- err
+
+
+
+=== TEST 2: ffi.fromtable
+--- lua
+local ffi = require "ffi"
+local d = ffi.fromtable("double[?]", {1, 2.5, 3})
+print(ffi.sizeof(d), d[0], d[1], d[2])
+local i = ffi.fromtable("int[4]", {1, 2.7, -3.9, 4, 5})
+print(i[0], i[1], i[2], i[3])
+local z = ffi.fromtable("float[3]", {0.5})
+print(z[0], z[1], z[2])
+local s = ffi.fromtable("struct { int a; double b; }[?]", {{1, 2}, {3, 4}})
+print(s[1].a, s[1].b)
+local h = {}
+h[3] = 3; h[2] = 2; h[1] = 1
+print(unpack(ffi.totable(ffi.fromtable("int64_t[?]", h))))
+print(ffi.sizeof(ffi.fromtable("int[?]", {})))
+print(pcall(ffi.fromtable, "double[?]", {1, "x"}))
+print(pcall(ffi.fromtable, "double", {}))
+--- out
+24	1	2.5	3
+1	2	-3	4
+0.5	0	0
+3	4
+1LL	2LL	3LL
+0
+false	cannot convert 'string' to 'double'
+false	bad argument #1 to '?' (invalid C type)
+--- err
+
+
+
+=== TEST 3: compiled conversions
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ffi = require "ffi"
+local src = {}
+for k = 1, 100 do src[k] = k * 0.5 end
+local acc = 0
+for k = 1, 200 do
+    local c = ffi.fromtable("double[?]", src)
+    c[0] = k
+    local t = ffi.totable(c, 100)
+    acc = acc + t[1] + t[100] + #t
+    local f = ffi.fromtable("int32_t[4]", src)
+    acc = acc + f[3] + #ffi.totable(f)
+end
+print(acc, require("jit.util").traceinfo(2) ~= nil)
+--- out
+51300	true
+--- err
@@ -0,0 +1,61 @@
+# vim: set ss=4 ft= sw=4 et sts=4 ts=4:
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: exhausting maxmcode evicts areas instead of flushing
+--- lua
+jit.on()
+jit.opt.start("hotloop=2", "sizemcode=32", "maxmcode=128")
+
+local jutil = require "jit.util"
+local flushes, evicted, stale = 0, 0, 0
+jit.attach(function(what, tr)
+  if what == "flush" then
+    if tr then
+      evicted = evicted + 1
+      if jutil.traceinfo(tr) then stale = stale + 1 end
+    else
+      flushes = flushes + 1
+    end
+  end
+end, "trace")
+
+local sum, keep = 0, {}
+for n = 1, 2000 do
+  local f = loadstring("local s = 0 for i = 1, 20 do s = s + i * " .. n ..
+                       " end return s")
+  keep[n] = f  -- keep the traces alive until their area is evicted
+  sum = sum + f()
+end
+print(sum, flushes, evicted > 0, stale)
+--- out
+420210000	0	true	0
+--- err
+
+
+
+=== TEST 2: traceinfo reports taken exits
+--- lua
+jit.on()
+jit.opt.start("hotloop=2")
+local jutil = require "jit.util"
+
+local function f(n)
+  local s = 0
+  for i = 1, n do s = s + i end
+  return s
+end
+
+for i = 1, 10 do f(20) end
+local info = jutil.traceinfo(1)
+print(type(info.exitcount), info.exitcount > 0)
+--- out
+number	true
+--- err
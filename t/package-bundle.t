@@ -0,0 +1,149 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: modules are loaded from a bytecode bundle
+--- lua
+local function write(name, s)
+    local fp = assert(io.open(name, "wb"))
+    fp:write(s)
+    fp:close()
+end
+write("foo.lua", "local M = {} function M.f(x) return 'foo' .. x end return M")
+write("bar.lua", "return { v = require('a.foo').f(...) }")
+require("jit.bcsave").start("a.foo=foo.lua", "bar.lua", "mods.ljb")
+print(package.loadbundle("mods.ljb"))
+print(require("bar").v, #package.bundles)
+local ok, err = pcall(require, "missing")
+print(ok, err:match("no module 'missing' in bundle 'mods.ljb'") ~= nil)
+--- out
+2
+foobar	1
+false	true
+--- err
+
+
+
+=== TEST 2: bad bundles are rejected
+--- lua
+local function u32(x)
+    return string.char(x % 256, math.floor(x / 256) % 256, 0, 0)
+end
+local fp = assert(io.open("bad.ljb", "wb"))
+fp:write("\027LJB\001\0\0\0", u32(1), u32(28), u32(1), u32(29), u32(100), "xy")
+fp:close()
+fp = assert(io.open("ver.ljb", "wb"))
+fp:write("\027LJB\099\0\0\0", u32(0))
+fp:close()
+print(package.loadbundle("bad.ljb"))
+print(package.loadbundle("ver.ljb"))
+print(package.loadbundle("test.lua"))
+print(package.loadbundle("nonexistent.ljb"))
+print(#package.bundles)
+--- out
+nil	cannot load bundle 'bad.ljb': truncated bytecode bundle
+nil	cannot load bundle 'ver.ljb': bytecode bundle version mismatch
+nil	cannot load bundle 'test.lua': not a bytecode bundle
+nil	cannot load bundle 'nonexistent.ljb': No such file or directory
+0
+--- err
+
+
+
+=== TEST 3: names, comments and whitespace across reader chunks
+--- lua
+local src = "local  abc_def1 = 10 -- comment\n\t  local xyz = abc_def1 * 2" ..
+            " --[[ long\n comment ]] return abc_def1 + xyz, 'end'"
+for n = 1, 7 do
+    local pos = 1
+    local f = load(function()
+        local s = src:sub(pos, pos + n - 1)
+        pos = pos + n
+        return s ~= "" and s or nil
+    end)
+    io.write(n, ":", table.concat({f()}, ","), " ")
+end
+print()
+--- out
+1:30,end 2:30,end 3:30,end 4:30,end 5:30,end 6:30,end 7:30,end 
+--- err
+
+
+
+=== TEST 4: debug info is referenced in place from a mapped bundle
+--- lua
+local t = {"local M = {}"}
+for i = 1, 300 do t[#t + 1] = "do local v" .. i .. " = " .. i .. " end" end
+t[#t + 1] = "local v = 300"
+t[#t + 1] = "function M.f() local here = debug.getinfo(1, 'l').currentline"
+t[#t + 1] = "  return here, debug.getlocal(1, 1), v end"
+t[#t + 1] = "return M"
+local fp = assert(io.open("big.lua", "wb"))
+fp:write(table.concat(t, "\n"))
+fp:close()
+require("jit.bcsave").start("-g", "big.lua", "dbg.ljb")
+package.loadbundle("dbg.ljb")
+local f = require("big").f
+package.bundles[1] = nil
+collectgarbage()
+collectgarbage()
+print(f())
+print(debug.getinfo(f, "S").linedefined, debug.getinfo(f, "S").source)
+print(string.dump(f) == string.dump(loadfile("big.lua")().f))
+print(#string.dump(require("big").f, true) < #string.dump(f))
+--- out
+303	here	300
+303	@big.lua
+true
+true
+--- err
+
+
+
+=== TEST 5: nested functions are decoded on first use
+--- lua
+local fp = assert(io.open("lazy.lua", "wb"))
+fp:write([[
+local M = {}
+local up = 10
+local function helper(a)
+    return function(b) return a + b + up end
+end
+function M.add(x) return helper(x)(1) end
+function M.fail() local t = nil; return t.x end
+function M.nested()
+    local function l1()
+        local function l2() return "deep", 2^53 + 0LL, { 1, x = "y" } end
+        return l2()
+    end
+    return l1()
+end
+function M.unused() return function() return "never" end end
+return M
+]])
+fp:close()
+require("jit.bcsave").start("-g", "lazy.lua", "lazy.ljb")
+package.loadbundle("lazy.ljb")
+local M = require("lazy")
+local ref = loadfile("lazy.lua")()
+print(M.add(5), M.add(6))
+local s, n, t = M.nested()
+print(s, n, t.x)
+print(pcall(M.fail))
+jit.off(M.unused, true)
+print(string.dump(M.unused) == string.dump(ref.unused))
+print(type(require("jit.util").funck(M.nested, -1)))
+--- out
+16	17
+deep	9007199254740992LL	y
+false	lazy.lua:7: attempt to index local 't' (a nil value)
+true
+proto
+--- err
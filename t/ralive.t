@@ -0,0 +1,48 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: eviction by next use - results
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3", "+ralive")
+local a = {}
+for i = 1, 16 do a[i] = i * 0.5 end
+local s = 0
+for it = 1, 100 do
+    local x1, x2, x3, x4 = a[1] + it, a[2] + it, a[3] + it, a[4] + it
+    local x5, x6, x7, x8 = a[5] + it, a[6] + it, a[7] + it, a[8] + it
+    local y1, y2, y3, y4 = a[9] * x1, a[10] * x2, a[11] * x3, a[12] * x4
+    local y5, y6, y7, y8 = a[13] * x5, a[14] * x6, a[15] * x7, a[16] * x8
+    local z1, z2, z3, z4 = x1 * y8, x2 * y7, x3 * y6, x4 * y5
+    local z5, z6, z7, z8 = x5 * y4, x6 * y3, x7 * y2, x8 * y1
+    s = s + (z1 + z2 + x1) * x3 + (z3 + z4 + x2) * x4 + (z5 + z6 + y1) * y3
+          + (z7 + z8 + y2) * y4 + x5 * y5 + x6 * y6 + x7 * y7 + x8 * y8
+          + z1 * z8 + z2 * z7
+end
+print(s)
+--- out
+172380593083.13
+--- err
+
+
+
+=== TEST 2: spill statistics in traceinfo
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local jutil = require "jit.util"
+local s = 0
+for i = 1, 100 do s = s + i end
+local info = jutil.traceinfo(1)
+print(type(info.nspill), type(info.nreload), info.nspill, info.nreload)
+--- out
+number	number	0	0
+--- err
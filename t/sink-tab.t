@@ -0,0 +1,112 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: length, unpack and concat of temporary tables
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local s = 0
+local c
+for i = 1, 100 do
+    local t = {i, i * 2, "x"}
+    s = s + #t + select('#', unpack(t)) + (unpack(t, 2))
+    c = table.concat({i, "a", i + 0.5}, ",") .. table.concat({}, ",")
+        .. table.concat({1, 2, 3}, "-", 2)
+end
+print(s, c)
+--- out
+10700	100,a,100.52-3
+--- err
+
+
+
+=== TEST 2: length with holes, numeric hash keys and aliases
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ts = {{1, 2, 3}, {4, 5}, {6}, {}}
+local n = 0
+for i = 1, 100 do
+    n = n + select('#', unpack(ts[i % 4 + 1]))
+end
+local s = 0
+for i = 1, 100 do
+    local t = {i, nil, 3}
+    local u = {1, 2, [4] = 4}
+    local v = {}
+    v[1] = 1; v[2] = 2; v[2] = nil
+    local w = {1}
+    w[i] = 5
+    local x = {1, 2}
+    local h = {x}
+    h[1][3] = 3
+    s = s + #t + #u + #v + #w + #x + select('#', unpack(v))
+end
+print(n, s)
+--- out
+150	1304
+--- err
+
+
+
+=== TEST 3: temporary tables are sunk
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local jutil = require "jit.util"
+local vmdef = require "jit.vmdef"
+local function unsunk_allocs()
+    local n = 0
+    for tr = 1, 100 do
+        local info = jutil.traceinfo(tr)
+        if not info then break end
+        for ref = 1, info.nins do
+            local _, ot, _, _, ridsp = jutil.traceir(tr, ref)
+            local oidx = 6 * math.floor(ot / 256)
+            local op = vmdef.irnames:sub(oidx + 1, oidx + 4)
+            local rid = ridsp % 256
+            if (op == "TNEW" or op == "TDUP") and rid ~= 253 and rid ~= 254 then
+                n = n + 1
+            end
+        end
+    end
+    return n
+end
+local s = 0
+for i = 1, 100 do
+    local t = {i, i + 1}
+    local a, b = unpack(t)
+    s = s + #t + a + b + #table.concat({i, "x"})
+end
+print(s, unsunk_allocs())
+--- out
+10692	0
+--- err
+
+
+
+=== TEST 4: concat of a temporary table with a metatable is raw
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local hits = 0
+local mt = {__index = function(t, k) hits = hits + 1; return "m" end}
+local r, ok = {}, 0
+for i = 1, 100 do
+    local t = setmetatable({i, "a"}, mt)
+    r[#r + 1] = table.concat(t, ",", 1, 2)
+    local u = setmetatable({i, nil, "b"}, mt)
+    if not pcall(table.concat, u, ",", 1, 3) then ok = ok + 1 end
+end
+print(r[1], r[100], ok, hits)
+--- out
+1,a	100,a	100	0
+--- err
@@ -0,0 +1,92 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: default order - numbers and strings
+--- lua
+math.randomseed(7)
+for _, n in ipairs{0, 1, 2, 3, 15, 16, 17, 100, 2000} do
+    local a, b, c = {}, {}, {}
+    for i = 1, n do
+        a[i] = math.random(1, 50)
+        b[i] = math.random() - 0.5
+        c[i] = tostring(math.random(1, 1000))
+    end
+    table.sort(a)
+    table.sort(b)
+    table.sort(c)
+    for i = 2, n do
+        assert(a[i-1] <= a[i] and b[i-1] <= b[i] and c[i-1] <= c[i])
+    end
+end
+local t = {}
+for i = 1, 1000 do t[i] = 1001 - i end
+table.sort(t)
+for i = 1, 1000 do assert(t[i] == i) end
+print(pcall(table.sort, {1, "a", 2}))
+print("ok")
+--- out
+false	attempt to compare string with number
+ok
+--- err
+
+
+
+=== TEST 2: custom comparator - JIT
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local gt = function(a, b) return a > b end
+for _ = 1, 20 do
+    local t = {}
+    for i = 1, 300 do t[i] = (i * 7919) % 300 end
+    table.sort(t, gt)
+    for i = 1, 300 do assert(t[i] == 300 - i) end
+end
+print("ok")
+--- out
+ok
+--- err
+
+
+
+=== TEST 3: invalid order function
+--- lua
+local t = {}
+for i = 1, 20 do t[i] = i end
+print(pcall(table.sort, t, function() return true end))
+print(table.sort_cmp)
+--- out
+false	invalid order function for sorting
+nil
+--- err
+
+
+
+=== TEST 4: custom comparator uses raw access on tables with a metatable
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local hits = 0
+local mt = {
+  __index = function() hits = hits + 1; return 2 end,
+  __newindex = function(t, k, v) hits = hits + 1; rawset(t, k, v) end,
+}
+local t
+for _ = 1, 20 do
+  t = {5, 4, 3, 2, 1}
+  t[3] = nil
+  setmetatable(t, mt)
+  table.sort(t, function(a, b) return (a or 0) < (b or 0) end)
+end
+print(#t, hits, rawget(t, 1), rawget(t, 2), rawget(t, 5))
+--- out
+5	0	nil	1	5
+--- err
@@ -0,0 +1,143 @@
+# vim:ft=
+
+use lib '.';
+use t::TestLJ;
+
+plan tests => 3 * blocks();
+
+run_tests();
+
+__DATA__
+
+=== TEST 1: vectorized loop - results and remainders
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3", "+vec")
+local ffi = require "ffi"
+for _, n in ipairs{1, 5, 127, 128, 129, 255, 300, 1000, 1027} do
+    local a = ffi.new("double[?]", n + 2)
+    local b = ffi.new("double[?]", n + 2)
+    local d = ffi.new("double[?]", n + 2)
+    for i = 0, n + 1 do b[i] = i; d[i] = -2 * i end
+    for _ = 1, 10 do
+        for i = 1, n do a[i] = b[i] * 2.5 + d[i] end
+        for i = 0, n - 1 do b[i] = math.abs(-(a[i + 1] / 0.5)) - 1 end
+    end
+    for i = 1, n do assert(a[i] == 0.5 * i, i) end
+    for i = 0, n - 1 do assert(b[i] == i, i) end
+    assert(a[0] == 0 and a[n + 1] == 0)
+end
+print("ok")
+--- out
+ok
+--- err
+
+
+
+=== TEST 2: vectorized loop - overlapping and aliased arrays
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3", "+vec")
+local ffi = require "ffi"
+local n = 1000
+local a = ffi.new("double[?]", n + 1)
+for _ = 1, 10 do
+    a[0] = 0
+    for i = 1, n do a[i] = a[i - 1] + 1 end
+end
+for i = 0, n do assert(a[i] == i) end
+for _ = 1, 10 do
+    for i = 0, n - 1 do a[i] = a[i + 1] end
+end
+for i = 0, n - 10 do assert(a[i] == i + 10) end
+local p = ffi.cast("double *", a) + 1
+for i = 0, n do a[i] = 0 end
+for _ = 1, 10 do
+    for i = 0, n - 1 do p[i] = a[i] + 1 end
+end
+for i = 0, n do assert(a[i] == i) end
+for i = 0, n do a[i] = i end
+for _ = 1, 10 do
+    for i = 0, n do a[i] = a[i] * 2 end
+end
+for i = 0, n do assert(a[i] == i * 1024) end
+print("ok")
+--- out
+ok
+--- err
+
+
+
+=== TEST 3: vectorized loop - kernel call is compiled
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3", "+vec")
+local ffi = require "ffi"
+local jutil = require "jit.util"
+local vmdef = require "jit.vmdef"
+local function has_vec()
+    for tr = 1, 100 do
+        local info = jutil.traceinfo(tr)
+        if not info then break end
+        for ref = 1, info.nins do
+            local _, ot, _, op2 = jutil.traceir(tr, ref)
+            local oidx = 6 * math.floor(ot / 256)
+            if vmdef.irnames:sub(oidx + 1, oidx + 6) == "CALLS " and
+               vmdef.ircall[op2] == "lj_vec_loop" then
+                return true
+            end
+        end
+    end
+    return false
+end
+local n = 1000
+local a = ffi.new("double[?]", n + 1)
+local b = ffi.new("double[?]", n + 1)
+for _ = 1, 10 do
+    for i = 1, n do a[i] = b[i] + 1 end
+end
+print(has_vec())
+--- out
+true
+--- err
+
+
+
+=== TEST 4: vectorized loop - off by default, negative bounds
+--- lua
+jit.on()
+require "jit.opt".start("hotloop=3")
+local ffi = require "ffi"
+local jutil = require "jit.util"
+local vmdef = require "jit.vmdef"
+local function count_vec()
+    local c = 0
+    for tr = 1, 100 do
+        local info = jutil.traceinfo(tr)
+        if not info then break end
+        for ref = 1, info.nins do
+            local _, ot, _, op2 = jutil.traceir(tr, ref)
+            local oidx = 6 * math.floor(ot / 256)
+            if vmdef.irnames:sub(oidx + 1, oidx + 6) == "CALLS " and
+               vmdef.ircall[op2] == "lj_vec_loop" then
+                c = c + 1
+            end
+        end
+    end
+    return c
+end
+local a = ffi.new("double[?]", 1001)
+local function f(lo, hi)
+    for i = lo, hi do a[i] = a[i] + 1 end
+end
+for _ = 1, 10 do f(1, 1000) end
+print(count_vec())
+jit.flush()
+require "jit.opt".start("+vec")
+for _ = 1, 10 do f(1, 1000) end
+for _, hi in ipairs{-1, -2147483647, -2147483648} do f(1, hi); f(1000, hi) end
+print(count_vec() > 0, a[1], a[1000])
+--- out
+0
+true	20	20
+--- err